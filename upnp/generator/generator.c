@@ -35,6 +35,10 @@ static struct s_Member UpnpActionRequest_members[] = {
 		struct sockaddr_storage,
 		"UpnpInet.h"),
 	INIT_MEMBER(Os, TYPE_STRING, 0, 0),
+	INIT_MEMBER(ActionArgs,
+		TYPE_INTEGER,
+		UpnpActionArgs *,
+		"UpnpActionArgs.h"),
 };
 
 static struct s_Member UpnpDiscovery_members[] = {
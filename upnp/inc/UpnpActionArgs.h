@@ -0,0 +1,249 @@
+#ifndef UPNPACTIONARGS_H
+#define UPNPACTIONARGS_H
+
+/*!
+ * \defgroup UpnpActionArgs The UpnpActionArgs Class
+ *
+ * \brief Typed argument list of a SOAP action decoded through the action
+ * schema compiled from the service SCPD.
+ *
+ * An UpnpActionArgs object is created by the library for every action
+ * received for a service whose schema has been compiled with
+ * \b UpnpCompileActionSchemas. The input arguments are already decoded and
+ * validated against the data type of their related state variable, and the
+ * output arguments are serialized by the library without building a DOM
+ * document. The object is owned by the library, the application must not
+ * free it.
+ *
+ * Input and output arguments are addressed by their index in the
+ * argument list of the action, in the order they appear in the SCPD.
+ *
+ * @{
+ *
+ * \file
+ *
+ * \brief UpnpActionArgs object declaration.
+ */
+
+#include "UpnpGlobal.h" /* for UPNP_EXPORT_SPEC */
+
+#include <stdlib.h> /* for size_t */
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*!
+ * \brief Data type of an action argument, taken from the dataType of its
+ * related state variable.
+ */
+typedef enum Upnp_ArgType_e
+{
+	/*! string, char, uri, uuid, date/time and binary types. */
+	UPNP_ARG_STRING,
+	/*! boolean. */
+	UPNP_ARG_BOOLEAN,
+	/*! ui1. */
+	UPNP_ARG_UI1,
+	/*! ui2. */
+	UPNP_ARG_UI2,
+	/*! ui4. */
+	UPNP_ARG_UI4,
+	/*! ui8. */
+	UPNP_ARG_UI8,
+	/*! i1. */
+	UPNP_ARG_I1,
+	/*! i2. */
+	UPNP_ARG_I2,
+	/*! i4 and int. */
+	UPNP_ARG_I4,
+	/*! i8. */
+	UPNP_ARG_I8,
+	/*! r4, r8, number, float and fixed.14.4. */
+	UPNP_ARG_REAL
+} Upnp_ArgType;
+
+/*!
+ * \brief Type of the action argument objects.
+ */
+typedef struct s_UpnpActionArgs UpnpActionArgs;
+
+/*!
+ * \brief Returns the name of the action.
+ */
+UPNP_EXPORT_SPEC const char *UpnpActionArgs_get_ActionName(
+	/*! [in] The \em \b this pointer. */
+	const UpnpActionArgs *p);
+
+/*!
+ * \brief Returns the number of input arguments of the action.
+ */
+UPNP_EXPORT_SPEC int UpnpActionArgs_get_NumIn(
+	/*! [in] The \em \b this pointer. */
+	const UpnpActionArgs *p);
+
+/*!
+ * \brief Returns the number of output arguments of the action.
+ */
+UPNP_EXPORT_SPEC int UpnpActionArgs_get_NumOut(
+	/*! [in] The \em \b this pointer. */
+	const UpnpActionArgs *p);
+
+/*!
+ * \brief Looks up an input argument by name.
+ *
+ * \return The index of the argument or -1 if the action has no such input
+ * argument.
+ */
+UPNP_EXPORT_SPEC int UpnpActionArgs_find_In(
+	/*! [in] The \em \b this pointer. */
+	const UpnpActionArgs *p,
+	/*! [in] Name of the argument. */
+	const char *name);
+
+/*!
+ * \brief Looks up an output argument by name.
+ *
+ * \return The index of the argument or -1 if the action has no such output
+ * argument.
+ */
+UPNP_EXPORT_SPEC int UpnpActionArgs_find_Out(
+	/*! [in] The \em \b this pointer. */
+	const UpnpActionArgs *p,
+	/*! [in] Name of the argument. */
+	const char *name);
+
+/*!
+ * \brief Returns the name of an input argument, or NULL if \b i is out of
+ * range.
+ */
+UPNP_EXPORT_SPEC const char *UpnpActionArgs_get_InName(
+	/*! [in] The \em \b this pointer. */
+	const UpnpActionArgs *p,
+	/*! [in] Index of the argument. */
+	int i);
+
+/*!
+ * \brief Returns the data type of an input argument.
+ */
+UPNP_EXPORT_SPEC Upnp_ArgType UpnpActionArgs_get_InType(
+	/*! [in] The \em \b this pointer. */
+	const UpnpActionArgs *p,
+	/*! [in] Index of the argument. */
+	int i);
+
+/*!
+ * \brief Returns the decoded value of an input argument, or NULL if \b i is
+ * out of range or the value is not set.
+ */
+UPNP_EXPORT_SPEC const char *UpnpActionArgs_get_InValue(
+	/*! [in] The \em \b this pointer. */
+	const UpnpActionArgs *p,
+	/*! [in] Index of the argument. */
+	int i);
+
+/*!
+ * \brief Converts the value of an integer input argument.
+ *
+ * \return UPNP_E_SUCCESS on success, UPNP_E_INVALID_ARGUMENT if the
+ * argument does not exist or is not a number.
+ */
+UPNP_EXPORT_SPEC int UpnpActionArgs_get_InInteger(
+	/*! [in] The \em \b this pointer. */
+	const UpnpActionArgs *p,
+	/*! [in] Index of the argument. */
+	int i,
+	/*! [out] The converted value. */
+	long long *value);
+
+/*!
+ * \brief Converts the value of a boolean input argument.
+ *
+ * \return UPNP_E_SUCCESS on success, UPNP_E_INVALID_ARGUMENT if the
+ * argument does not exist or is not a boolean.
+ */
+UPNP_EXPORT_SPEC int UpnpActionArgs_get_InBoolean(
+	/*! [in] The \em \b this pointer. */
+	const UpnpActionArgs *p,
+	/*! [in] Index of the argument. */
+	int i,
+	/*! [out] 0 or 1. */
+	int *value);
+
+/*!
+ * \brief Returns the name of an output argument, or NULL if \b i is out of
+ * range.
+ */
+UPNP_EXPORT_SPEC const char *UpnpActionArgs_get_OutName(
+	/*! [in] The \em \b this pointer. */
+	const UpnpActionArgs *p,
+	/*! [in] Index of the argument. */
+	int i);
+
+/*!
+ * \brief Returns the data type of an output argument.
+ */
+UPNP_EXPORT_SPEC Upnp_ArgType UpnpActionArgs_get_OutType(
+	/*! [in] The \em \b this pointer. */
+	const UpnpActionArgs *p,
+	/*! [in] Index of the argument. */
+	int i);
+
+/*!
+ * \brief Returns the value of an output argument, or NULL if \b i is
+ * out of range or the value has not been set yet.
+ */
+UPNP_EXPORT_SPEC const char *UpnpActionArgs_get_OutValue(
+	/*! [in] The \em \b this pointer. */
+	const UpnpActionArgs *p,
+	/*! [in] Index of the argument. */
+	int i);
+
+/*!
+ * \brief Sets the value of an output argument. The value is copied and
+ * will be XML escaped by the library when the response is sent.
+ *
+ * \return UPNP_E_SUCCESS on success, UPNP_E_INVALID_PARAM if \b i is out of
+ * range or UPNP_E_OUTOF_MEMORY.
+ */
+UPNP_EXPORT_SPEC int UpnpActionArgs_set_OutValue(
+	/*! [in] The \em \b this pointer. */
+	UpnpActionArgs *p,
+	/*! [in] Index of the argument. */
+	int i,
+	/*! [in] The value. */
+	const char *value);
+
+/*!
+ * \brief Sets the value of an integer output argument.
+ *
+ * \return Same as \b UpnpActionArgs_set_OutValue.
+ */
+UPNP_EXPORT_SPEC int UpnpActionArgs_set_OutInteger(
+	/*! [in] The \em \b this pointer. */
+	UpnpActionArgs *p,
+	/*! [in] Index of the argument. */
+	int i,
+	/*! [in] The value. */
+	long long value);
+
+/*!
+ * \brief Sets the value of a boolean output argument.
+ *
+ * \return Same as \b UpnpActionArgs_set_OutValue.
+ */
+UPNP_EXPORT_SPEC int UpnpActionArgs_set_OutBoolean(
+	/*! [in] The \em \b this pointer. */
+	UpnpActionArgs *p,
+	/*! [in] Index of the argument. */
+	int i,
+	/*! [in] Zero for false, non-zero for true. */
+	int value);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+/*! @} UpnpActionArgs */
+
+#endif /* UPNPACTIONARGS_H */
@@ -15,6 +15,7 @@
 
 #include "UpnpGlobal.h" /* for UPNP_EXPORT_SPEC */
 
+#include "UpnpActionArgs.h"
 #include "UpnpInet.h"
 #include "UpnpString.h"
 #include "ixml.h"
@@ -185,6 +186,13 @@ UPNP_EXPORT_SPEC int UpnpActionRequest_strncpy_Os(
 /*! UpnpActionRequest_clear_Os */
 UPNP_EXPORT_SPEC void UpnpActionRequest_clear_Os(UpnpActionRequest *p);
 
+/*! UpnpActionRequest_get_ActionArgs */
+UPNP_EXPORT_SPEC UpnpActionArgs *UpnpActionRequest_get_ActionArgs(
+	const UpnpActionRequest *p);
+/*! UpnpActionRequest_set_ActionArgs */
+UPNP_EXPORT_SPEC int UpnpActionRequest_set_ActionArgs(
+	UpnpActionRequest *p, UpnpActionArgs *n);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
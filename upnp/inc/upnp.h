@@ -321,6 +321,15 @@
  */
 #define UPNP_E_CANCELED -210
 
+/*!
+ * \brief The data was not queued because too much data is already waiting to
+ * be sent.
+ *
+ * This error is returned by \b UpnpWebStream_Write. The application is told
+ * with a \c UPNP_WEBSTREAM_WRITABLE event when it can write again.
+ */
+#define UPNP_E_WOULD_BLOCK -211
+
 #define UPNP_E_EVENT_PROTOCOL -300
 
 /*!
@@ -397,6 +406,7 @@
  * the internal implementation of these data structures without breaking
  * the API.
  */
+#include "UpnpActionArgs.h"
 #include "UpnpActionComplete.h"
 #include "UpnpActionRequest.h"
 #include "UpnpDiscovery.h"
@@ -496,6 +506,139 @@ enum Upnp_DescType_e
 
 typedef enum Upnp_DescType_e Upnp_DescType;
 
+/*!
+ * \brief Specifies the threads of the SDK in \b UpnpSetThreadCpus.
+ */
+enum Upnp_Threads_e
+{
+	/*! The thread pool sending SSDP replies, GENA events and requests. */
+	UPNP_THREADS_SEND_POOL,
+
+	/*! The thread pool running the callbacks of received messages. */
+	UPNP_THREADS_RECV_POOL,
+
+	/*! The thread pool handling the HTTP requests and SSDP messages
+	    received by the miniserver. */
+	UPNP_THREADS_MINISERVER_POOL,
+
+	/*! The thread pool sending the large files of the web server. */
+	UPNP_THREADS_STREAM_POOL,
+
+	/*! The timer thread, a persistent thread of the send pool. */
+	UPNP_THREADS_TIMER,
+
+	/*! The miniserver thread, a persistent thread of the miniserver
+	    pool. */
+	UPNP_THREADS_MINISERVER
+};
+
+typedef enum Upnp_Threads_e Upnp_Threads;
+
+/*!
+ * \brief Specifies the classes of jobs the SDK admits under load, see
+ * \b UpnpSetLoadBudget.
+ */
+enum Upnp_LoadClass_e
+{
+	/*! The HTTP requests received by the miniserver: SOAP actions, GENA
+	    subscriptions and GET requests. A request shed is answered with
+	    503 Service Unavailable and a Retry-After header. */
+	UPNP_LOAD_HTTP,
+
+	/*! The SSDP datagrams received. A datagram shed is dropped. */
+	UPNP_LOAD_SSDP,
+
+	/*! The replies to M-SEARCH requests waiting to be sent. Once half the
+	    budget is spent, a reply to the same control point for the same
+	    search target as a reply waiting is dropped, as the control point
+	    repeated its request. */
+	UPNP_LOAD_SEARCH_REPLY
+};
+
+typedef enum Upnp_LoadClass_e Upnp_LoadClass;
+
+/*!
+ * \brief Counters of a class of jobs, see \b UpnpGetLoadStats.
+ */
+struct Upnp_LoadStats_s
+{
+	/*! Jobs in progress. */
+	int jobs;
+	/*! Budget of the class, 0 if only limited by its thread pool. */
+	int budget;
+	/*! Jobs admitted. */
+	unsigned long admitted;
+	/*! Jobs shed because the budget was spent. */
+	unsigned long shedBudget;
+	/*! Jobs shed because the thread pool was full. */
+	unsigned long shedPool;
+	/*! Replies shed as duplicates of a reply waiting. */
+	unsigned long shedDuplicate;
+};
+
+typedef struct Upnp_LoadStats_s Upnp_LoadStats;
+
+/*!
+ * \brief Specifies the types of jobs the latency is recorded for, see
+ * \b UpnpGetJobLatency.
+ */
+enum Upnp_JobType_e
+{
+	/*! The jobs of no other type. */
+	UPNP_JOB_OTHER,
+
+	/*! The SOAP requests received. */
+	UPNP_JOB_SOAP,
+
+	/*! The GENA events sent, and those received by control points. */
+	UPNP_JOB_GENA_NOTIFY,
+
+	/*! The GENA subscription requests received. */
+	UPNP_JOB_GENA_SUBSCRIBE,
+
+	/*! The SSDP datagrams received and the M-SEARCH replies sent. */
+	UPNP_JOB_SSDP,
+
+	/*! The requests of the web server: GET, HEAD and POST. */
+	UPNP_JOB_HTTP_GET
+};
+
+typedef enum Upnp_JobType_e Upnp_JobType;
+
+/*!
+ * \brief Percentiles of the time jobs waited in their queue and ran, in
+ * microseconds, see \b UpnpGetJobLatency.
+ *
+ * The values are recorded within some 6%.
+ */
+struct Upnp_Latency_s
+{
+	/*! Jobs run. */
+	unsigned long count;
+	/*! Median wait. */
+	long waitP50;
+	/*! 90th percentile of the wait. */
+	long waitP90;
+	/*! 99th percentile of the wait. */
+	long waitP99;
+	/*! 99.9th percentile of the wait. */
+	long waitP999;
+	/*! Longest wait. */
+	long waitMax;
+	/*! Median run time. */
+	long runP50;
+	/*! 90th percentile of the run time. */
+	long runP90;
+	/*! 99th percentile of the run time. */
+	long runP99;
+	/*! 99.9th percentile of the run time. */
+	long runP999;
+	/*! Longest run time. */
+	long runMax;
+};
+
+typedef struct Upnp_Latency_s Upnp_Latency;
+
 #include "Callback.h"
 
 /* @} Constants and Types */
@@ -551,6 +694,31 @@ UPNP_EXPORT_SPEC int UpnpInit2(
 	 * \c NULL will pick an arbitrary free port. */
 	unsigned short DestPort);
 
+/*!
+ * \brief Sets the CPUs threads of the SDK run on.
+ *
+ * This function must be called before \b UpnpInit2, the threads being bound
+ * as they start. The workers of a pool set to be NUMA local run on the CPUs
+ * of a single NUMA node each, spread over the nodes of the CPUs, so that the
+ * stacks and buffers they touch first are allocated on their node. By
+ * default, the threads run on any CPU.
+ *
+ * \return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *     \li \c UPNP_E_INIT: The SDK is already initialized.
+ *     \li \c UPNP_E_INVALID_PARAM: The threads or the list of CPUs are
+ *             not valid.
+ */
+UPNP_EXPORT_SPEC int UpnpSetThreadCpus(
+	/*! [in] The threads. */
+	Upnp_Threads threads,
+	/*! [in] CPU numbers and ranges separated by commas, such as
+	 * "0-3,8", \c NULL or empty to run on any CPU. */
+	const char *cpus,
+	/*! [in] 1 to keep each worker of a pool on a NUMA node, ignored for
+	 * the timer and miniserver threads. */
+	int numaLocal);
+
 /*!
  * \brief Initializes the OpenSSL library, and the OpenSSL context for use
  * with pupnp
@@ -757,6 +925,11 @@ UPNP_EXPORT_SPEC int UpnpRegisterRootDevice(
 	 bufferLen == length of memory buffer
    \endverbatim
  *
+ * A description given in a memory buffer is served as
+ * <tt>/description.xml</tt>. While that alias is in use by another device,
+ * it is served as <tt>/description-N.xml</tt> instead, N being the new
+ * device handle, so that the first description is not replaced.
+ *
  * \return An integer representing one of the following:
  *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
  *     \li \c UPNP_E_FINISH: The SDK is already terminated or
@@ -967,6 +1140,36 @@ UPNP_EXPORT_SPEC int UpnpUnRegisterRootDeviceLowPower(
 	/*! RegistrationState as defined by UPnP Low Power. */
 	int RegistrationState);
 
+/*!
+ * \brief Compiles the action lists of the SCPDs of a root device registered
+ * with \b UpnpRegisterRootDevice, \b UpnpRegisterRootDevice2,
+ * \b UpnpRegisterRootDevice3 or \b UpnpRegisterRootDevice4.
+ *
+ * Once the schema of a service is compiled, its action requests are decoded
+ * without building a DOM document: the \b UpnpActionRequest passed to the
+ * callback carries an \b UpnpActionArgs object with the validated input
+ * arguments, and its \b ActionRequest document is NULL unless the request
+ * could not be decoded that way. The application may then return the output
+ * arguments through the \b UpnpActionArgs object instead of building the
+ * \b ActionResult document. Requests with missing, unknown or repeated
+ * arguments are answered with error 402, and values that do not match the
+ * data type of their related state variable with error 600, before the
+ * callback is called.
+ *
+ * Services whose SCPD cannot be downloaded or compiled keep the DOM based
+ * processing.
+ *
+ * \return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *     \li \c UPNP_E_FINISH: The SDK is not initialized.
+ *     \li \c UPNP_E_INVALID_HANDLE: The handle is not a valid device handle.
+ *     \li \c UPNP_E_OUTOF_MEMORY: Insufficient resources exist to compile
+ *             the schemas.
+ */
+UPNP_EXPORT_SPEC int UpnpCompileActionSchemas(
+	/*! [in] The handle of the root device instance. */
+	UpnpDevice_Handle Hnd);
+
 /*!
  * \brief Registers a control point application with the UPnP Library.
  *
@@ -1049,6 +1252,65 @@ UPNP_EXPORT_SPEC int UpnpSetMaxContentLength(
 	 * actions, in bytes. */
 	size_t contentLength);
 
+/*!
+ * \brief Sets the maximum number of jobs of a class in progress.
+ *
+ * The jobs over the budget of their class, or that their thread pool has no
+ * room for, are shed as described in \b Upnp_LoadClass, so that a storm of
+ * one class of requests does not fill the queues shared with the others.
+ * The defaults are \c LOAD_BUDGET_HTTP, \c LOAD_BUDGET_SSDP and
+ * \c LOAD_BUDGET_SEARCH_REPLY.
+ *
+ * \return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *     \li \c UPNP_E_INVALID_PARAM: The class or the budget is not valid.
+ */
+UPNP_EXPORT_SPEC int UpnpSetLoadBudget(
+	/*! [in] The class of jobs. */
+	Upnp_LoadClass loadClass,
+	/*! [in] The maximum number of jobs in progress, 0 to only limit them
+	 * by the size of their thread pool. */
+	int budget);
+
+/*!
+ * \brief Gets the counters of a class of jobs, kept since the library was
+ * loaded.
+ *
+ * \return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *     \li \c UPNP_E_INVALID_PARAM: The class is not valid or \b stats is
+ *             \c NULL.
+ */
+UPNP_EXPORT_SPEC int UpnpGetLoadStats(
+	/*! [in] The class of jobs. */
+	Upnp_LoadClass loadClass,
+	/*! [out] The counters of the class. */
+	Upnp_LoadStats *stats);
+
+/*!
+ * \brief Gets the percentiles of the time the jobs of a thread pool waited
+ * in their queue and ran, for a priority or a type of jobs.
+ *
+ * The times are recorded in histograms since the SDK was initialized, and
+ * read while the pool runs.
+ *
+ * \return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *     \li \c UPNP_E_FINISH: The SDK is not initialized.
+ *     \li \c UPNP_E_INVALID_PARAM: The pool, the priority or the type is
+ *             not valid, or \b latency is \c NULL.
+ */
+UPNP_EXPORT_SPEC int UpnpGetJobLatency(
+	/*! [in] The thread pool, one of the UPNP_THREADS_*_POOL. */
+	Upnp_Threads pool,
+	/*! [in] The priority of the jobs, 0 for low, 1 for medium and 2 for
+	 * high, or -1 for the jobs of a type. */
+	int priority,
+	/*! [in] The type of the jobs, ignored unless \b priority is -1. */
+	Upnp_JobType type,
+	/*! [out] The percentiles. */
+	Upnp_Latency *latency);
+
 /* @} Initialization and Registration */
 
 /******************************************************************************
@@ -2596,6 +2858,55 @@ UPNP_EXPORT_SPEC int UpnpSetWebServerRootDir(
 	/*! [in] Path of the root directory of the web server. */
 	const char *rootDir);
 
+/*!
+ * \brief Sets the bounds of the in-memory cache of the files of the document
+ * root directory.
+ *
+ * Files not larger than \b maxFileSize are kept in memory after they are first
+ * served, the least recently used ones being dropped when the cache would
+ * exceed \b cacheSize bytes. A cached file is checked against its
+ * modification time and size on every request. The defaults are
+ * \c WEB_SERVER_CACHE_SIZE and \c WEB_SERVER_CACHE_MAX_FILE_SIZE.
+ *
+ * \note This function is not available when the web server is not compiled
+ * 	into the UPnP Library.
+ *
+ * \return An integer representing one of the following:
+ *       \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *       \li \c UPNP_E_FINISH: The SDK is not initialized.
+ */
+UPNP_EXPORT_SPEC int UpnpSetWebServerCache(
+	/*! [in] Number of bytes of files kept in memory, \c 0 to disable the
+	 * cache. */
+	size_t cacheSize,
+	/*! [in] Size of the largest file kept in memory. */
+	size_t maxFileSize);
+
+/*!
+ * \brief Limits the rate at which the web server sends files.
+ *
+ * Each connection sends at most \b connectionRate bytes per second, and all
+ * connections together at most \b totalRate bytes per second, the
+ * connections sending in turn so that each gets its share of the total. The
+ * limits apply to the files of the document root directory and of the
+ * virtual directories, including the streamed ones, not to the descriptions
+ * and control responses. The rates are not limited by default.
+ *
+ * \note This function is not available when the web server is not compiled
+ * 	into the UPnP Library.
+ *
+ * \return An integer representing one of the following:
+ *       \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *       \li \c UPNP_E_FINISH: The SDK is not initialized.
+ */
+UPNP_EXPORT_SPEC int UpnpSetWebServerRateLimit(
+	/*! [in] Bytes per second sent on one connection, \c 0 not to limit
+	 * it. */
+	size_t connectionRate,
+	/*! [in] Bytes per second sent on all the connections, \c 0 not to
+	 * limit it. */
+	size_t totalRate);
+
 /*!
  * \brief The type of handle returned by the web server for open requests.
  */
@@ -2753,6 +3064,165 @@ typedef int (*VDCallback_Close)(
 UPNP_EXPORT_SPEC int UpnpVirtualDir_set_CloseCallback(
 	VDCallback_Close callback);
 
+/*!
+ * \brief Body of a response streamed by the application.
+ *
+ * The application queues the data of the body with \b UpnpWebStream_Write
+ * and \b UpnpWebStream_WriteFile, from any thread, and the library sends it
+ * from the miniserver thread as the client reads it. No thread is blocked
+ * while the client is slow or while the application produces the data.
+ */
+typedef struct s_UpnpWebStream UpnpWebStream;
+
+/*!
+ * \brief Events of a web stream, given to the \b VDCallback_StreamEvent
+ * callback.
+ */
+typedef enum Upnp_WebStreamEvent
+{
+	/*! A write failed with \c UPNP_E_WOULD_BLOCK and enough of the queued
+	 * data was sent since to write again. */
+	UPNP_WEBSTREAM_WRITABLE,
+	/*! The whole body was sent: the data queued before
+	 * \b UpnpWebStream_Close, or as many bytes as the length given to the
+	 * open stream callback. This is the last event of the stream. */
+	UPNP_WEBSTREAM_DONE,
+	/*! The connection ended before the whole body was sent: the client
+	 * closed it, it timed out or the library is stopping. Writes fail
+	 * from now on. This is the last event of the stream. */
+	UPNP_WEBSTREAM_ABORTED
+} Upnp_WebStreamEvent;
+
+/*!
+ * \brief Open stream callback function prototype.
+ *
+ * Called instead of the open callback, when it is set, for the GET requests
+ * of a virtual directory. The headers of the response are already queued in
+ * the stream; the application writes the body and calls
+ * \b UpnpWebStream_Close once it is complete, possibly long after this
+ * callback returned.
+ *
+ * \return \c 0 to stream the file, or any other value to serve it with the
+ * open, read and close callbacks instead, in which case the stream must not
+ * be used.
+ */
+typedef int (*VDCallback_OpenStream)(
+	/*! [in] The name of the file to send. */
+	const char *filename,
+	/*! [in] Offset in the file of the first byte of the body, not \c 0
+	 * for a range request. */
+	off_t offset,
+	/*! [in] The number of bytes of the body, or a negative value if the
+	 * length was not given by the get-info callback. */
+	off_t length,
+	/*! [in] The stream of the body. */
+	UpnpWebStream *stream,
+	/*! [in] The cookie associated with this VirtualDir */
+	const void *cookie,
+	/*! [in] The cookie associated with this request */
+	const void *request_cookie);
+
+/*!
+ * \brief Sets the open stream callback function to be used to access a
+ * virtual directory.
+ *
+ * \return An integer representing one of the following:
+ *       \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *       \li \c UPNP_E_INVALID_ARGUMENT: \b callback is not a valid pointer.
+ */
+UPNP_EXPORT_SPEC int UpnpVirtualDir_set_OpenStreamCallback(
+	VDCallback_OpenStream callback);
+
+/*!
+ * \brief Stream event callback function prototype.
+ *
+ * Called from a thread of the library; the events of a stream are never
+ * given concurrently.
+ */
+typedef void (*VDCallback_StreamEvent)(
+	/*! [in] The stream. */
+	UpnpWebStream *stream,
+	/*! [in] The event. */
+	Upnp_WebStreamEvent event,
+	/*! [in] The cookie associated with this VirtualDir */
+	const void *cookie,
+	/*! [in] The cookie associated with this request */
+	const void *request_cookie);
+
+/*!
+ * \brief Sets the callback function receiving the events of the streams.
+ *
+ * \return An integer representing one of the following:
+ *       \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *       \li \c UPNP_E_INVALID_ARGUMENT: \b callback is not a valid pointer.
+ */
+UPNP_EXPORT_SPEC int UpnpVirtualDir_set_StreamEventCallback(
+	VDCallback_StreamEvent callback);
+
+/*!
+ * \brief Queues a copy of a buffer at the end of the body of a stream.
+ *
+ * A write is refused once \c WEB_STREAM_MAX_QUEUED bytes, 256KB by default,
+ * wait to be sent; a \c UPNP_WEBSTREAM_WRITABLE event follows when half of
+ * them are sent.
+ *
+ * \return An integer representing one of the following:
+ *       \li \c UPNP_E_SUCCESS: The buffer is queued.
+ *       \li \c UPNP_E_WOULD_BLOCK: Too much data is queued, nothing was.
+ *       \li \c UPNP_E_SOCKET_WRITE: The connection ended.
+ *       \li \c UPNP_E_OUTOF_BOUNDS: The body would be longer than the
+ *		length given to the open stream callback.
+ *       \li \c UPNP_E_INVALID_PARAM: The stream is closed.
+ *       \li \c UPNP_E_OUTOF_MEMORY: Not enough memory to copy the buffer.
+ *       \li \c UPNP_E_NO_WEB_SERVER: The internal web server has been
+ *		compiled out.
+ */
+UPNP_EXPORT_SPEC int UpnpWebStream_Write(
+	/*! [in] The stream. */
+	UpnpWebStream *stream,
+	/*! [in] The data to send. */
+	const char *buf,
+	/*! [in] The number of bytes to send. */
+	size_t buflen);
+
+/*!
+ * \brief Queues a range of a file at the end of the body of a stream.
+ *
+ * The range is read as it is sent and does not count in the limit of the
+ * queued data. The file descriptor must stay open until the last event of
+ * the stream.
+ *
+ * \return Same values as \b UpnpWebStream_Write, except
+ * \c UPNP_E_WOULD_BLOCK.
+ */
+UPNP_EXPORT_SPEC int UpnpWebStream_WriteFile(
+	/*! [in] The stream. */
+	UpnpWebStream *stream,
+	/*! [in] File descriptor opened for reading. */
+	int fd,
+	/*! [in] Offset of the range in the file. */
+	off_t offset,
+	/*! [in] Length of the range. */
+	size_t length);
+
+/*!
+ * \brief Ends the body of a stream and releases it.
+ *
+ * The queued data is still sent, then \c UPNP_WEBSTREAM_DONE is given. The
+ * application must call this function exactly once for every stream it
+ * accepted, even after \c UPNP_WEBSTREAM_ABORTED, and must not use the
+ * stream after its last event once it did.
+ *
+ * \return An integer representing one of the following:
+ *       \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *       \li \c UPNP_E_INVALID_PARAM: The stream is already closed.
+ *       \li \c UPNP_E_NO_WEB_SERVER: The internal web server has been
+ *		compiled out.
+ */
+UPNP_EXPORT_SPEC int UpnpWebStream_Close(
+	/*! [in] The stream. */
+	UpnpWebStream *stream);
+
 /*!
  * \brief Enables or disables the webserver.
  *
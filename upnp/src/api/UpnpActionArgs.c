@@ -0,0 +1,285 @@
+/*!
+ * \addtogroup UpnpActionArgs
+ *
+ * @{
+ *
+ * \file
+ *
+ * \brief UpnpActionArgs object implementation.
+ */
+
+#include "config.h"
+
+#include "UpnpActionArgs.h"
+
+#include "UpnpStdInt.h"
+#include "soap_schema.h"
+#include "upnp.h"
+
+#include <stdio.h>  /* for snprintf() */
+#include <stdlib.h> /* for malloc(), free(), strtoll() */
+#include <string.h> /* for memcpy(), strcmp() */
+
+#include "posix_overwrites.h"
+
+/*! Offset of a value that has not been set. */
+#define ARG_UNSET ((size_t)-1)
+
+/*!
+ * \brief Internal implementation of the class UpnpActionArgs.
+ *
+ * The object, the value offsets and the copy of the action schema live in
+ * a single allocation; the values themselves are appended to m_values.
+ *
+ * \internal
+ */
+struct s_UpnpActionArgs
+{
+	/*! Private copy of the action schema. */
+	action_schema *m_schema;
+	/*! Offsets of the values in m_values, input arguments first. */
+	size_t *m_offsets;
+	/*! NUL terminated values, back to back. */
+	membuffer m_values;
+};
+
+UpnpActionArgs *UpnpActionArgs_new(const action_schema *schema)
+{
+	struct s_UpnpActionArgs *p;
+	size_t num_args;
+	size_t head;
+	size_t i;
+
+	num_args = (size_t)(schema->num_in + schema->num_out);
+	/* Keep the schema copy aligned like the original block. */
+	head = sizeof(struct s_UpnpActionArgs) + num_args * sizeof(size_t);
+	head = (head + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+	p = malloc(head + schema->size);
+	if (!p)
+		return NULL;
+	p->m_offsets = (size_t *)(p + 1);
+	for (i = 0; i < num_args; i++)
+		p->m_offsets[i] = ARG_UNSET;
+	p->m_schema = (action_schema *)((char *)p + head);
+	memcpy(p->m_schema, schema, schema->size);
+	membuffer_init(&p->m_values);
+	/* Grow in steps large enough for a typical argument list. */
+	p->m_values.size_inc = (size_t)256;
+
+	return (UpnpActionArgs *)p;
+}
+
+void UpnpActionArgs_delete(UpnpActionArgs *p)
+{
+	if (!p)
+		return;
+	membuffer_destroy(&p->m_values);
+	free(p);
+}
+
+const action_schema *UpnpActionArgs_get_Schema(const UpnpActionArgs *p)
+{
+	return p->m_schema;
+}
+
+/*!
+ * \brief Appends a value and records its offset.
+ *
+ * \return The stored copy or NULL if out of memory.
+ */
+static char *store_value(
+	/*! [in] The \em \b this pointer. */
+	UpnpActionArgs *p,
+	/*! [in] Index in the offsets array. */
+	int slot,
+	/*! [in] Value. */
+	const char *value,
+	/*! [in] Length of the value. */
+	size_t len)
+{
+	size_t offset = p->m_values.length;
+
+	/* Store the terminator too, so values can be read in place. */
+	if (membuffer_append(&p->m_values, value, len) != 0 ||
+		membuffer_append(&p->m_values, "", (size_t)1) != 0)
+		return NULL;
+	p->m_offsets[slot] = offset;
+
+	return p->m_values.buf + offset;
+}
+
+char *UpnpActionArgs_set_InValue(
+	UpnpActionArgs *p, int i, const char *value, size_t len)
+{
+	if (i < 0 || i >= p->m_schema->num_in)
+		return NULL;
+
+	return store_value(p, i, value, len);
+}
+
+const char *UpnpActionArgs_get_ActionName(const UpnpActionArgs *p)
+{
+	return ACTION_SCHEMA_STR(p->m_schema, p->m_schema->name);
+}
+
+int UpnpActionArgs_get_NumIn(const UpnpActionArgs *p)
+{
+	return p->m_schema->num_in;
+}
+
+int UpnpActionArgs_get_NumOut(const UpnpActionArgs *p)
+{
+	return p->m_schema->num_out;
+}
+
+/*!
+ * \brief Linear search of an argument name in a range of the schema.
+ *
+ * \return The index relative to \b first, or -1.
+ */
+static int find_arg(
+	/*! [in] Action schema. */
+	const action_schema *schema,
+	/*! [in] Index of the first argument of the range. */
+	int first,
+	/*! [in] Number of arguments in the range. */
+	int count,
+	/*! [in] Name to look up. */
+	const char *name)
+{
+	const action_arg_schema *args = ACTION_SCHEMA_ARGS(schema) + first;
+	int i;
+
+	if (!name)
+		return -1;
+	for (i = 0; i < count; i++) {
+		if (strcmp(ACTION_SCHEMA_STR(schema, args[i].name), name) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+int UpnpActionArgs_find_In(const UpnpActionArgs *p, const char *name)
+{
+	return find_arg(p->m_schema, 0, p->m_schema->num_in, name);
+}
+
+int UpnpActionArgs_find_Out(const UpnpActionArgs *p, const char *name)
+{
+	return find_arg(
+		p->m_schema, p->m_schema->num_in, p->m_schema->num_out, name);
+}
+
+const char *UpnpActionArgs_get_InName(const UpnpActionArgs *p, int i)
+{
+	if (i < 0 || i >= p->m_schema->num_in)
+		return NULL;
+
+	return ACTION_SCHEMA_STR(
+		p->m_schema, ACTION_SCHEMA_ARGS(p->m_schema)[i].name);
+}
+
+Upnp_ArgType UpnpActionArgs_get_InType(const UpnpActionArgs *p, int i)
+{
+	if (i < 0 || i >= p->m_schema->num_in)
+		return UPNP_ARG_STRING;
+
+	return ACTION_SCHEMA_ARGS(p->m_schema)[i].type;
+}
+
+const char *UpnpActionArgs_get_InValue(const UpnpActionArgs *p, int i)
+{
+	if (i < 0 || i >= p->m_schema->num_in || p->m_offsets[i] == ARG_UNSET)
+		return NULL;
+
+	return p->m_values.buf + p->m_offsets[i];
+}
+
+int UpnpActionArgs_get_InInteger(
+	const UpnpActionArgs *p, int i, long long *value)
+{
+	const char *s = UpnpActionArgs_get_InValue(p, i);
+	char *end;
+
+	if (!s || !*s)
+		return UPNP_E_INVALID_ARGUMENT;
+	*value = strtoll(s, &end, 10);
+	if (*end != '\0')
+		return UPNP_E_INVALID_ARGUMENT;
+
+	return UPNP_E_SUCCESS;
+}
+
+int UpnpActionArgs_get_InBoolean(const UpnpActionArgs *p, int i, int *value)
+{
+	const char *s = UpnpActionArgs_get_InValue(p, i);
+
+	if (!s)
+		return UPNP_E_INVALID_ARGUMENT;
+	if (!strcmp(s, "1") || !strcasecmp(s, "true") || !strcasecmp(s, "yes"))
+		*value = 1;
+	else if (!strcmp(s, "0") || !strcasecmp(s, "false") ||
+		 !strcasecmp(s, "no"))
+		*value = 0;
+	else
+		return UPNP_E_INVALID_ARGUMENT;
+
+	return UPNP_E_SUCCESS;
+}
+
+const char *UpnpActionArgs_get_OutName(const UpnpActionArgs *p, int i)
+{
+	if (i < 0 || i >= p->m_schema->num_out)
+		return NULL;
+
+	return ACTION_SCHEMA_STR(p->m_schema,
+		ACTION_SCHEMA_ARGS(p->m_schema)[p->m_schema->num_in + i].name);
+}
+
+Upnp_ArgType UpnpActionArgs_get_OutType(const UpnpActionArgs *p, int i)
+{
+	if (i < 0 || i >= p->m_schema->num_out)
+		return UPNP_ARG_STRING;
+
+	return ACTION_SCHEMA_ARGS(p->m_schema)[p->m_schema->num_in + i].type;
+}
+
+const char *UpnpActionArgs_get_OutValue(const UpnpActionArgs *p, int i)
+{
+	size_t offset;
+
+	if (i < 0 || i >= p->m_schema->num_out)
+		return NULL;
+	offset = p->m_offsets[p->m_schema->num_in + i];
+	if (offset == ARG_UNSET)
+		return NULL;
+
+	return p->m_values.buf + offset;
+}
+
+int UpnpActionArgs_set_OutValue(UpnpActionArgs *p, int i, const char *value)
+{
+	if (i < 0 || i >= p->m_schema->num_out || !value)
+		return UPNP_E_INVALID_PARAM;
+	if (!store_value(p, p->m_schema->num_in + i, value, strlen(value)))
+		return UPNP_E_OUTOF_MEMORY;
+
+	return UPNP_E_SUCCESS;
+}
+
+int UpnpActionArgs_set_OutInteger(UpnpActionArgs *p, int i, long long value)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%lld", value);
+
+	return UpnpActionArgs_set_OutValue(p, i, buf);
+}
+
+int UpnpActionArgs_set_OutBoolean(UpnpActionArgs *p, int i, int value)
+{
+	return UpnpActionArgs_set_OutValue(p, i, value ? "1" : "0");
+}
+
+/* @} UpnpActionArgs */
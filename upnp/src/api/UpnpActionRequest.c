@@ -28,6 +28,7 @@ struct s_UpnpActionRequest
 	IXML_Document *m_SoapHeader;
 	struct sockaddr_storage m_CtrlPtIPAddr;
 	UpnpString *m_Os;
+	UpnpActionArgs *m_ActionArgs;
 };
 
 UpnpActionRequest *UpnpActionRequest_new()
@@ -49,6 +50,7 @@ UpnpActionRequest *UpnpActionRequest_new()
 	/*p->m_SoapHeader = 0;*/
 	/* memset(&p->m_CtrlPtIPAddr, 0, sizeof (struct sockaddr_storage)); */
 	p->m_Os = UpnpString_new();
+	/*p->m_ActionArgs = 0;*/
 
 	return (UpnpActionRequest *)p;
 }
@@ -60,6 +62,7 @@ void UpnpActionRequest_delete(UpnpActionRequest *q)
 	if (!p)
 		return;
 
+	p->m_ActionArgs = 0;
 	UpnpString_delete(p->m_Os);
 	p->m_Os = 0;
 	memset(&p->m_CtrlPtIPAddr, 0, sizeof(struct sockaddr_storage));
@@ -107,6 +110,8 @@ int UpnpActionRequest_assign(UpnpActionRequest *p, const UpnpActionRequest *q)
 				   p, UpnpActionRequest_get_CtrlPtIPAddr(q));
 		ok = ok &&
 		     UpnpActionRequest_set_Os(p, UpnpActionRequest_get_Os(q));
+		ok = ok && UpnpActionRequest_set_ActionArgs(
+				   p, UpnpActionRequest_get_ActionArgs(q));
 	}
 
 	return ok;
@@ -391,3 +396,15 @@ void UpnpActionRequest_clear_Os(UpnpActionRequest *p)
 {
 	UpnpString_clear(p->m_Os);
 }
+
+UpnpActionArgs *UpnpActionRequest_get_ActionArgs(const UpnpActionRequest *p)
+{
+	return p->m_ActionArgs;
+}
+
+int UpnpActionRequest_set_ActionArgs(UpnpActionRequest *p, UpnpActionArgs *n)
+{
+	p->m_ActionArgs = n;
+
+	return 1;
+}
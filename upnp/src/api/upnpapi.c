@@ -46,11 +46,14 @@
 #include "UpnpStdInt.h"
 #include "UpnpUniStd.h" /* for close() */
 #include "httpreadwrite.h"
+#include "loadshed.h"
 #include "membuffer.h"
+#include "soap_schema.h"
 #include "soaplib.h"
 #include "ssdplib.h"
 #include "sysdep.h"
 #include "uuid.h"
+#include "webvdir.h"
 
 /* Needed for GENA */
 #include "gena.h"
@@ -60,7 +63,10 @@
 #ifdef INTERNAL_WEB_SERVER
 	#include "VirtualDir.h"
 	#include "urlconfig.h"
+	#include "webcache.h"
+	#include "webrate.h"
 	#include "webserver.h"
+	#include "webstream.h"
 #endif /* INTERNAL_WEB_SERVER */
 
 #include <sys/stat.h>
@@ -108,9 +114,6 @@
 /*! This structure is for virtual directory callbacks */
 struct VirtualDirCallbacks virtualDirCallback;
 
-/*! Pointer to the virtual directory list. */
-virtualDirList *pVirtualDirList;
-
 #ifdef INCLUDE_CLIENT_APIS
 /*! Mutex to synchronize the subscription handling at the client side. */
 ithread_mutex_t GlobalClientSubscribeMutex;
@@ -137,6 +140,11 @@ ThreadPool gRecvThreadPool;
 /*! Mini server thread pool. */
 ThreadPool gMiniServerThreadPool;
 
+#if EXCLUDE_WEB_SERVER == 0
+/*! Thread pool sending the large files of the web server. */
+ThreadPool gStreamThreadPool;
+#endif /* EXCLUDE_WEB_SERVER */
+
 /*! Flag to indicate the state of web server */
 WebServerState bWebServerState = WEB_SERVER_DISABLED;
 
@@ -344,6 +352,29 @@ static int UpnpInitMutexes(void)
 	return UPNP_E_SUCCESS;
 }
 
+/*! CPUs of the threads of the SDK, see UpnpSetThreadCpus(). */
+static ThreadPoolCpuSet gThreadCpus[UPNP_THREADS_MINISERVER + 1];
+
+/*! Whether the workers of a pool are NUMA local, see UpnpSetThreadCpus(). */
+static int gThreadNumaLocal[UPNP_THREADS_MINISERVER + 1];
+
+/*!
+ * \brief Sets the CPUs of a thread pool and of its persistent thread.
+ */
+static void SetPoolCpus(
+	/*! [in,out] Attributes of the pool. */
+	ThreadPoolAttr *attr,
+	/*! [in] Pool. */
+	Upnp_Threads pool,
+	/*! [in] Persistent thread of the pool, or the pool if it has none. */
+	Upnp_Threads persistent)
+{
+	TPAttrSetCpuSet(attr, &gThreadCpus[pool]);
+	TPAttrSetNumaLocal(attr, gThreadNumaLocal[pool]);
+	TPAttrSetPersistentCpuSet(
+		attr, persistent != pool ? &gThreadCpus[persistent] : NULL);
+}
+
 /*!
  * \brief Initializes the global threadm pools used by the UPnP SDK.
  *
@@ -362,22 +393,45 @@ static int UpnpInitThreadPools(void)
 	TPAttrSetJobsPerThread(&attr, JOBS_PER_THREAD);
 	TPAttrSetIdleTime(&attr, THREAD_IDLE_TIME);
 	TPAttrSetMaxJobsTotal(&attr, MAX_JOBS_TOTAL);
+	TPAttrSetQueueMode(&attr, THREAD_QUEUE_MODE);
+	TPAttrSetAdaptiveInterval(&attr, THREAD_ADAPTIVE_INTERVAL);
+	TPAttrSetAdaptiveWait(&attr, THREAD_ADAPTIVE_WAIT);
 
+	SetPoolCpus(&attr, UPNP_THREADS_SEND_POOL, UPNP_THREADS_TIMER);
 	if (ThreadPoolInit(&gSendThreadPool, &attr) != UPNP_E_SUCCESS) {
 		ret = UPNP_E_INIT_FAILED;
 		goto exit_function;
 	}
 
+	SetPoolCpus(&attr, UPNP_THREADS_RECV_POOL, UPNP_THREADS_RECV_POOL);
 	if (ThreadPoolInit(&gRecvThreadPool, &attr) != UPNP_E_SUCCESS) {
 		ret = UPNP_E_INIT_FAILED;
 		goto exit_function;
 	}
 
+	SetPoolCpus(
+		&attr, UPNP_THREADS_MINISERVER_POOL, UPNP_THREADS_MINISERVER);
 	if (ThreadPoolInit(&gMiniServerThreadPool, &attr) != UPNP_E_SUCCESS) {
 		ret = UPNP_E_INIT_FAILED;
 		goto exit_function;
 	}
 
+#if EXCLUDE_WEB_SERVER == 0
+	TPAttrSetMaxThreads(&attr, STREAM_MAX_THREADS);
+	TPAttrSetMinThreads(&attr, STREAM_MIN_THREADS);
+	/* one thread per transfer */
+	TPAttrSetJobsPerThread(&attr, 1);
+	TPAttrSetAdaptiveInterval(&attr, 0);
+	TPAttrSetMaxJobsTotal(&attr, STREAM_MAX_JOBS_TOTAL);
+	/* few long jobs, added by the miniserver pool */
+	TPAttrSetQueueMode(&attr, SHARED_QUEUES);
+	SetPoolCpus(&attr, UPNP_THREADS_STREAM_POOL, UPNP_THREADS_STREAM_POOL);
+	if (ThreadPoolInit(&gStreamThreadPool, &attr) != UPNP_E_SUCCESS) {
+		ret = UPNP_E_INIT_FAILED;
+		goto exit_function;
+	}
+#endif /* EXCLUDE_WEB_SERVER */
+
 exit_function:
 	if (ret != UPNP_E_SUCCESS) {
 		UpnpSdkInit = 0;
@@ -586,6 +640,22 @@ exit_function:
 	return retVal;
 }
 
+int UpnpSetThreadCpus(Upnp_Threads threads, const char *cpus, int numaLocal)
+{
+	ThreadPoolCpuSet set;
+
+	if (UpnpSdkInit == 1)
+		return UPNP_E_INIT;
+	if ((int)threads < UPNP_THREADS_SEND_POOL ||
+		threads > UPNP_THREADS_MINISERVER ||
+		TPCpuSetParse(&set, cpus ? cpus : "") != 0)
+		return UPNP_E_INVALID_PARAM;
+	gThreadCpus[threads] = set;
+	gThreadNumaLocal[threads] = numaLocal;
+
+	return UPNP_E_SUCCESS;
+}
+
 #ifdef UPNP_ENABLE_OPEN_SSL
 int UpnpInitSslContext(int initOpenSslLib, const SSL_METHOD *sslMethod)
 {
@@ -630,9 +700,13 @@ void PrintThreadPoolStats(
 		"High Jobs pending: %d\n"
 		"Med Jobs Pending: %d\n"
 		"Low Jobs Pending: %d\n"
+		"Deadline Jobs Pending: %d\n"
 		"Average wait in High Q in milliseconds: %lf\n"
 		"Average wait in Med Q in milliseconds: %lf\n"
 		"Average wait in Low Q in milliseconds: %lf\n"
+		"Average wait in Deadline Q in milliseconds: %lf\n"
+		"Deadline Misses: %d\n"
+		"Deadline Drops: %d\n"
 		"Max Threads Used: %d\n"
 		"Worker Threads: %d\n"
 		"Persistent Threads: %d\n"
@@ -644,9 +718,13 @@ void PrintThreadPoolStats(
 		stats.currentJobsHQ,
 		stats.currentJobsMQ,
 		stats.currentJobsLQ,
+		stats.currentJobsDQ,
 		stats.avgWaitHQ,
 		stats.avgWaitMQ,
 		stats.avgWaitLQ,
+		stats.avgWaitDQ,
+		stats.deadlineMisses,
+		stats.deadlineDrops,
 		stats.maxThreads,
 		stats.workerThreads,
 		stats.persistentThreads,
@@ -718,6 +796,10 @@ int UpnpFinish(void)
 	StopMiniServer();
 #endif
 #if EXCLUDE_WEB_SERVER == 0
+	/* the transfers still use the web server */
+	ThreadPoolShutdown(&gStreamThreadPool);
+	PrintThreadPoolStats(
+		&gStreamThreadPool, __FILE__, __LINE__, "Stream Thread Pool");
 	web_server_destroy();
 #endif
 	ThreadPoolShutdown(&gMiniServerThreadPool);
@@ -868,6 +950,9 @@ static int FreeHandle(
 			"FreeHandle: HandleTable[%d] is NULL\n",
 			Upnp_Handle);
 	} else {
+#ifdef INCLUDE_DEVICE_APIS
+		RemoveServicePaths(Upnp_Handle);
+#endif /* INCLUDE_DEVICE_APIS */
 		free(HandleTable[Upnp_Handle]);
 		HandleTable[Upnp_Handle] = NULL;
 		ret = UPNP_E_SUCCESS;
@@ -1032,6 +1117,7 @@ int UpnpRegisterRootDevice(const char *DescUrl,
 			"UpnpRegisterRootDevice: GENA Service Table\n"
 			"Here are the known services:\n");
 		printServiceTable(&HInfo->ServiceTable, UPNP_ALL, API);
+		AddServicePaths(*Hnd, HInfo);
 	} else {
 		UpnpPrintf(UPNP_ALL,
 			API,
@@ -1070,10 +1156,15 @@ static int GetDescDocumentAndURL(
 	int config_baseURL,
 	/* [in] . */
 	int AddressFamily,
+	/* [in] Device handle, naming the alias of a description given in a
+	 * buffer. */
+	int Hnd,
 	/* [out] . */
 	IXML_Document **xmlDoc,
 	/* [out] . */
-	char descURL[LINE_SIZE]);
+	char descURL[LINE_SIZE],
+	/* [out] Alias serving the description, if config_baseURL. */
+	char descAlias[LINE_SIZE]);
 
 #ifdef INCLUDE_DEVICE_APIS
 int UpnpRegisterRootDevice2(Upnp_DescType descriptionType,
@@ -1131,8 +1222,10 @@ int UpnpRegisterRootDevice2(Upnp_DescType descriptionType,
 		description,
 		config_baseURL,
 		AF_INET,
+		*Hnd,
 		&HInfo->DescDocument,
-		HInfo->DescURL);
+		HInfo->DescURL,
+		HInfo->DescAlias);
 	if (retVal != UPNP_E_SUCCESS) {
 		FreeHandle(*Hnd);
 		goto exit_function;
@@ -1221,6 +1314,7 @@ int UpnpRegisterRootDevice2(Upnp_DescType descriptionType,
 			"UpnpRegisterRootDevice2: GENA Service Table\n"
 			"Here are the known services: \n");
 		printServiceTable(&HInfo->ServiceTable, UPNP_ALL, API);
+		AddServicePaths(*Hnd, HInfo);
 	} else {
 		UpnpPrintf(UPNP_ALL,
 			API,
@@ -1410,6 +1504,7 @@ int UpnpRegisterRootDevice4(const char *DescUrl,
 			"UpnpRegisterRootDevice4: GENA Service Table \n"
 			"Here are the known services: \n");
 		printServiceTable(&HInfo->ServiceTable, UPNP_ALL, API);
+		AddServicePaths(*Hnd, HInfo);
 	} else {
 		UpnpPrintf(UPNP_ALL,
 			API,
@@ -1515,7 +1610,7 @@ int UpnpUnRegisterRootDeviceLowPower(UpnpDevice_Handle Hnd,
 	#endif /* INCLUDE_CLIENT_APIS */
 	#ifdef INTERNAL_WEB_SERVER
 	if (HInfo->aliasInstalled)
-		web_server_set_alias(NULL, NULL, 0, 0);
+		web_server_remove_alias(HInfo->DescAlias);
 	#endif /* INTERNAL_WEB_SERVER */
 	switch (HInfo->DeviceAf) {
 	case AF_INET:
@@ -1538,6 +1633,128 @@ int UpnpUnRegisterRootDeviceLowPower(UpnpDevice_Handle Hnd,
 
 	return retVal;
 }
+
+	#if EXCLUDE_SOAP == 0 && EXCLUDE_GENA == 0
+/*!
+ * \brief Copies the identification of the n-th service of a device.
+ *
+ * \return UPNP_E_SUCCESS, UPNP_E_INVALID_HANDLE, UPNP_E_OUTOF_BOUNDS if there
+ * are not more than \b n services, or UPNP_E_OUTOF_MEMORY.
+ */
+static int GetNthService(
+	/*! [in] Device handle. */
+	UpnpDevice_Handle Hnd,
+	/*! [in] Index of the service in the service table. */
+	int n,
+	/*! [out] UDN, service ID and SCPD URL, to be freed with free(). */
+	char **udn,
+	char **service_id,
+	char **scpd_url)
+{
+	struct Handle_Info *HInfo = NULL;
+	service_info *service;
+	int retVal = UPNP_E_OUTOF_BOUNDS;
+
+	*udn = *service_id = *scpd_url = NULL;
+	HandleReadLock();
+	if (GetHandleInfo(Hnd, &HInfo) != HND_DEVICE) {
+		retVal = UPNP_E_INVALID_HANDLE;
+		goto exit_function;
+	}
+	for (service = HInfo->ServiceTable.serviceList; service && n > 0;
+		service = service->next)
+		n--;
+	if (!service)
+		goto exit_function;
+	*udn = strdup(service->UDN);
+	*service_id = strdup(service->serviceId);
+	*scpd_url = strdup(service->SCPDURL);
+	if (!*udn || !*service_id || !*scpd_url) {
+		free(*udn);
+		free(*service_id);
+		free(*scpd_url);
+		retVal = UPNP_E_OUTOF_MEMORY;
+		goto exit_function;
+	}
+	retVal = UPNP_E_SUCCESS;
+
+exit_function:
+	HandleUnlock();
+
+	return retVal;
+}
+
+int UpnpCompileActionSchemas(UpnpDevice_Handle Hnd)
+{
+	struct Handle_Info *HInfo = NULL;
+	service_info *service;
+	service_schema *schema;
+	IXML_Document *scpd;
+	char *udn;
+	char *service_id;
+	char *scpd_url;
+	int retVal;
+	int n;
+
+	if (UpnpSdkInit != 1)
+		return UPNP_E_FINISH;
+	UpnpPrintf(UPNP_INFO,
+		API,
+		__FILE__,
+		__LINE__,
+		"Inside UpnpCompileActionSchemas\n");
+	/* The SCPD may be served by our own web server, so the handle lock
+	 * is not held while downloading. */
+	for (n = 0;; n++) {
+		retVal = GetNthService(Hnd, n, &udn, &service_id, &scpd_url);
+		if (retVal != UPNP_E_SUCCESS)
+			break;
+		schema = NULL;
+		scpd = NULL;
+		retVal = UpnpDownloadXmlDoc(scpd_url, &scpd);
+		if (retVal == UPNP_E_SUCCESS)
+			retVal = soap_schema_compile(scpd, &schema);
+		ixmlDocument_free(scpd);
+		if (retVal != UPNP_E_SUCCESS) {
+			/* Actions of this service keep using the DOM. */
+			UpnpPrintf(UPNP_CRITICAL,
+				API,
+				__FILE__,
+				__LINE__,
+				"Cannot compile SCPD %s: %d\n",
+				scpd_url,
+				retVal);
+		} else {
+			HandleLock();
+			service = NULL;
+			if (GetHandleInfo(Hnd, &HInfo) == HND_DEVICE)
+				service = FindServiceId(
+					&HInfo->ServiceTable, service_id, udn);
+			if (service) {
+				soap_schema_free(service->schema);
+				service->schema = schema;
+				schema = NULL;
+			}
+			HandleUnlock();
+			soap_schema_free(schema);
+		}
+		free(udn);
+		free(service_id);
+		free(scpd_url);
+		if (retVal == UPNP_E_OUTOF_MEMORY)
+			break;
+	}
+	if (retVal == UPNP_E_OUTOF_BOUNDS)
+		retVal = UPNP_E_SUCCESS;
+	UpnpPrintf(UPNP_INFO,
+		API,
+		__FILE__,
+		__LINE__,
+		"Exiting UpnpCompileActionSchemas\n");
+
+	return retVal;
+}
+	#endif /* EXCLUDE_SOAP && EXCLUDE_GENA */
 #endif /* INCLUDE_DEVICE_APIS */
 
 #ifdef INCLUDE_CLIENT_APIS
@@ -1719,12 +1936,42 @@ static void get_server_addr6(
 	sa6->sin6_port = htons(LOCAL_PORT_V6);
 }
 
+/*!
+ * \brief Checks whether another handle serves its description under an
+ * alias of a given name. The handle table must be locked.
+ *
+ * \return 1 if it does, 0 otherwise.
+ */
+static int DescAliasInUse(
+	/*! [in] Handle being registered. */
+	int Hnd,
+	/*! [in] Name of the alias, without the path. */
+	const char *name)
+{
+	struct Handle_Info *HInfo;
+	const char *p;
+	int i;
+
+	for (i = 1; i < NUM_HANDLE; i++) {
+		HInfo = (struct Handle_Info *)HandleTable[i];
+		if (i == Hnd || !HInfo || !HInfo->aliasInstalled)
+			continue;
+		p = strrchr(HInfo->DescAlias, '/');
+		if (strcmp(p ? p + 1 : HInfo->DescAlias, name) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
 static int GetDescDocumentAndURL(Upnp_DescType descriptionType,
 	char *description,
 	int config_baseURL,
 	int AddressFamily,
+	int Hnd,
 	IXML_Document **xmlDoc,
-	char descURL[LINE_SIZE])
+	char descURL[LINE_SIZE],
+	char descAlias[LINE_SIZE])
 {
 	int retVal = 0;
 	char *membuf = NULL;
@@ -1822,9 +2069,17 @@ static int GetDescDocumentAndURL(Upnp_DescType descriptionType,
 	/* Determine alias */
 	if (config_baseURL) {
 		if (descriptionType == (enum Upnp_DescType_e)UPNPREG_BUF_DESC) {
-			strncpy(aliasStr,
-				"description.xml",
-				sizeof(aliasStr) - 1);
+			/* one alias per device, the first one keeping the
+			 * usual name */
+			if (DescAliasInUse(Hnd, "description.xml"))
+				snprintf(aliasStr,
+					sizeof(aliasStr),
+					"description-%d.xml",
+					Hnd);
+			else
+				snprintf(aliasStr,
+					sizeof(aliasStr),
+					"description.xml");
 		} else {
 			/* URL or filename */
 			retVal = GetNameForAlias(description, &temp_str);
@@ -1849,7 +2104,8 @@ static int GetDescDocumentAndURL(Upnp_DescType descriptionType,
 			(struct sockaddr *)&serverAddr,
 			aliasStr,
 			last_modified,
-			descURL);
+			descURL,
+			descAlias);
 		if (retVal != UPNP_E_SUCCESS) {
 			ixmlDocument_free(*xmlDoc);
 			return retVal;
@@ -1874,8 +2130,10 @@ static int GetDescDocumentAndURL(Upnp_DescType descriptionType,
 	char *description,
 	int config_baseURL,
 	int AddressFamily,
+	int Hnd,
 	IXML_Document **xmlDoc,
-	char descURL[LINE_SIZE])
+	char descURL[LINE_SIZE],
+	char descAlias[LINE_SIZE])
 {
 	int retVal = 0;
 
@@ -4180,6 +4438,212 @@ Upnp_Handle_Type GetDeviceHandleInfo(UpnpDevice_Handle start,
 	return HND_INVALID;
 }
 
+#ifdef INCLUDE_DEVICE_APIS
+/*!
+ * \brief Entry of the table of control and event URL paths.
+ */
+typedef struct service_path_entry
+{
+	/*! Hash of the path. */
+	unsigned long hash;
+	/*! Address family of the device. */
+	int AddressFamily;
+	/*! Device handle. */
+	UpnpDevice_Handle Hnd;
+	/*! 1 for an event URL, 0 for a control URL. */
+	int isEvent;
+	/*! Rank of the service in the service list of the device. */
+	int rank;
+	/*! Service owning the URL, freed with the service table. */
+	service_info *service;
+	/*! Next entry of the bucket. */
+	struct service_path_entry *next;
+	/*! Length of the path. */
+	size_t len;
+	/*! The path and query of the URL, not NUL terminated. */
+	char path[1];
+} service_path_entry;
+
+/*! Table of control and event URL paths, protected by the handle lock. */
+static struct
+{
+	service_path_entry **buckets;
+	/*! Number of buckets, a power of two. */
+	size_t numBuckets;
+	size_t count;
+	/*! Set if an insertion failed, lookups then scan the handles. */
+	int incomplete;
+} ServicePathTable;
+
+/*!
+ * \brief FNV-1a hash of a path.
+ */
+static unsigned long HashServicePath(const char *path, size_t len)
+{
+	unsigned long hash = 2166136261lu;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (unsigned char)path[i];
+		hash *= 16777619lu;
+	}
+
+	return hash & 0xfffffffflu;
+}
+
+/*!
+ * \brief Tells whether an entry of the path table comes before another in a
+ * scan of the handles: lowest handle first, control URL before event URL,
+ * then the first service of the list.
+ */
+static int ServicePathBefore(
+	const service_path_entry *a, const service_path_entry *b)
+{
+	if (a->Hnd != b->Hnd)
+		return a->Hnd < b->Hnd;
+	if (a->isEvent != b->isEvent)
+		return a->isEvent < b->isEvent;
+
+	return a->rank < b->rank;
+}
+
+/*!
+ * \brief Doubles the number of buckets of the path table.
+ *
+ * \return UPNP_E_SUCCESS or UPNP_E_OUTOF_MEMORY.
+ */
+static int GrowServicePathTable(void)
+{
+	size_t numBuckets = ServicePathTable.numBuckets
+				    ? ServicePathTable.numBuckets * 2
+				    : (size_t)64;
+	service_path_entry **buckets;
+	service_path_entry *entry;
+	service_path_entry *next;
+	size_t i;
+
+	buckets = calloc(numBuckets, sizeof(service_path_entry *));
+	if (!buckets)
+		return UPNP_E_OUTOF_MEMORY;
+	for (i = 0; i < ServicePathTable.numBuckets; i++) {
+		for (entry = ServicePathTable.buckets[i]; entry; entry = next) {
+			next = entry->next;
+			entry->next = buckets[entry->hash & (numBuckets - 1)];
+			buckets[entry->hash & (numBuckets - 1)] = entry;
+		}
+	}
+	free(ServicePathTable.buckets);
+	ServicePathTable.buckets = buckets;
+	ServicePathTable.numBuckets = numBuckets;
+
+	return UPNP_E_SUCCESS;
+}
+
+/*!
+ * \brief Adds the path of a control or event URL to the path table.
+ *
+ * \return UPNP_E_SUCCESS, UPNP_E_INVALID_URL or UPNP_E_OUTOF_MEMORY.
+ */
+static int AddServicePath(UpnpDevice_Handle Hnd,
+	int AddressFamily,
+	service_info *service,
+	int rank,
+	const char *url,
+	int isEvent)
+{
+	service_path_entry *entry;
+	uri_type parsed_url;
+	size_t bucket;
+
+	if (parse_uri(url, strlen(url), &parsed_url) != HTTP_SUCCESS)
+		return UPNP_E_INVALID_URL;
+	if (ServicePathTable.count >= ServicePathTable.numBuckets &&
+		GrowServicePathTable() != UPNP_E_SUCCESS)
+		return UPNP_E_OUTOF_MEMORY;
+	entry = malloc(sizeof(service_path_entry) + parsed_url.pathquery.size);
+	if (!entry)
+		return UPNP_E_OUTOF_MEMORY;
+	entry->len = parsed_url.pathquery.size;
+	memcpy(entry->path, parsed_url.pathquery.buff, entry->len);
+	entry->hash = HashServicePath(entry->path, entry->len);
+	entry->AddressFamily = AddressFamily;
+	entry->Hnd = Hnd;
+	entry->isEvent = isEvent;
+	entry->rank = rank;
+	entry->service = service;
+	bucket = entry->hash & (ServicePathTable.numBuckets - 1);
+	entry->next = ServicePathTable.buckets[bucket];
+	ServicePathTable.buckets[bucket] = entry;
+	ServicePathTable.count++;
+
+	return UPNP_E_SUCCESS;
+}
+
+int AddServicePaths(UpnpDevice_Handle Hnd, struct Handle_Info *HInfo)
+{
+	service_info *service;
+	int rank = 0;
+	int ret = UPNP_E_SUCCESS;
+
+	for (service = HInfo->ServiceTable.serviceList; service;
+		service = service->next, rank++) {
+		if (service->controlURL &&
+			AddServicePath(Hnd,
+				HInfo->DeviceAf,
+				service,
+				rank,
+				service->controlURL,
+				0) == UPNP_E_OUTOF_MEMORY)
+			ret = UPNP_E_OUTOF_MEMORY;
+		if (service->eventURL &&
+			AddServicePath(Hnd,
+				HInfo->DeviceAf,
+				service,
+				rank,
+				service->eventURL,
+				1) == UPNP_E_OUTOF_MEMORY)
+			ret = UPNP_E_OUTOF_MEMORY;
+	}
+	if (ret != UPNP_E_SUCCESS) {
+		UpnpPrintf(UPNP_CRITICAL,
+			API,
+			__FILE__,
+			__LINE__,
+			"AddServicePaths: out of memory, using linear "
+			"lookups\n");
+		ServicePathTable.incomplete = 1;
+	}
+
+	return ret;
+}
+
+void RemoveServicePaths(UpnpDevice_Handle Hnd)
+{
+	service_path_entry **prev;
+	service_path_entry *entry;
+	size_t i;
+
+	for (i = 0; i < ServicePathTable.numBuckets; i++) {
+		prev = &ServicePathTable.buckets[i];
+		while ((entry = *prev) != NULL) {
+			if (entry->Hnd == Hnd) {
+				*prev = entry->next;
+				free(entry);
+				ServicePathTable.count--;
+			} else {
+				prev = &entry->next;
+			}
+		}
+	}
+	if (ServicePathTable.count == 0) {
+		free(ServicePathTable.buckets);
+		ServicePathTable.buckets = NULL;
+		ServicePathTable.numBuckets = 0;
+		ServicePathTable.incomplete = 0;
+	}
+}
+#endif /* INCLUDE_DEVICE_APIS */
+
 Upnp_Handle_Type GetDeviceHandleInfoForPath(const char *path,
 	int AddressFamily,
 	UpnpDevice_Handle *device_handle_out,
@@ -4187,6 +4651,11 @@ Upnp_Handle_Type GetDeviceHandleInfoForPath(const char *path,
 	service_info **serv_info)
 {
 #ifdef INCLUDE_DEVICE_APIS
+	service_path_entry *entry;
+	service_path_entry *found = NULL;
+	uri_type parsed_url;
+	unsigned long hash;
+
 	/* Check if we've got a registered device of the address family
 	 * specified. */
 	if ((AddressFamily == AF_INET && UpnpSdkDeviceRegisteredV4 == 0) ||
@@ -4194,6 +4663,40 @@ Upnp_Handle_Type GetDeviceHandleInfoForPath(const char *path,
 		*device_handle_out = -1;
 		return HND_INVALID;
 	}
+	if (!ServicePathTable.incomplete) {
+		if (!path || !ServicePathTable.numBuckets ||
+			parse_uri(path, strlen(path), &parsed_url) !=
+				HTTP_SUCCESS) {
+			*device_handle_out = -1;
+			return HND_INVALID;
+		}
+		hash = HashServicePath(
+			parsed_url.pathquery.buff, parsed_url.pathquery.size);
+		/* the order of the bucket does not matter */
+		for (entry = ServicePathTable
+				     .buckets[hash &
+					      (ServicePathTable.numBuckets - 1)];
+			entry;
+			entry = entry->next) {
+			if (entry->hash != hash ||
+				entry->AddressFamily != AddressFamily ||
+				entry->len != parsed_url.pathquery.size ||
+				memcmp(entry->path,
+					parsed_url.pathquery.buff,
+					entry->len) != 0)
+				continue;
+			if (!found || ServicePathBefore(entry, found))
+				found = entry;
+		}
+		if (found &&
+			GetHandleInfo(found->Hnd, HndInfo) == HND_DEVICE) {
+			*device_handle_out = found->Hnd;
+			*serv_info = found->service;
+			return HND_DEVICE;
+		}
+		*device_handle_out = -1;
+		return HND_INVALID;
+	}
 	/* Find it. */
 	for (*device_handle_out = 1; *device_handle_out < NUM_HANDLE;
 		(*device_handle_out)++) {
@@ -4319,14 +4822,29 @@ int UpnpSetWebServerRootDir(const char *rootDir)
 
 	return web_server_set_root_dir(rootDir);
 }
+
+int UpnpSetWebServerCache(size_t cacheSize, size_t maxFileSize)
+{
+	if (UpnpSdkInit == 0)
+		return UPNP_E_FINISH;
+	web_cache_set_limits(cacheSize, maxFileSize);
+
+	return UPNP_E_SUCCESS;
+}
+
+int UpnpSetWebServerRateLimit(size_t connectionRate, size_t totalRate)
+{
+	if (UpnpSdkInit == 0)
+		return UPNP_E_FINISH;
+	web_rate_set(connectionRate, totalRate);
+
+	return UPNP_E_SUCCESS;
+}
 #endif /* INTERNAL_WEB_SERVER */
 
 int UpnpAddVirtualDir(
 	const char *newDirName, const void *cookie, const void **oldcookie)
 {
-	virtualDirList *pNewVirtualDir;
-	virtualDirList *pLast;
-	virtualDirList *pCurVirtualDir;
 	char dirName[NAME_SIZE];
 
 	memset(dirName, 0, sizeof(dirName));
@@ -4350,52 +4868,11 @@ int UpnpAddVirtualDir(
 		strncpy(dirName, newDirName, sizeof(dirName) - 1);
 	}
 
-	pCurVirtualDir = pVirtualDirList;
-	while (pCurVirtualDir != NULL) {
-		/* already has this entry */
-		if (strcmp(pCurVirtualDir->dirName, dirName) == 0) {
-			if (oldcookie != NULL)
-				*oldcookie = pCurVirtualDir->cookie;
-			pCurVirtualDir->cookie = cookie;
-			return UPNP_E_SUCCESS;
-		}
-
-		pCurVirtualDir = pCurVirtualDir->next;
-	}
-
-	pNewVirtualDir = (virtualDirList *)malloc(sizeof(virtualDirList));
-	if (pNewVirtualDir == NULL) {
-		return UPNP_E_OUTOF_MEMORY;
-	}
-	pNewVirtualDir->next = NULL;
-	if (oldcookie != NULL)
-		*oldcookie = NULL;
-	pNewVirtualDir->cookie = cookie;
-	memset(pNewVirtualDir->dirName, 0, sizeof(pNewVirtualDir->dirName));
-	strncpy(pNewVirtualDir->dirName,
-		dirName,
-		sizeof(pNewVirtualDir->dirName) - 1);
-	*(pNewVirtualDir->dirName + strlen(dirName)) = 0;
-
-	if (pVirtualDirList == NULL) { /* first virtual dir */
-		pVirtualDirList = pNewVirtualDir;
-	} else {
-		pLast = pVirtualDirList;
-		while (pLast->next != NULL) {
-			pLast = pLast->next;
-		}
-		pLast->next = pNewVirtualDir;
-	}
-
-	return UPNP_E_SUCCESS;
+	return web_vdir_add(dirName, cookie, oldcookie);
 }
 
 int UpnpRemoveVirtualDir(const char *dirName)
 {
-	virtualDirList *pPrev;
-	virtualDirList *pCur;
-	int found = 0;
-
 	if (UpnpSdkInit != 1) {
 		return UPNP_E_FINISH;
 	}
@@ -4404,58 +4881,16 @@ int UpnpRemoveVirtualDir(const char *dirName)
 		return UPNP_E_INVALID_PARAM;
 	}
 
-	if (pVirtualDirList == NULL) {
-		return UPNP_E_INVALID_PARAM;
-	}
-	/* Handle the special case where the directory that we are */
-	/* removing is the first in the list. */
-	if (strcmp(pVirtualDirList->dirName, dirName) == 0) {
-		pPrev = pVirtualDirList;
-		pVirtualDirList = pVirtualDirList->next;
-		free(pPrev);
-		return UPNP_E_SUCCESS;
-	}
-
-	pCur = pVirtualDirList->next;
-	pPrev = pVirtualDirList;
-
-	while (pCur != NULL) {
-		if (strcmp(pCur->dirName, dirName) == 0) {
-			pPrev->next = pCur->next;
-			free(pCur);
-			found = 1;
-			break;
-		} else {
-			pPrev = pCur;
-			pCur = pCur->next;
-		}
-	}
-
-	if (found == 1)
-		return UPNP_E_SUCCESS;
-	else
-		return UPNP_E_INVALID_PARAM;
+	return web_vdir_remove(dirName);
 }
 
 void UpnpRemoveAllVirtualDirs(void)
 {
-	virtualDirList *pCur;
-	virtualDirList *pNext;
-
 	if (UpnpSdkInit != 1) {
 		return;
 	}
 
-	pCur = pVirtualDirList;
-
-	while (pCur != NULL) {
-		pNext = pCur->next;
-		free(pCur);
-
-		pCur = pNext;
-	}
-
-	pVirtualDirList = NULL;
+	web_vdir_remove_all();
 }
 
 int UpnpEnableWebserver(int enable)
@@ -4581,6 +5016,81 @@ int UpnpVirtualDir_set_CloseCallback(VDCallback_Close callback)
 	return ret;
 }
 
+int UpnpVirtualDir_set_OpenStreamCallback(VDCallback_OpenStream callback)
+{
+	int ret = UPNP_E_SUCCESS;
+	if (!callback) {
+		ret = UPNP_E_INVALID_PARAM;
+	} else {
+		virtualDirCallback.open_stream = callback;
+	}
+
+	return ret;
+}
+
+int UpnpVirtualDir_set_StreamEventCallback(VDCallback_StreamEvent callback)
+{
+	int ret = UPNP_E_SUCCESS;
+	if (!callback) {
+		ret = UPNP_E_INVALID_PARAM;
+	} else {
+		virtualDirCallback.stream_event = callback;
+	}
+
+	return ret;
+}
+
+int UpnpWebStream_Write(UpnpWebStream *stream, const char *buf, size_t buflen)
+{
+#ifdef INTERNAL_WEB_SERVER
+	if (!stream || (!buf && buflen)) {
+		return UPNP_E_INVALID_PARAM;
+	}
+
+	return web_stream_write(stream, buf, buflen);
+#else  /* INTERNAL_WEB_SERVER */
+	(void)stream;
+	(void)buf;
+	(void)buflen;
+
+	return UPNP_E_NO_WEB_SERVER;
+#endif /* INTERNAL_WEB_SERVER */
+}
+
+int UpnpWebStream_WriteFile(
+	UpnpWebStream *stream, int fd, off_t offset, size_t length)
+{
+#ifdef INTERNAL_WEB_SERVER
+	if (!stream || fd < 0 || offset < 0) {
+		return UPNP_E_INVALID_PARAM;
+	}
+
+	return web_stream_write_file(stream, fd, offset, length);
+#else  /* INTERNAL_WEB_SERVER */
+	(void)stream;
+	(void)fd;
+	(void)offset;
+	(void)length;
+
+	return UPNP_E_NO_WEB_SERVER;
+#endif /* INTERNAL_WEB_SERVER */
+}
+
+int UpnpWebStream_Close(UpnpWebStream *stream)
+{
+#ifdef INTERNAL_WEB_SERVER
+	if (!stream) {
+		return UPNP_E_INVALID_PARAM;
+	}
+
+	return web_stream_close(stream);
+#else  /* INTERNAL_WEB_SERVER */
+	(void)stream;
+
+	return UPNP_E_NO_WEB_SERVER;
+#endif /* INTERNAL_WEB_SERVER */
+}
+
 int UpnpSetContentLength(UpnpClient_Handle Hnd, size_t contentLength)
 {
 	int errCode = UPNP_E_SUCCESS;
@@ -4627,6 +5137,78 @@ int UpnpSetMaxContentLength(size_t contentLength)
 	return errCode;
 }
 
+int UpnpSetLoadBudget(Upnp_LoadClass loadClass, int budget)
+{
+	return load_set_budget(loadClass, budget);
+}
+
+int UpnpGetLoadStats(Upnp_LoadClass loadClass, Upnp_LoadStats *stats)
+{
+	return load_get_stats(loadClass, stats);
+}
+
+int UpnpGetJobLatency(Upnp_Threads pool,
+	int priority,
+	Upnp_JobType type,
+	Upnp_Latency *latency)
+{
+	ThreadPool *tp;
+	ThreadPoolHistogram *wait = NULL;
+	ThreadPoolHistogram *run = NULL;
+	int retVal = UPNP_E_SUCCESS;
+
+	if (UpnpSdkInit != 1)
+		return UPNP_E_FINISH;
+	switch (pool) {
+	case UPNP_THREADS_SEND_POOL:
+		tp = &gSendThreadPool;
+		break;
+	case UPNP_THREADS_RECV_POOL:
+		tp = &gRecvThreadPool;
+		break;
+	case UPNP_THREADS_MINISERVER_POOL:
+		tp = &gMiniServerThreadPool;
+		break;
+#if EXCLUDE_WEB_SERVER == 0
+	case UPNP_THREADS_STREAM_POOL:
+		tp = &gStreamThreadPool;
+		break;
+#endif /* EXCLUDE_WEB_SERVER */
+	default:
+		return UPNP_E_INVALID_PARAM;
+	}
+	if (!latency)
+		return UPNP_E_INVALID_PARAM;
+	/* too large for the stack of the small threads */
+	wait = (ThreadPoolHistogram *)malloc(sizeof(*wait));
+	run = (ThreadPoolHistogram *)malloc(sizeof(*run));
+	if (!wait || !run) {
+		retVal = UPNP_E_OUTOF_MEMORY;
+		goto exit_function;
+	}
+	if (ThreadPoolGetLatency(tp, priority, (int)type, wait, run) != 0) {
+		retVal = UPNP_E_INVALID_PARAM;
+		goto exit_function;
+	}
+	latency->count = TPHistogramCount(run);
+	latency->waitP50 = TPHistogramValueAt(wait, 0.5);
+	latency->waitP90 = TPHistogramValueAt(wait, 0.9);
+	latency->waitP99 = TPHistogramValueAt(wait, 0.99);
+	latency->waitP999 = TPHistogramValueAt(wait, 0.999);
+	latency->waitMax = wait->max;
+	latency->runP50 = TPHistogramValueAt(run, 0.5);
+	latency->runP90 = TPHistogramValueAt(run, 0.9);
+	latency->runP99 = TPHistogramValueAt(run, 0.99);
+	latency->runP999 = TPHistogramValueAt(run, 0.999);
+	latency->runMax = run->max;
+
+exit_function:
+	free(wait);
+	free(run);
+
+	return retVal;
+}
+
 int UpnpSetEventQueueLimits(int maxLen, int maxAge)
 {
 	g_UpnpSdkEQMaxLen = maxLen;
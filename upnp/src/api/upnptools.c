@@ -98,6 +98,7 @@ struct ErrorString ErrorMessages[] = {
 	{UPNP_E_SOCKET_ERROR, "UPNP_E_SOCKET_ERROR"},
 	{UPNP_E_FILE_WRITE_ERROR, "UPNP_E_FILE_WRITE_ERROR"},
 	{UPNP_E_CANCELED, "UPNP_E_CANCELED"},
+	{UPNP_E_WOULD_BLOCK, "UPNP_E_WOULD_BLOCK"},
 	{UPNP_E_EVENT_PROTOCOL, "UPNP_E_EVENT_PROTOCOL"},
 	{UPNP_E_SUBSCRIBE_UNACCEPTED, "UPNP_E_SUBSCRIBE_UNACCEPTED"},
 	{UPNP_E_UNSUBSCRIBE_UNACCEPTED, "UPNP_E_UNSUBSCRIBE_UNACCEPTED"},
@@ -78,6 +78,7 @@ int genaUnregisterDevice(
 			device_handle);
 		ret = GENA_E_BAD_HANDLE;
 	} else {
+		RemoveServicePaths(device_handle);
 		freeServiceTable(&handle_info->ServiceTable);
 		ret = UPNP_E_SUCCESS;
 	}
@@ -413,6 +414,26 @@ static void genaNotifyThread(
 	HandleUnlock();
 }
 
+/*!
+ * \brief Gives a notify job the deadline after which maybeDiscardEvents()
+ * would discard its event.
+ *
+ * The job is still run after it, since the subscriber expects the event keys
+ * in a row, but the pool counts it as a deadline miss.
+ */
+static void setNotifyDeadline(
+	/*! [in,out] Notify job. */
+	ThreadPoolJob *job,
+	/*! [in] Time the event was queued. */
+	time_t ctime)
+{
+	struct timeval deadline;
+
+	deadline.tv_sec = ctime + g_UpnpSdkEQMaxAge;
+	deadline.tv_usec = 0;
+	TPJobSetDeadline(job, &deadline, NULL);
+}
+
 /*!
  * \brief Allocates the GENA header.
  *
@@ -613,6 +634,8 @@ static int genaInitNotifyCommon(UpnpDevice_Handle device_handle,
 		TPJobInit(job, (start_routine)genaNotifyThread, thread_struct);
 		TPJobSetFreeFunction(job, (free_routine)free_notify_struct);
 		TPJobSetPriority(job, MED_PRIORITY);
+		TPJobSetType(job, UPNP_JOB_GENA_NOTIFY);
+		setNotifyDeadline(job, thread_struct->ctime);
 
 		ret = ThreadPoolAdd(&gSendThreadPool, job, NULL);
 		if (ret != 0) {
@@ -904,6 +927,8 @@ static int genaNotifyAllCommon(UpnpDevice_Handle device_handle,
 				TPJobSetFreeFunction(
 					job, (free_routine)free_notify_struct);
 				TPJobSetPriority(job, MED_PRIORITY);
+				TPJobSetType(job, UPNP_JOB_GENA_NOTIFY);
+				setNotifyDeadline(job, thread_s->ctime);
 				node = ListAddTail(&finger->outgoing, job);
 
 				/* If there is only one element on the list
@@ -0,0 +1,119 @@
+/*!
+ * \file
+ *
+ * \brief Admission of the jobs of the SDK under load.
+ *
+ * The counters of a class are updated with atomic operations only: a job is
+ * counted in progress before its budget is checked, and uncounted if it
+ * went over, so that the budget is never exceeded for long.
+ */
+
+#include "config.h"
+
+#include "loadshed.h"
+
+#include "Atomic.h"
+#include "ithread.h"
+
+#include <string.h>
+
+/*! Number of classes of jobs. */
+#define LOAD_CLASSES (UPNP_LOAD_SEARCH_REPLY + 1)
+
+/*! Budget and counters of a class of jobs. */
+typedef struct
+{
+	/*! Maximum number of jobs in progress, 0 if not limited. */
+	int budget;
+	/*! Jobs in progress. */
+	int jobs;
+	/*! Jobs admitted. */
+	int admitted;
+	/*! Jobs shed because the budget was spent. */
+	int shedBudget;
+	/*! Jobs shed because the thread pool was full. */
+	int shedPool;
+	/*! Jobs shed as duplicates. */
+	int shedDuplicate;
+} load_class;
+
+/*! Classes of jobs, indexed by Upnp_LoadClass. */
+static load_class gLoad[LOAD_CLASSES] = {
+	{LOAD_BUDGET_HTTP, 0, 0, 0, 0, 0},
+	{LOAD_BUDGET_SSDP, 0, 0, 0, 0, 0},
+	{LOAD_BUDGET_SEARCH_REPLY, 0, 0, 0, 0, 0}};
+
+int load_admit(Upnp_LoadClass loadClass)
+{
+	load_class *c = &gLoad[loadClass];
+	int budget = ithread_atomic_load(&c->budget);
+
+	if (ithread_atomic_add(&c->jobs, 1) > budget && budget > 0) {
+		ithread_atomic_add(&c->jobs, -1);
+		ithread_atomic_add(&c->shedBudget, 1);
+		return 0;
+	}
+	ithread_atomic_add(&c->admitted, 1);
+
+	return 1;
+}
+
+void load_done(Upnp_LoadClass loadClass)
+{
+	ithread_atomic_add(&gLoad[loadClass].jobs, -1);
+}
+
+void load_shed_pool(Upnp_LoadClass loadClass)
+{
+	load_class *c = &gLoad[loadClass];
+
+	ithread_atomic_add(&c->jobs, -1);
+	ithread_atomic_add(&c->admitted, -1);
+	ithread_atomic_add(&c->shedPool, 1);
+}
+
+int load_pressure(Upnp_LoadClass loadClass)
+{
+	load_class *c = &gLoad[loadClass];
+	int budget = ithread_atomic_load(&c->budget);
+
+	return budget > 0 && 2 * ithread_atomic_load(&c->jobs) >= budget;
+}
+
+void load_shed_duplicate(Upnp_LoadClass loadClass)
+{
+	load_class *c = &gLoad[loadClass];
+
+	ithread_atomic_add(&c->jobs, -1);
+	ithread_atomic_add(&c->admitted, -1);
+	ithread_atomic_add(&c->shedDuplicate, 1);
+}
+
+int load_set_budget(Upnp_LoadClass loadClass, int budget)
+{
+	if ((int)loadClass < 0 || (int)loadClass >= LOAD_CLASSES ||
+		budget < 0)
+		return UPNP_E_INVALID_PARAM;
+	ithread_atomic_store(&gLoad[loadClass].budget, budget);
+
+	return UPNP_E_SUCCESS;
+}
+
+int load_get_stats(Upnp_LoadClass loadClass, Upnp_LoadStats *stats)
+{
+	load_class *c;
+
+	if ((int)loadClass < 0 || (int)loadClass >= LOAD_CLASSES || !stats)
+		return UPNP_E_INVALID_PARAM;
+	c = &gLoad[loadClass];
+	memset(stats, 0, sizeof(*stats));
+	stats->jobs = ithread_atomic_load(&c->jobs);
+	stats->budget = ithread_atomic_load(&c->budget);
+	stats->admitted = (unsigned int)ithread_atomic_load(&c->admitted);
+	stats->shedBudget = (unsigned int)ithread_atomic_load(&c->shedBudget);
+	stats->shedPool = (unsigned int)ithread_atomic_load(&c->shedPool);
+	stats->shedDuplicate =
+		(unsigned int)ithread_atomic_load(&c->shedDuplicate);
+
+	return UPNP_E_SUCCESS;
+}
@@ -52,11 +52,15 @@
 	#include "ThreadPool.h"
 	#include "httpreadwrite.h"
 	#include "ithread.h"
+	#include "loadshed.h"
 	#include "ssdplib.h"
 	#include "statcodes.h"
 	#include "unixutil.h" /* for socklen_t, EAFNOSUPPORT */
 	#include "upnpapi.h"
 	#include "upnputil.h"
+	#ifdef INTERNAL_WEB_SERVER
+		#include "webstream.h"
+	#endif
 
 	#include <assert.h>
 	#include <errno.h>
@@ -64,6 +68,7 @@
 	#include <stdlib.h>
 	#include <string.h>
 	#include <sys/types.h>
+	#include <time.h>
 
 	/*! . */
 	#define APPLICATION_LISTENING_PORT 49152
@@ -76,6 +81,24 @@ struct mserv_request_t
 	struct sockaddr_storage foreign_sockaddr;
 };
 
+	#ifdef INTERNAL_WEB_SERVER
+/*! Connection answered 503 Service Unavailable and closing. */
+struct mserv_busy_t
+{
+	/*! Connection handle. */
+	SOCKET connfd;
+	/*! Time the connection is closed at if the client did not close it. */
+	time_t expires;
+};
+
+/*! Connections answered 503 and closing, only used by the miniserver
+ * thread. */
+static struct mserv_busy_t gBusySocks[HTTP_BUSY_SOCKETS];
+
+/*! Number of connections in gBusySocks. */
+static int gBusyCount = 0;
+	#endif /* INTERNAL_WEB_SERVER */
+
 /*! . */
 typedef enum
 {
@@ -90,6 +113,9 @@ typedef enum
 /*! . */
 uint16_t miniStopSockPort;
 
+/*! Socket sending the wake up datagrams to the stop socket. */
+static SOCKET gMServWakeSock = INVALID_SOCKET;
+
 /*!
  * module vars
  */
@@ -248,6 +274,7 @@ static int dispatch_request(
 	case SOAPMETHOD_POST:
 	case HTTPMETHOD_MPOST:
 		callback = gSoapCallback;
+		ThreadPoolSetJobType(&gMiniServerThreadPool, UPNP_JOB_SOAP);
 		UpnpPrintf(UPNP_INFO,
 			MSERV,
 			__FILE__,
@@ -260,6 +287,10 @@ static int dispatch_request(
 	case HTTPMETHOD_SUBSCRIBE:
 	case HTTPMETHOD_UNSUBSCRIBE:
 		callback = gGenaCallback;
+		ThreadPoolSetJobType(&gMiniServerThreadPool,
+			hparser->msg.method == HTTPMETHOD_NOTIFY
+				? UPNP_JOB_GENA_NOTIFY
+				: UPNP_JOB_GENA_SUBSCRIBE);
 		UpnpPrintf(UPNP_INFO,
 			MSERV,
 			__FILE__,
@@ -273,6 +304,7 @@ static int dispatch_request(
 	case HTTPMETHOD_HEAD:
 	case HTTPMETHOD_SIMPLEGET:
 		callback = gGetCallback;
+		ThreadPoolSetJobType(&gMiniServerThreadPool, UPNP_JOB_HTTP_GET);
 		host_validate_callback = gWebCallback_HostValidate;
 		cookie = gWebCallback_HostValidateCookie;
 		UpnpPrintf(UPNP_INFO,
@@ -379,6 +411,7 @@ static void free_handle_request_arg(
 
 	sock_close(request->connfd);
 	free(request);
+	load_done(UPNP_LOAD_HTTP);
 }
 
 /*!
@@ -412,6 +445,7 @@ static void handle_request(
 	if (ret_code != UPNP_E_SUCCESS) {
 		free(request);
 		httpmsg_destroy(hmsg);
+		load_done(UPNP_LOAD_HTTP);
 		return;
 	}
 	/* read */
@@ -444,6 +478,7 @@ error_handler:
 	sock_destroy(&info, SD_BOTH);
 	httpmsg_destroy(hmsg);
 	free(request);
+	load_done(UPNP_LOAD_HTTP);
 
 	UpnpPrintf(UPNP_INFO,
 		MSERV,
@@ -453,6 +488,86 @@ error_handler:
 		connfd);
 }
 
+/*!
+ * \brief Answers a connection shed with 503 Service Unavailable.
+ *
+ * The connection is then half closed and read until the client closes it or
+ * HTTP_BUSY_LINGER seconds elapse, since closing a socket with unread data
+ * resets the connection, and the response with it.
+ */
+static void busy_reply(
+	/*! [in] Socket Descriptor on which connection is accepted. */
+	SOCKET connfd,
+	/*! [in] Clients Address information. */
+	struct sockaddr *clientAddr)
+{
+	SOCKINFO info;
+
+	sock_init_with_ip(&info, connfd, clientAddr);
+	/* The miniserver thread never waits on a client: the response goes
+	 * in the send buffer of the fresh socket, or is dropped. */
+	if (sock_make_no_blocking(connfd) != 0 ||
+		http_SendBusyResponse(&info, 1, 1) != 0 ||
+		gBusyCount == HTTP_BUSY_SOCKETS) {
+		sock_destroy(&info, SD_BOTH);
+		return;
+	}
+	shutdown(connfd, SD_SEND);
+	gBusySocks[gBusyCount].connfd = connfd;
+	gBusySocks[gBusyCount].expires = time(NULL) + HTTP_BUSY_LINGER;
+	gBusyCount++;
+}
+
+/*!
+ * \brief Adds the connections answered 503 to the read set of select().
+ *
+ * \return The timeout of select() in milliseconds, a second if there is a
+ * connection to close in time, or -1 if there is none.
+ */
+static int busy_fdset(
+	/*! [in,out] Read set. */
+	fd_set *rdSet,
+	/*! [in,out] Highest socket number plus one. */
+	SOCKET *nfds)
+{
+	int i;
+
+	for (i = 0; i < gBusyCount; i++) {
+		FD_SET(gBusySocks[i].connfd, rdSet);
+		if (gBusySocks[i].connfd >= *nfds)
+			*nfds = gBusySocks[i].connfd + 1;
+	}
+
+	return gBusyCount ? 1000 : -1;
+}
+
+/*!
+ * \brief Drains the connections answered 503, and closes those the client
+ * closed, those in error and those whose time is up.
+ */
+static void busy_process(
+	/*! [in] Read set returned by select(), NULL to close them all. */
+	fd_set *rdSet)
+{
+	char buf[256];
+	time_t now = time(NULL);
+	SOCKET connfd;
+	int i;
+
+	for (i = gBusyCount - 1; i >= 0; i--) {
+		connfd = gBusySocks[i].connfd;
+		if (rdSet && FD_ISSET(connfd, rdSet)) {
+			if (recv(connfd, buf, sizeof(buf), 0) > 0 &&
+				now < gBusySocks[i].expires)
+				continue;
+		} else if (rdSet && now < gBusySocks[i].expires) {
+			continue;
+		}
+		sock_close(connfd);
+		gBusySocks[i] = gBusySocks[--gBusyCount];
+	}
+}
+
 /*!
  * \brief Initilize the thread pool to handle a request, sets priority for the
  * job and adds the job to the thread pool.
@@ -468,6 +583,16 @@ static UPNP_INLINE void schedule_request_job(
 
 	memset(&job, 0, sizeof(job));
 
+	if (!load_admit(UPNP_LOAD_HTTP)) {
+		UpnpPrintf(UPNP_INFO,
+			MSERV,
+			__FILE__,
+			__LINE__,
+			"mserv %d: request budget spent\n",
+			connfd);
+		busy_reply(connfd, clientAddr);
+		return;
+	}
 	request = (struct mserv_request_t *)malloc(
 		sizeof(struct mserv_request_t));
 	if (request == NULL) {
@@ -477,6 +602,7 @@ static UPNP_INLINE void schedule_request_job(
 			__LINE__,
 			"mserv %d: out of memory\n",
 			connfd);
+		load_done(UPNP_LOAD_HTTP);
 		sock_close(connfd);
 		return;
 	}
@@ -496,7 +622,8 @@ static UPNP_INLINE void schedule_request_job(
 			"mserv %d: cannot schedule request\n",
 			connfd);
 		free(request);
-		sock_close(connfd);
+		load_shed_pool(UPNP_LOAD_HTTP);
+		busy_reply(connfd, clientAddr);
 		return;
 	}
 }
@@ -621,7 +748,15 @@ static void RunMiniServer(
 	char errorBuffer[ERROR_BUFFER_LEN];
 	fd_set expSet;
 	fd_set rdSet;
+	fd_set wrSet;
 	SOCKET maxMiniSock;
+	SOCKET nfds;
+	struct timeval timeout;
+	struct timeval *ptimeout;
+	#ifdef INTERNAL_WEB_SERVER
+	int streamTimeout;
+	int busyTimeout;
+	#endif /* INTERNAL_WEB_SERVER */
 	int ret = 0;
 	int stopSock = 0;
 
@@ -639,9 +774,16 @@ static void RunMiniServer(
 	#endif /* INCLUDE_CLIENT_APIS */
 	++maxMiniSock;
 
+	#ifdef INTERNAL_WEB_SERVER
+	/* the web streams need to wake the loop up */
+	gMServWakeSock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (gMServWakeSock != INVALID_SOCKET)
+		web_stream_enable(1);
+	#endif /* INTERNAL_WEB_SERVER */
 	gMServState = MSERV_RUNNING;
 	while (!stopSock) {
 		FD_ZERO(&rdSet);
+		FD_ZERO(&wrSet);
 		FD_ZERO(&expSet);
 		/* FD_SET()'s */
 		FD_SET(miniSock->miniServerStopSock, &expSet);
@@ -656,8 +798,22 @@ static void RunMiniServer(
 		fdset_if_valid(miniSock->ssdpReqSock4, &rdSet);
 		fdset_if_valid(miniSock->ssdpReqSock6, &rdSet);
 	#endif /* INCLUDE_CLIENT_APIS */
+		nfds = maxMiniSock;
+		ptimeout = NULL;
+	#ifdef INTERNAL_WEB_SERVER
+		streamTimeout = web_stream_fdset(&rdSet, &wrSet, &nfds);
+		busyTimeout = busy_fdset(&rdSet, &nfds);
+		if (busyTimeout >= 0 &&
+			(streamTimeout < 0 || busyTimeout < streamTimeout))
+			streamTimeout = busyTimeout;
+		if (streamTimeout >= 0) {
+			timeout.tv_sec = streamTimeout / 1000;
+			timeout.tv_usec = (streamTimeout % 1000) * 1000;
+			ptimeout = &timeout;
+		}
+	#endif /* INTERNAL_WEB_SERVER */
 		/* select() */
-		ret = select((int)maxMiniSock, &rdSet, NULL, &expSet, NULL);
+		ret = select((int)nfds, &rdSet, &wrSet, &expSet, ptimeout);
 		if (ret == SOCKET_ERROR && errno == EINTR) {
 			continue;
 		}
@@ -684,8 +840,18 @@ static void RunMiniServer(
 			ssdp_read(&miniSock->ssdpSock6UlaGua, &rdSet);
 			stopSock = receive_from_stopSock(
 				miniSock->miniServerStopSock, &rdSet);
+	#ifdef INTERNAL_WEB_SERVER
+			web_stream_process(&rdSet, &wrSet);
+			busy_process(&rdSet);
+	#endif /* INTERNAL_WEB_SERVER */
 		}
 	}
+	#ifdef INTERNAL_WEB_SERVER
+	web_stream_enable(0);
+	busy_process(NULL);
+	#endif /* INTERNAL_WEB_SERVER */
+	sock_close(gMServWakeSock);
+	gMServWakeSock = INVALID_SOCKET;
 	/* Close all sockets. */
 	sock_close(miniSock->miniServerSock4);
 	sock_close(miniSock->miniServerSock6);
@@ -1293,6 +1459,23 @@ int StartMiniServer(
 	return UPNP_E_SUCCESS;
 }
 
+void MiniServerWakeup(void)
+{
+	struct sockaddr_in stopAddr;
+	const char *buf = "Wake";
+
+	memset(&stopAddr, 0, sizeof(stopAddr));
+	stopAddr.sin_family = (sa_family_t)AF_INET;
+	inet_pton(AF_INET, "127.0.0.1", &stopAddr.sin_addr);
+	stopAddr.sin_port = htons(miniStopSockPort);
+	sendto(gMServWakeSock,
+		buf,
+		strlen(buf),
+		0,
+		(struct sockaddr *)&stopAddr,
+		(socklen_t)sizeof(stopAddr));
+}
+
 int StopMiniServer()
 {
 	char errorBuffer[ERROR_BUFFER_LEN];
@@ -0,0 +1,262 @@
+/*!
+ * \file
+ *
+ * \brief Content codings of HTTP responses: Accept-Encoding negotiation and
+ * gzip/deflate compression with zlib.
+ */
+
+#include "config.h"
+
+#include "httpcompress.h"
+
+#include "upnp.h"
+
+#include <string.h>
+
+#ifdef UPNP_ENABLE_ZLIB
+	#include <zlib.h>
+#endif
+
+#include "posix_overwrites.h"
+
+#ifdef UPNP_ENABLE_ZLIB
+	/*! Largest input given to zlib at once, which counts in uInt. */
+	#define HTTP_DEFLATE_CHUNK ((size_t)1 << 30)
+
+/*!
+ * \brief Parses the value of a q parameter.
+ *
+ * \return The quality in thousandths, 0 to 1000.
+ */
+static int parse_qvalue(
+	/*! [in,out] First character of the value, moved past it. */
+	const char **pp,
+	/*! [in] End of the header value. */
+	const char *end)
+{
+	const char *p = *pp;
+	int q = 0;
+	int scale = 1000;
+
+	if (p < end && *p >= '0' && *p <= '9')
+		q = (*p++ - '0') * 1000;
+	if (p < end && *p == '.') {
+		p++;
+		while (p < end && *p >= '0' && *p <= '9') {
+			scale /= 10;
+			q += (*p++ - '0') * scale;
+		}
+	}
+	*pp = p;
+
+	return q > 1000 ? 1000 : q;
+}
+#endif /* UPNP_ENABLE_ZLIB */
+
+http_coding_t http_select_coding(http_message_t *req)
+{
+#ifdef UPNP_ENABLE_ZLIB
+	memptr value;
+	const char *p;
+	const char *end;
+	const char *name;
+	size_t name_len;
+	int q;
+	int q_gzip = -1;
+	int q_deflate = -1;
+	int q_any = -1;
+
+	if (!httpmsg_find_hdr(req, HDR_ACCEPT_ENCODING, &value))
+		return HTTP_CODING_IDENTITY;
+	p = value.buf;
+	end = p + value.length;
+	while (p < end) {
+		while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+			p++;
+		name = p;
+		while (p < end && *p != ',' && *p != ';' && *p != ' ' &&
+			*p != '\t')
+			p++;
+		name_len = (size_t)(p - name);
+		q = 1000;
+		/* parameters */
+		while (p < end && *p != ',') {
+			if (*p++ != ';')
+				continue;
+			while (p < end && (*p == ' ' || *p == '\t'))
+				p++;
+			if (end - p >= 2 && (p[0] | 0x20) == 'q' &&
+				p[1] == '=') {
+				p += 2;
+				q = parse_qvalue(&p, end);
+			}
+		}
+		if ((name_len == 4 &&
+			    strncasecmp(name, "gzip", name_len) == 0) ||
+			(name_len == 6 &&
+				strncasecmp(name, "x-gzip", name_len) == 0))
+			q_gzip = q;
+		else if (name_len == 7 &&
+			 strncasecmp(name, "deflate", name_len) == 0)
+			q_deflate = q;
+		else if (name_len == 1 && *name == '*')
+			q_any = q;
+	}
+	if (q_gzip < 0)
+		q_gzip = q_any;
+	if (q_deflate < 0)
+		q_deflate = q_any;
+	if (q_gzip > 0 && q_gzip >= q_deflate)
+		return HTTP_CODING_GZIP;
+	if (q_deflate > 0)
+		return HTTP_CODING_DEFLATE;
+#else
+	(void)req;
+#endif /* UPNP_ENABLE_ZLIB */
+
+	return HTTP_CODING_IDENTITY;
+}
+
+const char *http_coding_name(http_coding_t coding)
+{
+	return coding == HTTP_CODING_GZIP ? "gzip" : "deflate";
+}
+
+int http_deflate(const char *in,
+	size_t in_len,
+	membuffer *out,
+	uint32_t *crc,
+	uint32_t *adler)
+{
+#ifdef UPNP_ENABLE_ZLIB
+	z_stream zs;
+	const unsigned char *next = (const unsigned char *)in;
+	size_t left = in_len;
+	uLong c = crc32(0L, Z_NULL, 0);
+	uLong a = adler32(0L, Z_NULL, 0);
+	uInt chunk;
+	uInt avail;
+	int flush;
+	int ret = UPNP_E_SUCCESS;
+
+	memset(&zs, 0, sizeof(zs));
+	/* negative window bits: no zlib wrapper, it is added on sending */
+	if (deflateInit2(&zs,
+		    Z_DEFAULT_COMPRESSION,
+		    Z_DEFLATED,
+		    -MAX_WBITS,
+		    8,
+		    Z_DEFAULT_STRATEGY) != Z_OK)
+		return UPNP_E_OUTOF_MEMORY;
+	do {
+		chunk = left > HTTP_DEFLATE_CHUNK ? (uInt)HTTP_DEFLATE_CHUNK
+						  : (uInt)left;
+		c = crc32(c, next, chunk);
+		a = adler32(a, next, chunk);
+		zs.next_in = (Bytef *)next;
+		zs.avail_in = chunk;
+		next += chunk;
+		left -= chunk;
+		flush = left ? Z_NO_FLUSH : Z_FINISH;
+		do {
+			if (membuffer_reserve(out,
+				    (size_t)deflateBound(&zs, zs.avail_in)) !=
+				0) {
+				ret = UPNP_E_OUTOF_MEMORY;
+				goto exit_function;
+			}
+			avail = out->capacity - out->length > HTTP_DEFLATE_CHUNK
+					? (uInt)HTTP_DEFLATE_CHUNK
+					: (uInt)(out->capacity - out->length);
+			zs.next_out = (Bytef *)out->buf + out->length;
+			zs.avail_out = avail;
+			deflate(&zs, flush);
+			membuffer_commit(out, (size_t)(avail - zs.avail_out));
+		} while (zs.avail_out == 0);
+	} while (left);
+	*crc = (uint32_t)c;
+	*adler = (uint32_t)a;
+
+exit_function:
+	deflateEnd(&zs);
+
+	return ret;
+#else
+	(void)in;
+	(void)in_len;
+	(void)out;
+	(void)crc;
+	(void)adler;
+
+	return UPNP_E_INTERNAL_ERROR;
+#endif /* UPNP_ENABLE_ZLIB */
+}
+
+size_t http_coding_header(http_coding_t coding, unsigned char *buf)
+{
+	if (coding == HTTP_CODING_GZIP) {
+		/* magic, deflate, no flags, no time, no extra flags, unknown
+		 * operating system */
+		static const unsigned char gzip_header[10] = {
+			0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff};
+
+		memcpy(buf, gzip_header, sizeof(gzip_header));
+		return sizeof(gzip_header);
+	}
+	/* zlib header: deflate with a 32K window, default level */
+	buf[0] = 0x78;
+	buf[1] = 0x9c;
+
+	return (size_t)2;
+}
+
+size_t http_coding_trailer(http_coding_t coding,
+	uint32_t crc,
+	uint32_t adler,
+	size_t in_len,
+	unsigned char *buf)
+{
+	uint32_t isize = (uint32_t)in_len;
+	int i;
+
+	if (coding == HTTP_CODING_GZIP) {
+		/* little endian CRC-32 and length modulo 2^32 */
+		for (i = 0; i < 4; i++) {
+			buf[i] = (unsigned char)(crc >> (8 * i));
+			buf[4 + i] = (unsigned char)(isize >> (8 * i));
+		}
+		return (size_t)8;
+	}
+	/* big endian Adler-32 */
+	for (i = 0; i < 4; i++)
+		buf[i] = (unsigned char)(adler >> (24 - 8 * i));
+
+	return (size_t)4;
+}
+
+size_t http_coding_overhead(http_coding_t coding)
+{
+	return coding == HTTP_CODING_GZIP ? (size_t)(10 + 8) : (size_t)(2 + 4);
+}
+
+int http_compress(
+	http_coding_t coding, const char *in, size_t in_len, membuffer *out)
+{
+	unsigned char wrapper[HTTP_CODING_HEADER_SIZE];
+	size_t wrapper_len;
+	uint32_t crc;
+	uint32_t adler;
+	int ret;
+
+	wrapper_len = http_coding_header(coding, wrapper);
+	if (membuffer_append(out, wrapper, wrapper_len) != 0)
+		return UPNP_E_OUTOF_MEMORY;
+	ret = http_deflate(in, in_len, out, &crc, &adler);
+	if (ret != UPNP_E_SUCCESS)
+		return ret;
+	wrapper_len = http_coding_trailer(coding, crc, adler, in_len, wrapper);
+	if (membuffer_append(out, wrapper, wrapper_len) != 0)
+		return UPNP_E_OUTOF_MEMORY;
+
+	return UPNP_E_SUCCESS;
+}
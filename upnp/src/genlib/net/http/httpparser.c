@@ -43,6 +43,7 @@
 #include "config.h"
 
 #include "httpparser.h"
+#include "httpscan.h"
 #include "statcodes.h"
 #include "strintmap.h"
 #include "unixutil.h"
@@ -58,6 +59,10 @@
 /* entity positions */
 
 #define NUM_HTTP_METHODS 11
+/* The methods recognized in requests come first. "POST" for SOAPMETHOD_POST
+ * and "PUT" are only used by method_to_str(): a request with PUT is answered
+ * with 501, like any unsupported method. */
+#define NUM_HTTP_REQUEST_METHODS 9
 static str_int_entry Http_Method_Table[NUM_HTTP_METHODS] = {
 	{"DELETE", HTTPMETHOD_DELETE},
 	{"GET", HTTPMETHOD_GET},
@@ -71,8 +76,8 @@ static str_int_entry Http_Method_Table[NUM_HTTP_METHODS] = {
 	{"POST", SOAPMETHOD_POST},
 	{"PUT", HTTPMETHOD_PUT}};
 
-#define NUM_HTTP_HEADER_NAMES 33
-str_int_entry Http_Header_Names[NUM_HTTP_HEADER_NAMES] = {
+#define NUM_HTTP_HEADER_NAMES 35
+static str_int_entry Http_Header_Names[NUM_HTTP_HEADER_NAMES] = {
 	{"ACCEPT", HDR_ACCEPT},
 	{"ACCEPT-CHARSET", HDR_ACCEPT_CHARSET},
 	{"ACCEPT-ENCODING", HDR_ACCEPT_ENCODING},
@@ -89,6 +94,8 @@ str_int_entry Http_Header_Names[NUM_HTTP_HEADER_NAMES] = {
 	{"DATE", HDR_DATE},
 	{"EXT", HDR_EXT},
 	{"HOST", HDR_HOST},
+	{"IF-MODIFIED-SINCE", HDR_IF_MODIFIED_SINCE},
+	{"IF-NONE-MATCH", HDR_IF_NONE_MATCH},
 	{"IF-RANGE", HDR_IF_RANGE},
 	{"LOCATION", HDR_LOCATION},
 	{"MAN", HDR_MAN},
@@ -108,6 +115,95 @@ str_int_entry Http_Header_Names[NUM_HTTP_HEADER_NAMES] = {
 	{"USN", HDR_USN},
 };
 
+/*
+ * Perfect hash of the method and header names: the length and the first
+ * and last characters of every name above give a distinct slot, so a
+ * lookup is one hash and one comparison. The slot tables hold the index of
+ * the name in Http_Method_Table or Http_Header_Names, or -1. They are
+ * constant, computed from the names with http_name_hash(); a name added
+ * above goes in its slot, which must be free, and test_http_names checks
+ * that every name is found in its slot.
+ */
+#define HTTP_HEADER_SLOTS 128
+static const signed char Http_Header_Slots[HTTP_HEADER_SLOTS] = {
+	15, -1, -1, -1, -1, 25, -1, -1, 23, 6, -1, -1, -1, -1, 22, 9,
+	-1, 7, -1, 28, -1, -1, -1, 4, -1, -1, 13, 16, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, 17, -1, 29, -1, -1, -1, 26, -1, 1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 20, -1, 5,
+	-1, 21, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 27,
+	-1, -1, -1, 18, 31, 12, -1, -1, -1, -1, 30, -1, -1, 11, -1, -1,
+	19, -1, -1, 3, -1, 34, -1, -1, 24, 14, -1, -1, -1, 0, 32, -1,
+	-1, 33, -1, 10, -1, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2};
+
+#define HTTP_METHOD_SLOTS 16
+static const signed char Http_Method_Slots[HTTP_METHOD_SLOTS] = {
+	2, 4, -1, 1, 5, -1, -1, 8, 6, 3, 0, -1, -1, 7, -1, -1};
+
+/************************************************************************
+ * Function :	http_name_hash
+ *
+ * Parameters :
+ *	IN const memptr* name ;	name, at least one character long
+ *
+ * Description :	Hash used for the slot tables of the method and header
+ *	names; case insensitive.
+ *
+ * Return : size_t ;
+ ************************************************************************/
+static UPNP_INLINE size_t http_name_hash(const memptr *name)
+{
+	return (name->length << 3) + (size_t)(name->buf[0] | 0x20) * 5u +
+	       (size_t)(name->buf[name->length - 1] | 0x20) * 14u;
+}
+
+/************************************************************************
+ * Function :	http_method_lookup
+ *
+ * Parameters :
+ *	IN memptr* name ;	method name, case sensitive
+ *
+ * Description :	Finds a request method in Http_Method_Table.
+ *
+ * Return : int ;
+ *	index in Http_Method_Table - On Success
+ *	-1 - On failure
+ ************************************************************************/
+static int http_method_lookup(memptr *name)
+{
+	int index;
+
+	if (name->length == (size_t)0) {
+		return -1;
+	}
+	index = Http_Method_Slots[http_name_hash(name) &
+				  (HTTP_METHOD_SLOTS - 1)];
+	if (index < 0 || memptr_cmp(name, Http_Method_Table[index].name)) {
+		return -1;
+	}
+
+	return index;
+}
+
+int httpheader_name_to_id(const char *name, size_t name_len)
+{
+	memptr name_ptr;
+	int index;
+
+	if (name_len == (size_t)0) {
+		return HDR_UNKNOWN;
+	}
+	name_ptr.buf = (char *)name;
+	name_ptr.length = name_len;
+	index = Http_Header_Slots[http_name_hash(&name_ptr) &
+				  (HTTP_HEADER_SLOTS - 1)];
+	if (index < 0 ||
+		memptr_cmp_nocase(&name_ptr, Http_Header_Names[index].name)) {
+		return HDR_UNKNOWN;
+	}
+
+	return Http_Header_Names[index].id;
+}
+
 /***********************************************************************/
 /*************                 scanner                     *************/
 /***********************************************************************/
@@ -146,7 +242,7 @@ static UPNP_INLINE void scanner_init(scanner_t *scanner, membuffer *bufptr)
  ************************************************************************/
 static UPNP_INLINE int is_separator_char(int c)
 {
-	return strchr(" \t()<>@,;:\\\"/[]?={}", c) != 0;
+	return (http_char_class[(unsigned char)c] & HTTP_CHAR_SEPARATOR) != 0;
 }
 
 /************************************************************************
@@ -160,7 +256,7 @@ static UPNP_INLINE int is_separator_char(int c)
  ************************************************************************/
 static UPNP_INLINE int is_identifier_char(int c)
 {
-	return c >= 32 && c <= 126 && !is_separator_char(c);
+	return (http_char_class[(unsigned char)c] & HTTP_CHAR_IDENTIFIER) != 0;
 }
 
 /************************************************************************
@@ -174,7 +270,7 @@ static UPNP_INLINE int is_identifier_char(int c)
  ************************************************************************/
 static UPNP_INLINE int is_control_char(int c)
 {
-	return (c >= 0 && c <= 31) || c == 127;
+	return (http_char_class[(unsigned char)c] & HTTP_CHAR_CONTROL) != 0;
 }
 
 /************************************************************************
@@ -237,8 +333,7 @@ static parse_status_t scanner_get_token(
 		/* scan identifier */
 		token->buf = cursor++;
 		token_type = TT_IDENTIFIER;
-		while (cursor < null_terminator && is_identifier_char(*cursor))
-			cursor++;
+		cursor = (char *)httpscan_identifier(cursor, null_terminator);
 		if (!scanner->entire_msg_loaded && cursor == null_terminator)
 			/* possibly more valid chars */
 			return PARSE_INCOMPLETE;
@@ -341,46 +436,120 @@ static UPNP_INLINE char *scanner_get_str(scanner_t *scanner)
 }
 
 /************************************************************************
- * Function :	httpmsg_compare
+ * Function :	scanner_skip_text
  *
  * Parameters :
- *	void* param1 ;
- *	void* param2 ;
+ *	INOUT scanner_t* scanner ;	Scanner Object
  *
- * Description :	Compares name id in the http headers.
+ * Description :	moves the cursor over the characters that
+ *	scanner_get_token() would return as plain tokens, i.e. up to the
+ *	next CR, LF, quoted string or non US-ASCII character
  *
- * Return : int ;
+ * Return : size_t ;	number of characters skipped
  *
  * Note :
  ************************************************************************/
-static int httpmsg_compare(void *param1, void *param2)
+static UPNP_INLINE size_t scanner_skip_text(scanner_t *scanner)
 {
-	assert(param1 != NULL);
-	assert(param2 != NULL);
+	const char *start = scanner_get_str(scanner);
+	size_t length;
+
+	length = (size_t)(httpscan_text(
+				  start, scanner->msg->buf + scanner->msg->length) -
+			  start);
+	scanner->cursor += length;
 
-	return ((http_header_t *)param1)->name_id ==
-	       ((http_header_t *)param2)->name_id;
+	return length;
 }
 
+/*! alignment of the allocations of a message arena. */
+#define HTTP_ARENA_ALIGN sizeof(void *)
+
 /************************************************************************
- * Function :	httpheader_free
+ * Function :	httpmsg_alloc
  *
  * Parameters :
- *	void *msg ;
+ *	INOUT http_message_t* msg ;	HTTP Message Object
+ *	IN size_t size ;		number of bytes needed
  *
- * Description :	Free memory allocated for the http header
+ * Description :	Allocates memory from the arena of the message; it is
+ *	freed by httpmsg_destroy()
  *
- * Return : void ;
+ * Return : void* ;
+ *	aligned memory - On Success
+ *	NULL - On failure
+ *
+ * Note :
+ ************************************************************************/
+static void *httpmsg_alloc(http_message_t *msg, size_t size)
+{
+	http_arena_t *arena = &msg->arena;
+	http_arena_block *block;
+	size_t block_size;
+	void *ptr;
+
+	size = (size + HTTP_ARENA_ALIGN - 1) & ~(HTTP_ARENA_ALIGN - 1);
+	if (size > arena->avail) {
+		/* the rest of the current block is lost */
+		block_size = MAXVAL(size, HTTP_ARENA_BLOCK_SIZE);
+		block = malloc(sizeof(http_arena_block) + block_size);
+		if (block == NULL) {
+			return NULL;
+		}
+		block->next = arena->blocks;
+		arena->blocks = block;
+		arena->next = (char *)(block + 1);
+		arena->avail = block_size;
+	}
+	ptr = arena->next;
+	arena->next += size;
+	arena->avail -= size;
+
+	return ptr;
+}
+
+/************************************************************************
+ * Function :	httpmsg_strdup
+ *
+ * Parameters :
+ *	INOUT http_message_t* msg ;	HTTP Message Object
+ *	IN const char* str ;		string, not necessarily null-terminated
+ *	IN size_t str_len ;		length of the string
+ *
+ * Description :	Copies a string into the arena of the message
+ *
+ * Return : char* ;
+ *	null-terminated copy - On Success
+ *	NULL - On failure
  *
  * Note :
  ************************************************************************/
-static void httpheader_free(void *msg)
+static char *httpmsg_strdup(
+	http_message_t *msg, const char *str, size_t str_len)
+{
+	char *copy = httpmsg_alloc(msg, str_len + (size_t)1);
+
+	if (copy != NULL) {
+		memcpy(copy, str, str_len);
+		copy[str_len] = 0;
+	}
+
+	return copy;
+}
+
+void httpmsg_set_arena_storage(http_message_t *msg, void *buf, size_t size)
 {
-	http_header_t *hdr = (http_header_t *)msg;
+	size_t skip;
+
+	assert(msg->arena.blocks == NULL && msg->arena.next == NULL);
 
-	membuffer_destroy(&hdr->name_buf);
-	membuffer_destroy(&hdr->value);
-	free(hdr);
+	skip = (HTTP_ARENA_ALIGN - (size_t)buf % HTTP_ARENA_ALIGN) %
+	       HTTP_ARENA_ALIGN;
+	if (size <= skip) {
+		return;
+	}
+	msg->arena.next = (char *)buf + skip;
+	msg->arena.avail = size - skip;
 }
 
 /************************************************************************
@@ -400,7 +569,13 @@ void httpmsg_init(http_message_t *msg)
 	msg->initialized = 1;
 	msg->entity.buf = NULL;
 	msg->entity.length = (size_t)0;
-	ListInit(&msg->headers, httpmsg_compare, httpheader_free);
+	msg->headers = NULL;
+	msg->last_header = NULL;
+	memset(msg->header_index, 0, sizeof(msg->header_index));
+	msg->urlbuf = NULL;
+	msg->arena.blocks = NULL;
+	msg->arena.next = NULL;
+	msg->arena.avail = (size_t)0;
 	membuffer_init(&msg->msg);
 	membuffer_init(&msg->status_msg);
 }
@@ -419,13 +594,25 @@ void httpmsg_init(http_message_t *msg)
  ************************************************************************/
 void httpmsg_destroy(http_message_t *msg)
 {
+	http_arena_block *block;
+
 	assert(msg != NULL);
 
 	if (msg->initialized == 1) {
-		ListDestroy(&msg->headers, 1);
+		/* headers and url live in the arena */
+		while (msg->arena.blocks != NULL) {
+			block = msg->arena.blocks;
+			msg->arena.blocks = block->next;
+			free(block);
+		}
+		msg->arena.next = NULL;
+		msg->arena.avail = (size_t)0;
+		msg->headers = NULL;
+		msg->last_header = NULL;
+		memset(msg->header_index, 0, sizeof(msg->header_index));
+		msg->urlbuf = NULL;
 		membuffer_destroy(&msg->msg);
 		membuffer_destroy(&msg->status_msg);
-		free(msg->urlbuf);
 		msg->initialized = 0;
 	}
 }
@@ -450,18 +637,10 @@ http_header_t *httpmsg_find_hdr_str(
 {
 	http_header_t *header;
 
-	ListNode *node;
-
-	node = ListHead(&msg->headers);
-	while (node != NULL) {
-
-		header = (http_header_t *)node->item;
-
+	for (header = msg->headers; header != NULL; header = header->next) {
 		if (memptr_cmp_nocase(&header->name, header_name) == 0) {
 			return header;
 		}
-
-		node = ListNext(&msg->headers, node);
 	}
 	return NULL;
 }
@@ -474,7 +653,8 @@ http_header_t *httpmsg_find_hdr_str(
  *	IN int header_name_id ;	 Header Name ID to be compared with
  *	OUT memptr* value ;		 Buffer to get the ouput to.
  *
- * Description :	Finds header from a list, with the given 'name_id'.
+ * Description :	Finds header with the given 'name_id', through the
+ *	index of known headers or, for other ids, in the list of headers.
  *
  * Return : http_header_t*  - Pointer to a header on success;
  *				NULL on failure
@@ -484,16 +664,21 @@ http_header_t *httpmsg_find_hdr_str(
 http_header_t *httpmsg_find_hdr(
 	http_message_t *msg, int header_name_id, memptr *value)
 {
-	http_header_t header; /* temp header for searching */
-	ListNode *node;
 	http_header_t *data;
 
-	header.name_id = header_name_id;
-	node = ListFind(&msg->headers, NULL, &header);
-	if (node == NULL) {
+	if (header_name_id >= 0 &&
+		header_name_id < HTTP_HEADER_INDEX_SIZE) {
+		/* known header: direct lookup */
+		data = msg->header_index[header_name_id];
+	} else {
+		data = msg->headers;
+		while (data != NULL && data->name_id != header_name_id) {
+			data = data->next;
+		}
+	}
+	if (data == NULL) {
 		return NULL;
 	}
-	data = (http_header_t *)node->item;
 	if (value != NULL) {
 		value->buf = data->value.buf;
 		value->length = data->value.length;
@@ -692,6 +877,9 @@ static UPNP_INLINE parse_status_t match_raw_value(
 	raw_value->length = (size_t)0;
 
 	while (!done) {
+		if (!saw_crlf) {
+			raw_value->length += scanner_skip_text(scanner);
+		}
 		status = scanner_get_token(scanner, &token, &tok_type);
 		if (status == (parse_status_t)PARSE_OK) {
 			if (!saw_crlf) {
@@ -834,6 +1022,7 @@ static UPNP_INLINE parse_status_t read_until_crlf(
 
 	/* read until we hit a crlf */
 	do {
+		scanner_skip_text(scanner);
 		status = scanner_get_token(scanner, &token, &tok_type);
 	} while (status == (parse_status_t)PARSE_OK &&
 		 tok_type != (token_type_t)TT_CRLF);
@@ -1253,11 +1442,7 @@ static parse_status_t parser_parse_requestline(http_parser_t *parser)
 
 	if (status == (parse_status_t)PARSE_OK) {
 
-		index = map_str_to_int(method_str.buf,
-			method_str.length,
-			Http_Method_Table,
-			NUM_HTTP_METHODS,
-			1);
+		index = http_method_lookup(&method_str);
 
 		if (index < 0) {
 			/* error; method not found */
@@ -1279,7 +1464,8 @@ static parse_status_t parser_parse_requestline(http_parser_t *parser)
 			url_str.length--;
 		}
 		/* store url */
-		hmsg->urlbuf = str_alloc(url_str.buf, url_str.length);
+		hmsg->urlbuf =
+			httpmsg_strdup(hmsg, url_str.buf, url_str.length);
 		if (hmsg->urlbuf == NULL) {
 			/* out of mem */
 			parser->http_error_code = HTTP_INTERNAL_SERVER_ERROR;
@@ -1310,7 +1496,8 @@ static parse_status_t parser_parse_requestline(http_parser_t *parser)
 		url_str.length--;
 	}
 	/* store url */
-	hmsg->urlbuf = str_alloc(url_str.buf, url_str.length);
+	hmsg->urlbuf =
+		httpmsg_strdup(hmsg, url_str.buf, url_str.length);
 	if (hmsg->urlbuf == NULL) {
 		/* out of mem */
 		parser->http_error_code = HTTP_INTERNAL_SERVER_ERROR;
@@ -1321,11 +1508,7 @@ static parse_status_t parser_parse_requestline(http_parser_t *parser)
 		return PARSE_FAILURE;
 	}
 
-	index = map_str_to_int(method_str.buf,
-		method_str.length,
-		Http_Method_Table,
-		NUM_HTTP_METHODS,
-		1);
+	index = http_method_lookup(&method_str);
 	if (index < 0) {
 		/* error; method not found */
 		parser->http_error_code = HTTP_NOT_IMPLEMENTED;
@@ -1469,11 +1652,10 @@ parse_status_t parser_parse_headers(http_parser_t *parser)
 	size_t save_pos;
 	http_header_t *header;
 	int header_id;
-	int ret = 0;
-	int index;
 	http_header_t *orig_header;
 	char save_char;
-	int ret2;
+	char *value;
+	size_t value_len;
 	static char zero = 0;
 
 	assert(parser->position == (parser_pos_t)POS_HEADERS ||
@@ -1515,21 +1697,15 @@ parse_status_t parser_parse_headers(http_parser_t *parser)
 		}
 		/* add header */
 		/* find header */
-		index = map_str_to_int(token.buf,
-			token.length,
-			Http_Header_Names,
-			NUM_HTTP_HEADER_NAMES,
-			0);
-		if (index != -1) {
+		header_id = httpheader_name_to_id(token.buf, token.length);
+		if (header_id != HDR_UNKNOWN) {
 			/*Check if it is a soap header */
-			if (Http_Header_Names[index].id == HDR_SOAPACTION) {
+			if (header_id == HDR_SOAPACTION) {
 				parser->msg.method = SOAPMETHOD_POST;
 			}
-			header_id = Http_Header_Names[index].id;
 			orig_header =
 				httpmsg_find_hdr(&parser->msg, header_id, NULL);
 		} else {
-			header_id = HDR_UNKNOWN;
 			save_char = token.buf[token.length];
 			token.buf[token.length] = '\0';
 			orig_header =
@@ -1538,60 +1714,72 @@ parse_status_t parser_parse_headers(http_parser_t *parser)
 		}
 		if (orig_header == NULL) {
 			/* add new header */
-			header = (http_header_t *)malloc(sizeof(http_header_t));
+			header = httpmsg_alloc(
+				&parser->msg, sizeof(http_header_t));
 			if (header == NULL) {
 				parser->http_error_code =
 					HTTP_INTERNAL_SERVER_ERROR;
 				return PARSE_FAILURE;
 			}
-			membuffer_init(&header->name_buf);
-			membuffer_init(&header->value);
 			/* value can be 0 length */
 			if (hdr_value.length == (size_t)0) {
 				hdr_value.buf = &zero;
 				hdr_value.length = (size_t)1;
 			}
 			/* save in header in buffers */
-			if (membuffer_assign(&header->name_buf,
-				    token.buf,
-				    token.length) ||
-				membuffer_assign(&header->value,
-					hdr_value.buf,
-					hdr_value.length)) {
+			header->name.buf = httpmsg_strdup(
+				&parser->msg, token.buf, token.length);
+			header->value.buf = httpmsg_strdup(&parser->msg,
+				hdr_value.buf,
+				hdr_value.length);
+			if (header->name.buf == NULL ||
+				header->value.buf == NULL) {
 				/* not enough mem */
-				membuffer_destroy(&header->value);
-				membuffer_destroy(&header->name_buf);
-				free(header);
 				parser->http_error_code =
 					HTTP_INTERNAL_SERVER_ERROR;
 				return PARSE_FAILURE;
 			}
-			header->name.buf = header->name_buf.buf;
-			header->name.length = header->name_buf.length;
+			header->name.length = token.length;
+			header->value.length = hdr_value.length;
 			header->name_id = header_id;
-			if (!ListAddTail(&parser->msg.headers, header)) {
-				membuffer_destroy(&header->value);
-				membuffer_destroy(&header->name_buf);
-				free(header);
+			header->next = NULL;
+			if (parser->msg.last_header == NULL) {
+				parser->msg.headers = header;
+			} else {
+				parser->msg.last_header->next = header;
+			}
+			parser->msg.last_header = header;
+			if (header_id >= 0 &&
+				header_id < HTTP_HEADER_INDEX_SIZE) {
+				parser->msg.header_index[header_id] = header;
+			}
+		} else if (hdr_value.length > (size_t)0) {
+			/* append value to existing header: the old value
+			 * stays in the arena until the message is destroyed */
+			value_len = orig_header->value.length + (size_t)2 +
+				    hdr_value.length;
+			value = httpmsg_alloc(
+				&parser->msg, value_len + (size_t)1);
+			if (value == NULL) {
+				/* not enuf mem */
 				parser->http_error_code =
 					HTTP_INTERNAL_SERVER_ERROR;
 				return PARSE_FAILURE;
 			}
-		} else if (hdr_value.length > (size_t)0) {
-			/* append value to existing header */
+			memcpy(value,
+				orig_header->value.buf,
+				orig_header->value.length);
 			/* append space */
-			ret = membuffer_append_str(&orig_header->value, ", ");
+			memcpy(value + orig_header->value.length,
+				", ",
+				(size_t)2);
 			/* append continuation of header value */
-			ret2 = membuffer_append(&orig_header->value,
+			memcpy(value + orig_header->value.length + 2,
 				hdr_value.buf,
 				hdr_value.length);
-			if (ret == UPNP_E_OUTOF_MEMORY ||
-				ret2 == UPNP_E_OUTOF_MEMORY) {
-				/* not enuf mem */
-				parser->http_error_code =
-					HTTP_INTERNAL_SERVER_ERROR;
-				return PARSE_FAILURE;
-			}
+			value[value_len] = 0;
+			orig_header->value.buf = value;
+			orig_header->value.length = value_len;
 		}
 	} /* end while */
 }
@@ -2196,6 +2384,94 @@ int raw_find_str(memptr *raw_value, const char *str)
 	return (int)(ptr - raw_value->buf);
 }
 
+/************************************************************************
+ * Function: days_from_civil
+ *
+ * Parameters:
+ *	IN int year ;	year
+ *	IN int month ;	month, 1 to 12
+ *	IN int day ;	day of the month, 1 to 31
+ *
+ * Description: Number of days between 1970-01-01 and a date of the
+ *	Gregorian calendar, so that dates can be converted without timegm().
+ *
+ * Returns:
+ *	 long
+ ************************************************************************/
+static long days_from_civil(int year, int month, int day)
+{
+	long era;
+	long yoe;
+	long doy;
+
+	/* years start in March, so that the leap day is the last one */
+	if (month <= 2)
+		year--;
+	era = (year >= 0 ? year : year - 399) / 400;
+	yoe = year - era * 400;
+	doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+
+	return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+int parse_http_date(const memptr *value, time_t *date)
+{
+	static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	char buf[64];
+	char mon[4];
+	int day;
+	int month;
+	int year;
+	int hour;
+	int min;
+	int sec;
+
+	if (value->length >= sizeof(buf))
+		return -1;
+	memcpy(buf, value->buf, value->length);
+	buf[value->length] = '\0';
+	if (sscanf(buf,
+		    "%*[a-zA-Z], %d %3s %d %d:%d:%d",
+		    &day,
+		    mon,
+		    &year,
+		    &hour,
+		    &min,
+		    &sec) != 6 &&
+		sscanf(buf,
+			"%*[a-zA-Z], %d-%3s-%d %d:%d:%d",
+			&day,
+			mon,
+			&year,
+			&hour,
+			&min,
+			&sec) != 6 &&
+		sscanf(buf,
+			"%*[a-zA-Z] %3s %d %d:%d:%d %d",
+			mon,
+			&day,
+			&hour,
+			&min,
+			&sec,
+			&year) != 6)
+		return -1;
+	if (year < 100)
+		/* two digit year of RFC 850 */
+		year += year < 70 ? 2000 : 1900;
+	for (month = 0; month < 12; month++) {
+		if (strncmp(mon, &months[month * 3], (size_t)3) == 0)
+			break;
+	}
+	if (month == 12 || strlen(mon) != 3 || day < 1 || day > 31 ||
+		year < 1970 || hour > 23 || min > 59 || sec > 60 || hour < 0 ||
+		min < 0 || sec < 0)
+		return -1;
+	*date = (time_t)days_from_civil(year, month + 1, day) * 86400 +
+		hour * 3600 + min * 60 + sec;
+
+	return 0;
+}
+
 /************************************************************************
  * Function: method_to_str
  *
@@ -2222,8 +2498,6 @@ const char *method_to_str(http_method_t method)
 #ifdef DEBUG
 void print_http_headers(http_message_t *hmsg)
 {
-	ListNode *node;
-	/* NNS:	 dlist_node *node; */
 	http_header_t *header;
 
 	/* print start line */
@@ -2253,11 +2527,7 @@ void print_http_headers(http_message_t *hmsg)
 	}
 
 	/* print headers */
-	node = ListHead(&hmsg->headers);
-	/* NNS: node = dlist_first_node( &hmsg->headers ); */
-	while (node != NULL) {
-		header = (http_header_t *)node->item;
-		/* NNS: header = (http_header_t *)node->data; */
+	for (header = hmsg->headers; header != NULL; header = header->next) {
 		UpnpPrintf(UPNP_ALL,
 			HTTP,
 			__FILE__,
@@ -2267,9 +2537,6 @@ void print_http_headers(http_message_t *hmsg)
 			header->name.buf,
 			(int)header->value.length,
 			header->value.buf);
-
-		node = ListNext(&hmsg->headers, node);
-		/* NNS: node = dlist_next( &hmsg->headers, node ); */
 	}
 }
 #endif /* DEBUG */
@@ -53,12 +53,17 @@
 #include "upnp.h"
 #include "upnpapi.h"
 #include "uri.h"
+#include "webrate.h"
 #include "webserver.h"
 
 #include <assert.h>
 #include <stdarg.h>
 #include <string.h>
 
+#if HAVE_POSIX_FADVISE
+	#include <fcntl.h>
+#endif /* HAVE_POSIX_FADVISE */
+
 #include "posix_overwrites.h"
 
 #ifdef _WIN32
@@ -86,6 +91,9 @@ const int CHUNK_TAIL_SIZE = 10;
 #define CHUNK_HEADER_SIZE (size_t)10
 #define CHUNK_TAIL_SIZE (size_t)10
 
+/*! Free space kept at the end of the message buffer for a socket read. */
+#define HTTP_READ_HEADROOM (size_t)1024
+
 #ifndef UPNP_ENABLE_BLOCKING_TCP_CONNECTIONS
 
 	/* in seconds */
@@ -212,21 +220,19 @@ end_function:
 	return ret_code;
 }
 
-static void copy_msg_headers(LinkedList *msgHeaders, UpnpString *headers)
+static void copy_msg_headers(http_message_t *msg, UpnpString *headers)
 {
-	(void)msgHeaders;
+	(void)msg;
 	(void)headers;
 	return;
 /* TODO: */
 #if 0
-	ListNode *node;
 	UpnpHttpHeader *header;
 	http_header_t *msgHeader;
 	if (headers) {
 		ListInit(headers, NULL, (free_function) UpnpHttpHeader_delete);
-		node = ListHead(msgHeaders);
-		while(node) {
-			msgHeader = (http_header_t*) node->item;
+		for (msgHeader = msg->headers; msgHeader;
+			msgHeader = msgHeader->next) {
 			header = UpnpHttpHeader_new();
 			UpnpHttpHeader_strncpy_Name(
 				header,
@@ -236,7 +242,6 @@ static void copy_msg_headers(LinkedList *msgHeaders, UpnpString *headers)
 				header,
 				msgHeader->value.buf,
 				msgHeader->value.length);
-			node = ListNext(msgHeaders, node);
 		}
 	}
 #endif
@@ -339,6 +344,40 @@ SOCKET http_Connect(uri_type *destination_url, uri_type *url)
 	return connfd;
 }
 
+/*!
+ * \brief Reads from the socket straight into the free space at the end of the
+ * raw message buffer of the parser, so that received bytes are copied once.
+ *
+ * \return Number of bytes read, 0 if the peer closed the connection, or a
+ * negative error code; on UPNP_E_OUTOF_MEMORY, the HTTP error code of the
+ * parser is set.
+ */
+static int sock_read_msg(
+	/*! [in] Socket information object. */
+	SOCKINFO *info,
+	/*! [in,out] HTTP parser object. */
+	http_parser_t *parser,
+	/*! [in,out] Time out. */
+	int *timeout_secs)
+{
+	membuffer *msg = &parser->msg.msg;
+	int num_read;
+
+	if (membuffer_reserve(msg, HTTP_READ_HEADROOM) != 0) {
+		parser->http_error_code = HTTP_INTERNAL_SERVER_ERROR;
+		return UPNP_E_OUTOF_MEMORY;
+	}
+	num_read = sock_read(info,
+		msg->buf + msg->length,
+		msg->capacity - msg->length,
+		timeout_secs);
+	if (num_read > 0) {
+		membuffer_commit(msg, (size_t)num_read);
+	}
+
+	return num_read;
+}
+
 /*!
  * \brief Get the data on the socket and take actions based on the read data to
  * modify the parser objects buffer.
@@ -368,15 +407,8 @@ int http_RecvMessage(SOCKINFO *info,
 	parse_status_t status;
 	int num_read = 0;
 	int ok_on_close = 0;
-	char *buf;
-	size_t buf_len = 1024;
 
 	*http_error_code = HTTP_INTERNAL_SERVER_ERROR;
-	buf = malloc(buf_len);
-	if (!buf) {
-		ret = UPNP_E_OUTOF_MEMORY;
-		goto ExitFunction;
-	}
 	if (request_method == (http_method_t)HTTPMETHOD_UNKNOWN) {
 		parser_request_init(parser);
 	} else {
@@ -384,22 +416,10 @@ int http_RecvMessage(SOCKINFO *info,
 	}
 
 	while (1) {
-		/* Double the bet if needed */
-		/* We should have already exited the loop if the value was <= 0
-		 * so the cast is safe */
-		if ((size_t)num_read >= buf_len) {
-			free(buf);
-			buf_len = 2 * buf_len;
-			buf = malloc(buf_len);
-			if (!buf) {
-				ret = UPNP_E_OUTOF_MEMORY;
-				goto ExitFunction;
-			}
-		}
-		num_read = sock_read(info, buf, buf_len, timeout_secs);
+		num_read = sock_read_msg(info, parser, timeout_secs);
 		if (num_read > 0) {
 			/* got data */
-			status = parser_append(parser, buf, (size_t)num_read);
+			status = parser_parse(parser);
 			switch (status) {
 			case PARSE_SUCCESS:
 				UpnpPrintf(UPNP_INFO,
@@ -471,7 +491,6 @@ int http_RecvMessage(SOCKINFO *info,
 	}
 
 ExitFunction:
-	free(buf);
 	if (ret != UPNP_E_SUCCESS) {
 		UpnpPrintf(UPNP_ALL,
 			HTTP,
@@ -485,6 +504,44 @@ ExitFunction:
 	return ret;
 }
 
+void http_ReadAheadStart(
+	http_readahead *ra, int fd, off_t offset, off_t length)
+{
+	ra->fd = fd;
+	ra->next = offset;
+	ra->end = length < 0 ? (off_t)-1 : offset + length;
+#if HAVE_POSIX_FADVISE
+	/* a length of 0 means up to the end of file */
+	posix_fadvise(fd,
+		offset,
+		length < 0 ? (off_t)0 : length,
+		POSIX_FADV_SEQUENTIAL);
+#endif /* HAVE_POSIX_FADVISE */
+	http_ReadAheadAdvance(ra, offset);
+}
+
+void http_ReadAheadAdvance(http_readahead *ra, off_t pos)
+{
+#if HAVE_POSIX_FADVISE
+	off_t len;
+
+	if (ra->fd < 0)
+		return;
+	while (ra->next < pos + WEB_SERVER_READAHEAD_SIZE &&
+		(ra->end < 0 || ra->next < ra->end)) {
+		len = WEB_SERVER_READAHEAD_SIZE / 2;
+		if (ra->end >= 0 && ra->end - ra->next < len)
+			len = ra->end - ra->next;
+		/* the kernel reads it while the current part is sent */
+		posix_fadvise(ra->fd, ra->next, len, POSIX_FADV_WILLNEED);
+		ra->next += len;
+	}
+#else
+	(void)ra;
+	(void)pos;
+#endif /* HAVE_POSIX_FADVISE */
+}
+
 int http_SendMessage(SOCKINFO *info, int *TimeOut, const char *fmt, ...)
 {
 #if EXCLUDE_WEB_SERVER == 0
@@ -498,6 +555,15 @@ int http_SendMessage(SOCKINFO *info, int *TimeOut, const char *fmt, ...)
 	size_t num_read;
 	off_t amount_to_be_read = 0;
 	size_t Data_Buf_Size = WEB_SERVER_BUF_SIZE;
+	web_rate rate;
+	int shaped;
+	http_readahead ra;
+	off_t file_pos = 0;
+	off_t offset;
+	/* part of a multipart/byteranges response */
+	int part = 0;
+	char part_header[WEB_SERVER_PART_HEADER_SIZE];
+	size_t part_len;
 #endif /* EXCLUDE_WEB_SERVER */
 	va_list argp;
 	char *buf = NULL;
@@ -549,10 +615,35 @@ int http_SendMessage(SOCKINFO *info, int *TimeOut, const char *fmt, ...)
 				RetVal = UPNP_E_FILE_READ_ERROR;
 				goto ExitFunction;
 			}
+			ra.fd = -1;
+			if (!Instr || !Instr->IsVirtualFile) {
+				/* read in large blocks, without copying */
+				setvbuf(Fp, NULL, _IONBF, (size_t)0);
+			}
+			offset = Instr && Instr->IsRangeActive
+					 ? Instr->RangeOffset
+					 : (off_t)0;
+			web_rate_init(&rate);
+		Next_Part:
+			if (Instr && Instr->Ranges) {
+				/* the parts are sorted, each one is sent from
+				 * where the previous one ended */
+				offset = Instr->Ranges->Offsets[part];
+				amount_to_be_read = Instr->Ranges->Lengths[part];
+				part_len = web_server_part_header(Instr->Ranges,
+					part,
+					part_header,
+					sizeof(part_header));
+				nw = sock_write(
+					info, part_header, part_len, TimeOut);
+				if (part_len == 0 || nw <= 0 ||
+					(size_t)nw != part_len)
+					goto Cleanup_File;
+			}
 			if (Instr && Instr->IsRangeActive &&
 				Instr->IsVirtualFile) {
 				if (virtualDirCallback.seek(Fp,
-					    Instr->RangeOffset,
+					    offset - file_pos,
 					    SEEK_CUR,
 					    Instr->Cookie,
 					    Instr->RequestCookie) != 0) {
@@ -560,13 +651,23 @@ int http_SendMessage(SOCKINFO *info, int *TimeOut, const char *fmt, ...)
 					goto Cleanup_File;
 				}
 			} else if (Instr && Instr->IsRangeActive) {
-				if (fseeko(Fp, Instr->RangeOffset, SEEK_CUR) !=
+				if (fseeko(Fp, offset - file_pos, SEEK_CUR) !=
 					0) {
 					RetVal = UPNP_E_FILE_READ_ERROR;
 					goto Cleanup_File;
 				}
 			}
+			file_pos = offset;
+			if (Instr && !Instr->IsVirtualFile) {
+				http_ReadAheadStart(&ra,
+					fileno(Fp),
+					file_pos,
+					Instr->Ranges ? amount_to_be_read
+						      : Instr->ReadSendSize);
+			}
 			while (amount_to_be_read) {
+				/* shaped connections send in turn */
+				shaped = web_rate_enabled();
 				if (Instr) {
 					int nr;
 					size_t n =
@@ -574,6 +675,9 @@ int http_SendMessage(SOCKINFO *info, int *TimeOut, const char *fmt, ...)
 								(off_t)Data_Buf_Size
 							? Data_Buf_Size
 							: (size_t)amount_to_be_read;
+					if (shaped &&
+						n > WEB_SERVER_RATE_QUANTUM)
+						n = WEB_SERVER_RATE_QUANTUM;
 					if (Instr->IsVirtualFile) {
 						nr = virtualDirCallback.read(Fp,
 							file_buf,
@@ -581,11 +685,15 @@ int http_SendMessage(SOCKINFO *info, int *TimeOut, const char *fmt, ...)
 							Instr->Cookie,
 							Instr->RequestCookie);
 						num_read = (size_t)nr;
+						file_pos += (off_t)num_read;
 					} else {
 						num_read = fread(file_buf,
 							(size_t)1,
 							n,
 							Fp);
+						file_pos += (off_t)num_read;
+						http_ReadAheadAdvance(
+							&ra, file_pos);
 					}
 					amount_to_be_read -= (off_t)num_read;
 					if (Instr->ReadSendSize < 0) {
@@ -612,6 +720,8 @@ int http_SendMessage(SOCKINFO *info, int *TimeOut, const char *fmt, ...)
 					}
 					goto Cleanup_File;
 				}
+				if (shaped)
+					web_rate_wait(&rate, num_read);
 				/* Create chunk for the current buffer. */
 				if (Instr && Instr->IsChunkActive) {
 					int rc;
@@ -679,6 +789,15 @@ int http_SendMessage(SOCKINFO *info, int *TimeOut, const char *fmt, ...)
 					}
 				}
 			} /* while */
+			if (Instr && Instr->Ranges) {
+				if (++part < Instr->Ranges->Count)
+					goto Next_Part;
+				part_len = web_server_part_header(Instr->Ranges,
+					part,
+					part_header,
+					sizeof(part_header));
+				sock_write(info, part_header, part_len, TimeOut);
+			}
 		Cleanup_File:
 			if (Instr && Instr->IsVirtualFile) {
 				virtualDirCallback.close(Fp,
@@ -1113,9 +1232,7 @@ static int ReadResponseLineAndHeaders(
 {
 	parse_status_t status;
 	int num_read;
-	char buf[2 * 1024];
 	int done = 0;
-	int ret_code = 0;
 
 	/*read response line */
 	status = parser_parse_responseline(parser);
@@ -1131,17 +1248,8 @@ static int ReadResponseLineAndHeaders(
 		return status;
 	}
 	while (!done) {
-		num_read = sock_read(info, buf, sizeof(buf), timeout_secs);
+		num_read = sock_read_msg(info, parser, timeout_secs);
 		if (num_read > 0) {
-			/* append data to buffer */
-			ret_code = membuffer_append(
-				&parser->msg.msg, buf, (size_t)num_read);
-			if (ret_code != 0) {
-				/* set failure status */
-				parser->http_error_code =
-					HTTP_INTERNAL_SERVER_ERROR;
-				return PARSE_FAILURE;
-			}
 			status = parser_parse_responseline(parser);
 			switch (status) {
 			case PARSE_OK:
@@ -1174,17 +1282,8 @@ static int ReadResponseLineAndHeaders(
 		return status;
 	/*read headers */
 	while (!done) {
-		num_read = sock_read(info, buf, sizeof(buf), timeout_secs);
+		num_read = sock_read_msg(info, parser, timeout_secs);
 		if (num_read > 0) {
-			/* append data to buffer */
-			ret_code = membuffer_append(
-				&parser->msg.msg, buf, (size_t)num_read);
-			if (ret_code != 0) {
-				/* set failure status */
-				parser->http_error_code =
-					HTTP_INTERNAL_SERVER_ERROR;
-				return PARSE_FAILURE;
-			}
 			status = parser_parse_headers(parser);
 			if (status == (parse_status_t)PARSE_OK &&
 				parser->position == (parser_pos_t)POS_ENTITY)
@@ -1476,7 +1575,7 @@ int http_GetHttpResponse(void *Handle,
 	}
 
 	if (headers) {
-		copy_msg_headers(&handle->response.msg.headers, headers);
+		copy_msg_headers(&handle->response.msg, headers);
 	}
 
 errorHandler:
@@ -1655,6 +1754,38 @@ int http_SendStatusResponse(SOCKINFO *info,
 	return ret;
 }
 
+int http_SendBusyResponse(
+	SOCKINFO *info, int request_major_version, int request_minor_version)
+{
+	int response_major, response_minor;
+	membuffer membuf;
+	int ret;
+	int timeout;
+
+	http_CalcResponseVersion(request_major_version,
+		request_minor_version,
+		&response_major,
+		&response_minor);
+	membuffer_init(&membuf);
+	membuf.size_inc = (size_t)70;
+	ret = http_MakeMessage(&membuf,
+		response_major,
+		response_minor,
+		"RSCsdcB",
+		HTTP_SERVICE_UNAVAILABLE,
+		"RETRY-AFTER: ",
+		HTTP_BUSY_RETRY_AFTER,
+		HTTP_SERVICE_UNAVAILABLE);
+	if (ret == 0) {
+		timeout = HTTP_DEFAULT_TIMEOUT;
+		ret = http_SendMessage(
+			info, &timeout, "b", membuf.buf, membuf.length);
+	}
+	membuffer_destroy(&membuf);
+
+	return ret;
+}
+
 int http_MakeMessage(membuffer *buf,
 	int http_major_version,
 	int http_minor_version,
@@ -0,0 +1,264 @@
+/*!
+ * \file
+ *
+ * \brief Character classes of the HTTP tokenizer and vectorized scanning of
+ * runs of characters.
+ *
+ * The SSE2 version is used on every x86 processor that has it, the AVX2
+ * version is selected at run time when the processor supports it, and the
+ * table driven loop handles the tail of the input and other processors.
+ */
+
+#include "config.h"
+
+#include "httpscan.h"
+
+#include "UpnpGlobal.h" /* for UPNP_INLINE */
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+	(defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define HTTPSCAN_SSE2 1
+	#include <emmintrin.h>
+	#if (defined(__GNUC__) || defined(__clang__)) && \
+		(defined(__x86_64__) || defined(__i386__))
+		#define HTTPSCAN_AVX2 1
+		#include <immintrin.h>
+	#endif
+#endif
+
+#if defined(_MSC_VER)
+	#include <intrin.h>
+#endif
+
+#define S HTTP_CHAR_SEPARATOR
+#define I HTTP_CHAR_IDENTIFIER
+#define C HTTP_CHAR_CONTROL
+
+/* bytes above 127 belong to no class. */
+const unsigned char http_char_class[256] = {
+	S | C, C, C, C, C, C, C, C,
+	C, S | C, C, C, C, C, C, C,
+	C, C, C, C, C, C, C, C,
+	C, C, C, C, C, C, C, C,
+	S, I, S, I, I, I, I, I,
+	S, S, I, I, S, I, I, S,
+	I, I, I, I, I, I, I, I,
+	I, I, S, S, S, S, S, S,
+	S, I, I, I, I, I, I, I,
+	I, I, I, I, I, I, I, I,
+	I, I, I, I, I, I, I, I,
+	I, I, I, S, S, S, I, I,
+	I, I, I, I, I, I, I, I,
+	I, I, I, I, I, I, I, I,
+	I, I, I, I, I, I, I, I,
+	I, I, I, S, I, S, I, C,
+};
+
+#undef S
+#undef I
+#undef C
+
+/*! Highest level used, see httpscan_limit(). */
+static int scan_level = HTTPSCAN_LEVEL_AVX2;
+
+#ifdef HTTPSCAN_SSE2
+/*!
+ * \brief Index of the lowest bit set in a non zero mask.
+ */
+static UPNP_INLINE unsigned int lowest_bit(unsigned int mask)
+{
+	#if defined(_MSC_VER)
+	unsigned long index;
+
+	_BitScanForward(&index, mask);
+	return (unsigned int)index;
+	#else
+	return (unsigned int)__builtin_ctz(mask);
+	#endif
+}
+
+/*!
+ * \brief Marks the bytes of \b v in the range [\b lo, \b hi].
+ */
+static UPNP_INLINE __m128i sse2_in_range(__m128i v, char lo, char hi)
+{
+	__m128i d = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+
+	return _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8((char)(hi - lo))), d);
+}
+
+/*!
+ * \brief Marks the bytes of \b v that are not allowed in a token.
+ */
+static UPNP_INLINE unsigned int sse2_not_identifier(__m128i v)
+{
+	__m128i sep;
+
+	/* separators between '!' and '~' */
+	sep = _mm_or_si128(sse2_in_range(v, '(', ')'), sse2_in_range(v, ':', '@'));
+	sep = _mm_or_si128(sep, sse2_in_range(v, '[', ']'));
+	sep = _mm_or_si128(sep, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+	sep = _mm_or_si128(sep, _mm_cmpeq_epi8(v, _mm_set1_epi8(',')));
+	sep = _mm_or_si128(sep, _mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+	sep = _mm_or_si128(sep, _mm_cmpeq_epi8(v, _mm_set1_epi8('{')));
+	sep = _mm_or_si128(sep, _mm_cmpeq_epi8(v, _mm_set1_epi8('}')));
+
+	return ((unsigned int)_mm_movemask_epi8(sse2_in_range(v, '!', '~')) ^
+		       0xffffu) |
+	       (unsigned int)_mm_movemask_epi8(sep);
+}
+
+/*!
+ * \brief Marks CR, LF, '"' and the bytes outside of US-ASCII.
+ */
+static UPNP_INLINE unsigned int sse2_text_end(__m128i v)
+{
+	__m128i end;
+
+	end = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')),
+		_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+	end = _mm_or_si128(end, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+
+	return (unsigned int)_mm_movemask_epi8(_mm_or_si128(end, v));
+}
+#endif /* HTTPSCAN_SSE2 */
+
+#ifdef HTTPSCAN_AVX2
+	#define HTTPSCAN_TARGET_AVX2 __attribute__((target("avx2")))
+
+HTTPSCAN_TARGET_AVX2 static UPNP_INLINE __m256i avx2_in_range(
+	__m256i v, char lo, char hi)
+{
+	__m256i d = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+
+	return _mm256_cmpeq_epi8(
+		_mm256_min_epu8(d, _mm256_set1_epi8((char)(hi - lo))), d);
+}
+
+HTTPSCAN_TARGET_AVX2 static const char *avx2_identifier(
+	const char *p, const char *end)
+{
+	__m256i v;
+	__m256i sep;
+	unsigned int mask;
+
+	while (end - p >= 32) {
+		v = _mm256_loadu_si256((const __m256i *)p);
+		sep = _mm256_or_si256(
+			avx2_in_range(v, '(', ')'), avx2_in_range(v, ':', '@'));
+		sep = _mm256_or_si256(sep, avx2_in_range(v, '[', ']'));
+		sep = _mm256_or_si256(
+			sep, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+		sep = _mm256_or_si256(
+			sep, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')));
+		sep = _mm256_or_si256(
+			sep, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('/')));
+		sep = _mm256_or_si256(
+			sep, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('{')));
+		sep = _mm256_or_si256(
+			sep, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('}')));
+		mask = ~(unsigned int)_mm256_movemask_epi8(
+			       avx2_in_range(v, '!', '~')) |
+		       (unsigned int)_mm256_movemask_epi8(sep);
+		if (mask)
+			return p + lowest_bit(mask);
+		p += 32;
+	}
+
+	return p;
+}
+
+HTTPSCAN_TARGET_AVX2 static const char *avx2_text(
+	const char *p, const char *end)
+{
+	__m256i v;
+	__m256i stop;
+	unsigned int mask;
+
+	while (end - p >= 32) {
+		v = _mm256_loadu_si256((const __m256i *)p);
+		stop = _mm256_or_si256(
+			_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')),
+			_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+		stop = _mm256_or_si256(
+			stop, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+		mask = (unsigned int)_mm256_movemask_epi8(
+			_mm256_or_si256(stop, v));
+		if (mask)
+			return p + lowest_bit(mask);
+		p += 32;
+	}
+
+	return p;
+}
+
+/*!
+ * \brief Whether the AVX2 versions can be used.
+ */
+static UPNP_INLINE int has_avx2(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+#endif /* HTTPSCAN_AVX2 */
+
+const char *httpscan_identifier(const char *p, const char *end)
+{
+#ifdef HTTPSCAN_SSE2
+	unsigned int mask;
+
+	#ifdef HTTPSCAN_AVX2
+	if (end - p >= 32 && scan_level >= HTTPSCAN_LEVEL_AVX2 && has_avx2())
+		p = avx2_identifier(p, end);
+	#endif
+	while (end - p >= 16 && scan_level >= HTTPSCAN_LEVEL_SSE2) {
+		mask = sse2_not_identifier(_mm_loadu_si128((const __m128i *)p));
+		if (mask)
+			return p + lowest_bit(mask);
+		p += 16;
+	}
+#endif
+	while (p < end && (http_char_class[(unsigned char)*p] &
+				  HTTP_CHAR_IDENTIFIER))
+		p++;
+
+	return p;
+}
+
+const char *httpscan_text(const char *p, const char *end)
+{
+#ifdef HTTPSCAN_SSE2
+	unsigned int mask;
+
+	#ifdef HTTPSCAN_AVX2
+	if (end - p >= 32 && scan_level >= HTTPSCAN_LEVEL_AVX2 && has_avx2())
+		p = avx2_text(p, end);
+	#endif
+	while (end - p >= 16 && scan_level >= HTTPSCAN_LEVEL_SSE2) {
+		mask = sse2_text_end(_mm_loadu_si128((const __m128i *)p));
+		if (mask)
+			return p + lowest_bit(mask);
+		p += 16;
+	}
+#endif
+	while (p < end && *p != '\r' && *p != '\n' && *p != '"' &&
+		!(*p & 0x80))
+		p++;
+
+	return p;
+}
+
+int httpscan_limit(int level)
+{
+#if !defined(HTTPSCAN_SSE2)
+	level = HTTPSCAN_LEVEL_SCALAR;
+#elif defined(HTTPSCAN_AVX2)
+	if (level > HTTPSCAN_LEVEL_SSE2 && !has_avx2())
+		level = HTTPSCAN_LEVEL_SSE2;
+#else
+	if (level > HTTPSCAN_LEVEL_SSE2)
+		level = HTTPSCAN_LEVEL_SSE2;
+#endif
+	scan_level = level;
+
+	return level;
+}
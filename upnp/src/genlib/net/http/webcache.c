@@ -0,0 +1,393 @@
+/*!
+ * \file
+ *
+ * \brief In-memory cache of the small files of the web server document root.
+ *
+ * The entries are kept in a hash table keyed by path and in a list ordered
+ * from the most to the least recently used, both protected by one mutex.
+ * Each entry is a single allocation holding the path, the content type and
+ * the content; its compressed content is a second one.
+ */
+
+#include "config.h"
+
+#if EXCLUDE_WEB_SERVER == 0
+
+	#include "webcache.h"
+
+	#include "UpnpIntTypes.h"
+	#include "httpcompress.h"
+	#include "ithread.h"
+	#include "membuffer.h"
+	#include "upnp.h"
+
+	#include <stdio.h>
+	#include <string.h>
+	#include <sys/stat.h>
+
+	#include "posix_overwrites.h"
+
+	/*! Number of hash buckets, a power of 2. */
+	#define WEB_CACHE_BUCKETS 64
+
+/*! Hash table of the entries. */
+static web_cache_entry *gWebCacheBuckets[WEB_CACHE_BUCKETS];
+/*! Most recently used entry. */
+static web_cache_entry *gWebCacheHead;
+/*! Least recently used entry. */
+static web_cache_entry *gWebCacheTail;
+/*! Bytes of content, compressed or not, held by the linked entries. */
+static size_t gWebCacheBytes;
+/*! Bound of gWebCacheBytes; 0 disables the cache. */
+static size_t gWebCacheMaxBytes = WEB_SERVER_CACHE_SIZE;
+/*! Size of the largest file cached. */
+static size_t gWebCacheMaxFileSize = WEB_SERVER_CACHE_MAX_FILE_SIZE;
+/*! Whether the cache is initialized. */
+static int gWebCacheInit = 0;
+/*! Protects all the above and the reference counts; never destroyed, so
+ * that the entries still referenced can be released after
+ * web_cache_destroy(). */
+static ithread_mutex_t gWebCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*!
+ * \brief FNV-1a hash of a path.
+ */
+static size_t web_cache_hash(
+	/*! [in] NUL terminated path. */
+	const char *path)
+{
+	unsigned int h = 2166136261u;
+
+	while (*path) {
+		h ^= (unsigned char)*path++;
+		h *= 16777619u;
+	}
+
+	return (size_t)h & (WEB_CACHE_BUCKETS - 1);
+}
+
+/*!
+ * \brief Frees an entry and its compressed content.
+ */
+static void web_cache_free(
+	/*! [in] Entry. */
+	web_cache_entry *entry)
+{
+	free(entry->deflated.stream);
+	free(entry);
+}
+
+/*!
+ * \brief Drops a reference; the mutex must be held.
+ */
+static void web_cache_unref(
+	/*! [in] Entry. */
+	web_cache_entry *entry)
+{
+	if (--entry->refcount == 0)
+		web_cache_free(entry);
+}
+
+/*!
+ * \brief Removes an entry from the hash table and the list and drops the
+ * reference of the cache; the mutex must be held.
+ */
+static void web_cache_unlink(
+	/*! [in] Linked entry. */
+	web_cache_entry *entry)
+{
+	web_cache_entry **pp = &gWebCacheBuckets[web_cache_hash(entry->path)];
+
+	while (*pp != entry)
+		pp = &(*pp)->bucket_next;
+	*pp = entry->bucket_next;
+	if (entry->lru_prev)
+		entry->lru_prev->lru_next = entry->lru_next;
+	else
+		gWebCacheHead = entry->lru_next;
+	if (entry->lru_next)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		gWebCacheTail = entry->lru_prev;
+	gWebCacheBytes -= entry->length + entry->deflated.length;
+	web_cache_unref(entry);
+}
+
+/*!
+ * \brief Evicts the least recently used entries until the content fits in
+ * \b max_bytes; the mutex must be held.
+ */
+static void web_cache_trim(
+	/*! [in] Number of bytes to fit in. */
+	size_t max_bytes)
+{
+	while (gWebCacheTail && gWebCacheBytes > max_bytes)
+		web_cache_unlink(gWebCacheTail);
+}
+
+/*!
+ * \brief Finds a linked entry; the mutex must be held.
+ */
+static web_cache_entry *web_cache_find(
+	/*! [in] Path of the file. */
+	const char *path)
+{
+	web_cache_entry *entry;
+
+	for (entry = gWebCacheBuckets[web_cache_hash(path)]; entry;
+		entry = entry->bucket_next) {
+		if (strcmp(entry->path, path) == 0)
+			return entry;
+	}
+
+	return NULL;
+}
+
+int web_cache_init(void)
+{
+	ithread_mutex_lock(&gWebCacheMutex);
+	/* the table is empty, web_cache_destroy() emptied it */
+	gWebCacheInit = 1;
+	ithread_mutex_unlock(&gWebCacheMutex);
+
+	return 0;
+}
+
+void web_cache_destroy(void)
+{
+	ithread_mutex_lock(&gWebCacheMutex);
+	/* Entries still used by a request are freed by web_cache_release(). */
+	web_cache_trim(0);
+	gWebCacheInit = 0;
+	ithread_mutex_unlock(&gWebCacheMutex);
+}
+
+void web_cache_set_limits(size_t max_bytes, size_t max_file_size)
+{
+	ithread_mutex_lock(&gWebCacheMutex);
+	gWebCacheMaxBytes = max_bytes;
+	gWebCacheMaxFileSize = max_file_size;
+	web_cache_trim(max_bytes);
+	ithread_mutex_unlock(&gWebCacheMutex);
+}
+
+/*!
+ * \brief Moves a linked entry to the front of the list; the mutex must be
+ * held.
+ */
+static void web_cache_touch(
+	/*! [in] Linked entry. */
+	web_cache_entry *entry)
+{
+	if (!entry->lru_prev)
+		return;
+	entry->lru_prev->lru_next = entry->lru_next;
+	if (entry->lru_next)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		gWebCacheTail = entry->lru_prev;
+	entry->lru_prev = NULL;
+	entry->lru_next = gWebCacheHead;
+	gWebCacheHead->lru_prev = entry;
+	gWebCacheHead = entry;
+}
+
+web_cache_entry *web_cache_lookup(const char *path)
+{
+	web_cache_entry *entry;
+	struct stat s;
+
+	ithread_mutex_lock(&gWebCacheMutex);
+	entry = gWebCacheInit ? web_cache_find(path) : NULL;
+	if (entry) {
+		entry->refcount++;
+		web_cache_touch(entry);
+	}
+	ithread_mutex_unlock(&gWebCacheMutex);
+	if (!entry)
+		return NULL;
+	/* Validate outside of the lock, the entry cannot go away. */
+	if (stat(path, &s) == 0 && S_ISREG(s.st_mode) &&
+		entry->last_modified == s.st_mtime &&
+		(off_t)entry->length == s.st_size)
+		return entry;
+	/* changed on disk */
+	ithread_mutex_lock(&gWebCacheMutex);
+	if (web_cache_find(path) == entry)
+		web_cache_unlink(entry);
+	web_cache_unref(entry);
+	ithread_mutex_unlock(&gWebCacheMutex);
+
+	return NULL;
+}
+
+web_cache_entry *web_cache_load(const char *path, const char *content_type)
+{
+	web_cache_entry *entry = NULL;
+	web_cache_entry *old;
+	struct stat s;
+	size_t max_file_size;
+	size_t path_len;
+	size_t type_len;
+	size_t length;
+	size_t size;
+	size_t bucket;
+	FILE *fp;
+
+	ithread_mutex_lock(&gWebCacheMutex);
+	max_file_size = gWebCacheMaxFileSize;
+	if (max_file_size > gWebCacheMaxBytes)
+		max_file_size = gWebCacheMaxBytes;
+	if (!gWebCacheInit)
+		max_file_size = 0;
+	ithread_mutex_unlock(&gWebCacheMutex);
+	if (max_file_size == 0)
+		return NULL;
+	#ifdef _WIN32
+	fopen_s(&fp, path, "rb");
+	#else
+	fp = fopen(path, "rb");
+	#endif
+	if (!fp)
+		return NULL;
+	if (fstat(fileno(fp), &s) != 0 || !S_ISREG(s.st_mode) ||
+		s.st_size < 0 || (size_t)s.st_size > max_file_size)
+		goto error_handler;
+	length = (size_t)s.st_size;
+	path_len = strlen(path) + 1;
+	type_len = strlen(content_type) + 1;
+	entry = malloc(sizeof(*entry) + path_len + type_len + length + 1);
+	if (!entry)
+		goto error_handler;
+	entry->deflated.stream = NULL;
+	entry->path = (char *)(entry + 1);
+	memcpy(entry->path, path, path_len);
+	entry->content_type = entry->path + path_len;
+	memcpy(entry->content_type, content_type, type_len);
+	entry->content = entry->content_type + type_len;
+	if (length > 0 && fread(entry->content, 1, length, fp) != length)
+		goto error_handler;
+	entry->content[length] = '\0';
+	entry->length = length;
+	entry->last_modified = s.st_mtime;
+	web_cache_make_file_etag(entry->etag, length, entry->last_modified);
+	fclose(fp);
+	fp = NULL;
+	/* once per version of the file */
+	web_cache_deflate(
+		&entry->deflated, content_type, entry->content, length);
+	size = length + entry->deflated.length;
+
+	ithread_mutex_lock(&gWebCacheMutex);
+	/* The limits may have changed while the file was read, or the cache
+	 * been destroyed. */
+	if (!gWebCacheInit || size > gWebCacheMaxBytes ||
+		length > gWebCacheMaxFileSize) {
+		ithread_mutex_unlock(&gWebCacheMutex);
+		goto error_handler;
+	}
+	old = web_cache_find(path);
+	if (old)
+		web_cache_unlink(old);
+	web_cache_trim(gWebCacheMaxBytes - size);
+	bucket = web_cache_hash(path);
+	entry->bucket_next = gWebCacheBuckets[bucket];
+	gWebCacheBuckets[bucket] = entry;
+	entry->lru_prev = NULL;
+	entry->lru_next = gWebCacheHead;
+	if (gWebCacheHead)
+		gWebCacheHead->lru_prev = entry;
+	else
+		gWebCacheTail = entry;
+	gWebCacheHead = entry;
+	gWebCacheBytes += size;
+	/* one for the cache, one for the caller */
+	entry->refcount = 2;
+	ithread_mutex_unlock(&gWebCacheMutex);
+
+	return entry;
+
+error_handler:
+	if (fp)
+		fclose(fp);
+	if (entry)
+		web_cache_free(entry);
+
+	return NULL;
+}
+
+void web_cache_make_etag(char *etag, const char *content, size_t length)
+{
+	uint64_t h = 14695981039346656037ull;
+	size_t i;
+
+	for (i = 0; i < length; i++) {
+		h ^= (unsigned char)content[i];
+		h *= 1099511628211ull;
+	}
+	snprintf(etag,
+		WEB_CACHE_ETAG_SIZE,
+		"\"%016" PRIx64 "-%" PRIx64 "\"",
+		h,
+		(uint64_t)length);
+}
+
+void web_cache_make_file_etag(char *etag, uint64_t size, time_t last_modified)
+{
+	snprintf(etag,
+		WEB_CACHE_ETAG_SIZE,
+		"W/\"%" PRIx64 "-%" PRIx64 "\"",
+		size,
+		(uint64_t)last_modified);
+}
+
+void web_cache_deflate(web_cache_deflated *deflated,
+	const char *content_type,
+	const char *content,
+	size_t length)
+{
+	#ifdef UPNP_ENABLE_ZLIB
+	membuffer out;
+	char *shrunk;
+	#endif
+
+	memset(deflated, 0, sizeof(*deflated));
+	#ifdef UPNP_ENABLE_ZLIB
+	if (length < WEB_SERVER_COMPRESS_MIN_SIZE ||
+		(strncmp(content_type, "text/", strlen("text/")) != 0 &&
+			strstr(content_type, "xml") == NULL))
+		return;
+	membuffer_init(&out);
+	if (http_deflate(content,
+		    length,
+		    &out,
+		    &deflated->crc,
+		    &deflated->adler) != UPNP_E_SUCCESS ||
+		out.length + HTTP_CODING_HEADER_SIZE +
+				HTTP_CODING_TRAILER_SIZE >=
+			length) {
+		membuffer_destroy(&out);
+		return;
+	}
+	deflated->length = out.length;
+	deflated->stream = membuffer_detach(&out);
+	/* the buffer was sized for the worst case */
+	shrunk = realloc(deflated->stream, deflated->length + 1);
+	if (shrunk)
+		deflated->stream = shrunk;
+	#else
+	(void)content_type;
+	(void)content;
+	(void)length;
+	#endif /* UPNP_ENABLE_ZLIB */
+}
+
+void web_cache_release(web_cache_entry *entry)
+{
+	if (!entry)
+		return;
+	ithread_mutex_lock(&gWebCacheMutex);
+	web_cache_unref(entry);
+	ithread_mutex_unlock(&gWebCacheMutex);
+}
+#endif /* EXCLUDE_WEB_SERVER */
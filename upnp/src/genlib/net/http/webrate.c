@@ -0,0 +1,270 @@
+/*!
+ * \file
+ *
+ * \brief Bandwidth shaping of the files sent by the web server.
+ *
+ * One mutex protects the rates, the total bucket and the queue of the
+ * connections waiting for their turn at it. The head of the queue is the
+ * only connection that may draw from the total bucket; the threads sending
+ * files wait on a condition for their turn, and the miniserver thread is
+ * woken up through its stop socket when the turn of one of its streams
+ * comes.
+ */
+
+#include "config.h"
+
+#if EXCLUDE_WEB_SERVER == 0
+
+	#include "webrate.h"
+
+	#include "Atomic.h"
+	#include "ThreadPool.h" /* for gettimeofday() */
+	#include "ithread.h"
+	#include "miniserver.h"
+
+	#include <string.h>
+
+/*! Bytes per second sent on one connection, 0 if not limited. */
+static size_t gConnectionRate = 0;
+/*! Bytes per second sent on all connections, 0 if not limited. */
+static size_t gTotalRate = 0;
+/*! Whether a rate is limited, read without the mutex. */
+static int gRateEnabled = 0;
+/*! Total bucket. */
+static web_rate gTotal;
+/*! Connections waiting for their turn at the total bucket. */
+static web_rate *gRateHead = NULL;
+/*! Last connection waiting. */
+static web_rate *gRateTail = NULL;
+/*! Protects the variables above. */
+static ithread_mutex_t gRateMutex = PTHREAD_MUTEX_INITIALIZER;
+/*! Signaled when the turn passes or the rates change. */
+static ithread_cond_t gRateCond = PTHREAD_COND_INITIALIZER;
+
+/*!
+ * \brief Returns the current time in microseconds.
+ */
+static int64_t rate_now(void)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+/*!
+ * \brief Adds the tokens earned since the last refill to a bucket, up to
+ * WEB_SERVER_RATE_BURST milliseconds worth of them.
+ */
+static void bucket_refill(
+	/*! [in,out] Bucket. */
+	web_rate *b,
+	/*! [in] Rate of the bucket. */
+	size_t rate,
+	/*! [in] Current time. */
+	int64_t now)
+{
+	int64_t burst = (int64_t)rate * WEB_SERVER_RATE_BURST / 1000;
+	int64_t elapsed = now - b->last;
+
+	if (b->last == 0 || elapsed < 0)
+		elapsed = 0;
+	/* a long idle time refills the bucket anyway */
+	if (elapsed > 1000000)
+		elapsed = 1000000;
+	b->last = now;
+	b->tokens += (int64_t)rate * elapsed / 1000000;
+	if (b->tokens > burst)
+		b->tokens = burst;
+}
+
+/*!
+ * \brief Returns the time until a bucket is out of debt.
+ *
+ * \return Microseconds, 0 if it is not in debt.
+ */
+static int64_t bucket_delay(
+	/*! [in] Bucket. */
+	const web_rate *b,
+	/*! [in] Rate of the bucket. */
+	size_t rate)
+{
+	if (b->tokens >= 0)
+		return 0;
+
+	return (-b->tokens * 1000000 + (int64_t)rate - 1) / (int64_t)rate;
+}
+
+/*!
+ * \brief Removes a connection from the queue; gRateMutex must be held.
+ */
+static void rate_dequeue(
+	/*! [in,out] Shaping state. */
+	web_rate *r)
+{
+	web_rate **prev;
+	web_rate *last = NULL;
+
+	if (!r->queued)
+		return;
+	for (prev = &gRateHead; *prev != r; prev = &(*prev)->next)
+		last = *prev;
+	*prev = r->next;
+	if (gRateTail == r)
+		gRateTail = last;
+	r->next = NULL;
+	r->queued = 0;
+	if (prev == &gRateHead && gRateHead) {
+		/* The turn passes. A connection with wake set is a stream,
+		 * and web_stream_enable() cancels them all before the
+		 * miniserver thread closes its wake socket. */
+		if (gRateHead->wake)
+			MiniServerWakeup();
+		else
+			ithread_cond_broadcast(&gRateCond);
+	}
+}
+
+/*!
+ * \brief Returns the time until a connection may send, queueing it for its
+ * turn at the total bucket once its own bucket is out of debt; gRateMutex
+ * must be held.
+ *
+ * \return Microseconds, 0 if it may send now, -1 if it waits for its turn.
+ */
+static int64_t rate_delay(
+	/*! [in,out] Shaping state. */
+	web_rate *r,
+	/*! [in] Current time. */
+	int64_t now)
+{
+	if (gConnectionRate) {
+		bucket_refill(r, gConnectionRate, now);
+		if (r->tokens < 0)
+			return bucket_delay(r, gConnectionRate);
+	}
+	if (!gTotalRate)
+		return 0;
+	if (!r->queued) {
+		r->queued = 1;
+		r->next = NULL;
+		if (gRateTail)
+			gRateTail->next = r;
+		else
+			gRateHead = r;
+		gRateTail = r;
+	}
+	if (gRateHead != r)
+		return -1;
+	bucket_refill(&gTotal, gTotalRate, now);
+
+	return bucket_delay(&gTotal, gTotalRate);
+}
+
+/*!
+ * \brief Charges a connection for data and passes the turn on; gRateMutex
+ * must be held.
+ */
+static void rate_charge(
+	/*! [in,out] Shaping state. */
+	web_rate *r,
+	/*! [in] Length of the data. */
+	size_t len)
+{
+	if (gConnectionRate)
+		r->tokens -= (int64_t)len;
+	if (gTotalRate && gRateHead == r)
+		gTotal.tokens -= (int64_t)len;
+	rate_dequeue(r);
+}
+
+void web_rate_set(size_t connection_rate, size_t total_rate)
+{
+	int enabled = connection_rate != 0 || total_rate != 0;
+	int wake = 0;
+	web_rate *r;
+
+	ithread_mutex_lock(&gRateMutex);
+	gConnectionRate = connection_rate;
+	gTotalRate = total_rate;
+	memset(&gTotal, 0, sizeof(gTotal));
+	/* the waiting connections queue again for the new rates */
+	while ((r = gRateHead) != NULL) {
+		gRateHead = r->next;
+		r->next = NULL;
+		r->queued = 0;
+		wake |= r->wake;
+	}
+	gRateTail = NULL;
+	/* only written here, with the mutex held */
+	ithread_atomic_add(&gRateEnabled, enabled - gRateEnabled);
+	ithread_cond_broadcast(&gRateCond);
+	/* Only the streams waiting for their turn need the miniserver thread
+	 * to poll them again now, the others time out of select() within
+	 * their delay. */
+	if (wake)
+		MiniServerWakeup();
+	ithread_mutex_unlock(&gRateMutex);
+}
+
+int web_rate_enabled(void)
+{
+	return ithread_atomic_load(&gRateEnabled);
+}
+
+void web_rate_init(web_rate *r)
+{
+	memset(r, 0, sizeof(*r));
+}
+
+void web_rate_wait(web_rate *r, size_t len)
+{
+	struct timespec ts;
+	int64_t delay;
+	int64_t until;
+
+	ithread_mutex_lock(&gRateMutex);
+	r->wake = 0;
+	while ((delay = rate_delay(r, rate_now())) != 0) {
+		if (delay < 0) {
+			ithread_cond_wait(&gRateCond, &gRateMutex);
+			continue;
+		}
+		until = rate_now() + delay;
+		ts.tv_sec = (time_t)(until / 1000000);
+		ts.tv_nsec = (long)(until % 1000000) * 1000;
+		ithread_cond_timedwait(&gRateCond, &gRateMutex, &ts);
+	}
+	rate_charge(r, len);
+	ithread_mutex_unlock(&gRateMutex);
+}
+
+int web_rate_poll(web_rate *r, int *delay)
+{
+	int64_t d;
+
+	ithread_mutex_lock(&gRateMutex);
+	r->wake = 1;
+	d = rate_delay(r, rate_now());
+	ithread_mutex_unlock(&gRateMutex);
+	/* rounded up, select() must not return before it is time */
+	*delay = d < 0 ? -1 : (int)((d + 999) / 1000);
+
+	return d == 0;
+}
+
+void web_rate_charge(web_rate *r, size_t len)
+{
+	ithread_mutex_lock(&gRateMutex);
+	rate_charge(r, len);
+	ithread_mutex_unlock(&gRateMutex);
+}
+
+void web_rate_cancel(web_rate *r)
+{
+	ithread_mutex_lock(&gRateMutex);
+	rate_dequeue(r);
+	ithread_mutex_unlock(&gRateMutex);
+}
+#endif /* EXCLUDE_WEB_SERVER */
@@ -47,18 +47,24 @@
 	#include "UpnpFileInfo.h"
 	#include "UpnpIntTypes.h"
 	#include "UpnpStdInt.h"
+	#include "Atomic.h"
+	#include "Epoch.h"
 	#include "VirtualDir.h"
+	#include "httpcompress.h"
 	#include "httpparser.h"
 	#include "httpreadwrite.h"
 	#include "ithread.h"
 	#include "membuffer.h"
 	#include "ssdplib.h"
 	#include "statcodes.h"
-	#include "strintmap.h"
 	#include "unixutil.h"
 	#include "upnp.h"
 	#include "upnpapi.h"
 	#include "upnputil.h"
+	#include "webcache.h"
+	#include "webrate.h"
+	#include "webstream.h"
+	#include "webvdir.h"
 
 	#include <assert.h>
 	#include <fcntl.h>
@@ -75,7 +81,8 @@ enum resp_type
 	RESP_XMLDOC,
 	RESP_HEADERS,
 	RESP_WEBDOC,
-	RESP_POST
+	RESP_POST,
+	RESP_CACHEDOC
 };
 
 /* mapping of file extension to content-type of document */
@@ -97,8 +104,22 @@ struct xml_alias_t
 	membuffer doc;
 	/*! . */
 	time_t last_modified;
-	/*! . */
-	int *ct;
+	/*! strong entity tag of the document */
+	char etag[WEB_CACHE_ETAG_SIZE];
+	/*! compressed document */
+	web_cache_deflated deflated;
+	/*! number of references: one while the alias is in the table and one
+	 * per response sending the document; updated atomically */
+	int ct;
+};
+
+/*! Aliases served, an immutable array replaced as a whole. */
+struct xml_alias_table_t
+{
+	/*! number of aliases */
+	size_t count;
+	/*! referenced aliases */
+	struct xml_alias_t *aliases[1];
 };
 
 static const char *gMediaTypes[] = {
@@ -132,7 +153,6 @@ static const char *gMediaTypes[] = {
 
 	/* general */
 	#define NUM_MEDIA_TYPES 70
-	#define NUM_HTTP_HEADER_NAMES 33
 
 	#define ASCTIME_R_BUFFER_SIZE 26
 	#ifdef _WIN32
@@ -232,10 +252,16 @@ static struct document_type_t gMediaTypeList[NUM_MEDIA_TYPES];
 /*! Global variable. A local dir which serves as webserver root. */
 membuffer gDocumentRootDir;
 
-/*! XML document. */
-static struct xml_alias_t gAliasDoc;
+/*!
+ * XML documents. Looked up without lock, replaced under gWebMutex: a table
+ * is freed once the lookups in gAliasEpoch that may have read it are over.
+ */
+static struct xml_alias_table_t *gAliasTable;
+/*! Lookups in gAliasTable. */
+static Epoch gAliasEpoch = EPOCH_INITIALIZER;
 static ithread_mutex_t gWebMutex;
-extern str_int_entry Http_Header_Names[NUM_HTTP_HEADER_NAMES];
+/*! Makes the boundaries of multipart/byteranges responses unique. */
+static int gBoundaryCount = 0;
 
 /*!
  * \brief Decodes list and stores it in gMediaTypeList.
@@ -355,68 +381,138 @@ static UPNP_INLINE int get_content_type(
 }
 
 /*!
- * \brief Initialize the global XML document. Allocate buffers for the XML
- * document.
+ * \brief Release a reference to an XML document. Free the allocated buffers
+ * associated with this object with the last one.
  */
-static UPNP_INLINE void glob_alias_init(void)
+static void alias_release(
+	/*! [in] XML alias object. */
+	struct xml_alias_t *alias)
 {
-	struct xml_alias_t *alias = &gAliasDoc;
-
-	membuffer_init(&alias->doc);
-	membuffer_init(&alias->name);
-	alias->ct = NULL;
-	alias->last_modified = 0;
+	if (ithread_atomic_add(&alias->ct, -1) == 0) {
+		membuffer_destroy(&alias->doc);
+		membuffer_destroy(&alias->name);
+		free(alias->deflated.stream);
+		free(alias);
+	}
 }
 
 /*!
- * \brief Check for the validity of the XML object buffer.
+ * \brief Compares the name of an alias, which starts with a '/', with a
+ * name which may not.
  *
- * \return int.
+ * \return 1 if the names match, 0 otherwise.
  */
-static UPNP_INLINE int is_valid_alias(
+static int alias_name_is(
 	/*! [in] XML alias object. */
-	const struct xml_alias_t *alias)
+	const struct xml_alias_t *alias,
+	/*! [in] Name. */
+	const char *name)
 {
-	return alias->doc.buf != NULL;
+	size_t length = alias->name.length;
+	const char *alias_name = alias->name.buf;
+
+	if (*name != '/') {
+		alias_name++;
+		length--;
+	}
+
+	return strncmp(alias_name, name, length) == 0 && name[length] == '\0';
 }
 
 /*!
- * \brief Copy the contents of the global XML document into the local output
- * parameter.
+ * \brief Looks up an XML document by name without taking a lock.
+ *
+ * \return The referenced alias, to be released with alias_release(), or
+ * NULL.
  */
-static void alias_grab(
-	/*! [out] XML alias object. */
-	struct xml_alias_t *alias)
+static struct xml_alias_t *alias_grab(
+	/*! [in] Request path. */
+	const char *request_file)
 {
-	ithread_mutex_lock(&gWebMutex);
-	assert(is_valid_alias(&gAliasDoc));
-	memcpy(alias, &gAliasDoc, sizeof(struct xml_alias_t));
-	*alias->ct = *alias->ct + 1;
-	ithread_mutex_unlock(&gWebMutex);
+	struct xml_alias_table_t *table;
+	struct xml_alias_t *alias = NULL;
+	size_t i;
+	int epoch;
+
+	epoch = EpochEnter(&gAliasEpoch);
+	table = ithread_atomic_load_ptr(&gAliasTable);
+	for (i = 0; table && i < table->count; i++) {
+		if (alias_name_is(table->aliases[i], request_file)) {
+			alias = table->aliases[i];
+			ithread_atomic_add(&alias->ct, 1);
+			break;
+		}
+	}
+	EpochLeave(&gAliasEpoch, epoch);
+
+	return alias;
 }
 
 /*!
- * \brief Release the XML document referred to by the input parameter. Free
- * the allocated buffers associated with this object.
+ * \brief Publishes a new table of aliases and waits for the lookups that
+ * may still read the previous one; gWebMutex must be held.
+ *
+ * \return The previous table, or NULL.
  */
-static void alias_release(
-	/*! [in] XML alias object. */
-	struct xml_alias_t *alias)
+static struct xml_alias_table_t *alias_publish(
+	/*! [in] New table, or NULL. */
+	struct xml_alias_table_t *table)
 {
-	ithread_mutex_lock(&gWebMutex);
-	/* ignore invalid alias */
-	if (!is_valid_alias(alias)) {
-		ithread_mutex_unlock(&gWebMutex);
-		return;
+	struct xml_alias_table_t *old;
+
+	old = ithread_atomic_exchange_ptr(&gAliasTable, table);
+	EpochSynchronize(&gAliasEpoch);
+
+	return old;
+}
+
+/*!
+ * \brief Replaces the table of aliases with a copy without the alias of a
+ * given name and with \b added, if not NULL; gWebMutex must be held.
+ *
+ * \return 0 or UPNP_E_OUTOF_MEMORY, in which case the table is unchanged.
+ */
+static int alias_update(
+	/*! [in] Name of the alias to remove. */
+	const char *alias_name,
+	/*! [in] Referenced alias to add, or NULL. */
+	struct xml_alias_t *added,
+	/*! [out] Alias removed from the table, to be released, or NULL. */
+	struct xml_alias_t **removed)
+{
+	struct xml_alias_table_t *old = gAliasTable;
+	struct xml_alias_table_t *table;
+	size_t count = old ? old->count : 0;
+	size_t i;
+
+	*removed = NULL;
+	if (!added) {
+		for (i = 0; i < count; i++) {
+			if (alias_name_is(old->aliases[i], alias_name))
+				break;
+		}
+		if (i == count)
+			return 0; /* nothing to remove */
 	}
-	assert(*alias->ct > 0);
-	*alias->ct -= 1;
-	if (*alias->ct <= 0) {
-		membuffer_destroy(&alias->doc);
-		membuffer_destroy(&alias->name);
-		free(alias->ct);
+	table = malloc(sizeof(*table) + count * sizeof(table->aliases[0]));
+	if (!table)
+		return UPNP_E_OUTOF_MEMORY;
+	table->count = 0;
+	for (i = 0; i < count; i++) {
+		if (!*removed && alias_name_is(old->aliases[i], alias_name))
+			*removed = old->aliases[i];
+		else
+			table->aliases[table->count++] = old->aliases[i];
 	}
-	ithread_mutex_unlock(&gWebMutex);
+	if (added)
+		table->aliases[table->count++] = added;
+	if (table->count == 0) {
+		free(table);
+		table = NULL;
+	}
+	free(alias_publish(table));
+
+	return 0;
 }
 
 int web_server_set_alias(const char *alias_name,
@@ -425,48 +521,71 @@ int web_server_set_alias(const char *alias_name,
 	time_t last_modified)
 {
 	int ret_code;
-	struct xml_alias_t alias;
+	struct xml_alias_t *alias;
+	struct xml_alias_t *replaced;
 
-	alias_release(&gAliasDoc);
-	if (alias_name == NULL) {
-		/* don't serve aliased doc anymore */
-		return 0;
-	}
-	assert(alias_content != NULL);
-	membuffer_init(&alias.doc);
-	membuffer_init(&alias.name);
-	alias.ct = NULL;
+	assert(alias_name != NULL && alias_content != NULL);
+	alias = malloc(sizeof(*alias));
+	if (alias == NULL)
+		return UPNP_E_OUTOF_MEMORY;
+	membuffer_init(&alias->doc);
+	membuffer_init(&alias->name);
+	alias->deflated.stream = NULL;
 	do {
 		/* insert leading /, if missing */
 		if (*alias_name != '/')
-			if (membuffer_assign_str(&alias.name, "/") != 0)
+			if (membuffer_assign_str(&alias->name, "/") != 0)
 				break; /* error; out of mem */
-		ret_code = membuffer_append_str(&alias.name, alias_name);
+		ret_code = membuffer_append_str(&alias->name, alias_name);
 		if (ret_code != 0)
 			break; /* error */
-		if ((alias.ct = (int *)malloc(sizeof(int))) == NULL)
-			break; /* error */
-		*alias.ct = 1;
-		membuffer_attach(&alias.doc,
+		alias->ct = 1;
+		alias->last_modified = last_modified;
+		/* once per version of the document */
+		web_cache_make_etag(
+			alias->etag, alias_content, alias_content_length);
+		web_cache_deflate(&alias->deflated,
+			"text/xml",
+			alias_content,
+			alias_content_length);
+		membuffer_attach(&alias->doc,
 			(char *)alias_content,
 			alias_content_length);
-		alias.last_modified = last_modified;
 		/* save in module var */
 		ithread_mutex_lock(&gWebMutex);
-		gAliasDoc = alias;
+		ret_code = alias_update(alias->name.buf, alias, &replaced);
 		ithread_mutex_unlock(&gWebMutex);
+		if (ret_code != 0) {
+			/* the caller keeps the content */
+			membuffer_detach(&alias->doc);
+			break; /* error */
+		}
+		if (replaced)
+			alias_release(replaced);
 
 		return 0;
 	} while (0);
 	/* error handler */
 	/* free temp alias */
-	membuffer_destroy(&alias.name);
-	membuffer_destroy(&alias.doc);
-	free(alias.ct);
+	membuffer_destroy(&alias->name);
+	free(alias->deflated.stream);
+	free(alias);
 
 	return UPNP_E_OUTOF_MEMORY;
 }
 
+void web_server_remove_alias(const char *alias_name)
+{
+	struct xml_alias_t *removed = NULL;
+
+	ithread_mutex_lock(&gWebMutex);
+	/* out of memory, the alias stays served */
+	alias_update(alias_name, NULL, &removed);
+	ithread_mutex_unlock(&gWebMutex);
+	if (removed)
+		alias_release(removed);
+}
+
 int web_server_init()
 {
 	int ret = UPNP_E_SUCCESS;
@@ -475,8 +594,7 @@ int web_server_init()
 		/* decode media list */
 		media_list_init();
 		membuffer_init(&gDocumentRootDir);
-		glob_alias_init();
-		pVirtualDirList = NULL;
+		gAliasTable = NULL;
 
 		/* Initialize callbacks */
 		virtualDirCallback.get_info = NULL;
@@ -485,10 +603,17 @@ int web_server_init()
 		virtualDirCallback.write = NULL;
 		virtualDirCallback.seek = NULL;
 		virtualDirCallback.close = NULL;
+		virtualDirCallback.open_stream = NULL;
+		virtualDirCallback.stream_event = NULL;
+		/* not limited until UpnpSetWebServerRateLimit() */
+		web_rate_set(0, 0);
 
 		if (ithread_mutex_init(&gWebMutex, NULL) == -1)
 			ret = UPNP_E_OUTOF_MEMORY;
-		else
+		else if (web_cache_init() != 0) {
+			ithread_mutex_destroy(&gWebMutex);
+			ret = UPNP_E_OUTOF_MEMORY;
+		} else
 			bWebServerState = WEB_SERVER_ENABLED;
 	}
 
@@ -497,15 +622,21 @@ int web_server_init()
 
 void web_server_destroy(void)
 {
+	struct xml_alias_table_t *table;
+	size_t i;
+
 	if (bWebServerState == WEB_SERVER_ENABLED) {
 		membuffer_destroy(&gDocumentRootDir);
-		alias_release(&gAliasDoc);
 
 		ithread_mutex_lock(&gWebMutex);
-		memset(&gAliasDoc, 0, sizeof(struct xml_alias_t));
+		table = alias_publish(NULL);
 		ithread_mutex_unlock(&gWebMutex);
+		for (i = 0; table && i < table->count; i++)
+			alias_release(table->aliases[i]);
+		free(table);
 
 		ithread_mutex_destroy(&gWebMutex);
+		web_cache_destroy();
 		bWebServerState = WEB_SERVER_DISABLED;
 	}
 }
@@ -588,6 +719,50 @@ exit_function:
 	return rc;
 }
 
+/*!
+ * \brief Same as get_file_info(), but takes the file from the cache if it is
+ * there and otherwise adds it to the cache if it is small enough.
+ *
+ * \return Same values as get_file_info().
+ */
+static int get_cached_file_info(
+	/*! [in] Filename having the description document. */
+	const char *filename,
+	/*! [out] File information object. */
+	UpnpFileInfo *info,
+	/*! [out] Cached file to be released with web_cache_release(), or NULL
+	 * if the file must be read from the disk. */
+	web_cache_entry **entry)
+{
+	int rc;
+
+	*entry = web_cache_lookup(filename);
+	if (*entry) {
+		UpnpFileInfo_set_IsReadable(info, 1);
+		UpnpFileInfo_set_IsDirectory(info, 0);
+		UpnpFileInfo_set_ContentType(info, (*entry)->content_type);
+		if (!UpnpFileInfo_get_ContentType(info)) {
+			web_cache_release(*entry);
+			*entry = NULL;
+			return -1;
+		}
+	} else {
+		rc = get_file_info(filename, info);
+		if (rc != 0 || UpnpFileInfo_get_IsDirectory(info) ||
+			!UpnpFileInfo_get_IsReadable(info))
+			return rc;
+		*entry = web_cache_load(
+			filename, UpnpFileInfo_get_ContentType(info));
+		if (!*entry)
+			return 0;
+	}
+	/* the file may have changed between get_file_info() and the read */
+	UpnpFileInfo_set_FileLength(info, (off_t)(*entry)->length);
+	UpnpFileInfo_set_LastModified(info, (*entry)->last_modified);
+
+	return 0;
+}
+
 int web_server_set_root_dir(const char *root_dir)
 {
 	size_t index;
@@ -607,8 +782,8 @@ int web_server_set_root_dir(const char *root_dir)
 }
 
 /*!
- * \brief Compare the files names between the one on the XML alias the one
- * passed in as the input parameter. If equal extract file information.
+ * \brief Looks up the XML alias of the file name passed in as the input
+ * parameter. If found extract file information.
  *
  * \return
  * \li \c 1 - On Success
@@ -617,70 +792,22 @@ int web_server_set_root_dir(const char *root_dir)
 static UPNP_INLINE int get_alias(
 	/*! [in] request file passed in to be compared with. */
 	const char *request_file,
-	/*! [out] xml alias object which has a file name stored. */
-	struct xml_alias_t *alias,
+	/*! [out] referenced xml alias object, if found. */
+	struct xml_alias_t **alias,
 	/*! [out] File information object which will be filled up if the file
 	 * comparison succeeds. */
 	UpnpFileInfo *info)
 {
-	int cmp = strcmp(alias->name.buf, request_file);
-	if (cmp == 0) {
-		UpnpFileInfo_set_FileLength(info, (off_t)alias->doc.length);
+	*alias = alias_grab(request_file);
+	if (*alias) {
+		UpnpFileInfo_set_FileLength(
+			info, (off_t)(*alias)->doc.length);
 		UpnpFileInfo_set_IsDirectory(info, 0);
 		UpnpFileInfo_set_IsReadable(info, 1);
-		UpnpFileInfo_set_LastModified(info, alias->last_modified);
-	}
-
-	return cmp == 0;
-}
-
-/*!
- * \brief Compares filePath with paths from the list of virtual directory
- * lists.
- *
- * \return int.
- */
-static int isFileInVirtualDir(
-	/*! [in] Directory path to be tested for virtual directory. */
-	char *filePath,
-	/*! [out] The cookie registered with this virtual directory, if matched.
-	 */
-	const void **cookie)
-{
-	virtualDirList *pCurVirtualDir;
-	size_t webDirLen;
-
-	pCurVirtualDir = pVirtualDirList;
-	while (pCurVirtualDir != NULL) {
-		webDirLen = strlen(pCurVirtualDir->dirName);
-		if (webDirLen) {
-			if (pCurVirtualDir->dirName[webDirLen - 1] == '/') {
-				if (strncmp(pCurVirtualDir->dirName,
-					    filePath,
-					    webDirLen) == 0) {
-					if (cookie != NULL)
-						*cookie =
-							pCurVirtualDir->cookie;
-					return 1;
-				}
-			} else {
-				if (strncmp(pCurVirtualDir->dirName,
-					    filePath,
-					    webDirLen) == 0 &&
-					(filePath[webDirLen] == '/' ||
-						filePath[webDirLen] == '\0' ||
-						filePath[webDirLen] == '?')) {
-					if (cookie != NULL)
-						*cookie =
-							pCurVirtualDir->cookie;
-					return 1;
-				}
-			}
-		}
-		pCurVirtualDir = pCurVirtualDir->next;
+		UpnpFileInfo_set_LastModified(info, (*alias)->last_modified);
 	}
 
-	return 0;
+	return *alias != NULL;
 }
 
 /*!
@@ -815,10 +942,104 @@ static int GetNextRange(
 	return 1;
 }
 
+/*! Range of a file to send. */
+typedef struct
+{
+	/*! Offset of the range. */
+	off_t offset;
+	/*! Length of the range. */
+	off_t length;
+} byte_range;
+
+/*!
+ * \brief Resolves a byte range spec against the length of a file.
+ *
+ * \return 1 if the range is satisfiable, 0 otherwise.
+ */
+static int resolve_range(
+	/*! [in] First byte, -1 for a suffix range. */
+	off_t FirstByte,
+	/*! [in] Last byte, or length of a suffix range, -1 if absent. */
+	off_t LastByte,
+	/*! [in] Length of the file. */
+	off_t FileLength,
+	/*! [out] Range of the file. */
+	byte_range *range)
+{
+	if (FirstByte >= 0 && LastByte >= 0 && LastByte >= FirstByte) {
+		if (FirstByte >= FileLength)
+			return 0;
+		if (LastByte >= FileLength)
+			LastByte = FileLength - 1;
+		range->offset = FirstByte;
+		range->length = LastByte - FirstByte + 1;
+	} else if (FirstByte >= 0 && LastByte == -1 &&
+		   FirstByte < FileLength) {
+		range->offset = FirstByte;
+		range->length = FileLength - FirstByte;
+	} else if (FirstByte == -1 && LastByte > 0) {
+		/* the last bytes of the file */
+		if (LastByte > FileLength)
+			LastByte = FileLength;
+		range->offset = FileLength - LastByte;
+		range->length = LastByte;
+	} else {
+		return 0;
+	}
+
+	return range->length > 0;
+}
+
+/*!
+ * \brief Compares two ranges by offset, for qsort().
+ */
+static int range_cmp(const void *a, const void *b)
+{
+	off_t x = ((const byte_range *)a)->offset;
+	off_t y = ((const byte_range *)b)->offset;
+
+	return x < y ? -1 : x > y;
+}
+
+/*!
+ * \brief Sorts ranges and merges those that overlap or are less than
+ * WEB_SERVER_RANGE_GAP bytes apart, which are cheaper to send as one part.
+ *
+ * \return The number of ranges left.
+ */
+static size_t coalesce_ranges(
+	/*! [in,out] Ranges. */
+	byte_range *ranges,
+	/*! [in] Number of ranges, at least 1. */
+	size_t count)
+{
+	size_t i;
+	size_t j = 0;
+	off_t end;
+
+	qsort(ranges, count, sizeof(*ranges), range_cmp);
+	for (i = 1; i < count; i++) {
+		end = ranges[j].offset + ranges[j].length;
+		if (ranges[i].offset <= end + WEB_SERVER_RANGE_GAP) {
+			if (ranges[i].offset + ranges[i].length > end)
+				ranges[j].length = ranges[i].offset +
+						   ranges[i].length -
+						   ranges[j].offset;
+		} else {
+			ranges[++j] = ranges[i];
+		}
+	}
+
+	return j + 1;
+}
+
 /*!
  * \brief Fills in the Offset, read size and contents to send out as an HTTP
  * Range Response.
  *
+ * Several ranges make the parts of a multipart/byteranges response, whose
+ * headers and length are filled in by the caller.
+ *
  * \return
  * \li \c HTTP_BAD_REQUEST
  * \li \c HTTP_INTERNAL_SERVER_ERROR
@@ -837,10 +1058,18 @@ static int CreateHTTPRangeResponseHeader(
 	off_t FirstByte, LastByte;
 	char *RangeInput;
 	char *Ptr;
+	byte_range *ranges;
+	size_t count = 1;
+	size_t n = 0;
+	size_t i;
 	int rc = 0;
+	int ret = HTTP_OK;
 
 	Instr->IsRangeActive = 1;
 	Instr->ReadSendSize = FileLength;
+	/* a repeated header replaces the ranges */
+	free(Instr->Ranges);
+	Instr->Ranges = NULL;
 	if (!ByteRangeSpecifier)
 		return HTTP_BAD_REQUEST;
 	RangeInput = strdup(ByteRangeSpecifier);
@@ -856,7 +1085,7 @@ static int CreateHTTPRangeResponseHeader(
 	/* Jump = */
 	Ptr = Ptr + 1;
 	if (FileLength < 0) {
-		int ret = HTTP_REQUEST_RANGE_NOT_SATISFIABLE;
+		ret = HTTP_REQUEST_RANGE_NOT_SATISFIABLE;
 		if ((*Ptr == '0') && (*(Ptr + 1) == '-') &&
 			(*(Ptr + 2) == '\0')) {
 			Instr->IsRangeActive = 0;
@@ -865,82 +1094,105 @@ static int CreateHTTPRangeResponseHeader(
 		free(RangeInput);
 		return ret;
 	}
-	if (GetNextRange(&Ptr, &FirstByte, &LastByte) != -1) {
-		if (FileLength < FirstByte) {
-			free(RangeInput);
-			return HTTP_REQUEST_RANGE_NOT_SATISFIABLE;
+	for (i = 0; Ptr[i] != '\0'; i++) {
+		if (Ptr[i] == ',')
+			count++;
+	}
+	ranges = (byte_range *)malloc(count * sizeof(*ranges));
+	if (!ranges) {
+		free(RangeInput);
+		return HTTP_INTERNAL_SERVER_ERROR;
+	}
+	/* the unsatisfiable ranges are left out */
+	while (n < count && GetNextRange(&Ptr, &FirstByte, &LastByte) != -1) {
+		if (resolve_range(FirstByte, LastByte, FileLength, &ranges[n]))
+			n++;
+	}
+	if (n == 0) {
+		ret = HTTP_REQUEST_RANGE_NOT_SATISFIABLE;
+		goto exit_function;
+	}
+	n = coalesce_ranges(ranges, n);
+	if (n > (size_t)WEB_SERVER_MAX_RANGES) {
+		/* too many parts, the whole file is sent */
+		Instr->IsRangeActive = 0;
+		goto exit_function;
+	}
+	if (n > 1) {
+		Instr->Ranges =
+			(struct SendRanges *)malloc(sizeof(*Instr->Ranges));
+		if (!Instr->Ranges) {
+			ret = HTTP_INTERNAL_SERVER_ERROR;
+			goto exit_function;
 		}
-		if (FirstByte >= 0 && LastByte >= 0 && LastByte >= FirstByte) {
-			if (LastByte >= FileLength)
-				LastByte = FileLength - 1;
-			Instr->RangeOffset = FirstByte;
-			Instr->ReadSendSize = LastByte - FirstByte + 1;
-			/* Data between two range. */
-			rc = snprintf(Instr->RangeHeader,
-				sizeof(Instr->RangeHeader),
-				"CONTENT-RANGE: bytes %" PRId64 "-%" PRId64
-				"/%" PRId64 "\r\n",
-				(int64_t)FirstByte,
-				(int64_t)LastByte,
-				(int64_t)FileLength);
-			if (rc < 0 || (unsigned int)rc >=
-					      sizeof(Instr->RangeHeader)) {
-				free(RangeInput);
-				return HTTP_INTERNAL_SERVER_ERROR;
-			}
-		} else if (FirstByte >= 0 && LastByte == -1 &&
-			   FirstByte < FileLength) {
-			Instr->RangeOffset = FirstByte;
-			Instr->ReadSendSize = FileLength - FirstByte;
-			rc = snprintf(Instr->RangeHeader,
-				sizeof(Instr->RangeHeader),
-				"CONTENT-RANGE: bytes %" PRId64 "-%" PRId64
-				"/%" PRId64 "\r\n",
-				(int64_t)FirstByte,
-				(int64_t)(FileLength - 1),
-				(int64_t)FileLength);
-			if (rc < 0 || (unsigned int)rc >=
-					      sizeof(Instr->RangeHeader)) {
-				free(RangeInput);
-				return HTTP_INTERNAL_SERVER_ERROR;
-			}
-		} else if (FirstByte == -1 && LastByte > 0) {
-			if (LastByte >= FileLength) {
-				Instr->RangeOffset = 0;
-				Instr->ReadSendSize = FileLength;
-				rc = snprintf(Instr->RangeHeader,
-					sizeof(Instr->RangeHeader),
-					"CONTENT-RANGE: bytes 0-%" PRId64
-					"/%" PRId64 "\r\n",
-					(int64_t)(FileLength - 1),
-					(int64_t)FileLength);
-			} else {
-				Instr->RangeOffset = FileLength - LastByte;
-				Instr->ReadSendSize = LastByte;
-				rc = snprintf(Instr->RangeHeader,
-					sizeof(Instr->RangeHeader),
-					"CONTENT-RANGE: bytes %" PRId64
-					"-%" PRId64 "/%" PRId64 "\r\n",
-					(int64_t)(FileLength - LastByte),
-					(int64_t)FileLength - 1,
-					(int64_t)FileLength);
-			}
-			if (rc < 0 || (unsigned int)rc >=
-					      sizeof(Instr->RangeHeader)) {
-				free(RangeInput);
-				return HTTP_INTERNAL_SERVER_ERROR;
-			}
-		} else {
-			free(RangeInput);
-			return HTTP_REQUEST_RANGE_NOT_SATISFIABLE;
+		Instr->Ranges->Count = (int)n;
+		for (i = 0; i < n; i++) {
+			Instr->Ranges->Offsets[i] = ranges[i].offset;
+			Instr->Ranges->Lengths[i] = ranges[i].length;
 		}
-	} else {
-		free(RangeInput);
-		return HTTP_REQUEST_RANGE_NOT_SATISFIABLE;
+		Instr->Ranges->FileLength = FileLength;
+		goto exit_function;
 	}
+	Instr->RangeOffset = ranges[0].offset;
+	Instr->ReadSendSize = ranges[0].length;
+	rc = snprintf(Instr->RangeHeader,
+		sizeof(Instr->RangeHeader),
+		"CONTENT-RANGE: bytes %" PRId64 "-%" PRId64 "/%" PRId64 "\r\n",
+		(int64_t)ranges[0].offset,
+		(int64_t)(ranges[0].offset + ranges[0].length - 1),
+		(int64_t)FileLength);
+	if (rc < 0 || (unsigned int)rc >= sizeof(Instr->RangeHeader))
+		ret = HTTP_INTERNAL_SERVER_ERROR;
 
+exit_function:
+	free(ranges);
 	free(RangeInput);
-	return HTTP_OK;
+
+	return ret;
+}
+
+size_t web_server_part_header(
+	const struct SendRanges *ranges, int i, char *buf, size_t size)
+{
+	int rc;
+
+	if (i < ranges->Count)
+		rc = snprintf(buf,
+			size,
+			"\r\n--%s\r\nCONTENT-TYPE: %s\r\n"
+			"CONTENT-RANGE: bytes %" PRId64 "-%" PRId64
+			"/%" PRId64 "\r\n\r\n",
+			ranges->Boundary,
+			ranges->ContentType,
+			(int64_t)ranges->Offsets[i],
+			(int64_t)(ranges->Offsets[i] + ranges->Lengths[i] - 1),
+			(int64_t)ranges->FileLength);
+	else
+		rc = snprintf(buf, size, "\r\n--%s--\r\n", ranges->Boundary);
+	if (rc < 0 || (size_t)rc >= size)
+		return 0;
+
+	return (size_t)rc;
+}
+
+/*!
+ * \brief Returns the length of the body of a multipart/byteranges response.
+ */
+static off_t multipart_length(
+	/*! [in] Parts of the response. */
+	const struct SendRanges *ranges)
+{
+	char buf[WEB_SERVER_PART_HEADER_SIZE];
+	off_t length = 0;
+	int i;
+
+	for (i = 0; i < ranges->Count; i++)
+		length += (off_t)web_server_part_header(
+				  ranges, i, buf, sizeof(buf)) +
+			  ranges->Lengths[i];
+
+	return length +
+	       (off_t)web_server_part_header(ranges, i, buf, sizeof(buf));
 }
 
 /*!
@@ -962,24 +1214,14 @@ static int CheckOtherHTTPHeaders(
 	off_t FileSize)
 {
 	http_header_t *header;
-	ListNode *node;
-	/*NNS: dlist_node* node; */
-	int index, RetCode = HTTP_OK;
+	int RetCode = HTTP_OK;
 	char *TmpBuf;
 	size_t TmpBufSize = LINE_SIZE;
 
 	TmpBuf = (char *)malloc(TmpBufSize);
 	if (!TmpBuf)
 		return HTTP_INTERNAL_SERVER_ERROR;
-	node = ListHead(&Req->headers);
-	while (node != NULL) {
-		header = (http_header_t *)node->item;
-		/* find header type. */
-		index = map_str_to_int((const char *)header->name.buf,
-			header->name.length,
-			Http_Header_Names,
-			NUM_HTTP_HEADER_NAMES,
-			0);
+	for (header = Req->headers; header != NULL; header = header->next) {
 		if (header->value.length >= TmpBufSize) {
 			free(TmpBuf);
 			TmpBufSize = header->value.length + 1;
@@ -989,8 +1231,9 @@ static int CheckOtherHTTPHeaders(
 		}
 		memcpy(TmpBuf, header->value.buf, header->value.length);
 		TmpBuf[header->value.length] = '\0';
-		if (index >= 0) {
-			switch (Http_Header_Names[index].id) {
+		/* header type was found by the parser. */
+		if (header->name_id != HDR_UNKNOWN) {
+			switch (header->name_id) {
 			case HDR_TE: {
 				/* Request */
 				RespInstr->IsChunkActive = 1;
@@ -1071,7 +1314,6 @@ static int CheckOtherHTTPHeaders(
 				break;
 			}
 		}
-		node = ListNext(&Req->headers, node);
 	}
 	free(TmpBuf);
 
@@ -1104,21 +1346,12 @@ static int ExtraHTTPHeaders(
 	UpnpListHead *extraHeadersList)
 {
 	http_header_t *header;
-	ListNode *node;
-	int index;
 	UpnpExtraHeaders *extraHeader;
 	UpnpListHead *extraHeaderNode;
 
-	node = ListHead(&Req->headers);
-	while (node != NULL) {
-		header = (http_header_t *)node->item;
-		/* find header type. */
-		index = map_str_to_int((const char *)header->name.buf,
-			header->name.length,
-			Http_Header_Names,
-			NUM_HTTP_HEADER_NAMES,
-			0);
-		if (index < 0) {
+	for (header = Req->headers; header != NULL; header = header->next) {
+		/* header type was found by the parser. */
+		if (header->name_id == HDR_UNKNOWN) {
 			extraHeader = UpnpExtraHeaders_new();
 			if (!extraHeader) {
 				FreeExtraHTTPHeaders(extraHeadersList);
@@ -1137,12 +1370,85 @@ static int ExtraHTTPHeaders(
 				header->value.buf,
 				header->value.length);
 		}
-		node = ListNext(&Req->headers, node);
 	}
 
 	return HTTP_OK;
 }
 
+/*!
+ * \brief Checks whether an entity tag is in the value of an If-None-Match
+ * header, using the weak comparison.
+ *
+ * \return 1 if it is, 0 otherwise.
+ */
+static int etag_list_match(
+	/*! [in] Header value. */
+	const memptr *list,
+	/*! [in] Quoted entity tag. */
+	const char *etag)
+{
+	const char *p = list->buf;
+	const char *end = p + list->length;
+	const char *q;
+	size_t etag_len;
+
+	if (etag[0] == 'W' && etag[1] == '/')
+		etag += 2;
+	etag_len = strlen(etag);
+	while (p < end) {
+		while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+			p++;
+		if (p == end)
+			break;
+		if (*p == '*')
+			return 1;
+		if (end - p > 2 && p[0] == 'W' && p[1] == '/')
+			p += 2;
+		if (*p != '"')
+			return 0;
+		q = memchr(p + 1, '"', (size_t)(end - p - 1));
+		if (!q)
+			return 0;
+		q++;
+		if ((size_t)(q - p) == etag_len &&
+			memcmp(p, etag, etag_len) == 0)
+			return 1;
+		p = q;
+	}
+
+	return 0;
+}
+
+/*!
+ * \brief Evaluates the If-None-Match and If-Modified-Since headers of a GET
+ * or HEAD request.
+ *
+ * \return 1 if the document did not change and 304 must be answered, 0
+ * otherwise.
+ */
+static int is_not_modified(
+	/*! [in] HTTP Request message. */
+	http_message_t *req,
+	/*! [in] Quoted entity tag of the document. */
+	const char *etag,
+	/*! [in] Last modification time of the document. */
+	time_t last_modified)
+{
+	memptr value;
+	time_t since;
+
+	if (req->method != HTTPMETHOD_GET && req->method != HTTPMETHOD_HEAD)
+		return 0;
+	/* If-None-Match takes precedence */
+	if (httpmsg_find_hdr(req, HDR_IF_NONE_MATCH, &value))
+		return etag_list_match(&value, etag);
+	if (httpmsg_find_hdr(req, HDR_IF_MODIFIED_SINCE, &value) &&
+		parse_http_date(&value, &since) == 0 && since <= time(NULL))
+		return last_modified <= since;
+
+	return 0;
+}
+
 /*!
  * \brief Processes the request and returns the result in the output parameters.
  *
@@ -1166,13 +1472,27 @@ static int process_request(
 	membuffer *headers,
 	/*! [out] Get filename from request document. */
 	membuffer *filename,
-	/*! [out] Xml alias document from the request document. */
-	struct xml_alias_t *alias,
+	/*! [out] Xml alias document, set when the response type is
+	 * RESP_XMLDOC. */
+	struct xml_alias_t **xmldoc,
+	/*! [out] Cached file, set when the response type is RESP_CACHEDOC. */
+	web_cache_entry **cached,
 	/*! [out] Send Instruction object where the response is set up. */
 	struct SendInstruction *RespInstr)
 {
 	int code;
 	int err_code;
+	web_cache_entry *entry = NULL;
+	struct xml_alias_t *alias = NULL;
+	const web_cache_deflated *deflated = NULL;
+	http_coding_t coding = HTTP_CODING_IDENTITY;
+	char file_etag[WEB_CACHE_ETAG_SIZE];
+	const char *etag;
+	char etag_header[WEB_CACHE_ETAG_SIZE +
+			 sizeof("ETAG: \r\nCONTENT-ENCODING: deflate\r\n"
+				"VARY: Accept-Encoding\r\n")];
+	char multipart_type[sizeof("multipart/byteranges; boundary=") +
+			    sizeof(RespInstr->Ranges->Boundary)];
 
 	char *request_doc;
 	UpnpFileInfo *finfo;
@@ -1183,7 +1503,6 @@ static int process_request(
 	const char *temp_str;
 	int resp_major;
 	int resp_minor;
-	int alias_grabbed;
 	size_t dummy;
 	memptr hdr_value;
 
@@ -1197,7 +1516,7 @@ static int process_request(
 	memset(&finfo, 0, sizeof(finfo));
 	request_doc = NULL;
 	finfo = UpnpFileInfo_new();
-	alias_grabbed = 0;
+	etag_header[0] = '\0';
 	err_code = HTTP_INTERNAL_SERVER_ERROR; /* default error */
 	using_virtual_dir = 0;
 	using_alias = 0;
@@ -1227,7 +1546,7 @@ static int process_request(
 		err_code = HTTP_BAD_REQUEST;
 		goto error_handler;
 	}
-	if (isFileInVirtualDir(request_doc, &RespInstr->Cookie)) {
+	if (web_vdir_lookup(request_doc, &RespInstr->Cookie)) {
 		using_virtual_dir = 1;
 		RespInstr->IsVirtualFile = 1;
 		if (membuffer_assign_str(filename, request_doc) != 0) {
@@ -1235,17 +1554,12 @@ static int process_request(
 		}
 	} else {
 		/* try using alias */
-		if (is_valid_alias(&gAliasDoc)) {
-			alias_grab(alias);
-			alias_grabbed = 1;
-			using_alias = get_alias(request_doc, alias, finfo);
-			if (using_alias == 1) {
-				UpnpFileInfo_set_ContentType(
-					finfo, "text/xml; charset=\"utf-8\"");
-				if (UpnpFileInfo_get_ContentType(finfo) ==
-					NULL) {
-					goto error_handler;
-				}
+		using_alias = get_alias(request_doc, &alias, finfo);
+		if (using_alias == 1) {
+			UpnpFileInfo_set_ContentType(
+				finfo, "text/xml; charset=\"utf-8\"");
+			if (UpnpFileInfo_get_ContentType(finfo) == NULL) {
+				goto error_handler;
 			}
 		}
 	}
@@ -1331,7 +1645,8 @@ static int process_request(
 		}
 		if (req->method != HTTPMETHOD_POST) {
 			/* get info on file */
-			if (get_file_info(filename->buf, finfo) != 0) {
+			if (get_cached_file_info(filename->buf, finfo, &entry) !=
+				0) {
 				err_code = HTTP_NOT_FOUND;
 				goto error_handler;
 			}
@@ -1348,7 +1663,8 @@ static int process_request(
 					goto error_handler;
 				}
 				/* get info */
-				if (get_file_info(filename->buf, finfo) != 0 ||
+				if (get_cached_file_info(
+					    filename->buf, finfo, &entry) != 0 ||
 					UpnpFileInfo_get_IsDirectory(finfo)) {
 					err_code = HTTP_NOT_FOUND;
 					goto error_handler;
@@ -1367,6 +1683,79 @@ static int process_request(
 		/*          goto error_handler; */
 		/*      } */
 	}
+	if (!using_virtual_dir && req->method != HTTPMETHOD_POST) {
+		/* validators of the alias or of a document root file */
+		aux_LastModified = UpnpFileInfo_get_LastModified(finfo);
+		if (using_alias) {
+			etag = alias->etag;
+			deflated = &alias->deflated;
+		} else if (entry) {
+			etag = entry->etag;
+			deflated = &entry->deflated;
+		} else {
+			/* not cached, the same tag as if it were */
+			web_cache_make_file_etag(file_etag,
+				(uint64_t)UpnpFileInfo_get_FileLength(finfo),
+				aux_LastModified);
+			etag = file_etag;
+		}
+		if (deflated && deflated->stream) {
+			/* A compressed variant exists; it is never sent in
+			 * parts nor chunked. */
+			if ((req->method == HTTPMETHOD_GET ||
+				    req->method == HTTPMETHOD_HEAD) &&
+				!httpmsg_find_hdr(req, HDR_RANGE, NULL) &&
+				!httpmsg_find_hdr(req, HDR_TE, NULL)) {
+				coding = http_select_coding(req);
+			}
+			if (coding != HTTP_CODING_IDENTITY) {
+				/* the variant has its own entity tag */
+				snprintf(file_etag,
+					sizeof(file_etag),
+					"%.*s-%s\"",
+					(int)strlen(etag) - 1,
+					etag,
+					coding == HTTP_CODING_GZIP ? "gz"
+								   : "df");
+				etag = file_etag;
+			}
+			snprintf(etag_header,
+				sizeof(etag_header),
+				"ETAG: %s\r\n%s%s%sVARY: Accept-Encoding\r\n",
+				etag,
+				coding ? "CONTENT-ENCODING: " : "",
+				coding ? http_coding_name(coding) : "",
+				coding ? "\r\n" : "");
+		} else {
+			snprintf(etag_header,
+				sizeof(etag_header),
+				"ETAG: %s\r\n",
+				etag);
+		}
+		if (is_not_modified(req, etag, aux_LastModified)) {
+			if (http_MakeMessage(headers,
+				    resp_major,
+				    resp_minor,
+				    "R"
+				    "D"
+				    "s"
+				    "tc"
+				    "s"
+				    "S"
+				    "Xc"
+				    "Cc",
+				    HTTP_NOT_MODIFIED, /* status code */
+				    "LAST-MODIFIED: ",
+				    &aux_LastModified,
+				    etag_header,
+				    X_USER_AGENT) != 0) {
+				goto error_handler;
+			}
+			*rtype = RESP_HEADERS;
+			err_code = HTTP_OK;
+			goto error_handler;
+		}
+	}
 	RespInstr->ReadSendSize = UpnpFileInfo_get_FileLength(finfo);
 	/* Check other header field. */
 	code = CheckOtherHTTPHeaders(
@@ -1375,6 +1764,11 @@ static int process_request(
 		err_code = code;
 		goto error_handler;
 	}
+	if (coding != HTTP_CODING_IDENTITY) {
+		RespInstr->ContentCoding = (int)coding;
+		RespInstr->ReadSendSize = (off_t)(deflated->length +
+						  http_coding_overhead(coding));
+	}
 	if (req->method == HTTPMETHOD_POST) {
 		*rtype = RESP_POST;
 		err_code = HTTP_OK;
@@ -1396,8 +1790,54 @@ static int process_request(
 		}
 	}
 
+	/* the parts of an alias or chunked document are not sent separately */
+	if (RespInstr->Ranges &&
+		(using_alias || RespInstr->IsChunkActive ||
+			strlen(UpnpFileInfo_get_ContentType(finfo)) >=
+				sizeof(RespInstr->Ranges->ContentType))) {
+		RespInstr->IsRangeActive = 0;
+		free(RespInstr->Ranges);
+		RespInstr->Ranges = NULL;
+		RespInstr->ReadSendSize = UpnpFileInfo_get_FileLength(finfo);
+	}
 	aux_LastModified = UpnpFileInfo_get_LastModified(finfo);
-	if (RespInstr->IsRangeActive && RespInstr->IsChunkActive) {
+	if (RespInstr->Ranges) {
+		/* Content-Type: multipart/byteranges HTTP_PARTIAL_CONTENT */
+		strcpy(RespInstr->Ranges->ContentType,
+			UpnpFileInfo_get_ContentType(finfo));
+		snprintf(RespInstr->Ranges->Boundary,
+			sizeof(RespInstr->Ranges->Boundary),
+			"%08lx%08x",
+			(unsigned long)time(NULL),
+			(unsigned int)ithread_atomic_add(&gBoundaryCount, 1));
+		snprintf(multipart_type,
+			sizeof(multipart_type),
+			"multipart/byteranges; boundary=%s",
+			RespInstr->Ranges->Boundary);
+		RespInstr->ReadSendSize = multipart_length(RespInstr->Ranges);
+		if (http_MakeMessage(headers,
+			    resp_major,
+			    resp_minor,
+			    "R"
+			    "N"
+			    "T"
+			    "LD"
+			    "s"
+			    "tcsS"
+			    "Xc"
+			    "ECc",
+			    HTTP_PARTIAL_CONTENT,    /* status code */
+			    RespInstr->ReadSendSize, /* content length */
+			    multipart_type,	     /* content type */
+			    RespInstr,		     /* language info */
+			    "LAST-MODIFIED: ",
+			    &aux_LastModified,
+			    etag_header,
+			    X_USER_AGENT,
+			    UpnpFileInfo_get_ExtraHeadersList(finfo)) != 0) {
+			goto error_handler;
+		}
+	} else if (RespInstr->IsRangeActive && RespInstr->IsChunkActive) {
 		/* Content-Range: bytes 222-3333/4000  HTTP_PARTIAL_CONTENT */
 		/* Transfer-Encoding: chunked */
 		if (http_MakeMessage(headers,
@@ -1407,7 +1847,7 @@ static int process_request(
 			    "T"
 			    "GKLD"
 			    "s"
-			    "tcS"
+			    "tcsS"
 			    "Xc"
 			    "ECc",
 			    HTTP_PARTIAL_CONTENT, /* status code */
@@ -1417,6 +1857,7 @@ static int process_request(
 			    RespInstr,	    /* language info */
 			    "LAST-MODIFIED: ",
 			    &aux_LastModified,
+			    etag_header,
 			    X_USER_AGENT,
 			    UpnpFileInfo_get_ExtraHeadersList(finfo)) != 0) {
 			goto error_handler;
@@ -1431,7 +1872,7 @@ static int process_request(
 			    "T"
 			    "GLD"
 			    "s"
-			    "tcS"
+			    "tcsS"
 			    "Xc"
 			    "ECc",
 			    HTTP_PARTIAL_CONTENT,    /* status code */
@@ -1442,6 +1883,7 @@ static int process_request(
 			    RespInstr,	    /* language info */
 			    "LAST-MODIFIED: ",
 			    &aux_LastModified,
+			    etag_header,
 			    X_USER_AGENT,
 			    UpnpFileInfo_get_ExtraHeadersList(finfo)) != 0) {
 			goto error_handler;
@@ -1454,7 +1896,7 @@ static int process_request(
 			    "RK"
 			    "TLD"
 			    "s"
-			    "tcS"
+			    "tcsS"
 			    "Xc"
 			    "ECc",
 			    HTTP_OK, /* status code */
@@ -1463,6 +1905,7 @@ static int process_request(
 			    RespInstr,	    /* language info */
 			    "LAST-MODIFIED: ",
 			    &aux_LastModified,
+			    etag_header,
 			    X_USER_AGENT,
 			    UpnpFileInfo_get_ExtraHeadersList(finfo)) != 0) {
 			goto error_handler;
@@ -1477,7 +1920,7 @@ static int process_request(
 				    "N"
 				    "TLD"
 				    "s"
-				    "tcS"
+				    "tcsS"
 				    "Xc"
 				    "ECc",
 				    HTTP_OK, /* status code */
@@ -1488,6 +1931,7 @@ static int process_request(
 				    RespInstr,	    /* language info */
 				    "LAST-MODIFIED: ",
 				    &aux_LastModified,
+				    etag_header,
 				    X_USER_AGENT,
 				    UpnpFileInfo_get_ExtraHeadersList(finfo)) !=
 				0) {
@@ -1500,7 +1944,7 @@ static int process_request(
 				    "R"
 				    "TLD"
 				    "s"
-				    "tcS"
+				    "tcsS"
 				    "Xc"
 				    "ECc",
 				    HTTP_OK, /* status code */
@@ -1509,6 +1953,7 @@ static int process_request(
 				    RespInstr,	    /* language info */
 				    "LAST-MODIFIED: ",
 				    &aux_LastModified,
+				    etag_header,
 				    X_USER_AGENT,
 				    UpnpFileInfo_get_ExtraHeadersList(finfo)) !=
 				0) {
@@ -1523,6 +1968,11 @@ static int process_request(
 		*rtype = RESP_XMLDOC;
 	} else if (using_virtual_dir) {
 		*rtype = RESP_WEBDOC;
+	} else if (entry && !RespInstr->IsChunkActive) {
+		/* GET cached file */
+		*rtype = RESP_CACHEDOC;
+		*cached = entry;
+		entry = NULL;
 	} else {
 		/* GET filename */
 		*rtype = RESP_FILEDOC;
@@ -1536,10 +1986,14 @@ static int process_request(
 
 error_handler:
 	free(request_doc);
+	web_cache_release(entry);
 	FreeExtraHTTPHeaders(
 		(UpnpListHead *)UpnpFileInfo_get_ExtraHeadersList(finfo));
 	UpnpFileInfo_delete(finfo);
-	if (err_code != HTTP_OK && alias_grabbed) {
+	/* only an alias document being sent is released by the caller */
+	if (alias && err_code == HTTP_OK && *rtype == RESP_XMLDOC) {
+		*xmldoc = alias;
+	} else if (alias) {
 		alias_release(alias);
 	}
 
@@ -1697,6 +2151,258 @@ ExitFunction:
 	return ret_code;
 }
 
+/*!
+ * \brief Sends the headers and the compressed variant of a document, wrapped
+ * for the coding of the response.
+ */
+static void send_deflated(
+	/*! [in] Socket info. */
+	SOCKINFO *info,
+	/*! [in,out] Send timeout. */
+	int *timeout,
+	/*! [in] Send instruction, with the coding. */
+	struct SendInstruction *RespInstr,
+	/*! [in] Headers. */
+	membuffer *headers,
+	/*! [in] Compressed document. */
+	const web_cache_deflated *deflated,
+	/*! [in] Length of the uncompressed document. */
+	size_t length)
+{
+	http_coding_t coding = (http_coding_t)RespInstr->ContentCoding;
+	unsigned char header[HTTP_CODING_HEADER_SIZE];
+	unsigned char trailer[HTTP_CODING_TRAILER_SIZE];
+	size_t header_len;
+	size_t trailer_len;
+
+	header_len = http_coding_header(coding, header);
+	trailer_len = http_coding_trailer(
+		coding, deflated->crc, deflated->adler, length, trailer);
+	http_SendMessage(info,
+		timeout,
+		"Ibbbb",
+		RespInstr,
+		headers->buf,
+		headers->length,
+		(char *)header,
+		header_len,
+		deflated->stream,
+		deflated->length,
+		(char *)trailer,
+		trailer_len);
+}
+
+/*!
+ * \brief Sends the headers and the body of a response, either a file or a
+ * cached content, in parts for a multipart/byteranges response.
+ *
+ * The parts are read straight from the file, which http_SendMessage() opens
+ * once for all of them, or from the cached content, between their headers.
+ */
+static void send_body(
+	/*! [in] Socket info. */
+	SOCKINFO *info,
+	/*! [in,out] Send timeout. */
+	int *timeout,
+	/*! [in] Send instruction of the response. */
+	const struct SendInstruction *RespInstr,
+	/*! [in] Headers. */
+	const membuffer *headers,
+	/*! [in] Name of the file, if content is NULL. */
+	const char *filename,
+	/*! [in] Cached content, or NULL. */
+	const char *content)
+{
+	const struct SendRanges *ranges = RespInstr->Ranges;
+	struct SendInstruction part = *RespInstr;
+	char buf[WEB_SERVER_PART_HEADER_SIZE];
+	size_t len;
+	int i;
+
+	if (!content) {
+		http_SendMessage(info,
+			timeout,
+			"Ibf",
+			&part,
+			headers->buf,
+			headers->length,
+			filename);
+		return;
+	}
+	if (!ranges) {
+		/* the range, if any, is within the cached content */
+		http_SendMessage(info,
+			timeout,
+			"Ibb",
+			&part,
+			headers->buf,
+			headers->length,
+			content + RespInstr->RangeOffset,
+			(size_t)RespInstr->ReadSendSize);
+		return;
+	}
+	if (http_SendMessage(
+		    info, timeout, "b", headers->buf, headers->length) != 0)
+		return;
+	part.Ranges = NULL;
+	for (i = 0; i < ranges->Count; i++) {
+		len = web_server_part_header(ranges, i, buf, sizeof(buf));
+		part.RangeOffset = ranges->Offsets[i];
+		part.ReadSendSize = ranges->Lengths[i];
+		if (http_SendMessage(info,
+			    timeout,
+			    "Ibb",
+			    &part,
+			    buf,
+			    len,
+			    content + part.RangeOffset,
+			    (size_t)part.ReadSendSize) != 0)
+			return;
+	}
+	len = web_server_part_header(ranges, i, buf, sizeof(buf));
+	http_SendMessage(info, timeout, "b", buf, len);
+}
+
+/*!
+ * \brief File response sent by the stream thread pool.
+ */
+typedef struct
+{
+	/*! Socket info of the connection, which the job owns. */
+	SOCKINFO info;
+	/*! Send instruction of the response. */
+	struct SendInstruction RespInstr;
+	/*! Headers of the response. */
+	membuffer headers;
+	/*! Name of the file. */
+	membuffer filename;
+} stream_job;
+
+/*!
+ * \brief Frees a stream job, closing its connection.
+ */
+static void stream_job_free(
+	/*! [in] Stream job. */
+	void *arg)
+{
+	stream_job *job = (stream_job *)arg;
+
+	sock_destroy(&job->info, SD_BOTH);
+	membuffer_destroy(&job->headers);
+	membuffer_destroy(&job->filename);
+	free(job->RespInstr.Ranges);
+	free(job);
+}
+
+/*!
+ * \brief Sends a file response, run by the stream thread pool.
+ */
+static void stream_job_send(
+	/*! [in] Stream job. */
+	void *arg)
+{
+	stream_job *job = (stream_job *)arg;
+	int timeout = -1;
+
+	send_body(&job->info,
+		&timeout,
+		&job->RespInstr,
+		&job->headers,
+		job->filename.buf,
+		NULL);
+	stream_job_free(job);
+}
+
+/*!
+ * \brief Hands a file response to the stream thread pool.
+ *
+ * On success, the job owns the socket, which is set to INVALID_SOCKET in
+ * the socket info, the headers and file name, which are emptied, and the
+ * parts of the send instruction, which are set to NULL.
+ *
+ * \return UPNP_E_SUCCESS, UPNP_E_OUTOF_MEMORY, or an error code of
+ * ThreadPoolAdd() if the pool is full.
+ */
+static int stream_handoff(
+	/*! [in,out] Socket info of the connection. */
+	SOCKINFO *info,
+	/*! [in,out] Send instruction of the response. */
+	struct SendInstruction *RespInstr,
+	/*! [in,out] Headers of the response. */
+	membuffer *headers,
+	/*! [in,out] Name of the file. */
+	membuffer *filename)
+{
+	ThreadPoolJob job;
+	stream_job *sjob;
+	int ret;
+
+	sjob = (stream_job *)malloc(sizeof(*sjob));
+	if (!sjob)
+		return UPNP_E_OUTOF_MEMORY;
+	sjob->info = *info;
+	sjob->RespInstr = *RespInstr;
+	/* the job may run before ThreadPoolAdd() returns */
+	sjob->headers = *headers;
+	sjob->filename = *filename;
+	membuffer_init(headers);
+	membuffer_init(filename);
+	memset(&job, 0, sizeof(job));
+	TPJobInit(&job, (start_routine)stream_job_send, sjob);
+	TPJobSetFreeFunction(&job, (free_routine)stream_job_free);
+	TPJobSetPriority(&job, MED_PRIORITY);
+	ret = ThreadPoolAdd(&gStreamThreadPool, &job, NULL);
+	if (ret != 0) {
+		*headers = sjob->headers;
+		*filename = sjob->filename;
+		free(sjob);
+		return ret;
+	}
+	info->socket = INVALID_SOCKET;
+	RespInstr->Ranges = NULL;
+
+	return UPNP_E_SUCCESS;
+}
+
+/*!
+ * \brief Sends a file response, from the stream thread pool if the body is
+ * large or of unknown length, 503 Service Unavailable if that pool is full.
+ */
+static void send_file(
+	/*! [in,out] Socket info of the connection. */
+	SOCKINFO *info,
+	/*! [in] Request. */
+	http_message_t *req,
+	/*! [in] Send instruction of the response. */
+	struct SendInstruction *RespInstr,
+	/*! [in,out] Headers of the response. */
+	membuffer *headers,
+	/*! [in,out] Name of the file. */
+	membuffer *filename)
+{
+	int timeout = -1;
+	int ret;
+
+	if (RespInstr->ReadSendSize < 0 ||
+		RespInstr->ReadSendSize >= WEB_SERVER_STREAM_MIN_SIZE) {
+		ret = stream_handoff(info, RespInstr, headers, filename);
+		if (ret == UPNP_E_SUCCESS)
+			return;
+		if (ret != UPNP_E_OUTOF_MEMORY) {
+			UpnpPrintf(UPNP_INFO,
+				HTTP,
+				__FILE__,
+				__LINE__,
+				"webserver: stream thread pool full.\n");
+			http_SendBusyResponse(info,
+				req->major_version,
+				req->minor_version);
+			return;
+		}
+	}
+	send_body(info, &timeout, RespInstr, headers, filename->buf, NULL);
+}
+
 void web_server_callback(
 	http_parser_t *parser, /* INOUT */ http_message_t *req, SOCKINFO *info)
 {
@@ -1705,7 +2411,8 @@ void web_server_callback(
 	enum resp_type rtype = 0;
 	membuffer headers;
 	membuffer filename;
-	struct xml_alias_t xmldoc;
+	struct xml_alias_t *xmldoc = NULL;
+	web_cache_entry *cached = NULL;
 	struct SendInstruction RespInstr;
 
 	/* init */
@@ -1715,8 +2422,14 @@ void web_server_callback(
 
 	/* Process request should create the different kind of header depending
 	 * on the type of request. */
-	ret = process_request(
-		info, req, &rtype, &headers, &filename, &xmldoc, &RespInstr);
+	ret = process_request(info,
+		req,
+		&rtype,
+		&headers,
+		&filename,
+		&xmldoc,
+		&cached,
+		&RespInstr);
 	if (ret != HTTP_OK) {
 		/* send error code */
 		http_SendStatusResponse(
@@ -1725,37 +2438,58 @@ void web_server_callback(
 		/* send response */
 		switch (rtype) {
 		case RESP_FILEDOC:
-			http_SendMessage(info,
-				&timeout,
-				"Ibf",
-				&RespInstr,
-				headers.buf,
-				headers.length,
-				filename.buf);
+			send_file(info, req, &RespInstr, &headers, &filename);
 			break;
 		case RESP_XMLDOC:
-			http_SendMessage(info,
-				&timeout,
-				"Ibb",
-				&RespInstr,
-				headers.buf,
-				headers.length,
-				xmldoc.doc.buf,
-				xmldoc.doc.length);
-			alias_release(&xmldoc);
+			if (RespInstr.ContentCoding != HTTP_CODING_IDENTITY) {
+				send_deflated(info,
+					&timeout,
+					&RespInstr,
+					&headers,
+					&xmldoc->deflated,
+					xmldoc->doc.length);
+			} else {
+				http_SendMessage(info,
+					&timeout,
+					"Ibb",
+					&RespInstr,
+					headers.buf,
+					headers.length,
+					xmldoc->doc.buf,
+					xmldoc->doc.length);
+			}
+			alias_release(xmldoc);
+			break;
+		case RESP_CACHEDOC:
+			if (RespInstr.ContentCoding != HTTP_CODING_IDENTITY) {
+				send_deflated(info,
+					&timeout,
+					&RespInstr,
+					&headers,
+					&cached->deflated,
+					cached->length);
+			} else {
+				send_body(info,
+					&timeout,
+					&RespInstr,
+					&headers,
+					NULL,
+					cached->content);
+			}
+			web_cache_release(cached);
 			break;
 		case RESP_WEBDOC:
-			/*http_SendVirtualDirDoc(info, &timeout, "Ibf",
-				&RespInstr,
-				headers.buf, headers.length,
-				filename.buf);*/
-			http_SendMessage(info,
-				&timeout,
-				"Ibf",
-				&RespInstr,
-				headers.buf,
-				headers.length,
-				filename.buf);
+			/* streamed by the application if it accepts to,
+			 * unless sent in parts */
+			if (virtualDirCallback.open_stream &&
+				!RespInstr.Ranges &&
+				web_stream_start(info,
+					&RespInstr,
+					&headers,
+					filename.buf) == UPNP_E_SUCCESS) {
+				break;
+			}
+			send_file(info, req, &RespInstr, &headers, &filename);
 			break;
 		case RESP_HEADERS:
 			/* headers only */
@@ -1798,6 +2532,7 @@ void web_server_callback(
 		__FILE__,
 		__LINE__,
 		"webserver: request processed...\n");
+	free(RespInstr.Ranges);
 	membuffer_destroy(&headers);
 	membuffer_destroy(&filename);
 }
@@ -0,0 +1,1043 @@
+/*!
+ * \file
+ *
+ * \brief Response bodies of virtual directory files streamed by the
+ * application.
+ *
+ * The streams driven by the miniserver thread are kept in a list. One mutex
+ * protects the list and the streams: the application queues data at the
+ * tail of a stream and the miniserver thread sends it from the head. A
+ * stream is reference counted by the application until it closes the
+ * stream, by the miniserver thread until the connection ends, by the job
+ * giving its events and by the job reading its file, if any.
+ *
+ * The miniserver thread only writes to the sockets, which do not block: the
+ * file ranges are read by jobs of the stream thread pool.
+ */
+
+#include "config.h"
+
+#if EXCLUDE_WEB_SERVER == 0
+
+	#include "webstream.h"
+
+	#include "ThreadPool.h"
+	#include "VirtualDir.h"
+	#include "httpreadwrite.h"
+	#include "ithread.h"
+	#include "miniserver.h"
+	#include "upnpapi.h"
+	#include "upnputil.h"
+	#include "webrate.h"
+
+	#include <errno.h>
+	#include <stdio.h>
+	#include <stdlib.h>
+	#include <string.h>
+	#include <time.h>
+
+	#ifdef _WIN32
+		#include <io.h>
+	#else
+		#include <unistd.h>
+	#endif
+
+	#include "posix_overwrites.h"
+
+	#ifndef MSG_NOSIGNAL
+		#define MSG_NOSIGNAL 0
+	#endif
+
+	/*! Room for the size line of a chunk: hexadecimal size and CRLF. */
+	#define WEB_STREAM_CHUNK_HEADER_SIZE 20
+
+/*! Data queued in a stream: a buffer, or a range of a file. */
+typedef struct web_stream_buf
+{
+	/*! Next data queued. */
+	struct web_stream_buf *next;
+	/*! File descriptor of a file range, -1 for a buffer. */
+	int fd;
+	/*! Offset in the file of the next byte of the range to read. */
+	off_t offset;
+	/*! Bytes left to send, or to read for a file range. */
+	size_t length;
+	/*! Next byte of the buffer to send. */
+	char *data;
+	/*! Read-ahead of a file range. */
+	http_readahead ra;
+} web_stream_buf;
+
+struct s_UpnpWebStream
+{
+	/*! Next stream driven by the miniserver thread. */
+	struct s_UpnpWebStream *next;
+	/*! Connection, owned by the stream. */
+	SOCKINFO info;
+	/*! Cookie of the virtual directory. */
+	const void *cookie;
+	/*! Cookie of the request. */
+	const void *request_cookie;
+	/*! Number of references. */
+	int refs;
+	/*! Whether the body is sent chunked. */
+	int chunked;
+	/*! Bytes of the body the application may still queue, -1 if the
+	 * length is not limited. */
+	off_t remaining;
+	/*! Whether the application closed the stream. */
+	int closed;
+	/*! Whether the connection ended. */
+	int ended;
+	/*! Whether a write was refused and the application waits for
+	 * UPNP_WEBSTREAM_WRITABLE. */
+	int blocked;
+	/*! Events to give, a bit per Upnp_WebStreamEvent. */
+	int events;
+	/*! Whether a job of the send thread pool gives the events. */
+	int notifying;
+	/*! Whether a job of the stream thread pool reads the file range at
+	 * the head. */
+	int reading;
+	/*! Whether the file range at the head could not be read. */
+	int read_failed;
+	/*! Bytes of the queued buffers. */
+	size_t queued;
+	/*! First data queued. */
+	web_stream_buf *head;
+	/*! Last data queued. */
+	web_stream_buf *tail;
+	/*! Data read from the file range at the head, not sent yet. */
+	char *stage;
+	/*! Length of the data read. */
+	size_t stage_len;
+	/*! Bytes of the data read already sent. */
+	size_t stage_sent;
+	/*! Last time the stream sent data, got data to send or was closed. */
+	time_t progress;
+	/*! Shaping state of the connection. */
+	web_rate rate;
+	/*! Whether the socket was writable and the stream waits for the
+	 * shaper to send. */
+	int rate_wait;
+	/*! Whether the stream waited for the shaper and has its turn. */
+	int rate_turn;
+	/*! Next stream whose socket is to destroy, see stream_end(). */
+	struct s_UpnpWebStream *closing_next;
+};
+
+/*! Streams driven by the miniserver thread. */
+static UpnpWebStream *gStreams = NULL;
+/*! Protects gStreams, the streams and the flags below. */
+static ithread_mutex_t gStreamMutex = PTHREAD_MUTEX_INITIALIZER;
+/*! Whether the miniserver thread drives the streams. */
+static int gStreamsEnabled = 0;
+/*! Whether the miniserver thread was woken up and has not polled the
+ * streams since. */
+static int gStreamWake = 0;
+/*! Seconds without activity after which a stream is aborted. */
+static int gStreamTimeout = WEB_STREAM_TIMEOUT;
+
+/*!
+ * \brief Frees a stream that has no more references.
+ */
+static void stream_free(
+	/*! [in] Stream. */
+	UpnpWebStream *s)
+{
+	web_stream_buf *b;
+
+	while ((b = s->head) != NULL) {
+		s->head = b->next;
+		free(b);
+	}
+	free(s->stage);
+	free(s);
+}
+
+/*!
+ * \brief Drops a reference to a stream; gStreamMutex must be held.
+ *
+ * \return 1 if it was the last one and the stream is to be freed.
+ */
+static int stream_unref(
+	/*! [in] Stream. */
+	UpnpWebStream *s)
+{
+	return --s->refs == 0;
+}
+
+/*!
+ * \brief Returns whether a stream has data to send.
+ */
+static int stream_pending(
+	/*! [in] Stream. */
+	const UpnpWebStream *s)
+{
+	return s->head != NULL || s->stage_sent < s->stage_len;
+}
+
+/*!
+ * \brief Wakes the miniserver thread up, once until it polls the streams
+ * again; gStreamMutex must be held.
+ */
+static void stream_wake(void)
+{
+	if (gStreamsEnabled && !gStreamWake) {
+		gStreamWake = 1;
+		MiniServerWakeup();
+	}
+}
+
+/*!
+ * \brief Allocates the data of a buffer, framed as a chunk if needed.
+ *
+ * \return The data, or NULL if out of memory.
+ */
+static web_stream_buf *buf_new(
+	/*! [in] Data. */
+	const char *data,
+	/*! [in] Length of the data. */
+	size_t len,
+	/*! [in] Whether to frame the data as a chunk. */
+	int chunk)
+{
+	web_stream_buf *b;
+	size_t header_len = 0;
+
+	b = malloc(sizeof(*b) + WEB_STREAM_CHUNK_HEADER_SIZE + len + 2);
+	if (!b)
+		return NULL;
+	b->next = NULL;
+	b->fd = -1;
+	b->offset = 0;
+	b->data = (char *)(b + 1);
+	b->ra.fd = -1;
+	if (chunk) {
+		header_len = (size_t)snprintf(b->data,
+			WEB_STREAM_CHUNK_HEADER_SIZE,
+			"%" PRIzx "\r\n",
+			len);
+	}
+	if (len)
+		memcpy(b->data + header_len, data, len);
+	b->length = header_len + len;
+	if (chunk) {
+		memcpy(b->data + b->length, "\r\n", (size_t)2);
+		b->length += 2;
+	}
+
+	return b;
+}
+
+/*!
+ * \brief Queues data at the tail of a stream; gStreamMutex must be held.
+ */
+static void stream_queue(
+	/*! [in] Stream. */
+	UpnpWebStream *s,
+	/*! [in] Data, possibly several linked ones. */
+	web_stream_buf *b)
+{
+	s->progress = time(NULL);
+	if (s->tail)
+		s->tail->next = b;
+	else
+		s->head = b;
+	for (; b; b = b->next) {
+		if (b->fd < 0)
+			s->queued += b->length;
+		s->tail = b;
+	}
+	stream_wake();
+}
+
+/*!
+ * \brief Checks that the application can queue data in a stream;
+ * gStreamMutex must be held.
+ *
+ * \return UPNP_E_SUCCESS or the error code of UpnpWebStream_Write().
+ */
+static int stream_check(
+	/*! [in] Stream. */
+	const UpnpWebStream *s,
+	/*! [in] Number of bytes of the body to queue. */
+	size_t len)
+{
+	if (s->closed)
+		return UPNP_E_INVALID_PARAM;
+	if (s->ended)
+		return UPNP_E_SOCKET_WRITE;
+	if (s->remaining >= 0 && (off_t)len > s->remaining)
+		return UPNP_E_OUTOF_BOUNDS;
+
+	return UPNP_E_SUCCESS;
+}
+
+/*!
+ * \brief Gives the events of a stream to the application, from the send
+ * thread pool.
+ */
+static void stream_notify(
+	/*! [in] Stream. */
+	void *arg)
+{
+	UpnpWebStream *s = (UpnpWebStream *)arg;
+	VDCallback_StreamEvent callback = virtualDirCallback.stream_event;
+	Upnp_WebStreamEvent event;
+	int last;
+
+	ithread_mutex_lock(&gStreamMutex);
+	while (s->events) {
+		/* the last event, DONE or ABORTED, comes last */
+		if (s->events & (1 << UPNP_WEBSTREAM_WRITABLE))
+			event = UPNP_WEBSTREAM_WRITABLE;
+		else if (s->events & (1 << UPNP_WEBSTREAM_DONE))
+			event = UPNP_WEBSTREAM_DONE;
+		else
+			event = UPNP_WEBSTREAM_ABORTED;
+		s->events &= ~(1 << event);
+		ithread_mutex_unlock(&gStreamMutex);
+		callback(s, event, s->cookie, s->request_cookie);
+		ithread_mutex_lock(&gStreamMutex);
+	}
+	s->notifying = 0;
+	last = stream_unref(s);
+	ithread_mutex_unlock(&gStreamMutex);
+	if (last)
+		stream_free(s);
+}
+
+/*!
+ * \brief Releases a stream whose events job is dropped by the thread pool.
+ */
+static void stream_notify_free(
+	/*! [in] Stream. */
+	void *arg)
+{
+	UpnpWebStream *s = (UpnpWebStream *)arg;
+	int last;
+
+	ithread_mutex_lock(&gStreamMutex);
+	s->notifying = 0;
+	last = stream_unref(s);
+	ithread_mutex_unlock(&gStreamMutex);
+	if (last)
+		stream_free(s);
+}
+
+/*!
+ * \brief Posts an event of a stream; gStreamMutex must be held.
+ */
+static void stream_post(
+	/*! [in] Stream. */
+	UpnpWebStream *s,
+	/*! [in] Event. */
+	Upnp_WebStreamEvent event)
+{
+	if (virtualDirCallback.stream_event)
+		s->events |= 1 << event;
+}
+
+/*!
+ * \brief Schedules the job giving the posted events of a stream unless it
+ * is already running; gStreamMutex must be held.
+ *
+ * \return 0, or -1 if the job could not be scheduled, or not yet, and the
+ * events are still to give.
+ */
+static int stream_schedule(
+	/*! [in] Stream. */
+	UpnpWebStream *s)
+{
+	ThreadPoolJob job;
+
+	if (!s->events || s->notifying)
+		return 0;
+	/* the application may close the file on the last event */
+	if (s->reading)
+		return -1;
+	memset(&job, 0, sizeof(job));
+	TPJobInit(&job, (start_routine)stream_notify, s);
+	TPJobSetFreeFunction(&job, (free_routine)stream_notify_free);
+	TPJobSetPriority(&job, MED_PRIORITY);
+	s->notifying = 1;
+	s->refs++;
+	if (ThreadPoolAdd(&gSendThreadPool, &job, NULL) != 0) {
+		s->notifying = 0;
+		s->refs--;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*!
+ * \brief Ends a stream and posts its last event; gStreamMutex must be held.
+ *
+ * The stream is referenced and added to a list; its connection is closed by
+ * stream_close() once the mutex is released.
+ */
+static void stream_end(
+	/*! [in] Stream. */
+	UpnpWebStream *s,
+	/*! [in] UPNP_WEBSTREAM_DONE or UPNP_WEBSTREAM_ABORTED. */
+	Upnp_WebStreamEvent event,
+	/*! [in,out] Streams whose connection is to close. */
+	UpnpWebStream **closing)
+{
+	UpnpPrintf(UPNP_INFO,
+		HTTP,
+		__FILE__,
+		__LINE__,
+		"webstream %d: %s\n",
+		s->info.socket,
+		event == UPNP_WEBSTREAM_DONE ? "done" : "aborted");
+	s->ended = 1;
+	web_rate_cancel(&s->rate);
+	s->refs++;
+	s->closing_next = *closing;
+	*closing = s;
+	stream_post(s, event);
+}
+
+/*!
+ * \brief Closes the connections of the streams ended by stream_end() and
+ * drops the references it took; gStreamMutex must not be held.
+ */
+static void stream_close(
+	/*! [in] Streams whose connection is to close, may be NULL. */
+	UpnpWebStream *closing)
+{
+	UpnpWebStream *s;
+	UpnpWebStream *dead = NULL;
+
+	if (!closing)
+		return;
+	/* no other thread uses the socket of an ended stream */
+	for (s = closing; s; s = s->closing_next)
+		sock_destroy(&s->info, SD_BOTH);
+	ithread_mutex_lock(&gStreamMutex);
+	while ((s = closing) != NULL) {
+		closing = s->closing_next;
+		if (stream_unref(s)) {
+			s->closing_next = dead;
+			dead = s;
+		}
+	}
+	ithread_mutex_unlock(&gStreamMutex);
+	while ((s = dead) != NULL) {
+		dead = s->closing_next;
+		stream_free(s);
+	}
+}
+
+/*!
+ * \brief Returns whether the last socket call failed only because it would
+ * block.
+ */
+static int stream_would_block(void)
+{
+	#ifdef _WIN32
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+	#else
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+	#endif
+}
+
+/*!
+ * \brief Reads part of a file range.
+ *
+ * \return The number of bytes read, 0 at the end of the file, or -1 if the
+ * file could not be read.
+ */
+static ssize_t stream_pread(
+	/*! [in] File descriptor. */
+	int fd,
+	/*! [out] Buffer. */
+	char *buf,
+	/*! [in] Number of bytes to read. */
+	size_t len,
+	/*! [in] Offset in the file. */
+	off_t offset)
+{
+	ssize_t n;
+
+	#ifdef _WIN32
+	if (_lseeki64(fd, offset, SEEK_SET) < 0)
+		return -1;
+	n = _read(fd, buf, (unsigned int)len);
+	#else
+	do {
+		n = pread(fd, buf, len, offset);
+	} while (n < 0 && errno == EINTR);
+	#endif
+
+	return n;
+}
+
+/*!
+ * \brief Returns the number of bytes to read next from a file range.
+ */
+static size_t stream_read_size(
+	/*! [in] File range. */
+	const web_stream_buf *b)
+{
+	return b->length < WEB_STREAM_READ_SIZE ? b->length
+						: WEB_STREAM_READ_SIZE;
+}
+
+/*!
+ * \brief Stages the data read from the file range at the head of a stream;
+ * gStreamMutex must be held.
+ *
+ * \return 0, or -1 if the file could not be read or ended before the range.
+ */
+static int stream_stage(
+	/*! [in] Stream. */
+	UpnpWebStream *s,
+	/*! [in] File range at the head of the stream. */
+	web_stream_buf *b,
+	/*! [in] Value returned by stream_pread(). */
+	ssize_t n)
+{
+	if (n <= 0)
+		return -1;
+	s->stage_len = (size_t)n;
+	s->stage_sent = 0;
+	b->offset += (off_t)n;
+	b->length -= (size_t)n;
+	http_ReadAheadAdvance(&b->ra, b->offset);
+
+	return 0;
+}
+
+/*!
+ * \brief Ends the read of the job reading the file of a stream and drops
+ * its reference; gStreamMutex must be held.
+ *
+ * \return 1 if it was the last reference and the stream is to be freed.
+ */
+static int stream_read_end(
+	/*! [in] Stream. */
+	UpnpWebStream *s)
+{
+	s->reading = 0;
+	/* the miniserver sends the data, or schedules the deferred events */
+	stream_wake();
+	if (s->ended)
+		stream_schedule(s);
+
+	return stream_unref(s);
+}
+
+/*!
+ * \brief Reads the next part of the file range at the head of a stream,
+ * from the stream thread pool.
+ */
+static void stream_read_job(
+	/*! [in] Stream. */
+	void *arg)
+{
+	UpnpWebStream *s = (UpnpWebStream *)arg;
+	web_stream_buf *b;
+	int fd;
+	off_t offset;
+	size_t len;
+	ssize_t n;
+	int last;
+
+	/* the miniserver thread leaves the head and the stage alone while
+	 * the job reads */
+	ithread_mutex_lock(&gStreamMutex);
+	b = s->head;
+	fd = b->fd;
+	offset = b->offset;
+	len = stream_read_size(b);
+	ithread_mutex_unlock(&gStreamMutex);
+	n = stream_pread(fd, s->stage, len, offset);
+	ithread_mutex_lock(&gStreamMutex);
+	if (stream_stage(s, b, n) == 0)
+		s->progress = time(NULL);
+	else
+		s->read_failed = 1;
+	last = stream_read_end(s);
+	ithread_mutex_unlock(&gStreamMutex);
+	if (last)
+		stream_free(s);
+}
+
+/*!
+ * \brief Releases a stream whose read job is dropped by the thread pool.
+ */
+static void stream_read_free(
+	/*! [in] Stream. */
+	void *arg)
+{
+	UpnpWebStream *s = (UpnpWebStream *)arg;
+	int last;
+
+	ithread_mutex_lock(&gStreamMutex);
+	s->read_failed = 1;
+	last = stream_read_end(s);
+	ithread_mutex_unlock(&gStreamMutex);
+	if (last)
+		stream_free(s);
+}
+
+/*!
+ * \brief Reads the next part of the file range at the head of a stream;
+ * gStreamMutex must be held.
+ *
+ * The file is read by a job of the stream thread pool, or by the calling
+ * thread if the pool is full.
+ *
+ * \return 0, or -1 if the file could not be read or ended before the range.
+ */
+static int stream_read(
+	/*! [in] Stream. */
+	UpnpWebStream *s,
+	/*! [in] File range at the head of the stream. */
+	web_stream_buf *b)
+{
+	ThreadPoolJob job;
+	ssize_t n;
+
+	if (!s->stage) {
+		s->stage = malloc(WEB_STREAM_READ_SIZE);
+		if (!s->stage)
+			return -1;
+	}
+	memset(&job, 0, sizeof(job));
+	TPJobInit(&job, (start_routine)stream_read_job, s);
+	TPJobSetFreeFunction(&job, (free_routine)stream_read_free);
+	TPJobSetPriority(&job, MED_PRIORITY);
+	s->reading = 1;
+	s->refs++;
+	if (ThreadPoolAdd(&gStreamThreadPool, &job, NULL) == 0)
+		return 0;
+	s->reading = 0;
+	s->refs--;
+	n = stream_pread(b->fd, s->stage, stream_read_size(b), b->offset);
+
+	return stream_stage(s, b, n);
+}
+
+/*!
+ * \brief Sends the queued data of a stream until the socket would block, or
+ * WEB_SERVER_RATE_QUANTUM bytes of it when its turn comes if rates are
+ * limited.
+ *
+ * \return 0, or -1 if the connection failed.
+ */
+static int stream_send(
+	/*! [in] Stream. */
+	UpnpWebStream *s,
+	/*! [in] Current time. */
+	time_t now)
+{
+	web_stream_buf *b;
+	const char *data;
+	size_t len;
+	ssize_t n;
+	int shaped = web_rate_enabled();
+	int delay;
+
+	for (;;) {
+		b = s->head;
+		if (s->stage_sent < s->stage_len) {
+			data = s->stage + s->stage_sent;
+			len = s->stage_len - s->stage_sent;
+		} else if (!b) {
+			return 0;
+		} else if (b->length == 0) {
+			s->head = b->next;
+			if (!s->head)
+				s->tail = NULL;
+			free(b);
+			continue;
+		} else if (s->read_failed) {
+			return -1;
+		} else if (s->reading) {
+			return 0;
+		} else if (b->fd >= 0) {
+			if (stream_read(s, b) != 0)
+				return -1;
+			continue;
+		} else {
+			data = b->data;
+			len = b->length;
+		}
+		if (shaped) {
+			/* only streams that may send without blocking take
+			 * turns, else they would hold the others up */
+			s->rate_wait = !web_rate_poll(&s->rate, &delay);
+			if (s->rate_wait)
+				return 0;
+			if (len > WEB_SERVER_RATE_QUANTUM)
+				len = WEB_SERVER_RATE_QUANTUM;
+		}
+		n = send(s->info.socket, data, len, MSG_NOSIGNAL);
+		if (shaped)
+			web_rate_charge(&s->rate, n > 0 ? (size_t)n : 0);
+		if (n < 0)
+			return stream_would_block() ? 0 : -1;
+		s->progress = now;
+		if (s->stage_sent < s->stage_len) {
+			s->stage_sent += (size_t)n;
+		} else {
+			b->data += n;
+			b->length -= (size_t)n;
+			s->queued -= (size_t)n;
+		}
+		/* the others have their turn first */
+		if (shaped || (size_t)n < len)
+			return 0;
+	}
+}
+
+/*!
+ * \brief Reads and drops what the client sent on the connection of a
+ * stream.
+ *
+ * \return 1 if the client closed the connection or it failed, 0 otherwise.
+ */
+static int stream_peer_closed(
+	/*! [in] Stream. */
+	UpnpWebStream *s)
+{
+	char buf[256];
+	ssize_t n;
+
+	n = recv(s->info.socket, buf, sizeof(buf), MSG_NOSIGNAL);
+	if (n > 0)
+		return 0;
+
+	return n == 0 || !stream_would_block();
+}
+
+int web_stream_start(SOCKINFO *info,
+	const struct SendInstruction *instr,
+	const membuffer *headers,
+	const char *filename)
+{
+	UpnpWebStream *s;
+	UpnpWebStream *closing = NULL;
+	web_stream_buf *b;
+	int last;
+	int ret;
+	#ifdef SO_NOSIGPIPE
+	int set = 1;
+	#endif
+
+	if (!virtualDirCallback.open_stream || !gStreamsEnabled)
+		return UPNP_E_INVALID_PARAM;
+	#ifndef _WIN32
+	/* the miniserver thread polls with select() */
+	if (info->socket >= FD_SETSIZE)
+		return UPNP_E_OUTOF_SOCKET;
+	#endif
+	s = calloc((size_t)1, sizeof(*s));
+	if (!s)
+		return UPNP_E_OUTOF_MEMORY;
+	s->info = *info;
+	s->cookie = instr->Cookie;
+	s->request_cookie = instr->RequestCookie;
+	s->chunked = instr->IsChunkActive;
+	s->remaining = instr->IsChunkActive || instr->ReadSendSize < 0
+			       ? (off_t)-1
+			       : instr->ReadSendSize;
+	/* the application and the miniserver thread */
+	s->refs = 2;
+	if (headers->length) {
+		b = buf_new(headers->buf, headers->length, 0);
+		if (!b) {
+			free(s);
+			return UPNP_E_OUTOF_MEMORY;
+		}
+		s->head = b;
+		s->tail = b;
+		s->queued = b->length;
+	}
+	if (sock_make_no_blocking(info->socket) != 0) {
+		stream_free(s);
+		return UPNP_E_SOCKET_ERROR;
+	}
+	#ifdef SO_NOSIGPIPE
+	setsockopt(info->socket, SOL_SOCKET, SO_NOSIGPIPE, &set, sizeof(set));
+	#endif
+	ret = virtualDirCallback.open_stream(filename,
+		instr->RangeOffset,
+		instr->ReadSendSize,
+		s,
+		s->cookie,
+		s->request_cookie);
+	if (ret != 0) {
+		/* declined, the file is sent the synchronous way */
+		stream_free(s);
+		sock_make_blocking(info->socket);
+		return UPNP_E_CANCELED;
+	}
+	/* the stream owns the connection from now on */
+	info->socket = INVALID_SOCKET;
+	ithread_mutex_lock(&gStreamMutex);
+	if (gStreamsEnabled) {
+		s->next = gStreams;
+		gStreams = s;
+		s->progress = time(NULL);
+		stream_wake();
+		ithread_mutex_unlock(&gStreamMutex);
+		return UPNP_E_SUCCESS;
+	}
+	/* the miniserver stopped meanwhile */
+	stream_end(s, UPNP_WEBSTREAM_ABORTED, &closing);
+	stream_schedule(s);
+	last = stream_unref(s);
+	ithread_mutex_unlock(&gStreamMutex);
+	stream_close(closing);
+	if (last)
+		stream_free(s);
+
+	return UPNP_E_SUCCESS;
+}
+
+int web_stream_write(UpnpWebStream *stream, const char *buf, size_t buflen)
+{
+	web_stream_buf *b;
+	int ret;
+
+	ithread_mutex_lock(&gStreamMutex);
+	ret = stream_check(stream, buflen);
+	if (ret != UPNP_E_SUCCESS || buflen == 0)
+		goto exit_function;
+	if (stream->queued >= WEB_STREAM_MAX_QUEUED) {
+		stream->blocked = 1;
+		ret = UPNP_E_WOULD_BLOCK;
+		goto exit_function;
+	}
+	b = buf_new(buf, buflen, stream->chunked);
+	if (!b) {
+		ret = UPNP_E_OUTOF_MEMORY;
+		goto exit_function;
+	}
+	if (stream->remaining >= 0)
+		stream->remaining -= (off_t)buflen;
+	stream_queue(stream, b);
+
+exit_function:
+	ithread_mutex_unlock(&gStreamMutex);
+
+	return ret;
+}
+
+int web_stream_write_file(
+	UpnpWebStream *stream, int fd, off_t offset, size_t length)
+{
+	web_stream_buf *header = NULL;
+	web_stream_buf *range;
+	web_stream_buf *trailer = NULL;
+	int ret;
+
+	ithread_mutex_lock(&gStreamMutex);
+	ret = stream_check(stream, length);
+	if (ret != UPNP_E_SUCCESS || length == 0)
+		goto exit_function;
+	range = malloc(sizeof(*range));
+	if (stream->chunked) {
+		/* the size line before the range and the CRLF after it */
+		header = buf_new(NULL, (size_t)0, 0);
+		trailer = buf_new("\r\n", (size_t)2, 0);
+	}
+	if (!range || (stream->chunked && (!header || !trailer))) {
+		free(range);
+		free(header);
+		free(trailer);
+		ret = UPNP_E_OUTOF_MEMORY;
+		goto exit_function;
+	}
+	range->next = trailer;
+	range->fd = fd;
+	range->offset = offset;
+	range->length = length;
+	range->data = NULL;
+	http_ReadAheadStart(&range->ra, fd, offset, (off_t)length);
+	if (header) {
+		header->length = (size_t)snprintf(header->data,
+			WEB_STREAM_CHUNK_HEADER_SIZE,
+			"%" PRIzx "\r\n",
+			length);
+		header->next = range;
+		range = header;
+	}
+	if (stream->remaining >= 0)
+		stream->remaining -= (off_t)length;
+	stream_queue(stream, range);
+
+exit_function:
+	ithread_mutex_unlock(&gStreamMutex);
+
+	return ret;
+}
+
+int web_stream_close(UpnpWebStream *stream)
+{
+	web_stream_buf *b;
+	int last;
+
+	ithread_mutex_lock(&gStreamMutex);
+	if (stream->closed) {
+		ithread_mutex_unlock(&gStreamMutex);
+		return UPNP_E_INVALID_PARAM;
+	}
+	stream->closed = 1;
+	if (!stream->ended) {
+		if (stream->chunked) {
+			/* last chunk, without trailer; if it cannot be
+			 * queued, the client sees a truncated body */
+			b = buf_new("0\r\n\r\n", (size_t)5, 0);
+			if (b)
+				stream_queue(stream, b);
+		}
+		/* the miniserver thread ends the stream once it is sent */
+		stream->progress = time(NULL);
+		stream_wake();
+	}
+	last = stream_unref(stream);
+	ithread_mutex_unlock(&gStreamMutex);
+	if (last)
+		stream_free(stream);
+
+	return UPNP_E_SUCCESS;
+}
+
+void web_stream_set_timeout(int timeout)
+{
+	ithread_mutex_lock(&gStreamMutex);
+	gStreamTimeout = timeout;
+	ithread_mutex_unlock(&gStreamMutex);
+}
+
+void web_stream_enable(int enable)
+{
+	UpnpWebStream *s;
+	UpnpWebStream *dead = NULL;
+	UpnpWebStream *closing = NULL;
+
+	ithread_mutex_lock(&gStreamMutex);
+	gStreamsEnabled = enable;
+	gStreamWake = 0;
+	while (!enable && (s = gStreams) != NULL) {
+		gStreams = s->next;
+		if (!s->ended)
+			stream_end(s, UPNP_WEBSTREAM_ABORTED, &closing);
+		stream_schedule(s);
+		if (stream_unref(s)) {
+			s->next = dead;
+			dead = s;
+		}
+	}
+	ithread_mutex_unlock(&gStreamMutex);
+	stream_close(closing);
+	while ((s = dead) != NULL) {
+		dead = s->next;
+		stream_free(s);
+	}
+}
+
+int web_stream_fdset(fd_set *rdSet, fd_set *wrSet, SOCKET *nfds)
+{
+	UpnpWebStream *s;
+	int timeout = -1;
+	int shaped = web_rate_enabled();
+	int delay;
+	time_t now = time(NULL);
+
+	ithread_mutex_lock(&gStreamMutex);
+	gStreamWake = 0;
+	for (s = gStreams; s; s = s->next) {
+		s->rate_turn = 0;
+		if (s->ended) {
+			/* its last event is still to schedule */
+			timeout = 1000;
+			continue;
+		}
+		FD_SET(s->info.socket, rdSet);
+		if (s->info.socket >= *nfds)
+			*nfds = s->info.socket + 1;
+		/* the streams may time out */
+		if (timeout < 0 || timeout > 1000)
+			timeout = 1000;
+		/* the job reading the file wakes the thread up */
+		if (!stream_pending(s) || s->reading)
+			continue;
+		if (shaped && s->rate_wait) {
+			if (!web_rate_poll(&s->rate, &delay)) {
+				/* waiting for the shaper is no lack of
+				 * progress */
+				s->progress = now;
+				if (delay >= 0 && delay < timeout)
+					timeout = delay;
+				continue;
+			}
+			s->rate_turn = 1;
+		}
+		FD_SET(s->info.socket, wrSet);
+	}
+	ithread_mutex_unlock(&gStreamMutex);
+
+	return timeout;
+}
+
+void web_stream_process(fd_set *rdSet, fd_set *wrSet)
+{
+	UpnpWebStream **prev;
+	UpnpWebStream *s;
+	UpnpWebStream *dead = NULL;
+	UpnpWebStream *closing = NULL;
+	time_t now = time(NULL);
+
+	ithread_mutex_lock(&gStreamMutex);
+	prev = &gStreams;
+	while ((s = *prev) != NULL) {
+		if (!s->ended && FD_ISSET(s->info.socket, rdSet) &&
+			stream_peer_closed(s))
+			stream_end(s, UPNP_WEBSTREAM_ABORTED, &closing);
+		if (!s->ended && FD_ISSET(s->info.socket, wrSet)) {
+			if (stream_send(s, now) != 0)
+				stream_end(s, UPNP_WEBSTREAM_ABORTED, &closing);
+		} else if (!s->ended && s->rate_turn) {
+			/* no longer writable, the others have their turn */
+			web_rate_cancel(&s->rate);
+			s->rate_wait = 0;
+		}
+		/* a body of known length is complete once sent */
+		if (!s->ended && (s->closed || s->remaining == 0) &&
+			!stream_pending(s))
+			stream_end(s, UPNP_WEBSTREAM_DONE, &closing);
+		/* nothing sent nor queued, whether or not data waits */
+		if (!s->ended && now - s->progress > gStreamTimeout)
+			stream_end(s, UPNP_WEBSTREAM_ABORTED, &closing);
+		if (!s->ended && s->blocked &&
+			s->queued <= WEB_STREAM_MAX_QUEUED / 2) {
+			s->blocked = 0;
+			stream_post(s, UPNP_WEBSTREAM_WRITABLE);
+		}
+		/* retried on the next pass if the pool is full */
+		if (stream_schedule(s) == 0 && s->ended) {
+			*prev = s->next;
+			if (stream_unref(s)) {
+				s->next = dead;
+				dead = s;
+			}
+			continue;
+		}
+		prev = &s->next;
+	}
+	ithread_mutex_unlock(&gStreamMutex);
+	stream_close(closing);
+	while ((s = dead) != NULL) {
+		dead = s->next;
+		stream_free(s);
+	}
+}
+#endif /* EXCLUDE_WEB_SERVER */
@@ -0,0 +1,404 @@
+/*!
+ * \file
+ *
+ * \brief Virtual directories of the web server.
+ *
+ * The directories are kept in a list, protected by a mutex, from which a
+ * trie of path components is built after each change. Each node holds its
+ * children sorted by name and is a single allocation with its name, so a
+ * trie does not refer to the list.
+ */
+
+#include "config.h"
+
+#include "webvdir.h"
+
+#include "Atomic.h"
+#include "Epoch.h"
+#include "VirtualDir.h"
+#include "ithread.h"
+#include "upnp.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "posix_overwrites.h"
+
+/*! Node of the trie, for one path component. */
+typedef struct web_vdir_node
+{
+	/*! Path component, NUL terminated. */
+	char *name;
+	/*! Length of the name. */
+	size_t name_len;
+	/*! Whether a directory without trailing '/' ends here. */
+	int is_dir;
+	/*! Its cookie. */
+	const void *cookie;
+	/*! Whether a directory with a trailing '/' ends here. */
+	int is_slash_dir;
+	/*! Its cookie. */
+	const void *slash_cookie;
+	/*! Number of children. */
+	size_t count;
+	/*! Children sorted by name. */
+	struct web_vdir_node **children;
+} web_vdir_node;
+
+/*! Directories in the order they were added. */
+static virtualDirList *gVdirList = NULL;
+/*! Protects gVdirList and serializes the changes of gVdirRoot. */
+static ithread_mutex_t gVdirMutex = PTHREAD_MUTEX_INITIALIZER;
+/*! Root of the trie read by the lookups, NULL if there is no directory. */
+static web_vdir_node *gVdirRoot = NULL;
+/*! Lookups in gVdirRoot. */
+static Epoch gVdirEpoch = EPOCH_INITIALIZER;
+
+/*!
+ * \brief Compares the name of a node with a path component.
+ */
+static int node_cmp(
+	/*! [in] Node. */
+	const web_vdir_node *node,
+	/*! [in] Path component, not NUL terminated. */
+	const char *name,
+	/*! [in] Length of the path component. */
+	size_t len)
+{
+	size_t n = node->name_len < len ? node->name_len : len;
+	int cmp = memcmp(node->name, name, n);
+
+	if (cmp != 0)
+		return cmp;
+
+	return node->name_len < len ? -1 : node->name_len > len;
+}
+
+/*!
+ * \brief Finds the child of a node by binary search.
+ *
+ * \return The index of the child, or of its place if it is not there.
+ */
+static size_t node_find(
+	/*! [in] Node. */
+	const web_vdir_node *node,
+	/*! [in] Path component, not NUL terminated. */
+	const char *name,
+	/*! [in] Length of the path component. */
+	size_t len,
+	/*! [out] Whether the child is there. */
+	int *found)
+{
+	size_t lo = 0;
+	size_t hi = node->count;
+	size_t mid;
+	int cmp;
+
+	*found = 0;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = node_cmp(node->children[mid], name, len);
+		if (cmp == 0) {
+			*found = 1;
+			return mid;
+		}
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*!
+ * \brief Allocates a node.
+ *
+ * \return The node, or NULL if out of memory.
+ */
+static web_vdir_node *node_new(
+	/*! [in] Path component, not NUL terminated. */
+	const char *name,
+	/*! [in] Length of the path component. */
+	size_t len)
+{
+	web_vdir_node *node = malloc(sizeof(*node) + len + 1);
+
+	if (!node)
+		return NULL;
+	memset(node, 0, sizeof(*node));
+	node->name = (char *)(node + 1);
+	memcpy(node->name, name, len);
+	node->name[len] = '\0';
+	node->name_len = len;
+
+	return node;
+}
+
+/*!
+ * \brief Frees a node and its descendants.
+ */
+static void node_free(
+	/*! [in] Node, may be NULL. */
+	web_vdir_node *node)
+{
+	size_t i;
+
+	if (!node)
+		return;
+	for (i = 0; i < node->count; i++)
+		node_free(node->children[i]);
+	free(node->children);
+	free(node);
+}
+
+/*!
+ * \brief Returns the child of a node, adding it if it is not there.
+ *
+ * \return The child, or NULL if out of memory.
+ */
+static web_vdir_node *node_child(
+	/*! [in] Node of a trie being built. */
+	web_vdir_node *node,
+	/*! [in] Path component, not NUL terminated. */
+	const char *name,
+	/*! [in] Length of the path component. */
+	size_t len)
+{
+	web_vdir_node **children;
+	web_vdir_node *child;
+	size_t i;
+	int found;
+
+	i = node_find(node, name, len, &found);
+	if (found)
+		return node->children[i];
+	child = node_new(name, len);
+	if (!child)
+		return NULL;
+	children = realloc(
+		node->children, (node->count + 1) * sizeof(*node->children));
+	if (!children) {
+		free(child);
+		return NULL;
+	}
+	memmove(children + i + 1,
+		children + i,
+		(node->count - i) * sizeof(*children));
+	children[i] = child;
+	node->children = children;
+	node->count++;
+
+	return child;
+}
+
+/*!
+ * \brief Adds a directory to a trie being built.
+ *
+ * \return UPNP_E_SUCCESS or UPNP_E_OUTOF_MEMORY.
+ */
+static int trie_insert(
+	/*! [in] Root of the trie. */
+	web_vdir_node *root,
+	/*! [in] Directory. */
+	const virtualDirList *dir)
+{
+	web_vdir_node *node = root;
+	const char *p = dir->dirName;
+	const char *end;
+
+	if (*p == '/')
+		p++;
+	if (*p == '\0') {
+		/* "/" */
+		node->is_slash_dir = 1;
+		node->slash_cookie = dir->cookie;
+		return UPNP_E_SUCCESS;
+	}
+	for (;;) {
+		end = strchr(p, '/');
+		if (!end)
+			end = p + strlen(p);
+		node = node_child(node, p, (size_t)(end - p));
+		if (!node)
+			return UPNP_E_OUTOF_MEMORY;
+		if (*end == '\0') {
+			node->is_dir = 1;
+			node->cookie = dir->cookie;
+			return UPNP_E_SUCCESS;
+		}
+		p = end + 1;
+		if (*p == '\0') {
+			node->is_slash_dir = 1;
+			node->slash_cookie = dir->cookie;
+			return UPNP_E_SUCCESS;
+		}
+	}
+}
+
+/*!
+ * \brief Builds the trie of the directories of gVdirList and publishes it;
+ * gVdirMutex must be held.
+ *
+ * \return UPNP_E_SUCCESS or UPNP_E_OUTOF_MEMORY, in which case the trie is
+ * unchanged.
+ */
+static int trie_publish(void)
+{
+	web_vdir_node *root = NULL;
+	web_vdir_node *old;
+	const virtualDirList *dir;
+
+	if (gVdirList) {
+		root = node_new("", 0);
+		if (!root)
+			return UPNP_E_OUTOF_MEMORY;
+		for (dir = gVdirList; dir; dir = dir->next) {
+			if (trie_insert(root, dir) != UPNP_E_SUCCESS) {
+				node_free(root);
+				return UPNP_E_OUTOF_MEMORY;
+			}
+		}
+	}
+	old = ithread_atomic_exchange_ptr(&gVdirRoot, root);
+	EpochSynchronize(&gVdirEpoch);
+	node_free(old);
+
+	return UPNP_E_SUCCESS;
+}
+
+int web_vdir_add(
+	const char *dirName, const void *cookie, const void **oldcookie)
+{
+	virtualDirList *dir;
+	virtualDirList **last;
+	const void *previous;
+	int ret;
+
+	ithread_mutex_lock(&gVdirMutex);
+	for (last = &gVdirList; *last; last = &(*last)->next) {
+		dir = *last;
+		/* already has this entry */
+		if (strcmp(dir->dirName, dirName) == 0) {
+			previous = dir->cookie;
+			dir->cookie = cookie;
+			ret = trie_publish();
+			if (ret != UPNP_E_SUCCESS)
+				dir->cookie = previous;
+			else if (oldcookie != NULL)
+				*oldcookie = previous;
+			ithread_mutex_unlock(&gVdirMutex);
+			return ret;
+		}
+	}
+	dir = (virtualDirList *)malloc(sizeof(virtualDirList));
+	if (dir == NULL) {
+		ithread_mutex_unlock(&gVdirMutex);
+		return UPNP_E_OUTOF_MEMORY;
+	}
+	dir->next = NULL;
+	dir->cookie = cookie;
+	memset(dir->dirName, 0, sizeof(dir->dirName));
+	strncpy(dir->dirName, dirName, sizeof(dir->dirName) - 1);
+	*last = dir;
+	ret = trie_publish();
+	if (ret != UPNP_E_SUCCESS) {
+		*last = NULL;
+		free(dir);
+	} else if (oldcookie != NULL) {
+		*oldcookie = NULL;
+	}
+	ithread_mutex_unlock(&gVdirMutex);
+
+	return ret;
+}
+
+int web_vdir_remove(const char *dirName)
+{
+	virtualDirList *dir;
+	virtualDirList **prev;
+	int ret = UPNP_E_INVALID_PARAM;
+
+	ithread_mutex_lock(&gVdirMutex);
+	for (prev = &gVdirList; *prev; prev = &(*prev)->next) {
+		dir = *prev;
+		if (strcmp(dir->dirName, dirName) == 0) {
+			*prev = dir->next;
+			ret = trie_publish();
+			if (ret != UPNP_E_SUCCESS)
+				*prev = dir;
+			else
+				free(dir);
+			break;
+		}
+	}
+	ithread_mutex_unlock(&gVdirMutex);
+
+	return ret;
+}
+
+void web_vdir_remove_all(void)
+{
+	virtualDirList *dir;
+	virtualDirList *next;
+
+	ithread_mutex_lock(&gVdirMutex);
+	dir = gVdirList;
+	gVdirList = NULL;
+	/* publishing an empty trie allocates nothing */
+	trie_publish();
+	ithread_mutex_unlock(&gVdirMutex);
+	while (dir != NULL) {
+		next = dir->next;
+		free(dir);
+		dir = next;
+	}
+}
+
+int web_vdir_lookup(const char *path, const void **cookie)
+{
+	const web_vdir_node *node;
+	const void *match = NULL;
+	const char *p = path;
+	const char *end;
+	size_t i;
+	int matched = 0;
+	int found;
+	int token;
+
+	if (*p != '/')
+		return 0;
+	token = EpochEnter(&gVdirEpoch);
+	node = ithread_atomic_load_ptr(&gVdirRoot);
+	if (node && node->is_slash_dir) {
+		matched = 1;
+		match = node->slash_cookie;
+	}
+	p++;
+	/* the deepest directory wins */
+	while (node) {
+		end = p;
+		while (*end != '\0' && *end != '/' && *end != '?')
+			end++;
+		i = node_find(node, p, (size_t)(end - p), &found);
+		if (!found)
+			break;
+		node = node->children[i];
+		if (node->is_dir) {
+			matched = 1;
+			match = node->cookie;
+		}
+		if (*end != '/')
+			break;
+		if (node->is_slash_dir) {
+			matched = 1;
+			match = node->slash_cookie;
+		}
+		p = end + 1;
+	}
+	EpochLeave(&gVdirEpoch, token);
+	if (matched && cookie != NULL)
+		*cookie = match;
+
+	return matched;
+}
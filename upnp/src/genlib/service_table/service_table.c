@@ -39,6 +39,7 @@
 
 #include "service_table.h"
 #include "config.h"
+#include "soap_schema.h"
 
 #ifdef INCLUDE_DEVICE_APIS
 
@@ -587,6 +588,10 @@ void freeService(service_info *in)
 		if (in->subscriptionList)
 			freeSubscriptionList(in->subscriptionList);
 
+		#if EXCLUDE_SOAP == 0
+		soap_schema_free(in->schema);
+		#endif /* EXCLUDE_SOAP */
+
 		in->TotalSubscriptions = 0;
 		free(in);
 	}
@@ -624,6 +629,9 @@ void freeServiceList(service_info *head)
 			ixmlFreeDOMString(head->UDN);
 		if (head->subscriptionList)
 			freeSubscriptionList(head->subscriptionList);
+		#if EXCLUDE_SOAP == 0
+		soap_schema_free(head->schema);
+		#endif /* EXCLUDE_SOAP */
 
 		head->TotalSubscriptions = 0;
 		next = head->next;
@@ -787,6 +795,7 @@ service_info *getServiceList(IXML_Node *node, service_info **end, char *URLBase)
 				current->SCPDURL = NULL;
 				current->active = 1;
 				current->subscriptionList = NULL;
+				current->schema = NULL;
 				current->TotalSubscriptions = 0;
 				if (!(current->UDN = getElementValue(UDN)))
 					fail = 1;
@@ -242,6 +242,30 @@ int membuffer_insert(
 	return 0;
 }
 
+int membuffer_reserve(membuffer *m, size_t min_free)
+{
+	size_t new_length;
+
+	assert(m != NULL);
+
+	if (m->capacity - m->length >= min_free) {
+		return 0;
+	}
+	new_length = m->length + MAXVAL(min_free, m->capacity);
+
+	return membuffer_set_size(m, new_length);
+}
+
+void membuffer_commit(membuffer *m, size_t num_bytes)
+{
+	assert(m != NULL);
+	assert(num_bytes <= m->capacity - m->length);
+
+	m->length += num_bytes;
+	/* null-terminate */
+	m->buf[m->length] = 0;
+}
+
 void membuffer_delete(membuffer *m, size_t index, size_t num_bytes)
 {
 	int return_value;
@@ -55,6 +55,17 @@ struct VirtualDirCallbacks
 	 *  error.
 	 */
 	VDCallback_Close close;
+
+	/** Called by the web server, when it is set, instead of \b open to
+	 *  stream the body of a GET response: the application pushes the data
+	 *  into the stream and the library sends it without holding a thread.
+	 */
+	VDCallback_OpenStream open_stream;
+
+	/** Called by the web server to tell the application about a stream
+	 *  opened with \b open_stream.
+	 */
+	VDCallback_StreamEvent stream_event;
 };
 
 typedef struct virtual_Dir_List
@@ -134,6 +134,89 @@
 #define MAX_JOBS_TOTAL 100
 /* @} */
 
+/*!
+ * \name THREAD_QUEUE_MODE
+ *
+ * The THREAD_QUEUE_MODE constant determines how the send, receive and
+ * miniserver thread pools queue their jobs: SHARED_QUEUES makes every
+ * ThreadPoolAdd() and every worker go through the pool mutex, WORK_STEALING
+ * gives each worker its own queues, so that the threads adding jobs do not
+ * contend with the workers on many cores, and LOCK_FREE_QUEUES keeps the jobs
+ * in lock-free rings, so that the miniserver thread adding them never waits
+ * on a lock. See ThreadPool.h.
+ *
+ * SHARED_QUEUES is the default, the others are selected with configure
+ * --enable-work_stealing or --enable-lock_free_queues.
+ *
+ * @{
+ */
+#if defined(UPNP_ENABLE_LOCK_FREE_QUEUES)
+	#define THREAD_QUEUE_MODE LOCK_FREE_QUEUES
+#elif defined(UPNP_ENABLE_WORK_STEALING)
+	#define THREAD_QUEUE_MODE WORK_STEALING
+#else
+	#define THREAD_QUEUE_MODE SHARED_QUEUES
+#endif
+/* @} */
+
+/*!
+ * \name THREAD_ADAPTIVE_INTERVAL
+ *
+ * The THREAD_ADAPTIVE_INTERVAL constant determines every how many
+ * milliseconds the send, receive and miniserver thread pools are resized
+ * between MIN_THREADS and MAX_THREADS: a pool grows while its jobs wait
+ * longer than THREAD_ADAPTIVE_WAIT milliseconds in their queue, as long as
+ * the threads added raise the number of jobs run, or while its threads are
+ * all blocked, and it gives back one thread per THREAD_IDLE_TIME while its
+ * threads stay idle. 0 sizes the pools by JOBS_PER_THREAD instead.
+ *
+ * @{
+ */
+#define THREAD_ADAPTIVE_INTERVAL 250
+#define THREAD_ADAPTIVE_WAIT 20
+/* @} */
+
+/*!
+ * \name STREAM_MAX_THREADS
+ *
+ * The files of the web server whose body is at least
+ * WEB_SERVER_STREAM_MIN_SIZE bytes long, or of unknown length, are sent by
+ * a thread pool of their own, so that long transfers do not hold the
+ * threads answering the control, eventing and description requests. The
+ * pool runs at most STREAM_MAX_THREADS transfers at once and queues at most
+ * STREAM_MAX_JOBS_TOTAL more; further requests are answered with 503
+ * Service Unavailable. The defaults allow some 30 concurrent HD streams.
+ *
+ * @{
+ */
+#define STREAM_MAX_THREADS 32
+#define STREAM_MIN_THREADS 1
+#define STREAM_MAX_JOBS_TOTAL 32
+#define WEB_SERVER_STREAM_MIN_SIZE (off_t)(64 * 1024)
+/* @} */
+
+/*!
+ * \name LOAD_BUDGET_HTTP
+ *
+ * The default budgets of the classes of jobs, see UpnpSetLoadBudget(). The
+ * M-SEARCH replies waiting get half the room of the send thread pool, so
+ * that a discovery storm leaves room for the events. The requests shed are
+ * answered with 503 Service Unavailable and a Retry-After header of
+ * HTTP_BUSY_RETRY_AFTER seconds; the miniserver reads what the client sends
+ * on at most HTTP_BUSY_SOCKETS of their connections for HTTP_BUSY_LINGER
+ * seconds before closing them, so that the client gets the response rather
+ * than a connection reset.
+ *
+ * @{
+ */
+#define LOAD_BUDGET_HTTP 0
+#define LOAD_BUDGET_SSDP 0
+#define LOAD_BUDGET_SEARCH_REPLY (MAX_JOBS_TOTAL / 2)
+#define HTTP_BUSY_RETRY_AFTER 2
+#define HTTP_BUSY_SOCKETS 32
+#define HTTP_BUSY_LINGER 2
+/* @} */
+
 /*! \name MAX_SUBSCRIPTION_QUEUED_EVENTS
  *
  *  The {\tt MAX_SUBSCRIPTION_QUEUED_EVENTS} determines the maximum number of
@@ -210,6 +293,35 @@
 #define WEB_SERVER_BUF_SIZE (size_t)(1024 * 1024)
 /* @} */
 
+/*!
+ * \name WEB_SERVER_READAHEAD_SIZE
+ *
+ * Where posix_fadvise() is available, the files of the document root and
+ * the file ranges of the web streams are read sequentially with the
+ * kernel reading up to this many bytes ahead of the sender, half of it at
+ * a time, so that concurrent streams from one disk read large blocks
+ * rather than seeking between small ones. The default value is 4MB.
+ *
+ * @{
+ */
+#define WEB_SERVER_READAHEAD_SIZE (off_t)(4 * 1024 * 1024)
+/* @} */
+
+/*!
+ * \name WEB_SERVER_MAX_RANGES
+ *
+ * A request for several ranges of a file is answered with a
+ * multipart/byteranges response of at most WEB_SERVER_MAX_RANGES parts,
+ * after the ranges that overlap or are less than WEB_SERVER_RANGE_GAP bytes
+ * apart are merged. A request for more parts is answered with the whole
+ * file.
+ *
+ * @{
+ */
+#define WEB_SERVER_MAX_RANGES 16
+#define WEB_SERVER_RANGE_GAP (off_t)80
+/* @} */
+
 /*!
  * \name WEB_SERVER_CONTENT_LANGUAGE
  *
@@ -224,6 +336,68 @@
 #define WEB_SERVER_CONTENT_LANGUAGE ""
 /* @} */
 
+/*!
+ * \name WEB_SERVER_CACHE_SIZE
+ *
+ * This configuration parameter sets the number of bytes of document root
+ * files that the webserver keeps in memory, and WEB_SERVER_CACHE_MAX_FILE_SIZE
+ * the size of the largest file kept. Both can be changed at run time with
+ * UpnpSetWebServerCache(). A cache size of 0 disables the cache. The default
+ * values are 256KB and 32KB, enough for the descriptions, SCPDs and icons
+ * of a few devices.
+ *
+ * @{
+ */
+#define WEB_SERVER_CACHE_SIZE (size_t)(256 * 1024)
+#define WEB_SERVER_CACHE_MAX_FILE_SIZE (size_t)(32 * 1024)
+/* @} */
+
+/*!
+ * \name WEB_SERVER_COMPRESS_MIN_SIZE
+ *
+ * When the library is built with zlib, the XML and text documents of the
+ * webserver that are at least this many bytes long are compressed once,
+ * when they are cached or aliased, and sent gzip or deflate coded to the
+ * clients that accept it. SOAP responses of at least SOAP_COMPRESS_MIN_SIZE
+ * bytes are compressed as they are sent.
+ *
+ * @{
+ */
+#define WEB_SERVER_COMPRESS_MIN_SIZE (size_t)256
+#define SOAP_COMPRESS_MIN_SIZE (size_t)4096
+/* @} */
+
+/*!
+ * \name WEB_STREAM_MAX_QUEUED
+ *
+ * WEB_STREAM_MAX_QUEUED is the number of bytes an application may queue in
+ * a web stream before its writes are refused with UPNP_E_WOULD_BLOCK; they
+ * are accepted again once half of these bytes are sent. The file ranges
+ * queued in a stream are read WEB_STREAM_READ_SIZE bytes at a time. A stream
+ * that neither sends data nor gets data to send for WEB_STREAM_TIMEOUT
+ * seconds is aborted, whether or not data is queued.
+ *
+ * @{
+ */
+#define WEB_STREAM_MAX_QUEUED (size_t)(256 * 1024)
+#define WEB_STREAM_READ_SIZE (size_t)(64 * 1024)
+#define WEB_STREAM_TIMEOUT HTTP_DEFAULT_TIMEOUT
+/* @} */
+
+/*!
+ * \name WEB_SERVER_RATE_QUANTUM
+ *
+ * When UpnpSetWebServerRateLimit() limits the rate of the web server, the
+ * files are sent WEB_SERVER_RATE_QUANTUM bytes at a time, the connections
+ * taking turns, and a connection idle for a while may send at most
+ * WEB_SERVER_RATE_BURST milliseconds worth of data at once.
+ *
+ * @{
+ */
+#define WEB_SERVER_RATE_QUANTUM (size_t)(32 * 1024)
+#define WEB_SERVER_RATE_BURST 250
+/* @} */
+
 /*!
  * \name AUTO_RENEW_TIME
  *
@@ -0,0 +1,126 @@
+#ifndef GENLIB_NET_HTTP_HTTPCOMPRESS_H
+#define GENLIB_NET_HTTP_HTTPCOMPRESS_H
+
+/*!
+ * \file
+ *
+ * \brief Content codings of HTTP responses.
+ *
+ * The gzip and deflate codings wrap the same raw deflate stream with a
+ * different header and trailer, so a content compressed once can be sent
+ * with either coding. Without zlib (UPNP_ENABLE_ZLIB), no coding is ever
+ * selected and the compression functions fail.
+ */
+
+#include "UpnpStdInt.h"
+#include "httpparser.h"
+#include "membuffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! Content codings. */
+typedef enum
+{
+	HTTP_CODING_IDENTITY = 0,
+	HTTP_CODING_GZIP,
+	HTTP_CODING_DEFLATE
+} http_coding_t;
+
+/*! Size of the largest wrapper header, the one of gzip. */
+#define HTTP_CODING_HEADER_SIZE 10
+/*! Size of the largest wrapper trailer, the one of gzip. */
+#define HTTP_CODING_TRAILER_SIZE 8
+
+/*!
+ * \brief Selects the coding of a response from the Accept-Encoding header of
+ * the request, gzip being preferred.
+ *
+ * \return HTTP_CODING_GZIP, HTTP_CODING_DEFLATE or HTTP_CODING_IDENTITY.
+ */
+http_coding_t http_select_coding(
+	/*! [in] HTTP request. */
+	http_message_t *req);
+
+/*!
+ * \brief Returns the name of a coding for the Content-Encoding header.
+ */
+const char *http_coding_name(
+	/*! [in] Coding other than HTTP_CODING_IDENTITY. */
+	http_coding_t coding);
+
+/*!
+ * \brief Appends the raw deflate stream of a content to a buffer.
+ *
+ * \return UPNP_E_SUCCESS, UPNP_E_OUTOF_MEMORY or UPNP_E_INTERNAL_ERROR if the
+ * library is built without zlib.
+ */
+int http_deflate(
+	/*! [in] Content. */
+	const char *in,
+	/*! [in] Length of the content. */
+	size_t in_len,
+	/*! [in,out] Buffer receiving the stream. */
+	membuffer *out,
+	/*! [out] CRC-32 of the content, for the gzip trailer. */
+	uint32_t *crc,
+	/*! [out] Adler-32 of the content, for the deflate trailer. */
+	uint32_t *adler);
+
+/*!
+ * \brief Writes the header that precedes the raw deflate stream.
+ *
+ * \return The size of the header.
+ */
+size_t http_coding_header(
+	/*! [in] Coding other than HTTP_CODING_IDENTITY. */
+	http_coding_t coding,
+	/*! [out] Buffer of HTTP_CODING_HEADER_SIZE bytes. */
+	unsigned char *buf);
+
+/*!
+ * \brief Writes the trailer that follows the raw deflate stream.
+ *
+ * \return The size of the trailer.
+ */
+size_t http_coding_trailer(
+	/*! [in] Coding other than HTTP_CODING_IDENTITY. */
+	http_coding_t coding,
+	/*! [in] CRC-32 returned by http_deflate(). */
+	uint32_t crc,
+	/*! [in] Adler-32 returned by http_deflate(). */
+	uint32_t adler,
+	/*! [in] Length of the uncompressed content. */
+	size_t in_len,
+	/*! [out] Buffer of HTTP_CODING_TRAILER_SIZE bytes. */
+	unsigned char *buf);
+
+/*!
+ * \brief Returns the size of the header and trailer of a coding, which are
+ * added to the length of the raw deflate stream.
+ */
+size_t http_coding_overhead(
+	/*! [in] Coding other than HTTP_CODING_IDENTITY. */
+	http_coding_t coding);
+
+/*!
+ * \brief Compresses a content with a coding into a buffer.
+ *
+ * \return Same values as http_deflate().
+ */
+int http_compress(
+	/*! [in] Coding other than HTTP_CODING_IDENTITY. */
+	http_coding_t coding,
+	/*! [in] Content. */
+	const char *in,
+	/*! [in] Length of the content. */
+	size_t in_len,
+	/*! [out] Initialized buffer receiving the coded content. */
+	membuffer *out);
+
+#ifdef __cplusplus
+} /* extern C */
+#endif
+
+#endif /* GENLIB_NET_HTTP_HTTPCOMPRESS_H */
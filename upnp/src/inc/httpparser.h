@@ -42,6 +42,8 @@
 #include "upnputil.h"
 #include "uri.h"
 
+#include <time.h> /* for time_t */
+
 /* private types */
 
 /* scanner */
@@ -115,7 +117,7 @@ typedef enum
 #define HDR_DATE 5
 #define HDR_EXT 6
 #define HDR_HOST 7
-/*define HDR_IF_MODIFIED_SINCE		8 */
+#define HDR_IF_MODIFIED_SINCE 8
 /*define HDR_IF_UNMODIFIED_SINCE	9 */
 /*define HDR_LAST_MODIFIED		10 */
 #define HDR_LOCATION 11
@@ -146,6 +148,10 @@ typedef enum
 #define HDR_IF_RANGE 34
 #define HDR_RANGE 35
 #define HDR_TE 36
+#define HDR_IF_NONE_MATCH 37
+
+/*! number of slots in the index of known headers of a message. */
+#define HTTP_HEADER_INDEX_SIZE (HDR_IF_NONE_MATCH + 1)
 
 /*! status of parsing */
 typedef enum
@@ -166,18 +172,41 @@ typedef enum
 	PARSE_CONTINUE_1
 } parse_status_t;
 
-typedef struct
+typedef struct http_header
 {
 	/*! header name as a string. */
 	memptr name;
 	/*! header name id (for a selective group of headers only). */
 	int name_id;
-	/*! raw-value; could be multi-lined; min-length = 0. */
-	membuffer value;
-	/* private. */
-	membuffer name_buf;
+	/*! raw-value; could be multi-lined; min-length = 0; null-terminated. */
+	memptr value;
+	/*! next header of the message, in the order they were received. */
+	struct http_header *next;
 } http_header_t;
 
+/*! Default size of the blocks of a message arena. */
+#define HTTP_ARENA_BLOCK_SIZE (size_t)1024
+
+/*! Block allocated by a message arena; the storage follows it. */
+typedef struct http_arena_block
+{
+	/*! previously allocated block. */
+	struct http_arena_block *next;
+} http_arena_block;
+
+/*! Bump allocator of a message: the header records, header names and values
+ * and the url are carved from its blocks, and all of them are freed at once
+ * by httpmsg_destroy(). */
+typedef struct
+{
+	/*! blocks allocated by the arena. */
+	http_arena_block *blocks;
+	/*! next free byte of the current block. */
+	char *next;
+	/*! number of free bytes in the current block. */
+	size_t avail;
+} http_arena_t;
+
 typedef struct
 {
 	int initialized;
@@ -202,15 +231,22 @@ typedef struct
 	int major_version;
 	/* http minor version. */
 	int minor_version;
-	/*! . */
-	LinkedList headers;
+	/*! first header, the others are linked through http_header_t::next. */
+	http_header_t *headers;
+	/*! last header, where new headers are linked. */
+	http_header_t *last_header;
+	/*! known headers indexed by name_id, pointing into the headers list;
+	 * only headers with HDR_UNKNOWN have to be looked up in the list. */
+	http_header_t *header_index[HTTP_HEADER_INDEX_SIZE];
 	/*! message body(entity). */
 	memptr entity;
 	/* private fields. */
 	/*! entire raw message. */
 	membuffer msg;
-	/*! storage for url string. */
+	/*! storage for url string, in the arena. */
 	char *urlbuf;
+	/*! storage for the headers and the url. */
+	http_arena_t arena;
 } http_message_t;
 
 typedef struct
@@ -265,6 +301,37 @@ void httpmsg_init(http_message_t *msg);
  ************************************************************************/
 void httpmsg_destroy(http_message_t *msg);
 
+/************************************************************************
+ *	Function :	httpmsg_set_arena_storage
+ *
+ *	Parameters :
+ *		INOUT http_message_t* msg ;	HTTP Message Object
+ *		IN void* buf ;			storage owned by the caller
+ *		IN size_t size ;		size of the storage
+ *
+ *	Description :	Lets the arena of a message, which must not have
+ *		allocated anything yet, use the given storage before it
+ *		allocates blocks. The storage must outlive the message.
+ *
+ *	Return : void ;
+ ************************************************************************/
+void httpmsg_set_arena_storage(http_message_t *msg, void *buf, size_t size);
+
+/************************************************************************
+ *	Function :	httpheader_name_to_id
+ *
+ *	Parameters :
+ *		IN const char* name ;	header name, not necessarily null
+ *					terminated
+ *		IN size_t name_len ;	length of the header name
+ *
+ *	Description :	Maps a header name to its id, ignoring case.
+ *
+ *	Return : int ;
+ *		one of the HDR_* ids, or HDR_UNKNOWN
+ ************************************************************************/
+int httpheader_name_to_id(const char *name, size_t name_len);
+
 /************************************************************************
  *	Function :	httpmsg_find_hdr_str
  *
@@ -468,6 +535,22 @@ int raw_to_int(memptr *raw_value, int base);
  ************************************************************************/
 int raw_find_str(memptr *raw_value, const char *str);
 
+/************************************************************************
+ * Function: parse_http_date
+ *
+ * Parameters:
+ *	IN const memptr* value ;	header value
+ *	OUT time_t* date ;	date
+ *
+ * Description: Parses an HTTP date in one of the three formats of
+ *	RFC 7231: "Sun, 06 Nov 1994 08:49:37 GMT",
+ *	"Sunday, 06-Nov-94 08:49:37 GMT" or "Sun Nov  6 08:49:37 1994".
+ *
+ * Returns:
+ *	 int - 0 on success, -1 if the date is invalid.
+ ************************************************************************/
+int parse_http_date(const memptr *value, time_t *date);
+
 /************************************************************************
  * Function: method_to_str
  *
@@ -55,6 +55,17 @@ struct tm *http_gmtime_r(const time_t *clock, struct tm *result);
 	#define http_gmtime_r gmtime_r
 #endif
 
+/*! Read-ahead of a file sent sequentially. */
+typedef struct http_readahead
+{
+	/*! File descriptor, -1 if there is no read-ahead. */
+	int fd;
+	/*! Offset past the data the kernel was asked to read ahead. */
+	off_t next;
+	/*! Offset past the data to send, -1 to send up to the end of file. */
+	off_t end;
+} http_readahead;
+
 int http_CancelHttpGet(/* IN */ void *Handle);
 
 /*!
@@ -157,6 +168,33 @@ int http_SendMessage(
 	/* [in] Variable parameter list. */
 	...);
 
+/*!
+ * \brief Tells the kernel that a range of a file is going to be read
+ * sequentially and starts reading the first WEB_SERVER_READAHEAD_SIZE bytes
+ * of it ahead.
+ *
+ * Does nothing where posix_fadvise() is not available.
+ */
+void http_ReadAheadStart(
+	/*! [out] Read-ahead state. */
+	http_readahead *ra,
+	/*! [in] File descriptor. */
+	int fd,
+	/*! [in] Offset of the range. */
+	off_t offset,
+	/*! [in] Length of the range, -1 for up to the end of file. */
+	off_t length);
+
+/*!
+ * \brief Starts reading ahead the next part of a file once the data read
+ * is less than WEB_SERVER_READAHEAD_SIZE bytes ahead of the reader.
+ */
+void http_ReadAheadAdvance(
+	/*! [in,out] Read-ahead state. */
+	http_readahead *ra,
+	/*! [in] Offset of the next byte to read. */
+	off_t pos);
+
 /************************************************************************
  * Function: http_RequestAndResponse
  *
@@ -501,6 +539,24 @@ int http_SendStatusResponse(SOCKINFO *info,
 	int request_major_version,
 	int request_minor_version);
 
+/*!
+ * \brief Sends a 503 Service Unavailable response asking the client to
+ * retry after HTTP_BUSY_RETRY_AFTER seconds.
+ *
+ * \return
+ * 	\li \c 0 - On Success
+ * 	\li \c UPNP_E_OUTOF_MEMORY
+ * 	\li \c UPNP_E_SOCKET_WRITE
+ * 	\li \c UPNP_E_TIMEDOUT
+ */
+int http_SendBusyResponse(
+	/*! [in] Socket information object. */
+	SOCKINFO *info,
+	/*! [in] Request major version. */
+	int request_major_version,
+	/*! [in] Request minor version. */
+	int request_minor_version);
+
 /*!
  * \brief Generate an HTTP message based on the format that is specified in
  * the input parameters.
@@ -0,0 +1,75 @@
+#ifndef GENLIB_NET_HTTP_HTTPSCAN_H
+#define GENLIB_NET_HTTP_HTTPSCAN_H
+
+/*!
+ * \file
+ *
+ * \brief Character classes of the HTTP tokenizer and functions skipping
+ * runs of characters of the same class, several bytes at a time when the
+ * processor supports it.
+ */
+
+#include <stdlib.h> /* for size_t */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! RFC 2616 separator; NUL is included, as strchr() used to match it. */
+#define HTTP_CHAR_SEPARATOR 0x01
+/*! Character allowed in a token. */
+#define HTTP_CHAR_IDENTIFIER 0x02
+/*! Control character. */
+#define HTTP_CHAR_CONTROL 0x04
+
+/*! Classes of the 256 byte values, indexed by unsigned char. */
+extern const unsigned char http_char_class[256];
+
+/*!
+ * \brief Skips token characters.
+ *
+ * \return Pointer to the first byte that is not allowed in a token, or
+ * \b end.
+ */
+const char *httpscan_identifier(
+	/*! [in] First byte to examine. */
+	const char *p,
+	/*! [in] End of the input. */
+	const char *end);
+
+/*!
+ * \brief Skips the bytes that the tokenizer accepts as they are inside a
+ * header value or a line: everything but CR, LF, the double quote and bytes
+ * outside of US-ASCII.
+ *
+ * \return Pointer to the first byte that needs the tokenizer, or \b end.
+ */
+const char *httpscan_text(
+	/*! [in] First byte to examine. */
+	const char *p,
+	/*! [in] End of the input. */
+	const char *end);
+
+/*! Levels of httpscan_limit(). */
+#define HTTPSCAN_LEVEL_SCALAR 0
+#define HTTPSCAN_LEVEL_SSE2 1
+#define HTTPSCAN_LEVEL_AVX2 2
+
+/*!
+ * \brief Limits the instructions used by the functions above, so that the
+ * tests can compare the versions; all of them are used by default. Not
+ * thread safe.
+ *
+ * \return The level the functions use from now on, lower than \b level if
+ * the processor or the compiler does not support it.
+ */
+int httpscan_limit(
+	/*! [in] One of HTTPSCAN_LEVEL_SCALAR, HTTPSCAN_LEVEL_SSE2 or
+	 * HTTPSCAN_LEVEL_AVX2. */
+	int level);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GENLIB_NET_HTTP_HTTPSCAN_H */
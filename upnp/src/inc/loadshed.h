@@ -0,0 +1,84 @@
+#ifndef GENLIB_MINISERVER_LOADSHED_H
+#define GENLIB_MINISERVER_LOADSHED_H
+
+/*!
+ * \file
+ *
+ * \brief Admission of the jobs of the SDK under load.
+ *
+ * Each class of jobs has a budget of jobs in progress, from the time they
+ * are admitted to the time they are run or freed. The jobs over the budget
+ * are shed by the caller, which also tells when their thread pool was full
+ * and when it dropped a duplicate. The counters are atomic, so that the
+ * miniserver thread admitting the jobs never waits on a lock.
+ */
+
+#include "upnp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+ * \brief Admits a job of a class, counting it in progress.
+ *
+ * \return 1 if the job is admitted, 0 if it is to be shed, the budget of
+ * its class being spent.
+ */
+int load_admit(
+	/*! [in] Class of the job. */
+	Upnp_LoadClass loadClass);
+
+/*!
+ * \brief Counts a job admitted as done, run or freed.
+ */
+void load_done(
+	/*! [in] Class of the job. */
+	Upnp_LoadClass loadClass);
+
+/*!
+ * \brief Counts a job admitted as shed because its thread pool was full.
+ */
+void load_shed_pool(
+	/*! [in] Class of the job. */
+	Upnp_LoadClass loadClass);
+
+/*!
+ * \brief Returns whether half the budget of a class is spent, from which
+ * the duplicate jobs are shed.
+ */
+int load_pressure(
+	/*! [in] Class of the jobs. */
+	Upnp_LoadClass loadClass);
+
+/*!
+ * \brief Counts a job admitted as shed because it duplicates a job in
+ * progress.
+ */
+void load_shed_duplicate(
+	/*! [in] Class of the job. */
+	Upnp_LoadClass loadClass);
+
+/*!
+ * \brief Sets the budget of a class, see UpnpSetLoadBudget().
+ */
+int load_set_budget(
+	/*! [in] Class of the jobs. */
+	Upnp_LoadClass loadClass,
+	/*! [in] Maximum number of jobs in progress, 0 if not limited. */
+	int budget);
+
+/*!
+ * \brief Gets the counters of a class, see UpnpGetLoadStats().
+ */
+int load_get_stats(
+	/*! [in] Class of the jobs. */
+	Upnp_LoadClass loadClass,
+	/*! [out] Counters. */
+	Upnp_LoadStats *stats);
+
+#ifdef __cplusplus
+} /* extern C */
+#endif
+
+#endif /* GENLIB_MINISERVER_LOADSHED_H */
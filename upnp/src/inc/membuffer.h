@@ -221,6 +221,32 @@ int membuffer_insert(
 	/*! [in] index to determine the bounds while movinf the data. */
 	size_t index);
 
+/*!
+ * \brief Makes sure that at least 'min_free' bytes can be written at the end
+ * of the buffer, at buf + length, before the data is added with
+ * membuffer_commit(). The capacity at least doubles when it has to grow.
+ *
+ * \return
+ * \li UPNP_E_SUCCESS - On Success
+ * \li UPNP_E_OUTOF_MEMORY - On failure to allocate memory.
+ */
+int membuffer_reserve(
+	/*! [in,out] Buffer to be enlarged. */
+	membuffer *m,
+	/*! [in] Number of free bytes needed after the data. */
+	size_t min_free);
+
+/*!
+ * \brief Adds to the length of the buffer the bytes that were written in
+ * place after its data, and null-terminates it.
+ */
+void membuffer_commit(
+	/*! [in,out] Buffer whose length is increased. */
+	membuffer *m,
+	/*! [in] Number of bytes written at buf + length; must not exceed
+	 * capacity - length. */
+	size_t num_bytes);
+
 /*!
  * \brief Shrink the size of the buffer depending on the current size of the
  * bufer and te input parameters. Move contents from the old buffer to the
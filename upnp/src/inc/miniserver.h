@@ -148,6 +148,14 @@ int StartMiniServer(
  */
 int StopMiniServer();
 
+/*!
+ * \brief Makes the miniserver thread return from select() and poll its
+ * sockets again, by sending a datagram to its stop socket.
+ *
+ * Only valid while the miniserver runs.
+ */
+void MiniServerWakeup(void);
+
 #ifdef __cplusplus
 } /* extern C */
 #endif
@@ -79,6 +79,8 @@ typedef struct SERVICE_INFO
 	int active;
 	int TotalSubscriptions;
 	subscription *subscriptionList;
+	/*! Action schemas compiled from the SCPD, or NULL. */
+	struct service_schema *schema;
 	struct SERVICE_INFO *next;
 } service_info;
 
@@ -0,0 +1,210 @@
+#ifndef SOAP_SCHEMA_H
+#define SOAP_SCHEMA_H
+
+/*!
+ * \addtogroup SOAP
+ *
+ * @{
+ *
+ * \file
+ *
+ * \brief Action schemas compiled from the SCPD of a service.
+ *
+ * The schema of an action is stored as a single relocatable block: names
+ * are referenced by their offset from the start of the block, so that the
+ * block can be copied with memcpy() into the UpnpActionArgs object of a
+ * request and outlive the service it was compiled from.
+ */
+
+#include "UpnpActionArgs.h"
+#include "ixml.h"
+#include "membuffer.h"
+
+#include <stdlib.h> /* for size_t */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! Schema of one argument of an action. */
+typedef struct action_arg_schema
+{
+	/*! Offset of the NUL terminated name in the action schema block. */
+	size_t name;
+	/*! Length of the name. */
+	size_t name_len;
+	/*! Data type of the related state variable. */
+	Upnp_ArgType type;
+} action_arg_schema;
+
+/*! Schema of one action, followed in memory by its argument schemas and
+ * by the names. */
+typedef struct action_schema
+{
+	/*! Size in bytes of the whole block. */
+	size_t size;
+	/*! Offset of the NUL terminated action name in the block. */
+	size_t name;
+	/*! Length of the action name. */
+	size_t name_len;
+	/*! Number of input arguments, stored first. */
+	int num_in;
+	/*! Number of output arguments, stored after the input arguments. */
+	int num_out;
+} action_schema;
+
+/*! Argument schemas of an action, input arguments first. */
+#define ACTION_SCHEMA_ARGS(a) ((action_arg_schema *)((action_schema *)(a) + 1))
+/*! String stored at offset \b off of an action schema block. */
+#define ACTION_SCHEMA_STR(a, off) ((const char *)(a) + (off))
+
+/*! Compiled schema of all actions of a service. */
+typedef struct service_schema
+{
+	/*! Number of actions. */
+	int num_actions;
+	/*! Actions, sorted by name. */
+	action_schema **actions;
+} service_schema;
+
+/*!
+ * \brief Compiles the action list of a SCPD document.
+ *
+ * \return UPNP_E_SUCCESS, UPNP_E_INVALID_DESC if the SCPD has no action list
+ * or an argument refers to an unknown state variable, or UPNP_E_OUTOF_MEMORY.
+ */
+int soap_schema_compile(
+	/*! [in] SCPD document. */
+	IXML_Document *scpd,
+	/*! [out] Compiled schema, to be freed with soap_schema_free(). */
+	service_schema **out);
+
+/*!
+ * \brief Frees a compiled service schema.
+ */
+void soap_schema_free(
+	/*! [in] Schema to be freed, may be NULL. */
+	service_schema *schema);
+
+/*!
+ * \brief Binary search of an action by name.
+ *
+ * \return The action schema or NULL.
+ */
+const action_schema *soap_schema_find_action(
+	/*! [in] Service schema. */
+	const service_schema *schema,
+	/*! [in] Action name, not necessarily NUL terminated. */
+	const char *name,
+	/*! [in] Length of the action name. */
+	size_t name_len);
+
+/*!
+ * \brief Checks the lexical form of a value against a data type.
+ *
+ * \return 1 if the value is valid, 0 otherwise.
+ */
+int soap_schema_check_value(
+	/*! [in] Data type. */
+	Upnp_ArgType type,
+	/*! [in] NUL terminated value. */
+	const char *value);
+
+/*!
+ * \brief Decodes the input arguments of a SOAP action request without
+ * building a DOM document.
+ *
+ * Only the plain envelope produced by control points is understood: no
+ * SOAP header, no comments, no CDATA sections and no nested elements in
+ * the arguments. Anything else makes the function return -1, and the
+ * caller must fall back to the DOM parser.
+ *
+ * \return
+ * \li 0 on success.
+ * \li -1 if the request does not fit the template.
+ * \li 402 (Invalid Args) if an argument is missing, unknown or repeated.
+ * \li 600 (Argument Value Invalid) if a value does not match its type.
+ * \li UPNP_E_OUTOF_MEMORY.
+ */
+int soap_schema_parse_request(
+	/*! [in] Request entity. */
+	const char *body,
+	/*! [in] Length of the request entity. */
+	size_t body_len,
+	/*! [in] Service type the action element must be qualified with. */
+	const char *service_type,
+	/*! [in,out] Arguments, created for the action of the request. */
+	UpnpActionArgs *args);
+
+/*!
+ * \brief Copies the input arguments of an already parsed action element.
+ *
+ * \return Same values as soap_schema_parse_request(), except -1.
+ */
+int soap_schema_parse_node(
+	/*! [in] Action element. */
+	IXML_Node *action_node,
+	/*! [in,out] Arguments, created for the action of the request. */
+	UpnpActionArgs *args);
+
+/*!
+ * \brief Serializes the action response element from the output arguments.
+ *
+ * \return UPNP_E_SUCCESS, UPNP_E_INVALID_ARGUMENT if an output argument was
+ * not set, or UPNP_E_OUTOF_MEMORY.
+ */
+int soap_schema_make_response(
+	/*! [in] Arguments holding the output values. */
+	const UpnpActionArgs *args,
+	/*! [in] Service type of the response element. */
+	const char *service_type,
+	/*! [out] Buffer receiving the response element. */
+	membuffer *out);
+
+/*!
+ * \brief Creates the argument list of an action, copying its schema.
+ *
+ * \return The new object or NULL if out of memory.
+ */
+UpnpActionArgs *UpnpActionArgs_new(
+	/*! [in] Schema of the action. */
+	const action_schema *schema);
+
+/*!
+ * \brief Destructor.
+ */
+void UpnpActionArgs_delete(
+	/*! [in] The \em \b this pointer, may be NULL. */
+	UpnpActionArgs *p);
+
+/*!
+ * \brief Returns the private copy of the action schema.
+ */
+const action_schema *UpnpActionArgs_get_Schema(
+	/*! [in] The \em \b this pointer. */
+	const UpnpActionArgs *p);
+
+/*!
+ * \brief Sets the value of an input argument.
+ *
+ * \return The stored NUL terminated copy of the value, which the caller may
+ * shorten in place (e.g. to decode XML entities), or NULL if \b i is out of
+ * range or out of memory.
+ */
+char *UpnpActionArgs_set_InValue(
+	/*! [in] The \em \b this pointer. */
+	UpnpActionArgs *p,
+	/*! [in] Index of the argument. */
+	int i,
+	/*! [in] Value, not necessarily NUL terminated. */
+	const char *value,
+	/*! [in] Length of the value. */
+	size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+/*! @} SOAP */
+
+#endif /* SOAP_SCHEMA_H */
@@ -75,6 +75,7 @@ typedef enum SsdpSearchType
 } SType;
 
 #define BUFSIZE (size_t)2500
+#define SSDP_ARENA_SIZE (size_t)2048
 #define SSDP_IP "239.255.255.250"
 #define SSDP_IPV6_LINKLOCAL "FF02::C"
 #define SSDP_IPV6_SITELOCAL "FF05::C"
@@ -140,6 +141,10 @@ typedef struct ssdpsearchreply
 	UpnpDevice_Handle handle;
 	struct sockaddr_storage dest_addr;
 	SsdpEvent event;
+	/*! Previous reply waiting to be sent. */
+	struct ssdpsearchreply *prev;
+	/*! Next reply waiting to be sent. */
+	struct ssdpsearchreply *next;
 } SsdpSearchReply;
 
 typedef struct ssdpsearcharg
@@ -160,6 +165,9 @@ typedef struct
 {
 	http_parser_t parser;
 	struct sockaddr_storage dest_addr;
+	/*! storage of the message arena, large enough for the headers of
+	 * usual datagrams. */
+	char arena[SSDP_ARENA_SIZE];
 } ssdp_thread_data;
 
 /* globals */
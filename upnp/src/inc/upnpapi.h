@@ -88,6 +88,9 @@ struct Handle_Info
 	char LowerDescURL[LINE_SIZE];
 	/*! XML file path for device description. */
 	char DescXML[LINE_SIZE];
+	/*! Web server alias serving the description document, if
+	 * aliasInstalled. */
+	char DescAlias[LINE_SIZE];
 	/* Advertisement timeout */
 	int MaxAge;
 	/* Power State as defined by UPnP Low Power. */
@@ -183,11 +186,41 @@ Upnp_Handle_Type GetDeviceHandleInfo(
 	/*! [out] Device handle structure passed by this function. */
 	struct Handle_Info **HndInfo);
 
+#ifdef INCLUDE_DEVICE_APIS
+/*!
+ * \brief Adds the control and event URL paths of the services of a device to
+ * the table used by GetDeviceHandleInfoForPath().
+ *
+ * Must be called with the handle lock held for writing. If memory runs out,
+ * the lookups fall back to a scan of the handles.
+ *
+ * \return UPNP_E_SUCCESS or UPNP_E_OUTOF_MEMORY.
+ */
+int AddServicePaths(
+	/*! [in] Device handle. */
+	UpnpDevice_Handle Hnd,
+	/*! [in] Device handle structure holding the service table. */
+	struct Handle_Info *HInfo);
+
+/*!
+ * \brief Removes the URL paths of a device from the path table, before its
+ * service table is freed.
+ *
+ * Must be called with the handle lock held for writing.
+ */
+void RemoveServicePaths(
+	/*! [in] Device handle. */
+	UpnpDevice_Handle Hnd);
+#endif /* INCLUDE_DEVICE_APIS */
+
 /*!
  * \brief Retrieves the device handle and information of the first device of
  * 	the address family specified, with a service having a controlURL or
  * 	eventSubURL matching the path.
  *
+ * The lookup uses a hash table of the URL paths maintained on device
+ * registration and unregistration.
+ *
  * \return HND_DEVICE or HND_INVALID
  */
 Upnp_Handle_Type GetDeviceHandleInfoForPath(
@@ -224,6 +257,9 @@ extern TimerThread gTimerThread;
 extern ThreadPool gRecvThreadPool;
 extern ThreadPool gSendThreadPool;
 extern ThreadPool gMiniServerThreadPool;
+#if EXCLUDE_WEB_SERVER == 0
+extern ThreadPool gStreamThreadPool;
+#endif /* EXCLUDE_WEB_SERVER */
 
 typedef enum
 {
@@ -259,7 +295,6 @@ struct UpnpNonblockParam
 	struct DevDesc *Devdesc;
 };
 
-extern virtualDirList *pVirtualDirList;
 extern struct VirtualDirCallbacks virtualDirCallback;
 
 typedef enum
@@ -52,6 +52,8 @@ extern "C" {
  * 		downloaded
  * 	OUT char docURL[LINE_SIZE] ;	buffer to hold the URL of the
  * 		document.
+ * 	OUT char docAlias[LINE_SIZE] ;	buffer to hold the name of the alias
+ * 		serving the document, for web_server_remove_alias().
  *
  * Description : Configure the full URL for the description document.
  * 	Create the URL document and add alias, description information.
@@ -66,7 +68,8 @@ int configure_urlbase(IXML_Document *doc,
 	const struct sockaddr *serverAddr,
 	const char *alias,
 	time_t last_modified,
-	char docURL[LINE_SIZE]);
+	char docURL[LINE_SIZE],
+	char docAlias[LINE_SIZE]);
 
 #ifdef __cplusplus
 } /* extern C */
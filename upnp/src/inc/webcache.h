@@ -0,0 +1,175 @@
+#ifndef GENLIB_NET_HTTP_WEBCACHE_H
+#define GENLIB_NET_HTTP_WEBCACHE_H
+
+/*!
+ * \file
+ *
+ * \brief In-memory cache of the small files of the web server document root.
+ *
+ * Entries are looked up by path and validated against the modification time
+ * and size returned by stat(), so a file changed on disk is read again on the
+ * next request; a miss costs no system call. The cache is bounded in bytes
+ * and evicts the least recently used entries first. An entry is reference
+ * counted and its content stays valid until it is released, even if it is
+ * evicted in the meantime.
+ */
+
+#include "UpnpStdInt.h"
+
+#include <stdlib.h> /* for size_t */
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! Size of a buffer holding a quoted entity tag, weak or strong, with the
+ * suffix of a compressed variant. */
+#define WEB_CACHE_ETAG_SIZE 48
+
+/*! Raw deflate stream of a content, sent with the gzip or deflate coding. */
+typedef struct web_cache_deflated
+{
+	/*! The stream, or NULL if the content is sent uncompressed. */
+	char *stream;
+	/*! Length of the stream. */
+	size_t length;
+	/*! CRC-32 of the content. */
+	uint32_t crc;
+	/*! Adler-32 of the content. */
+	uint32_t adler;
+} web_cache_deflated;
+
+/*! Cached file. All the fields are read only once the entry is published. */
+typedef struct web_cache_entry
+{
+	/*! NUL terminated path of the file, key of the cache. */
+	char *path;
+	/*! Content of the file. */
+	char *content;
+	/*! Length of the content. */
+	size_t length;
+	/*! Modification time of the file when it was read. */
+	time_t last_modified;
+	/*! NUL terminated content type. */
+	char *content_type;
+	/*! Entity tag of the file, see web_cache_make_file_etag(). */
+	char etag[WEB_CACHE_ETAG_SIZE];
+	/*! Compressed content. */
+	web_cache_deflated deflated;
+	/*! Number of references; the cache holds one while the entry is
+	 * linked. Protected by the cache mutex. */
+	int refcount;
+	/*! Next entry in the same hash bucket. */
+	struct web_cache_entry *bucket_next;
+	/*! More recently used entry. */
+	struct web_cache_entry *lru_prev;
+	/*! Less recently used entry. */
+	struct web_cache_entry *lru_next;
+} web_cache_entry;
+
+/*!
+ * \brief Initializes the cache. Called by web_server_init().
+ *
+ * \return Always 0.
+ */
+int web_cache_init(void);
+
+/*!
+ * \brief Drops all the entries and releases the cache. Entries still
+ * referenced are freed when they are released.
+ */
+void web_cache_destroy(void);
+
+/*!
+ * \brief Sets the bounds of the cache and evicts the entries exceeding them.
+ * A \b max_bytes of 0 disables the cache.
+ */
+void web_cache_set_limits(
+	/*! [in] Total number of bytes of content cached. */
+	size_t max_bytes,
+	/*! [in] Size of the largest file cached. */
+	size_t max_file_size);
+
+/*!
+ * \brief Looks up a file and, if it is cached, checks with stat() that it
+ * did not change since it was read.
+ *
+ * \return A referenced entry to be released with web_cache_release(), or
+ * NULL if the file is not cached, or if the entry is stale, in which case it
+ * is dropped.
+ */
+web_cache_entry *web_cache_lookup(
+	/*! [in] Path of the file. */
+	const char *path);
+
+/*!
+ * \brief Reads a regular file and adds it to the cache.
+ *
+ * \return A referenced entry to be released with web_cache_release(), or
+ * NULL if the cache is disabled, the file is too large or cannot be read, or
+ * out of memory.
+ */
+web_cache_entry *web_cache_load(
+	/*! [in] Path of the file. */
+	const char *path,
+	/*! [in] Content type of the file. */
+	const char *content_type);
+
+/*!
+ * \brief Computes the strong entity tag of an alias content: a 64 bits
+ * FNV-1a hash of the bytes and the length, quoted.
+ */
+void web_cache_make_etag(
+	/*! [out] Buffer of WEB_CACHE_ETAG_SIZE bytes receiving the tag. */
+	char *etag,
+	/*! [in] Content. */
+	const char *content,
+	/*! [in] Length of the content. */
+	size_t length);
+
+/*!
+ * \brief Computes the weak entity tag of a file from its size and
+ * modification time, quoted. A file gets the same tag whether it is served
+ * from the cache or read from the disk.
+ *
+ * The tag is weak since two versions of the same size written within a
+ * second of each other get the same one.
+ */
+void web_cache_make_file_etag(
+	/*! [out] Buffer of WEB_CACHE_ETAG_SIZE bytes receiving the tag. */
+	char *etag,
+	/*! [in] Size of the file. */
+	uint64_t size,
+	/*! [in] Modification time of the file. */
+	time_t last_modified);
+
+/*!
+ * \brief Compresses a text or XML content of at least
+ * WEB_SERVER_COMPRESS_MIN_SIZE bytes, if the library is built with zlib.
+ * The stream is kept only if it is smaller than the content.
+ */
+void web_cache_deflate(
+	/*! [out] Compressed content; its stream is NULL if the content is not
+	 * compressed. */
+	web_cache_deflated *deflated,
+	/*! [in] Content type of the content. */
+	const char *content_type,
+	/*! [in] Content. */
+	const char *content,
+	/*! [in] Length of the content. */
+	size_t length);
+
+/*!
+ * \brief Releases a reference obtained from web_cache_lookup() or
+ * web_cache_load().
+ */
+void web_cache_release(
+	/*! [in] Entry, may be NULL. */
+	web_cache_entry *entry);
+
+#ifdef __cplusplus
+} /* extern C */
+#endif
+
+#endif /* GENLIB_NET_HTTP_WEBCACHE_H */
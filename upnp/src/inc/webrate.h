@@ -0,0 +1,109 @@
+#ifndef GENLIB_NET_HTTP_WEBRATE_H
+#define GENLIB_NET_HTTP_WEBRATE_H
+
+/*!
+ * \file
+ *
+ * \brief Bandwidth shaping of the files sent by the web server.
+ *
+ * Each connection has a token bucket for the per connection rate, and all
+ * share one for the total rate. A connection may send while its buckets are
+ * not in debt, and is charged for what it sent afterwards, so that sends
+ * larger than the burst still go through. The connections waiting for the
+ * total bucket are served in turn, one send at a time, so that a client
+ * reading ahead cannot starve the others.
+ */
+
+#include "UpnpStdInt.h"
+
+#include <stdlib.h> /* for size_t */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! Shaping state of a connection. */
+typedef struct web_rate
+{
+	/*! Next connection waiting for its turn at the total bucket. */
+	struct web_rate *next;
+	/*! Whether the connection waits for its turn. */
+	int queued;
+	/*! Whether the miniserver thread is to be woken up when the turn of
+	 * the connection comes, rather than a thread in web_rate_wait(). */
+	int wake;
+	/*! Bytes the connection may send, negative if in debt. */
+	int64_t tokens;
+	/*! Time of the last refill of the bucket, in microseconds. */
+	int64_t last;
+} web_rate;
+
+/*!
+ * \brief Sets the rates; 0 does not limit.
+ */
+void web_rate_set(
+	/*! [in] Bytes per second sent on one connection. */
+	size_t connection_rate,
+	/*! [in] Bytes per second sent on all connections. */
+	size_t total_rate);
+
+/*!
+ * \brief Returns whether a rate is limited.
+ */
+int web_rate_enabled(void);
+
+/*!
+ * \brief Initializes the shaping state of a connection.
+ */
+void web_rate_init(
+	/*! [out] Shaping state. */
+	web_rate *r);
+
+/*!
+ * \brief Waits until a connection may send and charges it for the data it
+ * is going to send.
+ */
+void web_rate_wait(
+	/*! [in,out] Shaping state. */
+	web_rate *r,
+	/*! [in] Length of the data. */
+	size_t len);
+
+/*!
+ * \brief Checks whether a connection driven by the miniserver thread may
+ * send, queueing it for its turn at the total bucket if needed.
+ *
+ * If it may, web_rate_charge() must follow once it has sent.
+ *
+ * \return 1 if the connection may send now, 0 otherwise.
+ */
+int web_rate_poll(
+	/*! [in,out] Shaping state. */
+	web_rate *r,
+	/*! [out] Milliseconds until it may, -1 if the miniserver thread is
+	 * woken up when its turn comes. */
+	int *delay);
+
+/*!
+ * \brief Charges a connection for the data it sent after web_rate_poll()
+ * and passes the turn on.
+ */
+void web_rate_charge(
+	/*! [in,out] Shaping state. */
+	web_rate *r,
+	/*! [in] Length of the data sent. */
+	size_t len);
+
+/*!
+ * \brief Removes a connection that ends from the connections waiting for
+ * their turn.
+ */
+void web_rate_cancel(
+	/*! [in,out] Shaping state. */
+	web_rate *r);
+
+#ifdef __cplusplus
+} /* extern C */
+#endif
+
+#endif /* GENLIB_NET_HTTP_WEBRATE_H */
@@ -32,6 +32,7 @@
 #ifndef GENLIB_NET_HTTP_WEBSERVER_H
 #define GENLIB_NET_HTTP_WEBSERVER_H
 
+#include "config.h"
 #include "httpparser.h"
 #include "sock.h"
 #include <time.h>
@@ -40,6 +41,26 @@
 extern "C" {
 #endif
 
+/*! Boundary, content type and content range of a part. */
+#define WEB_SERVER_PART_HEADER_SIZE 400
+
+/*! Parts of a multipart/byteranges response. */
+struct SendRanges
+{
+	/*! Number of parts, at least 2. */
+	int Count;
+	/*! Offset of each part in the file. */
+	off_t Offsets[WEB_SERVER_MAX_RANGES];
+	/*! Length of each part. */
+	off_t Lengths[WEB_SERVER_MAX_RANGES];
+	/*! Length of the file the parts are taken from. */
+	off_t FileLength;
+	/*! Boundary between the parts. */
+	char Boundary[40];
+	/*! Content type of the parts. */
+	char ContentType[200];
+};
+
 struct SendInstruction
 {
 	int IsVirtualFile;
@@ -57,6 +78,11 @@ struct SendInstruction
 	const void *Cookie;
 	/*! Cookie associated with the request. */
 	const void *RequestCookie;
+	/*! Content coding of a compressed document, an http_coding_t. */
+	int ContentCoding;
+	/*! Parts of a multipart/byteranges response, allocated only for one,
+	 * NULL otherwise. Freed by the holder of the send instruction. */
+	struct SendRanges *Ranges;
 	/* Later few more member could be added depending
 	 * on the requirement.*/
 };
@@ -82,10 +108,10 @@ int web_server_init(void);
 void web_server_destroy(void);
 
 /*!
- * \brief Replaces current alias with the given alias. To remove the current
- * alias, set alias_name to NULL.
+ * \brief Adds an alias to the documents served from memory, replacing the
+ * alias of the same name if any.
  *
- * \note alias_content is not freed here
+ * \note alias_content is not freed here on failure
  *
  * \return
  * \li \c 0 - OK
@@ -104,6 +130,14 @@ int web_server_set_alias(
 	 */
 	time_t last_modified);
 
+/*!
+ * \brief Stops serving an alias. The document is freed once the responses
+ * sending it are done.
+ */
+void web_server_remove_alias(
+	/*! [in] Webserver name of alias, as given to web_server_set_alias(). */
+	const char *alias_name);
+
 /*!
  * \brief Assign the path specfied by the input const char* root_dir parameter
  * to the global Document root directory. Also check for path names ending
@@ -115,6 +149,22 @@ int web_server_set_root_dir(
 	/*! [in] String having the root directory for the document. */
 	const char *root_dir);
 
+/*!
+ * \brief Formats the header of a part of a multipart/byteranges response,
+ * or the closing boundary after the last part.
+ *
+ * \return The length of the header, 0 if it does not fit.
+ */
+size_t web_server_part_header(
+	/*! [in] Parts of the response. */
+	const struct SendRanges *ranges,
+	/*! [in] Index of the part, Count for the closing boundary. */
+	int i,
+	/*! [out] Buffer. */
+	char *buf,
+	/*! [in] Size of the buffer. */
+	size_t size);
+
 /*!
  * \brief Main entry point into web server; Handles HTTP GET and HEAD
  * requests.
@@ -0,0 +1,129 @@
+#ifndef GENLIB_NET_HTTP_WEBSTREAM_H
+#define GENLIB_NET_HTTP_WEBSTREAM_H
+
+/*!
+ * \file
+ *
+ * \brief Response bodies of virtual directory files streamed by the
+ * application.
+ *
+ * The worker thread that processed the request queues the headers in a new
+ * stream, hands the stream to the application through the open stream
+ * callback and returns, leaving the connection open. The application queues
+ * the body from any thread; the miniserver thread sends the queued data on
+ * the non-blocking socket as it becomes writable and is woken through its
+ * stop socket when a stream gets data to send. The events of a stream are
+ * given to the application from the send thread pool.
+ */
+
+#include "membuffer.h"
+#include "sock.h"
+#include "upnp.h"
+#include "webserver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+ * \brief Streams the response to a GET request of a virtual directory file
+ * through the open stream callback.
+ *
+ * On success, the stream owns the socket, which is set to INVALID_SOCKET in
+ * the socket info.
+ *
+ * \return UPNP_E_SUCCESS, or an error code if the response is to be sent by
+ * the caller: the streams are stopped, the socket cannot be polled, the
+ * application declined the stream or out of memory.
+ */
+int web_stream_start(
+	/*! [in,out] Socket info of the connection. */
+	SOCKINFO *info,
+	/*! [in] Send instruction of the response. */
+	const struct SendInstruction *instr,
+	/*! [in] Headers of the response. */
+	const membuffer *headers,
+	/*! [in] Name of the file. */
+	const char *filename);
+
+/*!
+ * \brief Queues a copy of a buffer in a stream, see UpnpWebStream_Write().
+ */
+int web_stream_write(
+	/*! [in] Stream. */
+	UpnpWebStream *stream,
+	/*! [in] Data. */
+	const char *buf,
+	/*! [in] Length of the data. */
+	size_t buflen);
+
+/*!
+ * \brief Queues a file range in a stream, see UpnpWebStream_WriteFile().
+ */
+int web_stream_write_file(
+	/*! [in] Stream. */
+	UpnpWebStream *stream,
+	/*! [in] File descriptor. */
+	int fd,
+	/*! [in] Offset of the range. */
+	off_t offset,
+	/*! [in] Length of the range. */
+	size_t length);
+
+/*!
+ * \brief Ends the body of a stream, see UpnpWebStream_Close().
+ */
+int web_stream_close(
+	/*! [in] Stream. */
+	UpnpWebStream *stream);
+
+/*!
+ * \brief Sets the number of seconds after which a stream that neither sent
+ * data nor got data to send is aborted, WEB_STREAM_TIMEOUT by default.
+ */
+void web_stream_set_timeout(
+	/*! [in] Timeout in seconds. */
+	int timeout);
+
+/*!
+ * \brief Starts or stops driving the streams; stopping aborts them all.
+ *
+ * Called by the miniserver thread as it starts and stops.
+ */
+void web_stream_enable(
+	/*! [in] 1 to start, 0 to stop. */
+	int enable);
+
+/*!
+ * \brief Adds the sockets of the streams to the sets of select().
+ *
+ * A socket is polled for reading to notice that the client closed the
+ * connection, and for writing while it has data to send and, if rates are
+ * limited, its turn to send it.
+ *
+ * \return The timeout of select() in milliseconds, at most a second since
+ * the streams time out, or -1 if there is none.
+ */
+int web_stream_fdset(
+	/*! [in,out] Read set. */
+	fd_set *rdSet,
+	/*! [in,out] Write set. */
+	fd_set *wrSet,
+	/*! [in,out] Highest socket number plus one. */
+	SOCKET *nfds);
+
+/*!
+ * \brief Sends the data of the streams whose socket is writable and ends
+ * the streams whose connection was closed or timed out.
+ */
+void web_stream_process(
+	/*! [in] Read set returned by select(). */
+	fd_set *rdSet,
+	/*! [in] Write set returned by select(). */
+	fd_set *wrSet);
+
+#ifdef __cplusplus
+} /* extern C */
+#endif
+
+#endif /* GENLIB_NET_HTTP_WEBSTREAM_H */
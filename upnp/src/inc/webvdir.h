@@ -0,0 +1,64 @@
+#ifndef GENLIB_NET_HTTP_WEBVDIR_H
+#define GENLIB_NET_HTTP_WEBVDIR_H
+
+/*!
+ * \file
+ *
+ * \brief Virtual directories of the web server.
+ *
+ * The directories are looked up by longest prefix of the request path, one
+ * path component at a time, in a trie that is read without lock: a change
+ * builds a new trie and publishes it atomically, and the previous one is
+ * freed once the lookups that may use it are over. A directory registered
+ * with a trailing '/' matches the paths below it; one registered without
+ * also matches the directory itself, with or without a query.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+ * \brief Adds a virtual directory, or changes its cookie if it exists.
+ *
+ * \return UPNP_E_SUCCESS or UPNP_E_OUTOF_MEMORY.
+ */
+int web_vdir_add(
+	/*! [in] Name of the directory, starting with '/'. */
+	const char *dirName,
+	/*! [in] Cookie given to the callbacks for the files in it. */
+	const void *cookie,
+	/*! [out] Previous cookie of the directory, or NULL; may be NULL. */
+	const void **oldcookie);
+
+/*!
+ * \brief Removes a virtual directory.
+ *
+ * \return UPNP_E_SUCCESS, UPNP_E_INVALID_PARAM if there is no such directory
+ * or UPNP_E_OUTOF_MEMORY.
+ */
+int web_vdir_remove(
+	/*! [in] Name of the directory, as given to web_vdir_add(). */
+	const char *dirName);
+
+/*!
+ * \brief Removes all the virtual directories.
+ */
+void web_vdir_remove_all(void);
+
+/*!
+ * \brief Finds the virtual directory of a request path.
+ *
+ * \return 1 if the path is in a virtual directory, 0 otherwise.
+ */
+int web_vdir_lookup(
+	/*! [in] Request path, with the query if any. */
+	const char *path,
+	/*! [out] Cookie of the longest matching directory; may be NULL. */
+	const void **cookie);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GENLIB_NET_HTTP_WEBVDIR_H */
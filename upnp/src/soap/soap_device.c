@@ -40,9 +40,11 @@
 	#if EXCLUDE_SOAP == 0
 
 		#include "UpnpActionRequest.h"
+		#include "httpcompress.h"
 		#include "httpparser.h"
 		#include "httpreadwrite.h"
 		#include "parsetools.h"
+		#include "soap_schema.h"
 		#include "soaplib.h"
 		#include "ssdplib.h"
 		#include "statcodes.h"
@@ -77,8 +79,11 @@ static const char *SOAP_URN = "http:/"
 			      "/schemas.xmlsoap.org/soap/envelope/";
 static const char *QUERY_STATE_VAR_URN = "urn:schemas-upnp-org:control-1-0";
 
+		#define SOAP_INVALID_ARG_VALUE 600
+
 static const char *Soap_Invalid_Action = "Invalid Action";
-/*static const char* Soap_Invalid_Args = "Invalid Args"; */
+static const char *Soap_Invalid_Args = "Invalid Args";
+static const char *Soap_Invalid_Arg_Value = "Argument Value Invalid";
 static const char *Soap_Action_Failed = "Action Failed";
 static const char *Soap_Invalid_Var = "Invalid Var";
 static const char *Soap_Memory_out = "Out of Memory";
@@ -91,6 +96,9 @@ typedef struct soap_devserv_t
 	memptr action_name;
 	Upnp_FunPtr callback;
 	void *cookie;
+	int dev_hnd;
+	/*! Arguments decoded through the action schema, or NULL. */
+	UpnpActionArgs *args;
 } soap_devserv_t;
 
 /*!
@@ -227,19 +235,68 @@ static UPNP_INLINE void send_var_query_response(
 	membuffer_destroy(&response);
 }
 
+/*!
+ * \brief Compresses a large SOAP response body for a client accepting a
+ * content coding.
+ *
+ * \return The coding of \b coded, or HTTP_CODING_IDENTITY if the body is to
+ * be sent as it is.
+ */
+static http_coding_t compress_action_response(
+	/*! [in] Action request. */
+	http_message_t *request,
+	/*! [in] Start of the body. */
+	const char *start_body,
+	/*! [in] The response element. */
+	const char *xml_response,
+	/*! [in] Length of the response element. */
+	size_t xml_len,
+	/*! [in] End of the body. */
+	const char *end_body,
+	/*! [out] Initialized buffer receiving the coded body. */
+	membuffer *coded)
+{
+	membuffer body;
+	http_coding_t coding;
+	size_t length = strlen(start_body) + xml_len + strlen(end_body);
+
+	if (length < SOAP_COMPRESS_MIN_SIZE)
+		return HTTP_CODING_IDENTITY;
+	coding = http_select_coding(request);
+	if (coding == HTTP_CODING_IDENTITY)
+		return coding;
+	membuffer_init(&body);
+	if (membuffer_append_str(&body, start_body) != 0 ||
+		membuffer_append(&body, xml_response, xml_len) != 0 ||
+		membuffer_append_str(&body, end_body) != 0 ||
+		http_compress(coding, body.buf, body.length, coded) !=
+			UPNP_E_SUCCESS ||
+		coded->length >= length) {
+		membuffer_destroy(coded);
+		coding = HTTP_CODING_IDENTITY;
+	}
+	membuffer_destroy(&body);
+
+	return coding;
+}
+
 /*!
  * \brief Sends the SOAP action response.
  */
 static UPNP_INLINE void send_action_response(
 	/*! [in] Socket info. */
 	SOCKINFO *info,
-	/*! [in] The response document. */
-	IXML_Document *action_resp,
+	/*! [in] The response element. */
+	const char *xml_response,
+	/*! [in] Length of the response element. */
+	size_t xml_len,
 	/*! [in] Action request document. */
 	http_message_t *request)
 {
-	char *xml_response = NULL;
 	membuffer headers;
+	membuffer coded;
+	http_coding_t coding;
+	char coding_header[sizeof("CONTENT-ENCODING: deflate\r\n")];
 	int major, minor;
 	int err_code;
 	off_t content_length;
@@ -256,37 +313,55 @@ static UPNP_INLINE void send_action_response(
 	http_CalcResponseVersion(
 		request->major_version, request->minor_version, &major, &minor);
 	membuffer_init(&headers);
+	membuffer_init(&coded);
 	err_code = UPNP_E_OUTOF_MEMORY; /* one error only */
-	/* get xml */
-	xml_response = ixmlPrintNode((IXML_Node *)action_resp);
-	if (!xml_response)
-		goto error_handler;
-	content_length = (off_t)(strlen(start_body) + strlen(xml_response) +
-				 strlen(end_body));
+	content_length =
+		(off_t)(strlen(start_body) + xml_len + strlen(end_body));
+	coding = compress_action_response(
+		request, start_body, xml_response, xml_len, end_body, &coded);
+	if (coding != HTTP_CODING_IDENTITY) {
+		content_length = (off_t)coded.length;
+		snprintf(coding_header,
+			sizeof(coding_header),
+			"CONTENT-ENCODING: %s\r\n",
+			http_coding_name(coding));
+	} else {
+		coding_header[0] = '\0';
+	}
 	/* make headers */
 	if (http_MakeMessage(&headers,
 		    major,
 		    minor,
-		    "RNsDsSXcc",
+		    "RNsDssSXcc",
 		    HTTP_OK, /* status code */
 		    content_length,
 		    ContentTypeHeader,
 		    "EXT:\r\n",
+		    coding_header,
 		    X_USER_AGENT) != 0) {
 		goto error_handler;
 	}
 	/* send whole msg */
-	ret_code = http_SendMessage(info,
-		&timeout_secs,
-		"bbbb",
-		headers.buf,
-		headers.length,
-		start_body,
-		strlen(start_body),
-		xml_response,
-		strlen(xml_response),
-		end_body,
-		strlen(end_body));
+	if (coding != HTTP_CODING_IDENTITY)
+		ret_code = http_SendMessage(info,
+			&timeout_secs,
+			"bb",
+			headers.buf,
+			headers.length,
+			coded.buf,
+			coded.length);
+	else
+		ret_code = http_SendMessage(info,
+			&timeout_secs,
+			"bbbb",
+			headers.buf,
+			headers.length,
+			start_body,
+			strlen(start_body),
+			xml_response,
+			xml_len,
+			end_body,
+			strlen(end_body));
 	if (ret_code != 0) {
 		UpnpPrintf(UPNP_INFO,
 			SOAP,
@@ -298,8 +373,8 @@ static UPNP_INLINE void send_action_response(
 	err_code = 0;
 
 error_handler:
-	ixmlFreeDOMString(xml_response);
 	membuffer_destroy(&headers);
+	membuffer_destroy(&coded);
 	if (err_code != 0) {
 		/* only one type of error to worry about - out of mem */
 		send_error_response(
@@ -374,6 +449,33 @@ error_handler:
 		send_error_response(info, err_code, err_str, request);
 }
 
+/*!
+ * \brief Maps an error of the action schema parser to a SOAP error.
+ */
+static void get_args_error(
+	/*! [in] Error returned by the action schema parser. */
+	int code,
+	/*! [out] SOAP error code. */
+	int *err_code,
+	/*! [out] SOAP error description. */
+	const char **err_str)
+{
+	switch (code) {
+	case SOAP_INVALID_ARGS:
+		*err_code = SOAP_INVALID_ARGS;
+		*err_str = Soap_Invalid_Args;
+		break;
+	case SOAP_INVALID_ARG_VALUE:
+		*err_code = SOAP_INVALID_ARG_VALUE;
+		*err_str = Soap_Invalid_Arg_Value;
+		break;
+	default:
+		*err_code = SOAP_MEMORY_OUT;
+		*err_str = Soap_Memory_out;
+		break;
+	}
+}
+
 /*!
  * \brief Handles the SOAP action request.
  */
@@ -384,7 +486,8 @@ static void handle_invoke_action(
 	http_message_t *request,
 	/*! [in] SOAP device/service information. */
 	soap_devserv_t *soap_info,
-	/*! [in] Node containing the SOAP action request. */
+	/*! [in] Node containing the SOAP action request, NULL if the arguments
+	 * have already been decoded through the action schema. */
 	IXML_Node *req_node)
 {
 	char save_char;
@@ -395,29 +498,42 @@ static void handle_invoke_action(
 	const char *err_str;
 	memptr action_name;
 	DOMString act_node = NULL;
+	DOMString xml_response = NULL;
+	membuffer response;
 	memptr hdr_value;
 
+	membuffer_init(&response);
 	/* null-terminate */
 	action_name = soap_info->action_name;
 	save_char = action_name.buf[action_name.length];
 	action_name.buf[action_name.length] = '\0';
-	/* get action node */
-	act_node = ixmlPrintNode(req_node);
-	if (!act_node) {
-		err_code = SOAP_MEMORY_OUT;
-		err_str = Soap_Memory_out;
-		goto error_handler;
-	}
-	err_code = ixmlParseBufferEx(act_node, &actionRequestDoc);
-	if (err_code != IXML_SUCCESS) {
-		if (IXML_INSUFFICIENT_MEMORY == err_code) {
+	if (req_node) {
+		/* get action node */
+		act_node = ixmlPrintNode(req_node);
+		if (!act_node) {
 			err_code = SOAP_MEMORY_OUT;
 			err_str = Soap_Memory_out;
-		} else {
-			err_code = SOAP_INVALID_ACTION;
-			err_str = Soap_Invalid_Action;
+			goto error_handler;
+		}
+		err_code = ixmlParseBufferEx(act_node, &actionRequestDoc);
+		if (err_code != IXML_SUCCESS) {
+			if (IXML_INSUFFICIENT_MEMORY == err_code) {
+				err_code = SOAP_MEMORY_OUT;
+				err_str = Soap_Memory_out;
+			} else {
+				err_code = SOAP_INVALID_ACTION;
+				err_str = Soap_Invalid_Action;
+			}
+			goto error_handler;
+		}
+		if (soap_info->args) {
+			err_code = soap_schema_parse_node(
+				req_node, soap_info->args);
+			if (err_code != 0) {
+				get_args_error(err_code, &err_code, &err_str);
+				goto error_handler;
+			}
 		}
-		goto error_handler;
 	}
 	UpnpActionRequest_set_ErrCode(action, UPNP_E_SUCCESS);
 	UpnpActionRequest_strcpy_ActionName(action, action_name.buf);
@@ -425,6 +541,7 @@ static void handle_invoke_action(
 	UpnpActionRequest_strcpy_ServiceID(action, soap_info->service_id);
 	UpnpActionRequest_set_ActionRequest(action, actionRequestDoc);
 	UpnpActionRequest_set_ActionResult(action, NULL);
+	UpnpActionRequest_set_ActionArgs(action, soap_info->args);
 	UpnpActionRequest_set_CtrlPtIPAddr(action, &info->foreign_sockaddr);
 
 	if (httpmsg_find_hdr(request, HDR_USER_AGENT, &hdr_value) != NULL) {
@@ -446,17 +563,34 @@ static void handle_invoke_action(
 	}
 	/* validate, and handle action error */
 	actionResultDoc = UpnpActionRequest_get_ActionResult(action);
-	if (actionResultDoc == NULL) {
+	if (actionResultDoc != NULL) {
+		xml_response = ixmlPrintNode((IXML_Node *)actionResultDoc);
+		if (!xml_response) {
+			err_code = SOAP_MEMORY_OUT;
+			err_str = Soap_Memory_out;
+			goto error_handler;
+		}
+		/* send response */
+		send_action_response(
+			info, xml_response, strlen(xml_response), request);
+	} else if (soap_info->args != NULL &&
+		   soap_schema_make_response(soap_info->args,
+			   soap_info->service_type,
+			   &response) == UPNP_E_SUCCESS) {
+		/* output arguments set through the action schema */
+		send_action_response(
+			info, response.buf, response.length, request);
+	} else {
 		err_code = SOAP_ACTION_FAILED;
 		err_str = Soap_Action_Failed;
 		goto error_handler;
 	}
-	/* send response */
-	send_action_response(info, actionResultDoc, request);
 	err_code = 0;
 
 	/* error handling and cleanup */
 error_handler:
+	membuffer_destroy(&response);
+	ixmlFreeDOMString(xml_response);
 	ixmlDocument_free(actionResultDoc);
 	ixmlDocument_free(actionRequestDoc);
 	ixmlFreeDOMString(act_node);
@@ -467,6 +601,38 @@ error_handler:
 	UpnpActionRequest_delete(action);
 }
 
+		#if EXCLUDE_GENA == 0
+/*!
+ * \brief Creates the argument list of the requested action if the action
+ * schemas of the service have been compiled.
+ */
+static void get_action_args(
+	/*! [in,out] SOAP device/service information. */
+	soap_devserv_t *soap_info)
+{
+	struct Handle_Info *device_info;
+	service_info *serv_info;
+	const action_schema *schema;
+
+	soap_info->args = NULL;
+	HandleReadLock();
+	if (GetHandleInfo(soap_info->dev_hnd, &device_info) == HND_DEVICE) {
+		serv_info = FindServiceId(&device_info->ServiceTable,
+			soap_info->service_id,
+			soap_info->dev_udn);
+		if (serv_info && serv_info->schema) {
+			schema = soap_schema_find_action(serv_info->schema,
+				soap_info->action_name.buf,
+				soap_info->action_name.length);
+			/* The schema is copied, the service may go away. */
+			if (schema)
+				soap_info->args = UpnpActionArgs_new(schema);
+		}
+	}
+	HandleUnlock();
+}
+		#endif /* EXCLUDE_GENA */
+
 /*!
  * \brief Retrieve SOAP device/service information associated
  * with request-URI, which includes the callback function to hand-over
@@ -511,6 +677,7 @@ static int get_dev_service(
 	namecopy(soap_info->service_id, serv_info->serviceId);
 	soap_info->callback = device_info->Callback;
 	soap_info->cookie = device_info->Cookie;
+	soap_info->dev_hnd = device_hnd;
 	ret_code = 0;
 
 error_handler:
@@ -752,6 +919,9 @@ void soap_device_callback(
 	IXML_Document *xml_doc = NULL;
 	soap_devserv_t *soap_info = NULL;
 	IXML_Node *req_node = NULL;
+		#if EXCLUDE_GENA == 0
+	UpnpActionArgs *fresh_args;
+		#endif /* EXCLUDE_GENA */
 	(void)parser;
 
 	/* get device/service identified by the request-URI */
@@ -760,6 +930,7 @@ void soap_device_callback(
 		err_code = HTTP_INTERNAL_SERVER_ERROR;
 		goto error_handler;
 	}
+	soap_info->args = NULL;
 	if (get_dev_service(
 		    request, info->foreign_sockaddr.ss_family, soap_info) < 0) {
 		err_code = HTTP_NOT_FOUND;
@@ -786,6 +957,34 @@ void soap_device_callback(
 		}
 		goto error_handler;
 	}
+		#if EXCLUDE_GENA == 0
+	/* decode the arguments without DOM if the action has a schema */
+	if (NULL != soap_info->action_name.buf)
+		get_action_args(soap_info);
+	if (NULL != soap_info->args) {
+		err_code = soap_schema_parse_request(request->entity.buf,
+			request->entity.length,
+			soap_info->service_type,
+			soap_info->args);
+		if (err_code == 0) {
+			handle_invoke_action(info, request, soap_info, NULL);
+			err_code = HTTP_OK;
+			goto error_handler;
+		} else if (err_code != -1) {
+			const char *err_str;
+
+			get_args_error(err_code, &err_code, &err_str);
+			send_error_response(info, err_code, err_str, request);
+			err_code = HTTP_OK;
+			goto error_handler;
+		}
+		/* not a plain envelope, start over with the DOM parser */
+		fresh_args = UpnpActionArgs_new(
+			UpnpActionArgs_get_Schema(soap_info->args));
+		UpnpActionArgs_delete(soap_info->args);
+		soap_info->args = fresh_args;
+	}
+		#endif /* EXCLUDE_GENA */
 	/* parse XML */
 	err_code = ixmlParseBufferEx(request->entity.buf, &xml_doc);
 	if (err_code != IXML_SUCCESS) {
@@ -812,6 +1011,8 @@ void soap_device_callback(
 
 error_handler:
 	ixmlDocument_free(xml_doc);
+	if (soap_info)
+		UpnpActionArgs_delete(soap_info->args);
 	free(soap_info);
 	if (err_code != HTTP_OK) {
 		http_SendStatusResponse(info,
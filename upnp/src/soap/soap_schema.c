@@ -0,0 +1,1095 @@
+/*!
+ * \addtogroup SOAP
+ *
+ * @{
+ *
+ * \file
+ *
+ * \brief Action schemas compiled from the SCPD of a service, and the
+ * template parser and serializer of the action arguments.
+ */
+
+#include "config.h"
+
+#ifdef INCLUDE_DEVICE_APIS
+	#if EXCLUDE_SOAP == 0 && EXCLUDE_GENA == 0
+
+		#include "soap_schema.h"
+
+		#include "UpnpStdInt.h"
+		#include "service_table.h"
+		#include "upnp.h"
+
+		#include <errno.h>
+		#include <limits.h>
+		#include <stdlib.h>
+		#include <string.h>
+
+		#include "posix_overwrites.h"
+
+static const char *SOAP_ENVELOPE_URN = "http:/"
+				       "/schemas.xmlsoap.org/soap/envelope/";
+
+/*! Argument value error codes, see the UPnP Device Architecture. */
+		#define SCHEMA_INVALID_ARGS 402
+		#define SCHEMA_INVALID_VALUE 600
+
+/*!
+ * \brief Maps the dataType of a state variable to an argument type.
+ */
+static Upnp_ArgType arg_type_from_name(
+	/*! [in] Value of the dataType element, may be NULL. */
+	const char *name)
+{
+	static const struct
+	{
+		const char *name;
+		Upnp_ArgType type;
+	} types[] = {
+		{"boolean", UPNP_ARG_BOOLEAN},
+		{"ui1", UPNP_ARG_UI1},
+		{"ui2", UPNP_ARG_UI2},
+		{"ui4", UPNP_ARG_UI4},
+		{"ui8", UPNP_ARG_UI8},
+		{"i1", UPNP_ARG_I1},
+		{"i2", UPNP_ARG_I2},
+		{"i4", UPNP_ARG_I4},
+		{"int", UPNP_ARG_I4},
+		{"i8", UPNP_ARG_I8},
+		{"r4", UPNP_ARG_REAL},
+		{"r8", UPNP_ARG_REAL},
+		{"number", UPNP_ARG_REAL},
+		{"float", UPNP_ARG_REAL},
+		{"fixed.14.4", UPNP_ARG_REAL},
+	};
+	size_t i;
+
+	if (!name)
+		return UPNP_ARG_STRING;
+	for (i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+		if (strcasecmp(types[i].name, name) == 0)
+			return types[i].type;
+	}
+
+	return UPNP_ARG_STRING;
+}
+
+/*!
+ * \brief Finds the data type of a state variable of the service state table.
+ *
+ * \return 0 on success, -1 if the variable does not exist.
+ */
+static int find_state_var_type(
+	/*! [in] serviceStateTable element. */
+	IXML_Node *state_table,
+	/*! [in] Name of the state variable. */
+	const char *name,
+	/*! [out] Data type. */
+	Upnp_ArgType *type)
+{
+	IXML_Node *var;
+	IXML_Node *node;
+	char *var_name;
+	char *data_type;
+	int found = 0;
+
+	if (!state_table)
+		return -1;
+	for (var = ixmlNode_getFirstChild(state_table); var && !found;
+		var = ixmlNode_getNextSibling(var)) {
+		if (ixmlNode_getNodeType(var) != eELEMENT_NODE ||
+			strcmp(ixmlNode_getNodeName(var), "stateVariable") != 0)
+			continue;
+		if (!getSubElement("name", var, &node))
+			continue;
+		var_name = getElementValue(node);
+		if (var_name && strcmp(var_name, name) == 0) {
+			data_type = NULL;
+			if (getSubElement("dataType", var, &node))
+				data_type = getElementValue(node);
+			*type = arg_type_from_name(data_type);
+			ixmlFreeDOMString(data_type);
+			found = 1;
+		}
+		ixmlFreeDOMString(var_name);
+	}
+
+	return found ? 0 : -1;
+}
+
+/*!
+ * \brief Reads the name, direction and data type of an argument element.
+ *
+ * \return UPNP_E_SUCCESS, UPNP_E_INVALID_DESC or UPNP_E_OUTOF_MEMORY.
+ */
+static int read_argument(
+	/*! [in] argument element. */
+	IXML_Node *arg,
+	/*! [in] serviceStateTable element. */
+	IXML_Node *state_table,
+	/*! [out] Name of the argument, to be freed with ixmlFreeDOMString(). */
+	char **name,
+	/*! [out] 1 for an output argument, 0 otherwise. */
+	int *is_out,
+	/*! [out] Data type. */
+	Upnp_ArgType *type)
+{
+	IXML_Node *node;
+	char *value;
+	int ret = UPNP_E_INVALID_DESC;
+
+	*name = NULL;
+	if (!getSubElement("name", arg, &node) ||
+		!(*name = getElementValue(node)))
+		goto error_handler;
+	*is_out = 0;
+	if (getSubElement("direction", arg, &node)) {
+		value = getElementValue(node);
+		*is_out = value && strcmp(value, "out") == 0;
+		ixmlFreeDOMString(value);
+	}
+	if (!getSubElement("relatedStateVariable", arg, &node))
+		goto error_handler;
+	value = getElementValue(node);
+	if (!value)
+		goto error_handler;
+	if (find_state_var_type(state_table, value, type) == 0)
+		ret = UPNP_E_SUCCESS;
+	ixmlFreeDOMString(value);
+
+error_handler:
+	if (ret != UPNP_E_SUCCESS) {
+		ixmlFreeDOMString(*name);
+		*name = NULL;
+	}
+	return ret;
+}
+
+/*!
+ * \brief Compiles one action element into a relocatable block.
+ *
+ * \return UPNP_E_SUCCESS, UPNP_E_INVALID_DESC or UPNP_E_OUTOF_MEMORY.
+ */
+static int compile_action(
+	/*! [in] action element. */
+	IXML_Node *action,
+	/*! [in] serviceStateTable element. */
+	IXML_Node *state_table,
+	/*! [out] Compiled action, to be freed with free(). */
+	action_schema **out)
+{
+	IXML_Node *node;
+	IXML_Node *arg_list = NULL;
+	IXML_Node *arg;
+	action_schema *schema = NULL;
+	action_arg_schema *slot;
+	char *action_name = NULL;
+	char *name;
+	char *str = NULL;
+	size_t size;
+	int num_in = 0;
+	int num_out = 0;
+	int in_idx = 0;
+	int out_idx = 0;
+	int is_out;
+	Upnp_ArgType type;
+	int pass;
+	int ret = UPNP_E_INVALID_DESC;
+
+	*out = NULL;
+	if (!getSubElement("name", action, &node) ||
+		!(action_name = getElementValue(node)))
+		goto error_handler;
+	size = sizeof(action_schema) + strlen(action_name) + (size_t)1;
+	if (!getSubElement("argumentList", action, &arg_list))
+		arg_list = NULL;
+	/* The first pass sizes the block, the second one fills it. */
+	for (pass = 0; pass < 2; pass++) {
+		if (pass == 1) {
+			size += (size_t)(num_in + num_out) *
+				sizeof(action_arg_schema);
+			schema = malloc(size);
+			if (!schema) {
+				ret = UPNP_E_OUTOF_MEMORY;
+				goto error_handler;
+			}
+			schema->size = size;
+			schema->num_in = num_in;
+			schema->num_out = num_out;
+			schema->name_len = strlen(action_name);
+			schema->name = sizeof(action_schema) +
+				       (size_t)(num_in + num_out) *
+					       sizeof(action_arg_schema);
+			str = (char *)schema + schema->name;
+			memcpy(str, action_name, schema->name_len + (size_t)1);
+			str += schema->name_len + (size_t)1;
+			out_idx = num_in;
+		}
+		if (!arg_list)
+			continue;
+		for (arg = ixmlNode_getFirstChild(arg_list); arg;
+			arg = ixmlNode_getNextSibling(arg)) {
+			if (ixmlNode_getNodeType(arg) != eELEMENT_NODE ||
+				strcmp(ixmlNode_getNodeName(arg), "argument") !=
+					0)
+				continue;
+			ret = read_argument(
+				arg, state_table, &name, &is_out, &type);
+			if (ret != UPNP_E_SUCCESS)
+				goto error_handler;
+			if (pass == 0) {
+				size += strlen(name) + (size_t)1;
+				if (is_out)
+					num_out++;
+				else
+					num_in++;
+			} else {
+				slot = ACTION_SCHEMA_ARGS(schema) +
+				       (is_out ? out_idx++ : in_idx++);
+				slot->name = (size_t)(str - (char *)schema);
+				slot->name_len = strlen(name);
+				slot->type = type;
+				memcpy(str, name, slot->name_len + (size_t)1);
+				str += slot->name_len + (size_t)1;
+			}
+			ixmlFreeDOMString(name);
+		}
+	}
+	*out = schema;
+	schema = NULL;
+	ret = UPNP_E_SUCCESS;
+
+error_handler:
+	free(schema);
+	ixmlFreeDOMString(action_name);
+	return ret;
+}
+
+/*!
+ * \brief qsort() callback ordering actions by name.
+ */
+static int compare_actions(const void *a, const void *b)
+{
+	const action_schema *x = *(const action_schema *const *)a;
+	const action_schema *y = *(const action_schema *const *)b;
+
+	return strcmp(
+		ACTION_SCHEMA_STR(x, x->name), ACTION_SCHEMA_STR(y, y->name));
+}
+
+int soap_schema_compile(IXML_Document *scpd, service_schema **out)
+{
+	IXML_Node *root;
+	IXML_Node *action_list;
+	IXML_Node *state_table;
+	IXML_Node *node;
+	service_schema *schema = NULL;
+	int num_actions = 0;
+	int ret = UPNP_E_INVALID_DESC;
+
+	*out = NULL;
+	root = ixmlNode_getFirstChild((IXML_Node *)scpd);
+	while (root && ixmlNode_getNodeType(root) != eELEMENT_NODE)
+		root = ixmlNode_getNextSibling(root);
+	if (!root || !getSubElement("actionList", root, &action_list))
+		goto error_handler;
+	if (!getSubElement("serviceStateTable", root, &state_table))
+		state_table = NULL;
+	for (node = ixmlNode_getFirstChild(action_list); node;
+		node = ixmlNode_getNextSibling(node)) {
+		if (ixmlNode_getNodeType(node) == eELEMENT_NODE)
+			num_actions++;
+	}
+	schema = malloc(sizeof(service_schema));
+	if (!schema) {
+		ret = UPNP_E_OUTOF_MEMORY;
+		goto error_handler;
+	}
+	schema->num_actions = 0;
+	schema->actions =
+		calloc((size_t)num_actions + (size_t)1, sizeof(action_schema *));
+	if (!schema->actions) {
+		ret = UPNP_E_OUTOF_MEMORY;
+		goto error_handler;
+	}
+	for (node = ixmlNode_getFirstChild(action_list); node;
+		node = ixmlNode_getNextSibling(node)) {
+		if (ixmlNode_getNodeType(node) != eELEMENT_NODE ||
+			strcmp(ixmlNode_getNodeName(node), "action") != 0)
+			continue;
+		ret = compile_action(node,
+			state_table,
+			&schema->actions[schema->num_actions]);
+		if (ret != UPNP_E_SUCCESS)
+			goto error_handler;
+		schema->num_actions++;
+	}
+	qsort(schema->actions,
+		(size_t)schema->num_actions,
+		sizeof(action_schema *),
+		compare_actions);
+	*out = schema;
+	schema = NULL;
+	ret = UPNP_E_SUCCESS;
+
+error_handler:
+	soap_schema_free(schema);
+	return ret;
+}
+
+void soap_schema_free(service_schema *schema)
+{
+	int i;
+
+	if (!schema)
+		return;
+	if (schema->actions) {
+		for (i = 0; i < schema->num_actions; i++)
+			free(schema->actions[i]);
+		free(schema->actions);
+	}
+	free(schema);
+}
+
+const action_schema *soap_schema_find_action(
+	const service_schema *schema, const char *name, size_t name_len)
+{
+	const action_schema *action;
+	int low = 0;
+	int high;
+	int mid;
+	int cmp;
+
+	if (!schema)
+		return NULL;
+	high = schema->num_actions - 1;
+	while (low <= high) {
+		mid = low + (high - low) / 2;
+		action = schema->actions[mid];
+		cmp = strncmp(ACTION_SCHEMA_STR(action, action->name),
+			name,
+			name_len);
+		if (cmp == 0 && action->name_len > name_len)
+			cmp = 1;
+		if (cmp == 0)
+			return action;
+		if (cmp < 0)
+			low = mid + 1;
+		else
+			high = mid - 1;
+	}
+
+	return NULL;
+}
+
+int soap_schema_check_value(Upnp_ArgType type, const char *value)
+{
+	char *end;
+	long long sval;
+	unsigned long long uval;
+	long long smin = 0;
+	long long smax = 0;
+	unsigned long long umax = 0;
+
+	switch (type) {
+	case UPNP_ARG_BOOLEAN:
+		return !strcmp(value, "0") || !strcmp(value, "1") ||
+		       !strcasecmp(value, "true") ||
+		       !strcasecmp(value, "false") ||
+		       !strcasecmp(value, "yes") || !strcasecmp(value, "no");
+	case UPNP_ARG_UI1:
+		umax = UCHAR_MAX;
+		break;
+	case UPNP_ARG_UI2:
+		umax = USHRT_MAX;
+		break;
+	case UPNP_ARG_UI4:
+		umax = UINT_MAX;
+		break;
+	case UPNP_ARG_UI8:
+		umax = ULLONG_MAX;
+		break;
+	case UPNP_ARG_I1:
+		smin = SCHAR_MIN;
+		smax = SCHAR_MAX;
+		break;
+	case UPNP_ARG_I2:
+		smin = SHRT_MIN;
+		smax = SHRT_MAX;
+		break;
+	case UPNP_ARG_I4:
+		smin = INT_MIN;
+		smax = INT_MAX;
+		break;
+	case UPNP_ARG_I8:
+		smin = LLONG_MIN;
+		smax = LLONG_MAX;
+		break;
+	case UPNP_ARG_REAL:
+		if (!*value || *value == ' ' || *value == '\t')
+			return 0;
+		strtod(value, &end);
+		return *end == '\0';
+	case UPNP_ARG_STRING:
+	default:
+		return 1;
+	}
+	/* strtoll() and strtoull() skip spaces and strtoull() accepts a
+	 * minus sign, neither is a valid lexical form. */
+	if (!*value || *value == ' ' || *value == '\t')
+		return 0;
+	errno = 0;
+	if (umax) {
+		if (*value == '-')
+			return 0;
+		uval = strtoull(value, &end, 10);
+		return *end == '\0' && errno != ERANGE && uval <= umax;
+	}
+	sval = strtoll(value, &end, 10);
+
+	return *end == '\0' && errno != ERANGE && sval >= smin && sval <= smax;
+}
+
+/*!
+ * \brief Input of the template parser.
+ */
+typedef struct xml_cursor
+{
+	/*! Current position. */
+	const char *p;
+	/*! End of the input. */
+	const char *end;
+} xml_cursor;
+
+/*!
+ * \brief Start tag of an element, as seen by the template parser.
+ */
+typedef struct xml_tag
+{
+	/*! Prefix, may be empty. */
+	const char *prefix;
+	size_t prefix_len;
+	/*! Local name. */
+	const char *local;
+	size_t local_len;
+	/*! Attributes, unparsed. */
+	const char *attrs;
+	size_t attrs_len;
+	/*! 1 for an empty element tag. */
+	int empty;
+} xml_tag;
+
+static void skip_ws(xml_cursor *c)
+{
+	while (c->p < c->end &&
+		(*c->p == ' ' || *c->p == '\t' || *c->p == '\r' || *c->p == '\n'))
+		c->p++;
+}
+
+static int is_name_char(char ch)
+{
+	return ch != '\0' && strchr(" \t\r\n/>=<\"'", ch) == NULL;
+}
+
+/*!
+ * \brief Reads a possibly prefixed name.
+ *
+ * \return 0 on success, -1 if there is no name at the current position.
+ */
+static int read_qname(xml_cursor *c,
+	const char **prefix,
+	size_t *prefix_len,
+	const char **local,
+	size_t *local_len)
+{
+	const char *start = c->p;
+	const char *colon = NULL;
+
+	while (c->p < c->end && is_name_char(*c->p)) {
+		if (*c->p == ':' && !colon)
+			colon = c->p;
+		c->p++;
+	}
+	if (c->p == start)
+		return -1;
+	if (colon) {
+		*prefix = start;
+		*prefix_len = (size_t)(colon - start);
+		*local = colon + 1;
+	} else {
+		*prefix = start;
+		*prefix_len = 0;
+		*local = start;
+	}
+	*local_len = (size_t)(c->p - *local);
+
+	return *local_len ? 0 : -1;
+}
+
+/*!
+ * \brief Reads a start tag. Anything other than an element (comment,
+ * processing instruction, CDATA or DOCTYPE) is rejected.
+ *
+ * \return 0 on success, -1 otherwise.
+ */
+static int read_start_tag(xml_cursor *c, xml_tag *tag)
+{
+	char quote;
+
+	if (c->p >= c->end || *c->p != '<')
+		return -1;
+	c->p++;
+	if (read_qname(c,
+		    &tag->prefix,
+		    &tag->prefix_len,
+		    &tag->local,
+		    &tag->local_len) != 0)
+		return -1;
+	tag->attrs = c->p;
+	while (c->p < c->end && *c->p != '>' && *c->p != '/') {
+		if (*c->p == '"' || *c->p == '\'') {
+			quote = *c->p++;
+			while (c->p < c->end && *c->p != quote) {
+				/* Attribute values are kept undecoded. */
+				if (*c->p == '&' || *c->p == '<')
+					return -1;
+				c->p++;
+			}
+			if (c->p >= c->end)
+				return -1;
+		}
+		c->p++;
+	}
+	tag->attrs_len = (size_t)(c->p - tag->attrs);
+	tag->empty = 0;
+	if (c->p < c->end && *c->p == '/') {
+		tag->empty = 1;
+		c->p++;
+	}
+	if (c->p >= c->end || *c->p != '>')
+		return -1;
+	c->p++;
+
+	return 0;
+}
+
+/*!
+ * \brief Reads an end tag that must match a start tag.
+ *
+ * \return 0 on success, -1 otherwise.
+ */
+static int read_end_tag(xml_cursor *c, const xml_tag *tag)
+{
+	size_t len = (size_t)(tag->local + tag->local_len - tag->prefix);
+
+	if (c->end - c->p < 2 || c->p[0] != '<' || c->p[1] != '/')
+		return -1;
+	c->p += 2;
+	if ((size_t)(c->end - c->p) < len || memcmp(c->p, tag->prefix, len))
+		return -1;
+	c->p += len;
+	skip_ws(c);
+	if (c->p >= c->end || *c->p != '>')
+		return -1;
+	c->p++;
+
+	return 0;
+}
+
+/*!
+ * \brief Looks up the namespace declaration of a prefix in the attributes
+ * of a start tag.
+ *
+ * \return 1 if found, 0 otherwise.
+ */
+static int find_xmlns(const xml_tag *tag,
+	const char *prefix,
+	size_t prefix_len,
+	const char **uri,
+	size_t *uri_len)
+{
+	xml_cursor c;
+	const char *attr_prefix;
+	size_t attr_prefix_len;
+	const char *local;
+	size_t local_len;
+	int match;
+	char quote;
+
+	c.p = tag->attrs;
+	c.end = tag->attrs + tag->attrs_len;
+	for (;;) {
+		skip_ws(&c);
+		if (read_qname(&c,
+			    &attr_prefix,
+			    &attr_prefix_len,
+			    &local,
+			    &local_len) != 0)
+			return 0;
+		if (prefix_len)
+			match = attr_prefix_len == 5 &&
+				!memcmp(attr_prefix, "xmlns", 5) &&
+				local_len == prefix_len &&
+				!memcmp(local, prefix, prefix_len);
+		else
+			match = attr_prefix_len == 0 && local_len == 5 &&
+				!memcmp(local, "xmlns", 5);
+		skip_ws(&c);
+		if (c.p >= c.end || *c.p != '=')
+			return 0;
+		c.p++;
+		skip_ws(&c);
+		if (c.p >= c.end || (*c.p != '"' && *c.p != '\''))
+			return 0;
+		quote = *c.p++;
+		*uri = c.p;
+		while (c.p < c.end && *c.p != quote)
+			c.p++;
+		if (c.p >= c.end)
+			return 0;
+		*uri_len = (size_t)(c.p - *uri);
+		c.p++;
+		if (match)
+			return 1;
+	}
+}
+
+/*!
+ * \brief Checks whether a start tag declares any namespace.
+ */
+static int has_xmlns(const xml_tag *tag)
+{
+	const char *s = tag->attrs;
+	const char *end = tag->attrs + tag->attrs_len;
+
+	for (; end - s >= 5; s++) {
+		if (!memcmp(s, "xmlns", 5))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*!
+ * \brief Checks that the prefix of a tag is bound to a namespace, looking
+ * first at the tag itself and then at the enclosing tag.
+ */
+static int tag_in_namespace(const xml_tag *tag,
+	const xml_tag *parent,
+	const char *ns,
+	size_t ns_len)
+{
+	const char *uri;
+	size_t uri_len;
+
+	if (!find_xmlns(tag, tag->prefix, tag->prefix_len, &uri, &uri_len) &&
+		(!parent ||
+			!find_xmlns(parent,
+				tag->prefix,
+				tag->prefix_len,
+				&uri,
+				&uri_len)))
+		return 0;
+
+	return uri_len == ns_len && !memcmp(uri, ns, ns_len);
+}
+
+/*!
+ * \brief Returns the value of a hexadecimal digit.
+ *
+ * \return The value, 16 if \a c is not a digit.
+ */
+static int digit_value(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return 16;
+}
+
+/*!
+ * \brief Appends the UTF-8 encoding of a code point.
+ *
+ * \return The number of bytes written, 0 if the code point is invalid.
+ */
+static size_t put_utf8(char *out, unsigned long cp)
+{
+	if (cp == 0 || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+		return 0;
+	if (cp < 0x80) {
+		out[0] = (char)cp;
+		return 1;
+	}
+	if (cp < 0x800) {
+		out[0] = (char)(0xC0 | (cp >> 6));
+		out[1] = (char)(0x80 | (cp & 0x3F));
+		return 2;
+	}
+	if (cp < 0x10000) {
+		out[0] = (char)(0xE0 | (cp >> 12));
+		out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+		out[2] = (char)(0x80 | (cp & 0x3F));
+		return 3;
+	}
+	out[0] = (char)(0xF0 | (cp >> 18));
+	out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+	out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+	out[3] = (char)(0x80 | (cp & 0x3F));
+
+	return 4;
+}
+
+/*!
+ * \brief Decodes the character and entity references of a NUL terminated
+ * text in place. The decoded text is never longer than the original one.
+ *
+ * \return 0 on success, -1 on an unknown or malformed reference.
+ */
+static int unescape_in_place(char *s)
+{
+	static const struct
+	{
+		const char *name;
+		size_t len;
+		char ch;
+	} entities[] = {
+		{"lt;", 3, '<'},
+		{"gt;", 3, '>'},
+		{"amp;", 4, '&'},
+		{"quot;", 5, '"'},
+		{"apos;", 5, '\''},
+	};
+	char *in = strchr(s, '&');
+	char *out = in;
+	char *end;
+	unsigned long cp;
+	int base;
+	int d;
+	size_t i;
+	size_t n;
+
+	if (!in)
+		return 0;
+	while (*in) {
+		if (*in != '&') {
+			*out++ = *in++;
+			continue;
+		}
+		in++;
+		if (*in == '#') {
+			in++;
+			base = *in == 'x' ? 16 : 10;
+			if (base == 16)
+				in++;
+			/* only digits, strtoul() would take spaces, a sign
+			 * and a 0x prefix */
+			cp = 0;
+			for (end = in; (d = digit_value(*end)) < base; end++) {
+				cp = cp * (unsigned long)base + (unsigned long)d;
+				if (cp > 0x10FFFF)
+					return -1;
+			}
+			if (end == in || *end != ';')
+				return -1;
+			n = put_utf8(out, cp);
+			if (!n)
+				return -1;
+			out += n;
+			in = end + 1;
+			continue;
+		}
+		for (i = 0; i < sizeof(entities) / sizeof(entities[0]); i++) {
+			if (!strncmp(in, entities[i].name, entities[i].len))
+				break;
+		}
+		if (i == sizeof(entities) / sizeof(entities[0]))
+			return -1;
+		*out++ = entities[i].ch;
+		in += entities[i].len;
+	}
+	*out = '\0';
+
+	return 0;
+}
+
+/*!
+ * \brief Index of an input argument, looked up by a name that is not NUL
+ * terminated.
+ *
+ * \return The index or -1.
+ */
+static int find_in_arg(
+	const action_schema *schema, const char *name, size_t name_len)
+{
+	const action_arg_schema *args = ACTION_SCHEMA_ARGS(schema);
+	int i;
+
+	for (i = 0; i < schema->num_in; i++) {
+		if (args[i].name_len == name_len &&
+			!memcmp(ACTION_SCHEMA_STR(schema, args[i].name),
+				name,
+				name_len))
+			return i;
+	}
+
+	return -1;
+}
+
+/*!
+ * \brief Stores, decodes and validates the value of an input argument.
+ *
+ * \return 0, -1 if the value must be decoded by the DOM parser, 402, 600 or
+ * UPNP_E_OUTOF_MEMORY.
+ */
+static int set_in_arg(UpnpActionArgs *args,
+	const char *name,
+	size_t name_len,
+	const char *value,
+	size_t value_len,
+	int decode)
+{
+	const action_schema *schema = UpnpActionArgs_get_Schema(args);
+	char *stored;
+	size_t i;
+	int idx;
+
+	idx = find_in_arg(schema, name, name_len);
+	if (idx < 0 || UpnpActionArgs_get_InValue(args, idx))
+		return SCHEMA_INVALID_ARGS;
+	/* Whitespace only text is not a text node for the DOM parser. */
+	for (i = 0; i < value_len; i++) {
+		if (!strchr(" \t\r\n", value[i]))
+			break;
+	}
+	if (i == value_len)
+		value_len = 0;
+	stored = UpnpActionArgs_set_InValue(args, idx, value, value_len);
+	if (!stored)
+		return UPNP_E_OUTOF_MEMORY;
+	if (decode && unescape_in_place(stored) != 0)
+		return -1;
+	if (!soap_schema_check_value(ACTION_SCHEMA_ARGS(schema)[idx].type,
+		    stored))
+		return SCHEMA_INVALID_VALUE;
+
+	return 0;
+}
+
+/*!
+ * \brief Checks that every input argument has been set.
+ */
+static int check_missing_args(const UpnpActionArgs *args)
+{
+	int i;
+
+	for (i = 0; i < UpnpActionArgs_get_NumIn(args); i++) {
+		if (!UpnpActionArgs_get_InValue(args, i))
+			return SCHEMA_INVALID_ARGS;
+	}
+
+	return 0;
+}
+
+int soap_schema_parse_request(const char *body,
+	size_t body_len,
+	const char *service_type,
+	UpnpActionArgs *args)
+{
+	const action_schema *schema = UpnpActionArgs_get_Schema(args);
+	xml_cursor c;
+	xml_tag envelope;
+	xml_tag soap_body;
+	xml_tag action;
+	xml_tag arg;
+	const char *text;
+	size_t text_len;
+	int ret;
+
+	c.p = body;
+	c.end = body + body_len;
+	skip_ws(&c);
+	/* XML declaration */
+	if (c.end - c.p >= 5 && !memcmp(c.p, "<?xml", 5)) {
+		while (c.end - c.p >= 2 && (c.p[0] != '?' || c.p[1] != '>'))
+			c.p++;
+		if (c.end - c.p < 2)
+			return -1;
+		c.p += 2;
+		skip_ws(&c);
+	}
+	/* Envelope */
+	if (read_start_tag(&c, &envelope) != 0 || envelope.empty ||
+		envelope.local_len != 8 ||
+		memcmp(envelope.local, "Envelope", 8) ||
+		!tag_in_namespace(&envelope,
+			NULL,
+			SOAP_ENVELOPE_URN,
+			strlen(SOAP_ENVELOPE_URN)))
+		return -1;
+	skip_ws(&c);
+	/* Body, a Header is left to the DOM parser */
+	if (read_start_tag(&c, &soap_body) != 0 || soap_body.empty ||
+		soap_body.local_len != 4 || memcmp(soap_body.local, "Body", 4) ||
+		soap_body.prefix_len != envelope.prefix_len ||
+		memcmp(soap_body.prefix, envelope.prefix, envelope.prefix_len) ||
+		has_xmlns(&soap_body))
+		return -1;
+	skip_ws(&c);
+	/* Action */
+	if (read_start_tag(&c, &action) != 0 ||
+		action.local_len != schema->name_len ||
+		memcmp(action.local,
+			ACTION_SCHEMA_STR(schema, schema->name),
+			schema->name_len) ||
+		!tag_in_namespace(&action,
+			&envelope,
+			service_type,
+			strlen(service_type)))
+		return -1;
+	/* Arguments */
+	while (!action.empty) {
+		skip_ws(&c);
+		if (c.end - c.p >= 2 && c.p[0] == '<' && c.p[1] == '/') {
+			if (read_end_tag(&c, &action) != 0)
+				return -1;
+			break;
+		}
+		if (read_start_tag(&c, &arg) != 0 || arg.prefix_len)
+			return -1;
+		text = c.p;
+		if (!arg.empty) {
+			while (c.p < c.end && *c.p != '<')
+				c.p++;
+		}
+		text_len = (size_t)(c.p - text);
+		/* Nested elements and CDATA sections fail here. */
+		if (!arg.empty && read_end_tag(&c, &arg) != 0)
+			return -1;
+		ret = set_in_arg(
+			args, arg.local, arg.local_len, text, text_len, 1);
+		if (ret != 0)
+			return ret;
+	}
+	skip_ws(&c);
+	if (read_end_tag(&c, &soap_body) != 0)
+		return -1;
+	skip_ws(&c);
+	if (read_end_tag(&c, &envelope) != 0)
+		return -1;
+	skip_ws(&c);
+	if (c.p != c.end)
+		return -1;
+
+	return check_missing_args(args);
+}
+
+int soap_schema_parse_node(IXML_Node *action_node, UpnpActionArgs *args)
+{
+	IXML_Node *node;
+	IXML_Node *child;
+	const char *name;
+	const char *value;
+	int ret;
+
+	for (node = ixmlNode_getFirstChild(action_node); node;
+		node = ixmlNode_getNextSibling(node)) {
+		if (ixmlNode_getNodeType(node) != eELEMENT_NODE)
+			continue;
+		name = ixmlNode_getLocalName(node);
+		if (!name)
+			return SCHEMA_INVALID_ARGS;
+		child = ixmlNode_getFirstChild(node);
+		value = "";
+		if (child && ixmlNode_getNodeType(child) == eTEXT_NODE)
+			value = ixmlNode_getNodeValue(child);
+		if (!value)
+			value = "";
+		ret = set_in_arg(args, name, strlen(name), value, strlen(value), 0);
+		if (ret != 0)
+			return ret;
+	}
+
+	return check_missing_args(args);
+}
+
+/*!
+ * \brief Appends a text with the XML markup characters escaped.
+ *
+ * \return 0 on success, UPNP_E_OUTOF_MEMORY otherwise.
+ */
+static int append_escaped(membuffer *out, const char *s)
+{
+	const char *run = s;
+	const char *entity;
+
+	for (; *s; s++) {
+		switch (*s) {
+		case '&':
+			entity = "&amp;";
+			break;
+		case '<':
+			entity = "&lt;";
+			break;
+		case '>':
+			entity = "&gt;";
+			break;
+		default:
+			continue;
+		}
+		if (membuffer_append(out, run, (size_t)(s - run)) != 0 ||
+			membuffer_append_str(out, entity) != 0)
+			return UPNP_E_OUTOF_MEMORY;
+		run = s + 1;
+	}
+	if (membuffer_append(out, run, (size_t)(s - run)) != 0)
+		return UPNP_E_OUTOF_MEMORY;
+
+	return 0;
+}
+
+int soap_schema_make_response(
+	const UpnpActionArgs *args, const char *service_type, membuffer *out)
+{
+	const char *action_name = UpnpActionArgs_get_ActionName(args);
+	const char *name;
+	const char *value;
+	int i;
+
+	for (i = 0; i < UpnpActionArgs_get_NumOut(args); i++) {
+		if (!UpnpActionArgs_get_OutValue(args, i))
+			return UPNP_E_INVALID_ARGUMENT;
+	}
+	if (membuffer_append_str(out, "<u:") != 0 ||
+		membuffer_append_str(out, action_name) != 0 ||
+		membuffer_append_str(out, "Response xmlns:u=\"") != 0 ||
+		membuffer_append_str(out, service_type) != 0 ||
+		membuffer_append_str(out, "\">\n") != 0)
+		return UPNP_E_OUTOF_MEMORY;
+	for (i = 0; i < UpnpActionArgs_get_NumOut(args); i++) {
+		name = UpnpActionArgs_get_OutName(args, i);
+		value = UpnpActionArgs_get_OutValue(args, i);
+		if (membuffer_append_str(out, "<") != 0 ||
+			membuffer_append_str(out, name) != 0 ||
+			membuffer_append_str(out, ">") != 0 ||
+			append_escaped(out, value) != 0 ||
+			membuffer_append_str(out, "</") != 0 ||
+			membuffer_append_str(out, name) != 0 ||
+			membuffer_append_str(out, ">\n") != 0)
+			return UPNP_E_OUTOF_MEMORY;
+	}
+	if (membuffer_append_str(out, "</u:") != 0 ||
+		membuffer_append_str(out, action_name) != 0 ||
+		membuffer_append_str(out, "Response>\n") != 0)
+		return UPNP_E_OUTOF_MEMORY;
+
+	return UPNP_E_SUCCESS;
+}
+
+	#endif /* EXCLUDE_SOAP && EXCLUDE_GENA */
+#endif /* INCLUDE_DEVICE_APIS */
+
+/* @} SOAP */
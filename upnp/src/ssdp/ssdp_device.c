@@ -47,6 +47,7 @@
 		#include "UpnpInet.h"
 		#include "httpparser.h"
 		#include "httpreadwrite.h"
+		#include "loadshed.h"
 		#include "ssdplib.h"
 		#include "statcodes.h"
 		#include "unixutil.h"
@@ -62,6 +63,115 @@
 		#define MSGTYPE_ADVERTISEMENT 1
 		#define MSGTYPE_REPLY 2
 
+/*! Replies to M-SEARCH requests waiting to be sent. */
+static SsdpSearchReply *gSearchReplies = NULL;
+
+/*! Protects gSearchReplies. */
+static ithread_mutex_t gSearchReplyMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*!
+ * \brief Returns whether two replies go to the same control point for the
+ * same search target.
+ */
+static int same_search_reply(
+	/*! [in] Reply. */
+	const SsdpSearchReply *a,
+	/*! [in] Other reply. */
+	const SsdpSearchReply *b)
+{
+	const struct sockaddr_in *a4 = (const struct sockaddr_in *)&a->dest_addr;
+	const struct sockaddr_in *b4 = (const struct sockaddr_in *)&b->dest_addr;
+	const struct sockaddr_in6 *a6 =
+		(const struct sockaddr_in6 *)&a->dest_addr;
+	const struct sockaddr_in6 *b6 =
+		(const struct sockaddr_in6 *)&b->dest_addr;
+
+	if (a->handle != b->handle ||
+		a->event.RequestType != b->event.RequestType ||
+		a->dest_addr.ss_family != b->dest_addr.ss_family)
+		return 0;
+	switch (a->dest_addr.ss_family) {
+	case AF_INET:
+		if (a4->sin_port != b4->sin_port ||
+			memcmp(&a4->sin_addr,
+				&b4->sin_addr,
+				sizeof(a4->sin_addr)) != 0)
+			return 0;
+		break;
+	case AF_INET6:
+		if (a6->sin6_port != b6->sin6_port ||
+			memcmp(&a6->sin6_addr,
+				&b6->sin6_addr,
+				sizeof(a6->sin6_addr)) != 0)
+			return 0;
+		break;
+	default:
+		return 0;
+	}
+
+	return strcmp(a->event.UDN, b->event.UDN) == 0 &&
+	       strcmp(a->event.DeviceType, b->event.DeviceType) == 0 &&
+	       strcmp(a->event.ServiceType, b->event.ServiceType) == 0;
+}
+
+/*!
+ * \brief Adds a reply admitted to the replies waiting to be sent.
+ *
+ * Once half the budget of the replies is spent, a reply duplicating one
+ * waiting is shed instead, the control point having repeated its request.
+ *
+ * \return 0 if the reply was added, -1 if it was shed.
+ */
+static int search_reply_add(
+	/*! [in,out] Reply. */
+	SsdpSearchReply *reply)
+{
+	SsdpSearchReply *r;
+	int rc = 0;
+
+	ithread_mutex_lock(&gSearchReplyMutex);
+	if (load_pressure(UPNP_LOAD_SEARCH_REPLY)) {
+		for (r = gSearchReplies; r; r = r->next) {
+			if (same_search_reply(r, reply)) {
+				load_shed_duplicate(UPNP_LOAD_SEARCH_REPLY);
+				rc = -1;
+				goto exit_function;
+			}
+		}
+	}
+	reply->prev = NULL;
+	reply->next = gSearchReplies;
+	if (gSearchReplies)
+		gSearchReplies->prev = reply;
+	gSearchReplies = reply;
+
+exit_function:
+	ithread_mutex_unlock(&gSearchReplyMutex);
+
+	return rc;
+}
+
+/*!
+ * \brief Removes a reply from the replies waiting to be sent and frees it.
+ */
+static void free_search_reply(
+	/*! [in] Reply. */
+	void *data)
+{
+	SsdpSearchReply *reply = (SsdpSearchReply *)data;
+
+	ithread_mutex_lock(&gSearchReplyMutex);
+	if (reply->prev)
+		reply->prev->next = reply->next;
+	else
+		gSearchReplies = reply->next;
+	if (reply->next)
+		reply->next->prev = reply->prev;
+	ithread_mutex_unlock(&gSearchReplyMutex);
+	free(reply);
+	load_done(UPNP_LOAD_SEARCH_REPLY);
+}
+
 void advertiseAndReplyThread(void *data)
 {
 	SsdpSearchReply *arg = (SsdpSearchReply *)data;
@@ -74,7 +184,7 @@ void advertiseAndReplyThread(void *data)
 		arg->event.UDN,
 		arg->event.ServiceType,
 		arg->MaxAge);
-	free(arg);
+	free_search_reply(arg);
 }
 
 		#ifdef INCLUDE_DEVICE_APIS
@@ -91,6 +201,7 @@ void ssdp_handle_device_request(
 	int ret_code;
 	SsdpSearchReply *threadArg = NULL;
 	ThreadPoolJob job;
+	struct timeval deadline;
 	int replyTime;
 	int maxAge;
 
@@ -116,6 +227,9 @@ void ssdp_handle_device_request(
 	if (ret_code == -1)
 		/* bad ST header. */
 		return;
+	/* the control point stops listening after MX seconds */
+	gettimeofday(&deadline, NULL);
+	deadline.tv_sec += MAXVAL(mx, 1);
 
 	start = 0;
 	for (;;) {
@@ -163,18 +277,31 @@ void ssdp_handle_device_request(
 			__LINE__,
 			"ServiceType =  %s\n",
 			event.ServiceType);
+		start = handle;
+		if (!load_admit(UPNP_LOAD_SEARCH_REPLY))
+			continue;
 		threadArg = (SsdpSearchReply *)malloc(sizeof(SsdpSearchReply));
-		if (threadArg == NULL)
+		if (threadArg == NULL) {
+			load_done(UPNP_LOAD_SEARCH_REPLY);
 			return;
+		}
 		threadArg->handle = handle;
 		memcpy(&threadArg->dest_addr,
 			dest_addr,
 			sizeof(threadArg->dest_addr));
 		threadArg->event = event;
 		threadArg->MaxAge = maxAge;
+		if (search_reply_add(threadArg) != 0) {
+			free(threadArg);
+			continue;
+		}
 
 		TPJobInit(&job, advertiseAndReplyThread, threadArg);
-		TPJobSetFreeFunction(&job, (free_routine)free);
+		/* the reply is released by the job, when it expires, or when
+		 * the job is dropped */
+		TPJobSetFreeFunction(&job, free_search_reply);
+		TPJobSetDeadline(&job, &deadline, free_search_reply);
+		TPJobSetType(&job, UPNP_JOB_SSDP);
 
 		/* Subtract a percentage from the mx to allow for network and
 		 * processing delays (i.e. if search is for 30 seconds, respond
@@ -184,13 +311,13 @@ void ssdp_handle_device_request(
 		if (mx < 1)
 			mx = 1;
 		replyTime = rand() % mx;
-		TimerThreadSchedule(&gTimerThread,
-			replyTime,
-			REL_SEC,
-			&job,
-			SHORT_TERM,
-			NULL);
-		start = handle;
+		if (TimerThreadSchedule(&gTimerThread,
+			    replyTime,
+			    REL_SEC,
+			    &job,
+			    SHORT_TERM,
+			    NULL) != 0)
+			free_search_reply(threadArg);
 	}
 }
 		#endif
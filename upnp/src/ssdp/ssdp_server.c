@@ -47,6 +47,7 @@
 	#include "ThreadPool.h"
 	#include "httpparser.h"
 	#include "httpreadwrite.h"
+	#include "loadshed.h"
 	#include "membuffer.h"
 	#include "miniserver.h"
 	#include "sock.h"
@@ -778,6 +779,18 @@ error_handler:
 	return -1;
 }
 
+/*!
+ * \brief Frees the SSDP request of a job that was not run.
+ */
+static void free_ssdp_event_handler_job(
+	/*! [in] ssdp_thread_data structure. This structure contains SSDP
+	 * request message. */
+	void *the_data)
+{
+	free_ssdp_event_handler_data(the_data);
+	load_done(UPNP_LOAD_SSDP);
+}
+
 /*!
  * \brief This function is a thread that handles SSDP requests.
  */
@@ -789,8 +802,10 @@ static void ssdp_event_handler_thread(
 	ssdp_thread_data *data = (ssdp_thread_data *)the_data;
 	http_message_t *hmsg = &data->parser.msg;
 
-	if (start_event_handler(the_data) != 0)
+	if (start_event_handler(the_data) != 0) {
+		load_done(UPNP_LOAD_SSDP);
 		return;
+	}
 	/* send msg to device or ctrlpt */
 	if (hmsg->method == (http_method_t)HTTPMETHOD_NOTIFY ||
 		hmsg->request_method == (http_method_t)HTTPMETHOD_MSEARCH) {
@@ -803,6 +818,7 @@ static void ssdp_event_handler_thread(
 
 	/* free data */
 	free_ssdp_event_handler_data(data);
+	load_done(UPNP_LOAD_SSDP);
 }
 
 int readFromSSDPSocket(SOCKET socket)
@@ -836,6 +852,8 @@ int readFromSSDPSocket(SOCKET socket)
 	#else  /* INCLUDE_CLIENT_APIS */
 		parser_request_init(&data->parser);
 	#endif /* INCLUDE_CLIENT_APIS */
+		httpmsg_set_arena_storage(
+			&data->parser.msg, data->arena, sizeof(data->arena));
 		/* set size of parser buffer */
 		if (membuffer_set_size(&data->parser.msg.msg, BUFSIZE) == 0)
 			/* use this as the buffer for recv */
@@ -882,7 +900,10 @@ int readFromSSDPSocket(SOCKET socket)
 			   "From host %s\n", requestBuf, ntop_buf);
 		/* clang-format on */
 		/* add thread pool job to handle request */
-		if (data != NULL) {
+		if (data != NULL && !load_admit(UPNP_LOAD_SSDP)) {
+			/* drop the datagram */
+			free_ssdp_event_handler_data(data);
+		} else if (data != NULL) {
 			data->parser.msg.msg.length += (size_t)byteReceived;
 			/* null-terminate */
 			data->parser.msg.msg.buf[byteReceived] = 0;
@@ -891,10 +912,13 @@ int readFromSSDPSocket(SOCKET socket)
 				(start_routine)ssdp_event_handler_thread,
 				data);
 			TPJobSetFreeFunction(
-				&job, free_ssdp_event_handler_data);
+				&job, free_ssdp_event_handler_job);
 			TPJobSetPriority(&job, MED_PRIORITY);
-			if (ThreadPoolAdd(&gRecvThreadPool, &job, NULL) != 0)
+			TPJobSetType(&job, UPNP_JOB_SSDP);
+			if (ThreadPoolAdd(&gRecvThreadPool, &job, NULL) != 0) {
 				free_ssdp_event_handler_data(data);
+				load_shed_pool(UPNP_LOAD_SSDP);
+			}
 		}
 		return 0;
 	} else {
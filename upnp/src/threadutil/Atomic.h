@@ -0,0 +1,48 @@
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+/*!
+ * \file
+ *
+ * \brief Sequentially consistent atomic operations on an int and on a
+ * pointer, for the data read without holding a mutex.
+ *
+ * The arguments p must be valid, non null and aligned pointers, to an int or
+ * to a void pointer for the _ptr variants. ithread_atomic_add() adds a value
+ * and returns the new value, ithread_atomic_cas() stores v if the int is e
+ * and returns nonzero if it did, ithread_atomic_exchange_ptr() stores a
+ * pointer and returns the previous one.
+ *
+ * \internal These are not part of the installed ithread.h.
+ */
+
+#if defined(_MSC_VER) && !defined(__clang__)
+	#include <intrin.h>
+	#define ithread_atomic_load(p) _InterlockedOr((volatile long *)(p), 0)
+	#define ithread_atomic_store(p, v) \
+		((void)_InterlockedExchange((volatile long *)(p), (v)))
+	#define ithread_atomic_add(p, v) \
+		(_InterlockedExchangeAdd((volatile long *)(p), (v)) + (v))
+	#define ithread_atomic_cas(p, e, v) \
+		(_InterlockedCompareExchange((volatile long *)(p), (v), (e)) == \
+			(e))
+	#define ithread_atomic_load_ptr(p) \
+		_InterlockedCompareExchangePointer( \
+			(void *volatile *)(p), NULL, NULL)
+	#define ithread_atomic_exchange_ptr(p, v) \
+		_InterlockedExchangePointer((void *volatile *)(p), (v))
+#else
+	#define ithread_atomic_load(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+	#define ithread_atomic_store(p, v) \
+		__atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+	#define ithread_atomic_add(p, v) \
+		__atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+	#define ithread_atomic_cas(p, e, v) \
+		__sync_bool_compare_and_swap((p), (e), (v))
+	#define ithread_atomic_load_ptr(p) \
+		__atomic_load_n((p), __ATOMIC_SEQ_CST)
+	#define ithread_atomic_exchange_ptr(p, v) \
+		__atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#endif
+
+#endif /* ATOMIC_H */
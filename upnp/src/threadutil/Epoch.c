@@ -0,0 +1,48 @@
+/*!
+ * \file
+ *
+ * \brief Grace periods for data read without lock.
+ */
+
+#include "Epoch.h"
+
+#include "ithread.h"
+
+#include <assert.h>
+#include <time.h>
+
+int EpochEnter(Epoch *e)
+{
+	int token;
+
+	assert(e != NULL);
+
+	/* If the epoch changes before the reader is counted, the writer may
+	 * not have seen it: count it again in the new epoch. */
+	for (;;) {
+		token = ithread_atomic_load(&e->epoch) & 1;
+		ithread_atomic_add(&e->readers[token], 1);
+		if ((ithread_atomic_load(&e->epoch) & 1) == token)
+			return token;
+		ithread_atomic_add(&e->readers[token], -1);
+	}
+}
+
+void EpochLeave(Epoch *e, int token)
+{
+	assert(e != NULL);
+
+	ithread_atomic_add(&e->readers[token], -1);
+}
+
+void EpochSynchronize(Epoch *e)
+{
+	int previous;
+
+	assert(e != NULL);
+
+	previous = (ithread_atomic_add(&e->epoch, 1) - 1) & 1;
+	/* readers hold the epoch for a lookup only */
+	while (ithread_atomic_load(&e->readers[previous]) != 0)
+		imillisleep(1);
+}
@@ -0,0 +1,72 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+/*!
+ * \file
+ *
+ * \brief Grace periods for data read without lock.
+ *
+ * Readers of a structure published with ithread_atomic_exchange_ptr() enter
+ * the current epoch before loading the pointer and leave it when done. A
+ * writer, after publishing a new version, synchronizes: it starts a new
+ * epoch and waits until the readers of the previous one have left, after
+ * which the old version can no longer be in use and may be freed. Writers
+ * must be serialized by the caller.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "Atomic.h"
+
+/*!
+ * Readers in progress, counted by parity of the epoch they entered.
+ * \internal
+ */
+typedef struct EPOCH
+{
+	int readers[2];
+	int epoch;
+} Epoch;
+
+/*!
+ * \brief Static initializer of an Epoch.
+ */
+#define EPOCH_INITIALIZER \
+	{ \
+		{0, 0}, 0 \
+	}
+
+/*!
+ * \brief Enters the current epoch, before loading a published pointer.
+ *
+ * \return The token to give to EpochLeave().
+ */
+int EpochEnter(
+	/*! Must be valid, non null, pointer to an Epoch. */
+	Epoch *e);
+
+/*!
+ * \brief Leaves the epoch entered with EpochEnter(), once done with the
+ * published data.
+ */
+void EpochLeave(
+	/*! Must be valid, non null, pointer to an Epoch. */
+	Epoch *e,
+	/*! Value returned by EpochEnter(). */
+	int token);
+
+/*!
+ * \brief Waits until the readers that may have loaded a pointer before it
+ * was replaced are done.
+ */
+void EpochSynchronize(
+	/*! Must be valid, non null, pointer to an Epoch. */
+	Epoch *e);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EPOCH_H */
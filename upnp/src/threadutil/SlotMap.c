@@ -0,0 +1,175 @@
+/*!
+ * \file
+ *
+ * \brief Ids of the items of a container, looked up in constant time.
+ */
+
+#include "SlotMap.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+/*! Slots of a new table. */
+#define SLOT_MAP_MIN_SLOTS 64
+
+/*!
+ * \brief Returns the slot of an id, NULL if the id is not in use.
+ */
+static SlotMapSlot *SlotMapFind(
+	/*! . */
+	SlotMap *map,
+	/*! . */
+	int id)
+{
+	int i = id & ((1 << map->slotBits) - 1);
+	int generation = (id >> map->slotBits) &
+			 ((1 << SLOT_MAP_GENERATION_BITS) - 1);
+	SlotMapSlot *slot;
+
+	if (id < 0 || (id & map->idBits) != map->idBits || i >= map->size)
+		return NULL;
+	slot = &map->slots[i];
+	if (!slot->used || slot->generation != generation)
+		return NULL;
+
+	return slot;
+}
+
+/*!
+ * \brief Doubles the table, adding the new slots to the free list.
+ *
+ * \return 0 on success, ENOMEM on failure.
+ */
+static int SlotMapGrow(
+	/*! . */
+	SlotMap *map)
+{
+	int size = map->size ? 2 * map->size : SLOT_MAP_MIN_SLOTS;
+	SlotMapSlot *slots;
+	int i;
+
+	if (size > 1 << map->slotBits)
+		size = 1 << map->slotBits;
+	if (size <= map->size)
+		return ENOMEM;
+	slots = (SlotMapSlot *)realloc(
+		map->slots, (size_t)size * sizeof(SlotMapSlot));
+	if (!slots)
+		return ENOMEM;
+	for (i = map->size; i < size; i++) {
+		slots[i].item = NULL;
+		slots[i].generation = 0;
+		slots[i].next = i + 1 < size ? i + 1 : -1;
+		slots[i].used = 0;
+	}
+	if (map->freeTail >= 0)
+		slots[map->freeTail].next = map->size;
+	else
+		map->freeHead = map->size;
+	map->freeTail = size - 1;
+	map->slots = slots;
+	map->size = size;
+
+	return 0;
+}
+
+int SlotMapInit(SlotMap *map, int idBits, int slotBits)
+{
+	assert(map != NULL);
+	assert(slotBits > 0 && slotBits <= SLOT_MAP_SLOT_BITS);
+
+	map->slots = NULL;
+	map->size = 0;
+	map->freeHead = -1;
+	map->freeTail = -1;
+	map->count = 0;
+	map->idBits = idBits;
+	map->slotBits = slotBits;
+
+	return 0;
+}
+
+int SlotMapAdd(SlotMap *map, void *item, int *id)
+{
+	SlotMapSlot *slot;
+	int i;
+
+	assert(map != NULL);
+	assert(id != NULL);
+
+	if (map->freeHead < 0 && SlotMapGrow(map) != 0)
+		return ENOMEM;
+	i = map->freeHead;
+	slot = &map->slots[i];
+	map->freeHead = slot->next;
+	if (map->freeHead < 0)
+		map->freeTail = -1;
+	slot->item = item;
+	slot->next = -1;
+	slot->used = 1;
+	map->count++;
+	*id = map->idBits | slot->generation << map->slotBits | i;
+
+	return 0;
+}
+
+void *SlotMapGet(SlotMap *map, int id)
+{
+	SlotMapSlot *slot;
+
+	assert(map != NULL);
+
+	slot = SlotMapFind(map, id);
+
+	return slot ? slot->item : NULL;
+}
+
+int SlotMapSet(SlotMap *map, int id, void *item)
+{
+	SlotMapSlot *slot;
+
+	assert(map != NULL);
+
+	slot = SlotMapFind(map, id);
+	if (!slot)
+		return EINVAL;
+	slot->item = item;
+
+	return 0;
+}
+
+void *SlotMapRemove(SlotMap *map, int id)
+{
+	SlotMapSlot *slot;
+	void *item;
+	int i;
+
+	assert(map != NULL);
+
+	slot = SlotMapFind(map, id);
+	if (!slot)
+		return NULL;
+	item = slot->item;
+	i = (int)(slot - map->slots);
+	slot->item = NULL;
+	slot->used = 0;
+	slot->generation =
+		(slot->generation + 1) & ((1 << SLOT_MAP_GENERATION_BITS) - 1);
+	/* reused last */
+	if (map->freeTail >= 0)
+		map->slots[map->freeTail].next = i;
+	else
+		map->freeHead = i;
+	map->freeTail = i;
+	map->count--;
+
+	return item;
+}
+
+void SlotMapDestroy(SlotMap *map)
+{
+	assert(map != NULL);
+
+	free(map->slots);
+	SlotMapInit(map, map->idBits, map->slotBits);
+}
@@ -0,0 +1,141 @@
+#ifndef SLOT_MAP_H
+#define SLOT_MAP_H
+
+/*!
+ * \file
+ *
+ * \brief Ids of the items of a container, looked up in constant time.
+ *
+ * An id gives the slot of its item in a table and the generation of the
+ * slot, which changes each time the slot is freed, so that a stale id is
+ * not taken for the item that reuses its slot. The freed slots are reused
+ * in the order they were freed, which keeps a slot free as long as possible
+ * before its generation comes round again. The caller serializes the calls.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <errno.h>
+
+/*! Most bits of an id giving its slot. */
+#define SLOT_MAP_SLOT_BITS 20
+
+/*! Bits of an id giving the generation of its slot, so that the ids are
+ * less than 1 << 29 with SLOT_MAP_SLOT_BITS slot bits. */
+#define SLOT_MAP_GENERATION_BITS 9
+
+/*!
+ * Slot of a SlotMap.
+ * \internal
+ */
+typedef struct SLOTMAPSLOT
+{
+	/*! item of the slot. */
+	void *item;
+	/*! generation of the slot. */
+	int generation;
+	/*! next free slot, -1 if none. */
+	int next;
+	/*! whether the slot is used. */
+	int used;
+} SlotMapSlot;
+
+/*!
+ * Table of slots and list of the free ones.
+ * \internal
+ */
+typedef struct SLOTMAP
+{
+	SlotMapSlot *slots;
+	int size;
+	int freeHead;
+	int freeTail;
+	int count;
+	/*! bits set in every id. */
+	int idBits;
+	/*! bits of an id giving its slot. */
+	int slotBits;
+} SlotMap;
+
+/*!
+ * \brief Initializes a slot map, which allocates its table as items are
+ * added.
+ *
+ * \return Always returns 0.
+ */
+int SlotMapInit(
+	/*! Must be valid, non null, pointer to a slot map. */
+	SlotMap *map,
+	/*! Bits set in every id, above slotBits + SLOT_MAP_GENERATION_BITS,
+	 * to tell its ids from others. */
+	int idBits,
+	/*! Bits of an id giving its slot, at most SLOT_MAP_SLOT_BITS, which
+	 * bounds the number of items to 1 << slotBits. */
+	int slotBits);
+
+/*!
+ * \brief Adds an item and gives its id.
+ *
+ * \return:
+ *	\li \c 0 on success.
+ *	\li \c ENOMEM if there is no memory or no slot left.
+ */
+int SlotMapAdd(
+	/*! Must be valid, non null, pointer to a slot map. */
+	SlotMap *map,
+	/*! Item, may be NULL until set with SlotMapSet(). */
+	void *item,
+	/*! [out] Id of the item. */
+	int *id);
+
+/*!
+ * \brief Returns the item of an id.
+ *
+ * \return The item, NULL if the id is not in use.
+ */
+void *SlotMapGet(
+	/*! Must be valid, non null, pointer to a slot map. */
+	SlotMap *map,
+	/*! Id. */
+	int id);
+
+/*!
+ * \brief Changes the item of an id.
+ *
+ * \return:
+ *	\li \c 0 on success.
+ *	\li \c EINVAL if the id is not in use.
+ */
+int SlotMapSet(
+	/*! Must be valid, non null, pointer to a slot map. */
+	SlotMap *map,
+	/*! Id. */
+	int id,
+	/*! New item. */
+	void *item);
+
+/*!
+ * \brief Frees the slot of an id.
+ *
+ * \return The item of the id, NULL if it is not in use.
+ */
+void *SlotMapRemove(
+	/*! Must be valid, non null, pointer to a slot map. */
+	SlotMap *map,
+	/*! Id. */
+	int id);
+
+/*!
+ * \brief Releases the table of a slot map, without the items.
+ */
+void SlotMapDestroy(
+	/*! Must be valid, non null, pointer to a slot map. */
+	SlotMap *map);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SLOT_MAP_H */
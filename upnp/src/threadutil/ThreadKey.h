@@ -0,0 +1,27 @@
+#ifndef THREADKEY_H
+#define THREADKEY_H
+
+/*!
+ * \file
+ *
+ * \brief Thread specific data: a key, and the value of the key for the
+ * currently running thread.
+ *
+ * ithread_key_create() and ithread_key_delete() create and delete a key,
+ * ithread_setspecific() and ithread_getspecific() set and get its value,
+ * NULL if not set. See the man page of pthread_key_create.
+ *
+ * \internal These are not part of the installed ithread.h.
+ */
+
+#include "ithread.h"
+
+/*! Thread specific data key. */
+typedef pthread_key_t ithread_key_t;
+
+#define ithread_key_create pthread_key_create
+#define ithread_key_delete pthread_key_delete
+#define ithread_setspecific pthread_setspecific
+#define ithread_getspecific pthread_getspecific
+
+#endif /* THREADKEY_H */
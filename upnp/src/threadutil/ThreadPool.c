@@ -34,19 +34,73 @@
  * \file
  */
 
+#ifndef _GNU_SOURCE
+	#define _GNU_SOURCE /* For sched_setaffinity() in sched.h */
+#endif
+
 #if !defined(_WIN32)
 	#include <sys/param.h>
 #endif
 
 #include "ThreadPool.h"
 
+#include "Atomic.h"
 #include "FreeList.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h> /* for memset()*/
 
+#ifdef __linux__
+	#include <ctype.h>
+	#include <linux/futex.h>
+	#include <sched.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+	#ifdef SYS_futex
+		#define USE_FUTEX 1
+	#endif
+#endif
+
+/*! States of a cell of a job ring. */
+enum
+{
+	CELL_EMPTY,
+	CELL_FULL,
+	CELL_TAKEN,
+	CELL_REMOVED
+};
+
+/*! Jobs a worker runs in LOCK_FREE_QUEUES mode before it adds their wait
+ * times to the statistics. */
+#define WAIT_STATS_BATCH 64
+
+/*! Bits of a word of a CPU set. */
+#define CPU_SET_BITS (8 * sizeof(unsigned long))
+
+/*! Bit set in the ids of the jobs kept under the pool mutex, which are
+ * looked up in the jobIds of the pool. */
+#define INDEXED_JOB_ID (1 << 30)
+
+/*! Bits of the ids of the jobs of the qs in WORK_STEALING mode and of the
+ * rings in LOCK_FREE_QUEUES mode, so that they stay below INVALID_JOB_ID. */
+#define QUEUE_JOB_ID_BITS 29
+
+/*! Bits of the id of a job of a ring giving its priority, the others giving
+ * its position in the ring. */
+#define RING_PRIORITY_BITS 2
+
+/*! Wait times of the jobs run by a worker, added to the statistics in
+ * batches. */
+typedef struct
+{
+	double totalTime[NUM_PRIORITIES];
+	int totalJobs[NUM_PRIORITIES];
+	int count;
+} WaitStats;
+
 /*!
  * \brief Returns the difference in milliseconds between two timeval structures.
  *
@@ -73,6 +127,126 @@ static long DiffMillis(
 	return (long)temp;
 }
 
+/*!
+ * \brief Returns the difference in microseconds between two timeval
+ * structures.
+ *
+ * \internal
+ *
+ * \return The difference in microseconds, time1-time2, 0 if negative.
+ */
+static long DiffMicros(
+	/*! . */
+	const struct timeval *time1,
+	/*! . */
+	const struct timeval *time2)
+{
+	double temp;
+
+	temp = ((double)time1->tv_sec - (double)time2->tv_sec) * 1000000.0 +
+	       ((double)time1->tv_usec - (double)time2->tv_usec);
+	if (temp < 0.0)
+		return 0;
+	if (temp > 2147483647.0)
+		return 2147483647L;
+
+	return (long)temp;
+}
+
+/*!
+ * \brief Returns the bucket of a latency histogram a value goes in.
+ *
+ * The values below 2 * TP_HIST_SUB_BUCKETS have a bucket each; above, each
+ * power of two is split in TP_HIST_SUB_BUCKETS buckets.
+ *
+ * \internal
+ */
+static int HistogramBucket(
+	/*! value in microseconds, from 0 to 2^31 - 1. */
+	long value)
+{
+	unsigned long v = (unsigned long)value;
+	int shift = 0;
+
+	while ((v >> shift) >= 2 * TP_HIST_SUB_BUCKETS)
+		shift++;
+
+	return shift * TP_HIST_SUB_BUCKETS + (int)(v >> shift);
+}
+
+/*!
+ * \brief Returns the largest value of a bucket of a latency histogram.
+ *
+ * \internal
+ */
+static long HistogramBucketTop(
+	/*! . */
+	int bucket)
+{
+	int shift = bucket / TP_HIST_SUB_BUCKETS - 1;
+
+	if (shift <= 0)
+		return bucket;
+
+	return (((long)(bucket - shift * TP_HIST_SUB_BUCKETS) + 1) << shift) -
+	       1;
+}
+
+/*!
+ * \brief Records a value in a latency histogram.
+ *
+ * \internal
+ */
+static void HistogramRecord(
+	/*! . */
+	ThreadPoolHistogram *h,
+	/*! value in microseconds, from 0 to 2^31 - 1. */
+	long value)
+{
+	int max;
+
+	ithread_atomic_add(&h->counts[HistogramBucket(value)], 1);
+	max = ithread_atomic_load(&h->max);
+	while (value > max && !ithread_atomic_cas(&h->max, max, (int)value))
+		max = ithread_atomic_load(&h->max);
+}
+
+/*!
+ * \brief Records the wait and run times of a job for its priority and its
+ * type.
+ *
+ * \internal
+ */
+static void AccountJob(
+	/*! . */
+	ThreadPool *tp,
+	/*! . */
+	ThreadPoolJob *job,
+	/*! time the job started. */
+	const struct timeval *start)
+{
+	struct timeval now;
+	long wait = DiffMicros(start, &job->requestTime);
+	long run;
+	int p = job->priority;
+
+	gettimeofday(&now, NULL);
+	run = DiffMicros(&now, start);
+	if (p < LOW_PRIORITY || p > HIGH_PRIORITY)
+		p = LOW_PRIORITY;
+	HistogramRecord(&tp->waitHist[p], wait);
+	HistogramRecord(&tp->runHist[p], run);
+	if (job->type >= 0 && job->type < TP_JOB_TYPES) {
+		HistogramRecord(&tp->typeWaitHist[job->type], wait);
+		HistogramRecord(&tp->typeRunHist[job->type], run);
+	}
+	if (tp->attr.adaptiveInterval > 0) {
+		ithread_atomic_add(&tp->adaptDone, 1);
+		if (wait > (long)tp->attr.adaptiveWait * 1000L)
+			ithread_atomic_add(&tp->adaptLate, 1);
+	}
+}
+
 #ifdef STATS
 /*!
  * \brief Initializes the statistics structure.
@@ -100,6 +274,12 @@ static void StatsInit(
 	stats->persistentThreads = 0;
 	stats->maxThreads = 0;
 	stats->totalThreads = 0;
+	stats->totalTimeDQ = 0.0;
+	stats->totalJobsDQ = 0;
+	stats->avgWaitDQ = 0.0;
+	stats->deadlineMisses = 0;
+	stats->deadlineDrops = 0;
+	stats->adaptiveThreads = 0;
 }
 
 /*!
@@ -369,7 +549,14 @@ static void BumpPriority(
 				StatsAccountMQ(tp, diffTime);
 				ListDelNode(
 					&tp->medJobQ, tp->medJobQ.head.next, 0);
-				ListAddTail(&tp->highJobQ, tempJob);
+				tempJob->node =
+					ListAddTail(&tp->highJobQ, tempJob);
+				tempJob->place = HIGH_PRIORITY;
+				if (!tempJob->node) {
+					SlotMapRemove(
+						&tp->jobIds, tempJob->jobId);
+					FreeThreadPoolJob(tp, tempJob);
+				}
 				continue;
 			}
 		}
@@ -383,7 +570,14 @@ static void BumpPriority(
 				StatsAccountLQ(tp, diffTime);
 				ListDelNode(
 					&tp->lowJobQ, tp->lowJobQ.head.next, 0);
-				ListAddTail(&tp->medJobQ, tempJob);
+				tempJob->node =
+					ListAddTail(&tp->medJobQ, tempJob);
+				tempJob->place = MED_PRIORITY;
+				if (!tempJob->node) {
+					SlotMapRemove(
+						&tp->jobIds, tempJob->jobId);
+					FreeThreadPoolJob(tp, tempJob);
+				}
 				continue;
 			}
 		}
@@ -392,245 +586,1543 @@ static void BumpPriority(
 }
 
 /*!
- * \brief Sets the fields of the passed in timespec to be relMillis
- * milliseconds in the future.
+ * \brief Returns the current time in milliseconds, wrapping around.
  *
  * \internal
  */
-static void SetRelTimeout(
-	/*! . */
-	struct timespec *time,
-	/*! milliseconds in the future. */
-	int relMillis)
+static int NowMillis(void)
 {
 	struct timeval now;
-	int sec = relMillis / 1000;
-	int milliSeconds = relMillis % 1000;
 
 	gettimeofday(&now, NULL);
-	time->tv_sec = now.tv_sec + sec;
-	time->tv_nsec = (now.tv_usec / 1000 + milliSeconds) * 1000000;
+
+	return (int)((unsigned int)now.tv_sec * 1000u +
+		     (unsigned int)now.tv_usec / 1000u);
 }
 
 /*!
- * \brief Sets seed for random number generator. Each thread sets the seed
- * random number generator.
+ * \brief Returns the number of jobs in a job ring, including the removed
+ * jobs not passed yet.
  *
  * \internal
  */
-static void SetSeed(void)
+static int RingJobs(
+	/*! . */
+	ThreadPoolRing *r)
 {
-	struct timeval t;
-
-	gettimeofday(&t, NULL);
-#if defined(__PTW32_DLLPORT)
-	srand((unsigned int)t.tv_usec +
-		PtrToUint(ithread_get_current_thread_id().p));
-#elif defined(BSD) || defined(__APPLE__) || defined(__FreeBSD_kernel__)
-	srand((unsigned int)t.tv_usec +
-		(unsigned int)ithread_get_current_thread_id());
-#elif defined(__linux__) || defined(__sun) || defined(__CYGWIN__) || \
-	defined(__GLIBC__)
-	srand((unsigned int)t.tv_usec +
-		(unsigned int)ithread_get_current_thread_id());
-#else
-	{
-		volatile union
-		{
-			volatile pthread_t tid;
-			volatile unsigned i;
-		} idu;
+	int end = ithread_atomic_load(&r->enqueuePos);
+	int n = (int)((unsigned int)end -
+		      (unsigned int)ithread_atomic_load(&r->dequeuePos));
 
-		idu.tid = ithread_get_current_thread_id();
-		srand((unsigned int)t.tv_usec + idu.i);
-	}
-#endif
+	return n > 0 ? n : 0;
 }
 
 /*!
- * \brief Implements a thread pool worker. Worker waits for a job to become
- * available. Worker picks up persistent jobs first, high priority,
- * med priority, then low priority.
- *
- * If worker remains idle for more than specified max, the worker is released.
+ * \brief Returns the number of jobs in the qs in WORK_STEALING mode, or in
+ * the rings in LOCK_FREE_QUEUES mode, and of the jobs with a deadline.
  *
  * \internal
  */
-static void *WorkerThread(
-	/*! arg -> is cast to (ThreadPool *). */
-	void *arg)
+static int QueuedJobs(
+	/*! . */
+	ThreadPool *tp)
 {
-	time_t start = 0;
-
-	ThreadPoolJob *job = NULL;
-	ListNode *head = NULL;
-
-	struct timespec timeout;
-	int retCode = 0;
-	int persistent = -1;
-	ThreadPool *tp = (ThreadPool *)arg;
-
-	ithread_initialize_thread();
-
-	/* Increment total thread count */
-	ithread_mutex_lock(&tp->mutex);
-	tp->totalThreads++;
-	tp->pendingWorkerThreadStart = 0;
-	ithread_cond_broadcast(&tp->start_and_shutdown);
-	ithread_mutex_unlock(&tp->mutex);
-
-	SetSeed();
-	StatsTime(&start);
-	while (1) {
-		ithread_mutex_lock(&tp->mutex);
-		if (job) {
-			tp->busyThreads--;
-			FreeThreadPoolJob(tp, job);
-			job = NULL;
-		}
-		retCode = 0;
-		tp->stats.idleThreads++;
-		tp->stats.totalWorkTime +=
-			(double)StatsTime(NULL) - (double)start;
-		StatsTime(&start);
-		if (persistent == 0) {
-			tp->stats.workerThreads--;
-		} else if (persistent == 1) {
-			/* Persistent thread becomes a regular thread */
-			tp->persistentThreads--;
-		}
-
-		/* Check for a job or shutdown */
-		while (tp->lowJobQ.size == 0 && tp->medJobQ.size == 0 &&
-			tp->highJobQ.size == 0 && !tp->persistentJob &&
-			!tp->shutdown) {
-			/* If wait timed out and we currently have more than the
-			 * min threads, or if we have more than the max threads
-			 * (only possible if the attributes have been reset)
-			 * let this thread die. */
-			if ((retCode == ETIMEDOUT &&
-				    tp->totalThreads > tp->attr.minThreads) ||
-				(tp->attr.maxThreads != -1 &&
-					tp->totalThreads >
-						tp->attr.maxThreads)) {
-				tp->stats.idleThreads--;
-				goto exit_function;
-			}
-			SetRelTimeout(&timeout, tp->attr.maxIdleTime);
-
-			/* wait for a job up to the specified max time */
-			retCode = ithread_cond_timedwait(
-				&tp->condition, &tp->mutex, &timeout);
-		}
-		tp->stats.idleThreads--;
-		/* idle time */
-		tp->stats.totalIdleTime +=
-			(double)StatsTime(NULL) - (double)start;
-		/* work time */
-		StatsTime(&start);
-		/* bump priority of starved jobs */
-		BumpPriority(tp);
-		/* if shutdown then stop */
-		if (tp->shutdown) {
-			goto exit_function;
-		} else {
-			/* Pick up persistent job if available */
-			if (tp->persistentJob) {
-				job = tp->persistentJob;
-				tp->persistentJob = NULL;
-				tp->persistentThreads++;
-				persistent = 1;
-				ithread_cond_broadcast(&tp->start_and_shutdown);
-			} else {
-				tp->stats.workerThreads++;
-				persistent = 0;
-				/* Pick the highest priority job */
-				if (tp->highJobQ.size > 0) {
-					head = ListHead(&tp->highJobQ);
-					if (head == NULL) {
-						tp->stats.workerThreads--;
-						goto exit_function;
-					}
-					job = (ThreadPoolJob *)head->item;
-					CalcWaitTime(tp, HIGH_PRIORITY, job);
-					ListDelNode(&tp->highJobQ, head, 0);
-				} else if (tp->medJobQ.size > 0) {
-					head = ListHead(&tp->medJobQ);
-					if (head == NULL) {
-						tp->stats.workerThreads--;
-						goto exit_function;
-					}
-					job = (ThreadPoolJob *)head->item;
-					CalcWaitTime(tp, MED_PRIORITY, job);
-					ListDelNode(&tp->medJobQ, head, 0);
-				} else if (tp->lowJobQ.size > 0) {
-					head = ListHead(&tp->lowJobQ);
-					if (head == NULL) {
-						tp->stats.workerThreads--;
-						goto exit_function;
-					}
-					job = (ThreadPoolJob *)head->item;
-					CalcWaitTime(tp, LOW_PRIORITY, job);
-					ListDelNode(&tp->lowJobQ, head, 0);
-				} else {
-					/* Should never get here */
-					tp->stats.workerThreads--;
-					goto exit_function;
-				}
-			}
-		}
-
-		tp->busyThreads++;
-		ithread_mutex_unlock(&tp->mutex);
-
-		/* In the future can log info */
-		if (SetPriority(job->priority) != 0) {
-		} else {
-		}
-		/* run the job */
-		job->func(job->arg);
-		/* return to Normal */
-		SetPriority(DEFAULT_PRIORITY);
+	int n = 0;
+	int i;
+
+	for (i = 0; i < NUM_PRIORITIES; i++) {
+		if (tp->rings)
+			n += RingJobs(&tp->rings[i]);
+		else
+			n += ithread_atomic_load(&tp->queuedJobs[i]);
 	}
 
-exit_function:
-	tp->totalThreads--;
-	ithread_cond_broadcast(&tp->start_and_shutdown);
-	ithread_mutex_unlock(&tp->mutex);
-	ithread_cleanup_thread();
-
-	return NULL;
+	return n + ithread_atomic_load(&tp->deadlineJobs);
 }
 
 /*!
- * \brief Creates a Thread Pool Job. (Dynamically allocated)
+ * \brief Passes the removed jobs at the head of a job ring, which the
+ * workers only pass while they take jobs, so that their cells can be reused.
  *
  * \internal
  *
- * \return ThreadPoolJob *on success, NULL on failure.
+ * \return The number of cells freed.
  */
-static ThreadPoolJob *CreateThreadPoolJob(
-	/*! job is copied. */
-	ThreadPoolJob *job,
-	/*! id of job. */
-	int id,
+static int RingSkipRemoved(
 	/*! . */
-	ThreadPool *tp)
+	ThreadPoolRing *r)
 {
-	ThreadPoolJob *newJob = NULL;
-
-	newJob = (ThreadPoolJob *)FreeListAlloc(&tp->jobFreeList);
-	if (newJob) {
-		*newJob = *job;
-		newJob->jobId = id;
-		gettimeofday(&newJob->requestTime, NULL);
+	ThreadPoolCell *c;
+	int pos;
+	int n = 0;
+
+	for (;;) {
+		pos = ithread_atomic_load(&r->dequeuePos);
+		c = &r->cells[pos & r->mask];
+		/* written at this position and removed for good */
+		if (ithread_atomic_load(&c->seq) !=
+				(int)((unsigned int)pos + 1u) ||
+			ithread_atomic_load(&c->state) != CELL_REMOVED)
+			return n;
+		if (!ithread_atomic_cas(&r->dequeuePos,
+			    pos,
+			    (int)((unsigned int)pos + 1u)))
+			continue;
+		ithread_atomic_store(&c->state, CELL_EMPTY);
+		ithread_atomic_store(&c->seq,
+			(int)((unsigned int)pos + (unsigned int)r->mask + 1u));
+		n++;
 	}
-
-	return newJob;
 }
 
 /*!
- * \brief Creates a worker thread, if the thread pool does not already have
+ * \brief Adds a copy of a job to a job ring, numbering the job by its
+ * position.
+ *
+ * \internal
+ *
+ * \return 1 on success, 0 if the ring is full.
+ */
+static int RingAdd(
+	/*! . */
+	ThreadPoolRing *r,
+	/*! Job, whose id is set. */
+	ThreadPoolJob *job,
+	/*! Priority of the ring, given in the id of the job. */
+	int p,
+	/*! Current time in milliseconds. */
+	int now)
+{
+	ThreadPoolCell *c;
+	int pos;
+	int diff;
+
+	for (;;) {
+		pos = ithread_atomic_load(&r->enqueuePos);
+		c = &r->cells[pos & r->mask];
+		diff = (int)((unsigned int)ithread_atomic_load(&c->seq) -
+			     (unsigned int)pos);
+		/* full, unless of removed jobs */
+		if (diff < 0 && !RingSkipRemoved(r))
+			return 0;
+		if (diff == 0 &&
+			ithread_atomic_cas(&r->enqueuePos,
+				pos,
+				(int)((unsigned int)pos + 1u)))
+			break;
+	}
+	/* the cell is ours until it is published */
+	job->jobId = (int)(((unsigned int)pos << RING_PRIORITY_BITS |
+				   (unsigned int)p) &
+			   ((1u << QUEUE_JOB_ID_BITS) - 1u));
+	c->job = *job;
+	ithread_atomic_store(&c->jobId, job->jobId);
+	ithread_atomic_store(&c->state, CELL_FULL);
+	if (pos == ithread_atomic_load(&r->dequeuePos))
+		ithread_atomic_store(&r->lastTaken, now);
+	ithread_atomic_store(&c->seq, (int)((unsigned int)pos + 1u));
+
+	return 1;
+}
+
+/*!
+ * \brief Takes the first job of a job ring, skipping the removed ones.
+ *
+ * \internal
+ *
+ * \return 1 if a job was taken, 0 if the ring is empty.
+ */
+static int RingTake(
+	/*! . */
+	ThreadPoolRing *r,
+	/*! [out] Copy of the job. */
+	ThreadPoolJob *out)
+{
+	ThreadPoolCell *c;
+	int pos;
+	int diff;
+	int taken;
+
+	for (;;) {
+		pos = ithread_atomic_load(&r->dequeuePos);
+		c = &r->cells[pos & r->mask];
+		diff = (int)((unsigned int)ithread_atomic_load(&c->seq) -
+			     ((unsigned int)pos + 1u));
+		if (diff < 0)
+			return 0;
+		if (diff > 0 ||
+			!ithread_atomic_cas(&r->dequeuePos,
+				pos,
+				(int)((unsigned int)pos + 1u)))
+			continue;
+		/* ThreadPoolRemove() may hold the job for a moment */
+		taken = 0;
+		while (!(taken = ithread_atomic_cas(
+				 &c->state, CELL_FULL, CELL_TAKEN)) &&
+			ithread_atomic_load(&c->state) != CELL_REMOVED) {
+		}
+		if (taken)
+			*out = c->job;
+		ithread_atomic_store(&c->state, CELL_EMPTY);
+		ithread_atomic_store(&c->seq,
+			(int)((unsigned int)pos + (unsigned int)r->mask + 1u));
+		if (taken)
+			return 1;
+	}
+}
+
+/*!
+ * \brief Removes a job from the job rings, leaving its cell to be skipped.
+ *
+ * \internal
+ *
+ * \return 0 on success, INVALID_JOB_ID if job not found.
+ */
+static int RingsRemove(
+	/*! . */
+	ThreadPool *tp,
+	/*! id of job. */
+	int jobId,
+	/*! space for removed job. */
+	ThreadPoolJob *out)
+{
+	ThreadPoolRing *r;
+	ThreadPoolCell *c;
+	int p = jobId & ((1 << RING_PRIORITY_BITS) - 1);
+
+	if (jobId < 0 || p >= NUM_PRIORITIES)
+		return INVALID_JOB_ID;
+	/* the id gives the cell of the job */
+	r = &tp->rings[p];
+	c = &r->cells[(jobId >> RING_PRIORITY_BITS) & r->mask];
+	if (ithread_atomic_load(&c->jobId) != jobId ||
+		!ithread_atomic_cas(&c->state, CELL_FULL, CELL_TAKEN))
+		return INVALID_JOB_ID;
+	/* the cell may have been reused meanwhile */
+	if (ithread_atomic_load(&c->jobId) != jobId) {
+		ithread_atomic_store(&c->state, CELL_FULL);
+		return INVALID_JOB_ID;
+	}
+	*out = c->job;
+	ithread_atomic_store(&c->state, CELL_REMOVED);
+	ithread_atomic_add(&tp->pendingJobs, -1);
+
+	return 0;
+}
+
+/*!
+ * \brief Takes the highest priority job of the job rings, unless a lower
+ * priority has not been served for the time after which BumpPriority()
+ * would have bumped its jobs.
+ *
+ * \internal
+ *
+ * \return 1 if a job was taken, 0 if there is none.
+ */
+static int RingsTakeJob(
+	/*! . */
+	ThreadPool *tp,
+	/*! [out] Copy of the job. */
+	ThreadPoolJob *out)
+{
+	ThreadPoolRing *r;
+	int now = NowMillis();
+	int limit;
+	int p;
+
+	for (p = MED_PRIORITY; p >= LOW_PRIORITY; p--) {
+		r = &tp->rings[p];
+		limit = p == MED_PRIORITY ? tp->attr.starvationTime
+					  : tp->attr.maxIdleTime;
+		if (RingJobs(r) > 0 &&
+			(int)((unsigned int)now -
+				(unsigned int)ithread_atomic_load(
+					&r->lastTaken)) >= limit &&
+			RingTake(r, out))
+			goto found;
+	}
+	for (p = HIGH_PRIORITY; p >= LOW_PRIORITY; p--) {
+		r = &tp->rings[p];
+		if (RingTake(r, out))
+			goto found;
+	}
+
+	return 0;
+
+found:
+	ithread_atomic_store(&r->lastTaken, now);
+	ithread_atomic_add(&tp->pendingJobs, -1);
+
+	return 1;
+}
+
+/*!
+ * \brief Tells whether a time is earlier than another.
+ *
+ * \internal
+ */
+static int TimeBefore(
+	/*! . */
+	const struct timeval *a,
+	/*! . */
+	const struct timeval *b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return a->tv_sec < b->tv_sec;
+
+	return a->tv_usec < b->tv_usec;
+}
+
+/*!
+ * \brief Moves the job at a position of the deadline heap up or down to its
+ * place.
+ *
+ * \remark The ThreadPool object mutex must be locked prior to calling this
+ * function.
+ *
+ * \internal
+ */
+static void DeadlineSift(
+	/*! . */
+	ThreadPool *tp,
+	/*! Position of the job. */
+	int i)
+{
+	ThreadPoolJob **q = tp->deadlineQ;
+	ThreadPoolJob *temp;
+	int n = tp->deadlineJobs;
+	int next;
+
+	q[i]->place = i;
+	while (i > 0 && TimeBefore(&q[i]->deadline, &q[(i - 1) / 2]->deadline)) {
+		next = (i - 1) / 2;
+		temp = q[i];
+		q[i] = q[next];
+		q[next] = temp;
+		q[i]->place = i;
+		q[next]->place = next;
+		i = next;
+	}
+	while ((next = 2 * i + 1) < n) {
+		if (next + 1 < n &&
+			TimeBefore(&q[next + 1]->deadline, &q[next]->deadline))
+			next++;
+		if (!TimeBefore(&q[next]->deadline, &q[i]->deadline))
+			break;
+		temp = q[i];
+		q[i] = q[next];
+		q[next] = temp;
+		q[i]->place = i;
+		q[next]->place = next;
+		i = next;
+	}
+}
+
+/*!
+ * \brief Removes the job at a position of the deadline heap.
+ *
+ * \remark The ThreadPool object mutex must be locked prior to calling this
+ * function.
+ *
+ * \internal
+ *
+ * \return The job.
+ */
+static ThreadPoolJob *DeadlineDel(
+	/*! . */
+	ThreadPool *tp,
+	/*! Position of the job. */
+	int i)
+{
+	ThreadPoolJob *job = tp->deadlineQ[i];
+	int n = ithread_atomic_add(&tp->deadlineJobs, -1);
+
+	SlotMapRemove(&tp->jobIds, job->jobId);
+	if (i < n) {
+		tp->deadlineQ[i] = tp->deadlineQ[n];
+		DeadlineSift(tp, i);
+	}
+	if (tp->queues || tp->rings)
+		ithread_atomic_add(&tp->pendingJobs, -1);
+
+	return job;
+}
+
+/*!
+ * \brief Takes the job with the earliest deadline, accounting its wait and
+ * whether its deadline has passed.
+ *
+ * \remark The ThreadPool object mutex must be locked prior to calling this
+ * function.
+ *
+ * \internal
+ *
+ * \return The job, or NULL if there is none.
+ */
+static ThreadPoolJob *DeadlinePop(
+	/*! . */
+	ThreadPool *tp,
+	/*! [out] Whether the job is to be given to its expired_func. */
+	int *expired)
+{
+	ThreadPoolJob *job;
+	struct timeval now;
+
+	*expired = 0;
+	if (tp->deadlineJobs == 0)
+		return NULL;
+	job = DeadlineDel(tp, 0);
+	gettimeofday(&now, NULL);
+	tp->stats.totalJobsDQ++;
+	tp->stats.totalTimeDQ += (double)DiffMillis(&now, &job->requestTime);
+	if (TimeBefore(&job->deadline, &now)) {
+		if (job->expired_func) {
+			*expired = 1;
+			tp->stats.deadlineDrops++;
+		} else {
+			tp->stats.deadlineMisses++;
+		}
+	}
+
+	return job;
+}
+
+/*!
+ * \brief Gives a job dropped at its deadline to its expired_func, which owns
+ * the argument as the function of the job would: free_func is not called.
+ *
+ * \internal
+ */
+static void ExpireJob(
+	/*! . */
+	ThreadPoolJob *job)
+{
+	job->expired_func(job->arg);
+}
+
+/*!
+ * \brief Takes a copy of the job with the earliest deadline in WORK_STEALING
+ * and LOCK_FREE_QUEUES modes.
+ *
+ * The deadline heap is protected by the pool mutex in every mode, so these
+ * jobs take it; a worker only does when the heap is not empty.
+ *
+ * \internal
+ *
+ * \return 1 if a job was taken, 0 if there is none.
+ */
+static int DeadlineTakeJob(
+	/*! . */
+	ThreadPool *tp,
+	/*! [out] Copy of the job. */
+	ThreadPoolJob *out,
+	/*! [out] Whether the job is to be given to its expired_func. */
+	int *expired)
+{
+	ThreadPoolJob *job;
+
+	if (ithread_atomic_load(&tp->deadlineJobs) == 0)
+		return 0;
+	ithread_mutex_lock(&tp->mutex);
+	job = DeadlinePop(tp, expired);
+	if (job) {
+		*out = *job;
+		FreeThreadPoolJob(tp, job);
+	}
+	ithread_mutex_unlock(&tp->mutex);
+
+	return job != NULL;
+}
+
+/*!
+ * \brief Moves a job whose wait is over a limit to the next higher priority
+ * q of a worker.
+ *
+ * The job is counted at its new priority first, so that the count of queued
+ * jobs never drops to zero while it moves.
+ *
+ * \internal
+ *
+ * \return 1 if a job was moved, 0 otherwise.
+ */
+static int QueueBumpJob(
+	/*! . */
+	ThreadPool *tp,
+	/*! Job qs, whose mutex must be locked. */
+	ThreadPoolQueue *q,
+	/*! Priority of the q to bump the first job of. */
+	ThreadPriority p,
+	/*! Maximum wait in milliseconds. */
+	long maxWait,
+	/*! . */
+	struct timeval *now)
+{
+	ThreadPoolJob *tempJob;
+	long diffTime;
+
+	if (q->jobQ[p].size == 0)
+		return 0;
+	tempJob = (ThreadPoolJob *)q->jobQ[p].head.next->item;
+	diffTime = DiffMillis(now, &tempJob->requestTime);
+	if (diffTime < maxWait)
+		return 0;
+	q->totalJobs[p]++;
+	q->totalTime[p] += (double)diffTime;
+	ListDelNode(&q->jobQ[p], q->jobQ[p].head.next, 0);
+	ithread_atomic_add(&tp->queuedJobs[p + 1], 1);
+	tempJob->node = ListAddTail(&q->jobQ[p + 1], tempJob);
+	tempJob->place = p + 1;
+	if (!tempJob->node) {
+		SlotMapRemove(&q->jobIds, tempJob->jobId);
+		FreeListFree(&q->jobFreeList, tempJob);
+		ithread_atomic_add(&tp->queuedJobs[p + 1], -1);
+		ithread_atomic_add(&tp->pendingJobs, -1);
+	}
+	ithread_atomic_add(&tp->queuedJobs[p], -1);
+
+	return 1;
+}
+
+/*!
+ * \brief Bumps the starved jobs of a worker's qs, like BumpPriority().
+ *
+ * \internal
+ */
+static void QueueBumpPriority(
+	/*! . */
+	ThreadPool *tp,
+	/*! Job qs, whose mutex must be locked. */
+	ThreadPoolQueue *q)
+{
+	struct timeval now;
+
+	if (q->jobQ[MED_PRIORITY].size == 0 && q->jobQ[LOW_PRIORITY].size == 0)
+		return;
+	gettimeofday(&now, NULL);
+	while (QueueBumpJob(tp,
+		       q,
+		       MED_PRIORITY,
+		       tp->attr.starvationTime,
+		       &now) ||
+		QueueBumpJob(
+			tp, q, LOW_PRIORITY, tp->attr.maxIdleTime, &now)) {
+	}
+}
+
+/*!
+ * \brief Takes the first job of a priority from a worker's qs.
+ *
+ * \internal
+ *
+ * \return 1 if a job was taken, 0 if that q is empty.
+ */
+static int QueueTakeJob(
+	/*! . */
+	ThreadPool *tp,
+	/*! Job qs. */
+	ThreadPoolQueue *q,
+	/*! Priority. */
+	ThreadPriority p,
+	/*! [out] Copy of the job. */
+	ThreadPoolJob *out)
+{
+	ThreadPoolJob *job;
+	ListNode *head;
+	struct timeval now;
+	int ret = 0;
+
+	ithread_mutex_lock(&q->mutex);
+	QueueBumpPriority(tp, q);
+	head = ListHead(&q->jobQ[p]);
+	if (head) {
+		job = (ThreadPoolJob *)head->item;
+		*out = *job;
+		gettimeofday(&now, NULL);
+		q->totalJobs[p]++;
+		q->totalTime[p] += (double)DiffMillis(&now, &job->requestTime);
+		ListDelNode(&q->jobQ[p], head, 0);
+		SlotMapRemove(&q->jobIds, job->jobId);
+		FreeListFree(&q->jobFreeList, job);
+		ithread_atomic_add(&tp->queuedJobs[p], -1);
+		ithread_atomic_add(&tp->pendingJobs, -1);
+		ret = 1;
+	}
+	ithread_mutex_unlock(&q->mutex);
+
+	return ret;
+}
+
+/*!
+ * \brief Takes the highest priority job of the qs, looking at the qs of the
+ * worker first and then at those of the others.
+ *
+ * \internal
+ *
+ * \return 1 if a job was taken, 0 if there is none.
+ */
+static int StealJob(
+	/*! . */
+	ThreadPool *tp,
+	/*! Index of the qs of the worker. */
+	int home,
+	/*! [out] Copy of the job. */
+	ThreadPoolJob *out)
+{
+	int p;
+	int i;
+
+	for (p = HIGH_PRIORITY; p >= LOW_PRIORITY; p--) {
+		for (i = 0; i < tp->queueCount &&
+			    ithread_atomic_load(&tp->queuedJobs[p]) > 0;
+			i++) {
+			if (QueueTakeJob(tp,
+				    &tp->queues[(home + i) % tp->queueCount],
+				    (ThreadPriority)p,
+				    out))
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*!
+ * \brief Sets the fields of the passed in timespec to be relMillis
+ * milliseconds in the future.
+ *
+ * \internal
+ */
+static void SetRelTimeout(
+	/*! . */
+	struct timespec *time,
+	/*! milliseconds in the future. */
+	int relMillis)
+{
+	struct timeval now;
+	int sec = relMillis / 1000;
+	int milliSeconds = relMillis % 1000;
+
+	gettimeofday(&now, NULL);
+	time->tv_sec = now.tv_sec + sec;
+	time->tv_nsec = (now.tv_usec / 1000 + milliSeconds) * 1000000;
+	/* the wait fails with EINVAL past a second */
+	if (time->tv_nsec >= 1000000000) {
+		time->tv_sec++;
+		time->tv_nsec -= 1000000000;
+	}
+}
+
+/*!
+ * \brief Wakes up workers parked by ParkWait().
+ *
+ * \internal
+ */
+static void ParkWake(
+	/*! . */
+	ThreadPool *tp,
+	/*! Whether to wake them all up rather than one. */
+	int all,
+	/*! Whether the pool mutex is locked by the caller. */
+	int locked)
+{
+	ithread_atomic_add(&tp->parkSeq, 1);
+#ifdef USE_FUTEX
+	(void)locked;
+	syscall(SYS_futex,
+		&tp->parkSeq,
+		FUTEX_WAKE_PRIVATE,
+		all ? INT_MAX : 1,
+		NULL,
+		NULL,
+		0);
+#else
+	if (!locked)
+		ithread_mutex_lock(&tp->mutex);
+	if (all)
+		ithread_cond_broadcast(&tp->condition);
+	else
+		ithread_cond_signal(&tp->condition);
+	if (!locked)
+		ithread_mutex_unlock(&tp->mutex);
+#endif
+}
+
+/*!
+ * \brief Parks a worker until ParkWake() is called after parkSeq was read,
+ * or a time out.
+ *
+ * \internal
+ *
+ * \return 0, or ETIMEDOUT.
+ */
+static int ParkWait(
+	/*! . */
+	ThreadPool *tp,
+	/*! Value of parkSeq read before the job rings were found empty. */
+	int seq,
+	/*! Time out in milliseconds. */
+	int relMillis)
+{
+#ifdef USE_FUTEX
+	struct timespec timeout;
+
+	timeout.tv_sec = relMillis / 1000;
+	timeout.tv_nsec = (long)(relMillis % 1000) * 1000000L;
+	if (syscall(SYS_futex,
+		    &tp->parkSeq,
+		    FUTEX_WAIT_PRIVATE,
+		    seq,
+		    &timeout,
+		    NULL,
+		    0) == -1 &&
+		errno == ETIMEDOUT)
+		return ETIMEDOUT;
+
+	return 0;
+#else
+	struct timespec timeout;
+	int retCode = 0;
+
+	ithread_mutex_lock(&tp->mutex);
+	SetRelTimeout(&timeout, relMillis);
+	while (ithread_atomic_load(&tp->parkSeq) == seq &&
+		retCode != ETIMEDOUT)
+		retCode = ithread_cond_timedwait(
+			&tp->condition, &tp->mutex, &timeout);
+	ithread_mutex_unlock(&tp->mutex);
+
+	return retCode == ETIMEDOUT ? ETIMEDOUT : 0;
+#endif
+}
+
+/*!
+ * \brief Tells whether a CPU set is empty.
+ *
+ * \internal
+ */
+static int CpuSetEmpty(
+	/*! . */
+	const ThreadPoolCpuSet *set)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(set->bits) / sizeof(set->bits[0]); i++)
+		if (set->bits[i])
+			return 0;
+
+	return 1;
+}
+
+/*!
+ * \brief Binds the calling thread to a CPU set.
+ *
+ * \internal
+ *
+ * \return 0 on success, an errno value otherwise.
+ */
+static int CpuSetBind(
+	/*! Non empty set. */
+	const ThreadPoolCpuSet *set)
+{
+#if defined(__linux__)
+	cpu_set_t mask;
+	int i;
+
+	CPU_ZERO(&mask);
+	for (i = 0; i < MAX_POOL_CPUS && i < CPU_SETSIZE; i++)
+		if (set->bits[i / CPU_SET_BITS] & (1UL << (i % CPU_SET_BITS)))
+			CPU_SET(i, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask) != 0)
+		return errno;
+
+	return 0;
+#elif defined(_WIN32)
+	DWORD_PTR mask = 0;
+	int i;
+
+	for (i = 0; i < (int)(8 * sizeof(mask)) && i < MAX_POOL_CPUS; i++)
+		if (set->bits[i / CPU_SET_BITS] & (1UL << (i % CPU_SET_BITS)))
+			mask |= (DWORD_PTR)1 << i;
+	if (!mask || !SetThreadAffinityMask(GetCurrentThread(), mask))
+		return EINVAL;
+
+	return 0;
+#else
+	(void)set;
+
+	return ENOTSUP;
+#endif
+}
+
+/*!
+ * \brief Gets the CPUs the calling thread may run on.
+ *
+ * \internal
+ *
+ * \return 0 on success, an errno value otherwise.
+ */
+static int CpuSetGet(
+	/*! [out] . */
+	ThreadPoolCpuSet *set)
+{
+#if defined(__linux__)
+	cpu_set_t mask;
+	int i;
+
+	if (sched_getaffinity(0, sizeof(mask), &mask) != 0)
+		return errno;
+	memset(set, 0, sizeof(*set));
+	for (i = 0; i < MAX_POOL_CPUS && i < CPU_SETSIZE; i++)
+		if (CPU_ISSET(i, &mask))
+			set->bits[i / CPU_SET_BITS] |= 1UL << (i % CPU_SET_BITS);
+
+	return 0;
+#elif defined(_WIN32)
+	DWORD_PTR mask;
+	DWORD_PTR system;
+	int i;
+
+	if (!GetProcessAffinityMask(GetCurrentProcess(), &mask, &system))
+		return EINVAL;
+	memset(set, 0, sizeof(*set));
+	for (i = 0; i < (int)(8 * sizeof(mask)) && i < MAX_POOL_CPUS; i++)
+		if (mask & ((DWORD_PTR)1 << i))
+			set->bits[i / CPU_SET_BITS] |= 1UL << (i % CPU_SET_BITS);
+
+	return 0;
+#else
+	(void)set;
+
+	return ENOTSUP;
+#endif
+}
+
+/*!
+ * \brief Fills sets with the CPUs of a base set on each NUMA node that has
+ * some.
+ *
+ * \internal
+ *
+ * \return The number of sets filled, 0 if the nodes are not known.
+ */
+static int NumaNodeCpus(
+	/*! CPUs to split. */
+	const ThreadPoolCpuSet *base,
+	/*! [out] MAX_NUMA_NODES sets. */
+	ThreadPoolCpuSet *nodes)
+{
+	int n = 0;
+#ifdef __linux__
+	char path[64];
+	char line[1024];
+	FILE *fp;
+	size_t len;
+	size_t i;
+	int node;
+	int empty;
+
+	for (node = 0; node < MAX_NUMA_NODES; node++) {
+		snprintf(path,
+			sizeof(path),
+			"/sys/devices/system/node/node%d/cpulist",
+			node);
+		fp = fopen(path, "r");
+		if (!fp)
+			continue;
+		if (!fgets(line, sizeof(line), fp))
+			line[0] = '\0';
+		fclose(fp);
+		len = strlen(line);
+		while (len > 0 && isspace((unsigned char)line[len - 1]))
+			line[--len] = '\0';
+		if (TPCpuSetParse(&nodes[n], line) != 0)
+			continue;
+		empty = 1;
+		for (i = 0; i < sizeof(base->bits) / sizeof(base->bits[0]);
+			i++) {
+			nodes[n].bits[i] &= base->bits[i];
+			if (nodes[n].bits[i])
+				empty = 0;
+		}
+		if (!empty)
+			n++;
+	}
+#else
+	(void)base;
+	(void)nodes;
+#endif
+
+	return n;
+}
+
+/*!
+ * \brief Computes the CPU sets the workers are bound to in turn: one per
+ * NUMA node if the pool is numaLocal, otherwise the CPU set of the pool, or
+ * the CPUs of the calling thread if only the persistent jobs are bound, for
+ * the workers to return to after them.
+ *
+ * \internal
+ *
+ * \return 0 on success, EAGAIN on failure.
+ */
+static int WorkerCpusInit(
+	/*! . */
+	ThreadPool *tp)
+{
+	ThreadPoolCpuSet base;
+	int n = 0;
+
+	tp->workerCpus = NULL;
+	tp->workerCpuSets = 0;
+	tp->nextCpuSet = 0;
+	if (CpuSetEmpty(&tp->attr.cpuSet) &&
+		CpuSetEmpty(&tp->attr.persistentCpuSet) &&
+		!tp->attr.numaLocal)
+		return 0;
+	if (!CpuSetEmpty(&tp->attr.cpuSet))
+		base = tp->attr.cpuSet;
+	else if (CpuSetGet(&base) != 0)
+		/* threads cannot be bound here */
+		return 0;
+	tp->workerCpus = (ThreadPoolCpuSet *)calloc(
+		MAX_NUMA_NODES, sizeof(ThreadPoolCpuSet));
+	if (!tp->workerCpus)
+		return EAGAIN;
+	if (tp->attr.numaLocal)
+		n = NumaNodeCpus(&base, tp->workerCpus);
+	if (n < 2) {
+		tp->workerCpus[0] = base;
+		n = 1;
+	}
+	tp->workerCpuSets = n;
+
+	return 0;
+}
+
+/*!
+ * \brief Binds a starting worker to the next CPU set of the pool.
+ *
+ * \internal
+ *
+ * \return The CPU set, NULL if the workers are not bound.
+ */
+static const ThreadPoolCpuSet *BindWorker(
+	/*! . */
+	ThreadPool *tp)
+{
+	const ThreadPoolCpuSet *cpus;
+	unsigned int next;
+
+	if (tp->workerCpuSets == 0)
+		return NULL;
+	next = (unsigned int)(ithread_atomic_add(&tp->nextCpuSet, 1) - 1);
+	cpus = &tp->workerCpus[next % (unsigned int)tp->workerCpuSets];
+	CpuSetBind(cpus);
+
+	return cpus;
+}
+
+/*!
+ * \brief Binds a worker to the persistent CPU set of the pool before it
+ * runs a persistent job, or back to its own CPU set after.
+ *
+ * \internal
+ */
+static void BindPersistent(
+	/*! . */
+	ThreadPool *tp,
+	/*! CPU set of the worker, NULL if not bound. */
+	const ThreadPoolCpuSet *cpus,
+	/*! 1 before the job, 0 after. */
+	int start)
+{
+	if (!cpus || CpuSetEmpty(&tp->attr.persistentCpuSet))
+		return;
+	CpuSetBind(start ? &tp->attr.persistentCpuSet : cpus);
+}
+
+/*!
+ * \brief Sets seed for random number generator. Each thread sets the seed
+ * random number generator.
+ *
+ * \internal
+ */
+static void SetSeed(void)
+{
+	struct timeval t;
+
+	gettimeofday(&t, NULL);
+#if defined(__PTW32_DLLPORT)
+	srand((unsigned int)t.tv_usec +
+		PtrToUint(ithread_get_current_thread_id().p));
+#elif defined(BSD) || defined(__APPLE__) || defined(__FreeBSD_kernel__)
+	srand((unsigned int)t.tv_usec +
+		(unsigned int)ithread_get_current_thread_id());
+#elif defined(__linux__) || defined(__sun) || defined(__CYGWIN__) || \
+	defined(__GLIBC__)
+	srand((unsigned int)t.tv_usec +
+		(unsigned int)ithread_get_current_thread_id());
+#else
+	{
+		volatile union
+		{
+			volatile pthread_t tid;
+			volatile unsigned i;
+		} idu;
+
+		idu.tid = ithread_get_current_thread_id();
+		srand((unsigned int)t.tv_usec + idu.i);
+	}
+#endif
+}
+
+/*!
+ * \brief Tells whether an idle worker exits: its wait for a job timed out
+ * and there are more than the min threads and than the threads the adaptive
+ * sizing keeps, or there are more than the max threads (only possible if
+ * the attributes have been reset).
+ *
+ * \remark The ThreadPool object mutex must be locked prior to calling this
+ * function.
+ *
+ * \internal
+ */
+static int WorkerExits(
+	/*! . */
+	ThreadPool *tp,
+	/*! result of the wait for a job. */
+	int retCode)
+{
+	if (tp->attr.maxThreads != -1 &&
+		tp->totalThreads > tp->attr.maxThreads)
+		return 1;
+	if (retCode != ETIMEDOUT || tp->totalThreads <= tp->attr.minThreads)
+		return 0;
+
+	return tp->attr.adaptiveInterval <= 0 ||
+	       tp->totalThreads > tp->adaptThreads;
+}
+
+/*!
+ * \brief Implements a thread pool worker. Worker waits for a job to become
+ * available. Worker picks up persistent jobs first, high priority,
+ * med priority, then low priority.
+ *
+ * If worker remains idle for more than specified max, the worker is released.
+ *
+ * \internal
+ */
+static void *WorkerThread(
+	/*! arg -> is cast to (ThreadPool *). */
+	void *arg)
+{
+	time_t start = 0;
+
+	ThreadPoolJob *job = NULL;
+	ListNode *head = NULL;
+
+	struct timespec timeout;
+	int retCode = 0;
+	int persistent = -1;
+	int expired = 0;
+	const ThreadPoolCpuSet *cpus;
+	struct timeval jobStart;
+	ThreadPool *tp = (ThreadPool *)arg;
+
+	ithread_initialize_thread();
+	cpus = BindWorker(tp);
+
+	/* Increment total thread count */
+	ithread_mutex_lock(&tp->mutex);
+	ithread_atomic_add(&tp->totalThreads, 1);
+	tp->pendingWorkerThreadStart = 0;
+	ithread_cond_broadcast(&tp->start_and_shutdown);
+	ithread_mutex_unlock(&tp->mutex);
+
+	SetSeed();
+	StatsTime(&start);
+	while (1) {
+		ithread_mutex_lock(&tp->mutex);
+		if (job) {
+			ithread_atomic_add(&tp->busyThreads, -1);
+			FreeThreadPoolJob(tp, job);
+			job = NULL;
+		}
+		retCode = 0;
+		tp->stats.idleThreads++;
+		tp->stats.totalWorkTime +=
+			(double)StatsTime(NULL) - (double)start;
+		StatsTime(&start);
+		if (persistent == 0) {
+			tp->stats.workerThreads--;
+		} else if (persistent == 1) {
+			/* Persistent thread becomes a regular thread */
+			ithread_atomic_add(&tp->persistentThreads, -1);
+		}
+
+		/* Check for a job or shutdown */
+		while (tp->lowJobQ.size == 0 && tp->medJobQ.size == 0 &&
+			tp->highJobQ.size == 0 && tp->deadlineJobs == 0 &&
+			!tp->persistentJob && !tp->shutdown) {
+			/* If wait timed out and we currently have more than the
+			 * threads to keep, or if we have more than the max
+			 * threads let this thread die. */
+			if (WorkerExits(tp, retCode)) {
+				tp->stats.idleThreads--;
+				goto exit_function;
+			}
+			SetRelTimeout(&timeout, tp->attr.maxIdleTime);
+
+			/* wait for a job up to the specified max time */
+			retCode = ithread_cond_timedwait(
+				&tp->condition, &tp->mutex, &timeout);
+		}
+		tp->stats.idleThreads--;
+		/* idle time */
+		tp->stats.totalIdleTime +=
+			(double)StatsTime(NULL) - (double)start;
+		/* work time */
+		StatsTime(&start);
+		/* bump priority of starved jobs */
+		BumpPriority(tp);
+		expired = 0;
+		/* if shutdown then stop */
+		if (tp->shutdown) {
+			goto exit_function;
+		} else {
+			/* Pick up persistent job if available */
+			if (tp->persistentJob) {
+				job = tp->persistentJob;
+				SlotMapRemove(&tp->jobIds, job->jobId);
+				(void)ithread_atomic_exchange_ptr(
+					&tp->persistentJob, NULL);
+				ithread_atomic_add(&tp->persistentThreads, 1);
+				persistent = 1;
+				ithread_cond_broadcast(&tp->start_and_shutdown);
+			} else {
+				tp->stats.workerThreads++;
+				persistent = 0;
+				/* Pick the job with the earliest deadline, then
+				 * the highest priority job */
+				if (tp->deadlineJobs > 0) {
+					job = DeadlinePop(tp, &expired);
+				} else if (tp->highJobQ.size > 0) {
+					head = ListHead(&tp->highJobQ);
+					if (head == NULL) {
+						tp->stats.workerThreads--;
+						goto exit_function;
+					}
+					job = (ThreadPoolJob *)head->item;
+					CalcWaitTime(tp, HIGH_PRIORITY, job);
+					ListDelNode(&tp->highJobQ, head, 0);
+					SlotMapRemove(&tp->jobIds, job->jobId);
+				} else if (tp->medJobQ.size > 0) {
+					head = ListHead(&tp->medJobQ);
+					if (head == NULL) {
+						tp->stats.workerThreads--;
+						goto exit_function;
+					}
+					job = (ThreadPoolJob *)head->item;
+					CalcWaitTime(tp, MED_PRIORITY, job);
+					ListDelNode(&tp->medJobQ, head, 0);
+					SlotMapRemove(&tp->jobIds, job->jobId);
+				} else if (tp->lowJobQ.size > 0) {
+					head = ListHead(&tp->lowJobQ);
+					if (head == NULL) {
+						tp->stats.workerThreads--;
+						goto exit_function;
+					}
+					job = (ThreadPoolJob *)head->item;
+					CalcWaitTime(tp, LOW_PRIORITY, job);
+					ListDelNode(&tp->lowJobQ, head, 0);
+					SlotMapRemove(&tp->jobIds, job->jobId);
+				} else {
+					/* Should never get here */
+					tp->stats.workerThreads--;
+					goto exit_function;
+				}
+			}
+		}
+
+		ithread_atomic_add(&tp->busyThreads, 1);
+		ithread_mutex_unlock(&tp->mutex);
+
+		if (persistent == 1)
+			BindPersistent(tp, cpus, 1);
+		/* In the future can log info */
+		if (SetPriority(job->priority) != 0) {
+		} else {
+		}
+		/* run the job */
+		if (expired) {
+			ExpireJob(job);
+		} else if (persistent == 1) {
+			job->func(job->arg);
+		} else {
+			gettimeofday(&jobStart, NULL);
+			ithread_setspecific(tp->jobKey, job);
+			job->func(job->arg);
+			ithread_setspecific(tp->jobKey, NULL);
+			AccountJob(tp, job, &jobStart);
+		}
+		/* return to Normal */
+		SetPriority(DEFAULT_PRIORITY);
+		if (persistent == 1)
+			BindPersistent(tp, cpus, 0);
+	}
+
+exit_function:
+	ithread_atomic_add(&tp->totalThreads, -1);
+	ithread_cond_broadcast(&tp->start_and_shutdown);
+	ithread_mutex_unlock(&tp->mutex);
+	ithread_cleanup_thread();
+
+	return NULL;
+}
+
+/*!
+ * \brief Runs a job at its priority.
+ *
+ * \internal
+ */
+static void RunJob(
+	/*! . */
+	ThreadPool *tp,
+	/*! . */
+	ThreadPoolJob *job)
+{
+	ithread_atomic_add(&tp->busyThreads, 1);
+	SetPriority(job->priority);
+	job->func(job->arg);
+	/* return to Normal */
+	SetPriority(DEFAULT_PRIORITY);
+	ithread_atomic_add(&tp->busyThreads, -1);
+}
+
+/*!
+ * \brief Runs a job that was queued, recording its wait and run times.
+ *
+ * \internal
+ */
+static void RunQueuedJob(
+	/*! . */
+	ThreadPool *tp,
+	/*! . */
+	ThreadPoolJob *job)
+{
+	struct timeval start;
+
+	gettimeofday(&start, NULL);
+	ithread_setspecific(tp->jobKey, job);
+	RunJob(tp, job);
+	ithread_setspecific(tp->jobKey, NULL);
+	AccountJob(tp, job, &start);
+}
+
+/*!
+ * \brief Takes the persistent job, if any, counting the worker persistent.
+ *
+ * \internal
+ *
+ * \return 1 if a job was taken, 0 otherwise.
+ */
+static int TakePersistentJob(
+	/*! . */
+	ThreadPool *tp,
+	/*! [out] Copy of the job. */
+	ThreadPoolJob *job)
+{
+	ThreadPoolJob *persistentJob;
+
+	if (!ithread_atomic_load_ptr(&tp->persistentJob))
+		return 0;
+	ithread_mutex_lock(&tp->mutex);
+	persistentJob = tp->persistentJob;
+	if (persistentJob) {
+		*job = *persistentJob;
+		SlotMapRemove(&tp->jobIds, persistentJob->jobId);
+		(void)ithread_atomic_exchange_ptr(&tp->persistentJob, NULL);
+		FreeThreadPoolJob(tp, persistentJob);
+		ithread_atomic_add(&tp->persistentThreads, 1);
+		ithread_cond_broadcast(&tp->start_and_shutdown);
+	}
+	ithread_mutex_unlock(&tp->mutex);
+
+	return persistentJob != NULL;
+}
+
+/*!
+ * \brief Implements a thread pool worker in WORK_STEALING mode. Worker
+ * picks up persistent jobs first, then the highest priority job of its own
+ * qs or of those of the other workers, without locking the pool mutex.
+ *
+ * Worker waits on the pool condition when all the qs are empty: it counts
+ * itself idle before it checks them, and ThreadPoolAdd() checks for idle
+ * workers after it queued a job, so that one of the two sees the other.
+ *
+ * \internal
+ */
+static void *StealingWorkerThread(
+	/*! arg -> is cast to (ThreadPool *). */
+	void *arg)
+{
+	time_t start = 0;
+	ThreadPoolJob job;
+	ThreadPoolQueue *q;
+	struct timespec timeout;
+	int retCode = 0;
+	int expired;
+	int home;
+	int bump;
+	const ThreadPoolCpuSet *cpus;
+	ThreadPool *tp = (ThreadPool *)arg;
+
+	ithread_initialize_thread();
+	cpus = BindWorker(tp);
+
+	/* Increment total thread count */
+	ithread_mutex_lock(&tp->mutex);
+	ithread_atomic_add(&tp->totalThreads, 1);
+	tp->pendingWorkerThreadStart = 0;
+	ithread_cond_broadcast(&tp->start_and_shutdown);
+	ithread_mutex_unlock(&tp->mutex);
+
+	home = (int)((unsigned int)ithread_atomic_add(&tp->nextQueue, 1) %
+		     (unsigned int)tp->queueCount);
+	bump = home;
+	SetSeed();
+	StatsTime(&start);
+	while (!ithread_atomic_load(&tp->shutdown)) {
+		/* Pick up persistent job if available */
+		if (TakePersistentJob(tp, &job)) {
+			BindPersistent(tp, cpus, 1);
+			RunJob(tp, &job);
+			BindPersistent(tp, cpus, 0);
+			/* Persistent thread becomes a regular thread */
+			ithread_atomic_add(&tp->persistentThreads, -1);
+			continue;
+		}
+		/* bump priority of starved jobs, one q at a time, so that
+		 * the jobs of the qs nobody takes from are bumped too */
+		q = &tp->queues[bump];
+		bump = (bump + 1) % tp->queueCount;
+		ithread_mutex_lock(&q->mutex);
+		QueueBumpPriority(tp, q);
+		ithread_mutex_unlock(&q->mutex);
+		if (DeadlineTakeJob(tp, &job, &expired)) {
+			if (expired)
+				ExpireJob(&job);
+			else
+				RunQueuedJob(tp, &job);
+			continue;
+		}
+		if (StealJob(tp, home, &job)) {
+			RunQueuedJob(tp, &job);
+			continue;
+		}
+
+		/* Wait for a job or shutdown */
+		ithread_mutex_lock(&tp->mutex);
+		tp->stats.totalWorkTime +=
+			(double)StatsTime(NULL) - (double)start;
+		StatsTime(&start);
+		ithread_atomic_add(&tp->idleWorkers, 1);
+		retCode = 0;
+		while (QueuedJobs(tp) == 0 && !tp->persistentJob &&
+			!tp->shutdown) {
+			/* Let this thread die as WorkerThread() does. */
+			if (WorkerExits(tp, retCode)) {
+				ithread_atomic_add(&tp->idleWorkers, -1);
+				goto exit_function;
+			}
+			SetRelTimeout(&timeout, tp->attr.maxIdleTime);
+			retCode = ithread_cond_timedwait(
+				&tp->condition, &tp->mutex, &timeout);
+		}
+		ithread_atomic_add(&tp->idleWorkers, -1);
+		/* idle time */
+		tp->stats.totalIdleTime +=
+			(double)StatsTime(NULL) - (double)start;
+		StatsTime(&start);
+		ithread_mutex_unlock(&tp->mutex);
+	}
+	ithread_mutex_lock(&tp->mutex);
+
+exit_function:
+	ithread_atomic_add(&tp->totalThreads, -1);
+	ithread_cond_broadcast(&tp->start_and_shutdown);
+	ithread_mutex_unlock(&tp->mutex);
+	ithread_cleanup_thread();
+
+	return NULL;
+}
+
+/*!
+ * \brief Adds the wait times of the jobs run by a worker in
+ * LOCK_FREE_QUEUES mode to the statistics.
+ *
+ * \remark The ThreadPool object mutex must be locked prior to calling this
+ * function.
+ *
+ * \internal
+ */
+static void FlushWaitStats(
+	/*! . */
+	ThreadPool *tp,
+	/*! . */
+	WaitStats *w)
+{
+	tp->stats.totalJobsHQ += w->totalJobs[HIGH_PRIORITY];
+	tp->stats.totalTimeHQ += w->totalTime[HIGH_PRIORITY];
+	tp->stats.totalJobsMQ += w->totalJobs[MED_PRIORITY];
+	tp->stats.totalTimeMQ += w->totalTime[MED_PRIORITY];
+	tp->stats.totalJobsLQ += w->totalJobs[LOW_PRIORITY];
+	tp->stats.totalTimeLQ += w->totalTime[LOW_PRIORITY];
+	memset(w, 0, sizeof(*w));
+}
+
+/*!
+ * \brief Implements a thread pool worker in LOCK_FREE_QUEUES mode. Worker
+ * picks up persistent jobs first, then a job of the rings, without locking
+ * the pool mutex.
+ *
+ * Worker parks on parkSeq when the rings are empty: it counts itself idle
+ * and reads parkSeq before it checks them, and ThreadPoolAdd() checks for
+ * idle workers after it queued a job and changes parkSeq before it wakes
+ * one up, so that the wake up cannot be lost.
+ *
+ * \internal
+ */
+static void *LockFreeWorkerThread(
+	/*! arg -> is cast to (ThreadPool *). */
+	void *arg)
+{
+	time_t start = 0;
+	ThreadPoolJob job;
+	WaitStats wait;
+	struct timeval now;
+	int retCode;
+	int expired;
+	int seq;
+	int p;
+	const ThreadPoolCpuSet *cpus;
+	ThreadPool *tp = (ThreadPool *)arg;
+
+	ithread_initialize_thread();
+	cpus = BindWorker(tp);
+
+	/* Increment total thread count */
+	ithread_mutex_lock(&tp->mutex);
+	ithread_atomic_add(&tp->totalThreads, 1);
+	tp->pendingWorkerThreadStart = 0;
+	ithread_cond_broadcast(&tp->start_and_shutdown);
+	ithread_mutex_unlock(&tp->mutex);
+
+	memset(&wait, 0, sizeof(wait));
+	SetSeed();
+	StatsTime(&start);
+	while (!ithread_atomic_load(&tp->shutdown)) {
+		/* Pick up persistent job if available */
+		if (TakePersistentJob(tp, &job)) {
+			BindPersistent(tp, cpus, 1);
+			RunJob(tp, &job);
+			BindPersistent(tp, cpus, 0);
+			/* Persistent thread becomes a regular thread */
+			ithread_atomic_add(&tp->persistentThreads, -1);
+			continue;
+		}
+		if (DeadlineTakeJob(tp, &job, &expired)) {
+			if (expired)
+				ExpireJob(&job);
+			else
+				RunQueuedJob(tp, &job);
+			continue;
+		}
+		if (RingsTakeJob(tp, &job)) {
+			gettimeofday(&now, NULL);
+			p = job.priority;
+			if (p < LOW_PRIORITY || p > HIGH_PRIORITY)
+				p = LOW_PRIORITY;
+			wait.totalJobs[p]++;
+			wait.totalTime[p] +=
+				(double)DiffMillis(&now, &job.requestTime);
+			if (++wait.count >= WAIT_STATS_BATCH) {
+				ithread_mutex_lock(&tp->mutex);
+				FlushWaitStats(tp, &wait);
+				ithread_mutex_unlock(&tp->mutex);
+			}
+			RunQueuedJob(tp, &job);
+			continue;
+		}
+
+		/* Park until a job comes or shutdown */
+		ithread_mutex_lock(&tp->mutex);
+		FlushWaitStats(tp, &wait);
+		tp->stats.totalWorkTime +=
+			(double)StatsTime(NULL) - (double)start;
+		StatsTime(&start);
+		ithread_mutex_unlock(&tp->mutex);
+		retCode = 0;
+		ithread_atomic_add(&tp->idleWorkers, 1);
+		seq = ithread_atomic_load(&tp->parkSeq);
+		if (QueuedJobs(tp) == 0 &&
+			!ithread_atomic_load_ptr(&tp->persistentJob) &&
+			!ithread_atomic_load(&tp->shutdown))
+			retCode = ParkWait(tp, seq, tp->attr.maxIdleTime);
+		ithread_atomic_add(&tp->idleWorkers, -1);
+		ithread_mutex_lock(&tp->mutex);
+		/* idle time */
+		tp->stats.totalIdleTime +=
+			(double)StatsTime(NULL) - (double)start;
+		StatsTime(&start);
+		/* Let this thread die as WorkerThread() does. */
+		if (QueuedJobs(tp) == 0 && WorkerExits(tp, retCode))
+			goto exit_function;
+		ithread_mutex_unlock(&tp->mutex);
+	}
+	ithread_mutex_lock(&tp->mutex);
+	FlushWaitStats(tp, &wait);
+
+exit_function:
+	ithread_atomic_add(&tp->totalThreads, -1);
+	ithread_cond_broadcast(&tp->start_and_shutdown);
+	ithread_mutex_unlock(&tp->mutex);
+	ithread_cleanup_thread();
+
+	return NULL;
+}
+
+/*!
+ * \brief Creates a Thread Pool Job. (Dynamically allocated)
+ *
+ * \internal
+ *
+ * \return ThreadPoolJob *on success, NULL on failure.
+ */
+static ThreadPoolJob *CreateThreadPoolJob(
+	/*! job is copied. */
+	ThreadPoolJob *job,
+	/*! id of job. */
+	int id,
+	/*! . */
+	ThreadPool *tp)
+{
+	ThreadPoolJob *newJob = NULL;
+
+	newJob = (ThreadPoolJob *)FreeListAlloc(&tp->jobFreeList);
+	if (newJob) {
+		*newJob = *job;
+		newJob->jobId = id;
+		newJob->node = NULL;
+		newJob->place = 0;
+		gettimeofday(&newJob->requestTime, NULL);
+	}
+
+	return newJob;
+}
+
+/*!
+ * \brief Creates a worker thread, if the thread pool does not already have
  * max threads.
  *
  * \remark The ThreadPool object mutex must be locked prior to calling this
@@ -638,73 +2130,414 @@ static ThreadPoolJob *CreateThreadPoolJob(
  *
  * \internal
  *
- * \return
- *	\li \c 0 on success, < 0 on failure.
- *	\li \c EMAXTHREADS if already max threads reached.
- *	\li \c EAGAIN if system can not create thread.
+ * \return
+ *	\li \c 0 on success, < 0 on failure.
+ *	\li \c EMAXTHREADS if already max threads reached.
+ *	\li \c EAGAIN if system can not create thread.
+ */
+static int CreateWorker(
+	/*! A pointer to the ThreadPool object. */
+	ThreadPool *tp)
+{
+	ithread_t temp;
+	int rc = 0;
+	ithread_attr_t attr;
+	void *(*worker)(void *) = WorkerThread;
+
+	/* if a new worker is the process of starting, wait until it fully
+	 * starts */
+	while (tp->pendingWorkerThreadStart) {
+		ithread_cond_wait(&tp->start_and_shutdown, &tp->mutex);
+	}
+
+	if (tp->attr.maxThreads != INFINITE_THREADS &&
+		tp->totalThreads + 1 > tp->attr.maxThreads) {
+		return EMAXTHREADS;
+	}
+	ithread_attr_init(&attr);
+	ithread_attr_setstacksize(&attr, tp->attr.stackSize);
+	ithread_attr_setdetachstate(&attr, ITHREAD_CREATE_DETACHED);
+	if (tp->rings)
+		worker = LockFreeWorkerThread;
+	else if (tp->queues)
+		worker = StealingWorkerThread;
+	rc = ithread_create(&temp, &attr, worker, tp);
+	ithread_attr_destroy(&attr);
+	if (rc == 0) {
+		tp->pendingWorkerThreadStart = 1;
+		/* wait until the new worker thread starts */
+		while (tp->pendingWorkerThreadStart) {
+			ithread_cond_wait(&tp->start_and_shutdown, &tp->mutex);
+		}
+	}
+	if (tp->stats.maxThreads < tp->totalThreads) {
+		tp->stats.maxThreads = tp->totalThreads;
+	}
+
+	return rc;
+}
+
+/*!
+ * \brief Returns the number of jobs waiting for a worker.
+ *
+ * \remark The ThreadPool object mutex must be locked prior to calling this
+ * function.
+ *
+ * \internal
+ */
+static long WaitingJobs(
+	/*! A pointer to the ThreadPool object. */
+	ThreadPool *tp)
+{
+	if (tp->queues || tp->rings)
+		return ithread_atomic_load(&tp->pendingJobs);
+
+	return (long)(tp->highJobQ.size + tp->lowJobQ.size +
+		      tp->medJobQ.size) +
+	       tp->deadlineJobs;
+}
+
+/*!
+ * \brief Determines whether or not a thread should be added based on the
+ * jobsPerThread ratio, or on the threads the adaptive sizing keeps. Adds a
+ * thread if appropriate.
+ *
+ * \remark The ThreadPool object mutex must be locked prior to calling this
+ * function.
+ *
+ * \internal
+ */
+static void AddWorker(
+	/*! A pointer to the ThreadPool object. */
+	ThreadPool *tp)
+{
+	long jobs = WaitingJobs(tp);
+	int threads = 0;
+
+	threads = tp->totalThreads - tp->persistentThreads;
+	if (tp->attr.adaptiveInterval > 0) {
+		while (jobs > 0 &&
+			(threads == 0 || tp->totalThreads < tp->adaptThreads)) {
+			if (CreateWorker(tp) != 0)
+				return;
+			threads++;
+		}
+		return;
+	}
+	while (threads == 0 || (jobs / threads) >= tp->attr.jobsPerThread ||
+		(tp->totalThreads == ithread_atomic_load(&tp->busyThreads))) {
+		if (CreateWorker(tp) != 0) {
+			return;
+		}
+		threads++;
+	}
+}
+
+/*!
+ * \brief Bounds the number of threads the adaptive sizing keeps by the min
+ * and max threads, keeping a worker beside the persistent threads.
+ *
+ * \remark The ThreadPool object mutex must be locked prior to calling this
+ * function.
+ *
+ * \internal
+ */
+static int AdaptBound(
+	/*! A pointer to the ThreadPool object. */
+	ThreadPool *tp,
+	/*! number of threads. */
+	int threads)
+{
+	int low = tp->attr.minThreads;
+
+	if (low < tp->persistentThreads + 1)
+		low = tp->persistentThreads + 1;
+	if (tp->attr.maxThreads != INFINITE_THREADS &&
+		threads > tp->attr.maxThreads)
+		threads = tp->attr.maxThreads;
+
+	return threads < low ? low : threads;
+}
+
+/*!
+ * \brief Takes a step of the adaptive sizing, hill climbing on the number
+ * of jobs run.
+ *
+ * The pool grows when more than 1 in 20 jobs waited longer than
+ * adaptiveWait, unless the threads added at the last step did not raise the
+ * number of jobs run, in which case they are taken back, and doubles when
+ * its workers are all blocked with jobs waiting. It shrinks by one thread
+ * per maxIdleTime while workers stay idle and no job waits too long.
+ *
+ * \remark The ThreadPool object mutex must be locked prior to calling this
+ * function.
+ *
+ * \internal
  */
-static int CreateWorker(
+static void AdaptPool(
 	/*! A pointer to the ThreadPool object. */
 	ThreadPool *tp)
 {
-	ithread_t temp;
-	int rc = 0;
-	ithread_attr_t attr;
-
-	/* if a new worker is the process of starting, wait until it fully
-	 * starts */
-	while (tp->pendingWorkerThreadStart) {
-		ithread_cond_wait(&tp->start_and_shutdown, &tp->mutex);
+	int now = NowMillis();
+	int done = ithread_atomic_load(&tp->adaptDone);
+	int late = ithread_atomic_load(&tp->adaptLate);
+	int workers = tp->totalThreads - tp->persistentThreads;
+	int busy = ithread_atomic_load(&tp->busyThreads);
+	int step = 0;
+	int threads;
+
+	ithread_atomic_add(&tp->adaptDone, -done);
+	ithread_atomic_add(&tp->adaptLate, -late);
+	if (WaitingJobs(tp) > 0 && done == 0 && busy >= tp->totalThreads) {
+		/* blocked, the jobs run cannot tell whether threads help */
+		step = workers > 0 ? workers : 1;
+	} else if (late * 20 > done) {
+		if (tp->adaptStep > 0 && done <= tp->adaptLastDone)
+			step = -tp->adaptStep;
+		else
+			step = workers / 4 > 0 ? workers / 4 : 1;
+	} else if (busy < tp->totalThreads &&
+		   (int)((unsigned int)now - (unsigned int)tp->adaptChange) >=
+			   tp->attr.maxIdleTime) {
+		step = -1;
 	}
+	tp->adaptLastDone = done;
+	threads = AdaptBound(tp, tp->adaptThreads + step);
+	tp->adaptStep = threads - tp->adaptThreads;
+	if (tp->adaptStep != 0)
+		tp->adaptChange = now;
+	ithread_atomic_store(&tp->adaptThreads, threads);
+}
 
-	if (tp->attr.maxThreads != INFINITE_THREADS &&
-		tp->totalThreads + 1 > tp->attr.maxThreads) {
-		return EMAXTHREADS;
+/*!
+ * \brief Thread of the adaptive sizing: takes a step every adaptiveInterval
+ * and starts the workers it asks for, until the pool shuts down or the
+ * sizing is turned off.
+ *
+ * \internal
+ */
+static void *AdaptThread(
+	/*! arg -> is cast to (ThreadPool *). */
+	void *arg)
+{
+	ThreadPool *tp = (ThreadPool *)arg;
+	struct timespec timeout;
+	int retCode;
+
+	ithread_initialize_thread();
+	ithread_mutex_lock(&tp->mutex);
+	while (!tp->shutdown && tp->attr.adaptiveInterval > 0) {
+		SetRelTimeout(&timeout, tp->attr.adaptiveInterval);
+		retCode = 0;
+		/* also woken up as workers start and exit */
+		while (retCode != ETIMEDOUT && !tp->shutdown)
+			retCode = ithread_cond_timedwait(
+				&tp->start_and_shutdown, &tp->mutex, &timeout);
+		if (tp->shutdown)
+			break;
+		AdaptPool(tp);
+		AddWorker(tp);
 	}
+	tp->adaptRunning = 0;
+	ithread_cond_broadcast(&tp->start_and_shutdown);
+	ithread_mutex_unlock(&tp->mutex);
+	ithread_cleanup_thread();
+
+	return NULL;
+}
+
+/*!
+ * \brief Starts the thread of the adaptive sizing if it is on and does not
+ * run yet.
+ *
+ * \remark The ThreadPool object mutex must be locked prior to calling this
+ * function.
+ *
+ * \internal
+ *
+ * \return 0 on success, EAGAIN if the thread cannot be created.
+ */
+static int StartAdapt(
+	/*! A pointer to the ThreadPool object. */
+	ThreadPool *tp)
+{
+	ithread_t temp;
+	ithread_attr_t attr;
+	int rc;
+
+	ithread_atomic_store(
+		&tp->adaptThreads, AdaptBound(tp, tp->adaptThreads));
+	if (tp->attr.adaptiveInterval <= 0 || tp->adaptRunning)
+		return 0;
 	ithread_attr_init(&attr);
 	ithread_attr_setstacksize(&attr, tp->attr.stackSize);
 	ithread_attr_setdetachstate(&attr, ITHREAD_CREATE_DETACHED);
-	rc = ithread_create(&temp, &attr, WorkerThread, tp);
+	rc = ithread_create(&temp, &attr, AdaptThread, tp);
 	ithread_attr_destroy(&attr);
-	if (rc == 0) {
-		tp->pendingWorkerThreadStart = 1;
-		/* wait until the new worker thread starts */
-		while (tp->pendingWorkerThreadStart) {
-			ithread_cond_wait(&tp->start_and_shutdown, &tp->mutex);
-		}
-	}
-	if (tp->stats.maxThreads < tp->totalThreads) {
-		tp->stats.maxThreads = tp->totalThreads;
+	if (rc != 0)
+		return EAGAIN;
+	tp->adaptRunning = 1;
+
+	return 0;
+}
+
+/*!
+ * \brief Allocates the job qs of the workers in WORK_STEALING mode, one per
+ * thread up to MAX_STEALING_QUEUES.
+ *
+ * \internal
+ *
+ * \return 0 on success, EAGAIN on failure.
+ */
+static int QueuesInit(
+	/*! . */
+	ThreadPool *tp)
+{
+	ThreadPoolQueue *q;
+	int count = tp->attr.maxThreads;
+	int bits = 0;
+	int i;
+	int p;
+
+	if (count == INFINITE_THREADS || count > MAX_STEALING_QUEUES)
+		count = MAX_STEALING_QUEUES;
+	else if (count < 1)
+		count = 1;
+	tp->queues = (ThreadPoolQueue *)calloc(
+		(size_t)count, sizeof(ThreadPoolQueue));
+	if (!tp->queues)
+		return EAGAIN;
+	/* the high bits of the id of a job give its q */
+	while (1 << bits < count)
+		bits++;
+	for (i = 0; i < count; i++) {
+		q = &tp->queues[i];
+		ithread_mutex_init(&q->mutex, NULL);
+		for (p = 0; p < NUM_PRIORITIES; p++)
+			ListInit(&q->jobQ[p], CmpThreadPoolJob, NULL);
+		FreeListInit(&q->jobFreeList,
+			sizeof(ThreadPoolJob),
+			JOBFREELISTSIZE / count + 1);
+		SlotMapInit(&q->jobIds,
+			i << (QUEUE_JOB_ID_BITS - bits),
+			QUEUE_JOB_ID_BITS - SLOT_MAP_GENERATION_BITS - bits);
 	}
+	tp->queueCount = count;
 
-	return rc;
+	return 0;
 }
 
 /*!
- * \brief Determines whether or not a thread should be added based on the
- * jobsPerThread ratio. Adds a thread if appropriate.
+ * \brief Frees the jobs left in the job qs of the workers and the qs.
  *
- * \remark The ThreadPool object mutex must be locked prior to calling this
- * function.
+ * \internal
+ */
+static void QueuesDestroy(
+	/*! . */
+	ThreadPool *tp)
+{
+	ThreadPoolQueue *q;
+	ThreadPoolJob *temp;
+	ListNode *head;
+	int i;
+	int p;
+
+	if (!tp->queues)
+		return;
+	for (i = 0; i < tp->queueCount; i++) {
+		q = &tp->queues[i];
+		for (p = NUM_PRIORITIES - 1; p >= 0; p--) {
+			while ((head = ListHead(&q->jobQ[p])) != NULL) {
+				temp = (ThreadPoolJob *)head->item;
+				if (temp->free_func)
+					temp->free_func(temp->arg);
+				FreeListFree(&q->jobFreeList, temp);
+				ListDelNode(&q->jobQ[p], head, 0);
+			}
+			ListDestroy(&q->jobQ[p], 0);
+		}
+		FreeListDestroy(&q->jobFreeList);
+		SlotMapDestroy(&q->jobIds);
+		ithread_mutex_destroy(&q->mutex);
+	}
+	free(tp->queues);
+	tp->queues = NULL;
+	tp->queueCount = 0;
+}
+
+/*!
+ * \brief Frees the jobs left in the job rings and the rings.
  *
  * \internal
  */
-static void AddWorker(
-	/*! A pointer to the ThreadPool object. */
+static void RingsDestroy(
+	/*! . */
 	ThreadPool *tp)
 {
-	long jobs = 0;
-	int threads = 0;
+	ThreadPoolRing *r;
+	ThreadPoolCell *c;
+	int pos;
+	int p;
 
-	jobs = tp->highJobQ.size + tp->lowJobQ.size + tp->medJobQ.size;
-	threads = tp->totalThreads - tp->persistentThreads;
-	while (threads == 0 || (jobs / threads) >= tp->attr.jobsPerThread ||
-		(tp->totalThreads == tp->busyThreads)) {
-		if (CreateWorker(tp) != 0) {
-			return;
+	if (!tp->rings)
+		return;
+	for (p = NUM_PRIORITIES - 1; p >= 0; p--) {
+		r = &tp->rings[p];
+		if (!r->cells)
+			continue;
+		for (pos = r->dequeuePos; pos != r->enqueuePos;
+			pos = (int)((unsigned int)pos + 1u)) {
+			c = &r->cells[pos & r->mask];
+			if (c->state == CELL_FULL && c->job.free_func)
+				c->job.free_func(c->job.arg);
 		}
-		threads++;
+		free(r->cells);
+	}
+	free(tp->rings);
+	tp->rings = NULL;
+}
+
+/*!
+ * \brief Allocates the job rings of LOCK_FREE_QUEUES mode, one per priority,
+ * each large enough for maxJobsTotal jobs up to MAX_RING_SIZE.
+ *
+ * \internal
+ *
+ * \return 0 on success, EAGAIN on failure.
+ */
+static int RingsInit(
+	/*! . */
+	ThreadPool *tp)
+{
+	ThreadPoolRing *r;
+	int size = 2;
+	int now = NowMillis();
+	int i;
+	int p;
+
+	while (size < tp->attr.maxJobsTotal && size < MAX_RING_SIZE)
+		size *= 2;
+	tp->rings = (ThreadPoolRing *)calloc(
+		NUM_PRIORITIES, sizeof(ThreadPoolRing));
+	if (!tp->rings)
+		return EAGAIN;
+	for (p = 0; p < NUM_PRIORITIES; p++) {
+		r = &tp->rings[p];
+		r->cells = (ThreadPoolCell *)calloc(
+			(size_t)size, sizeof(ThreadPoolCell));
+		if (!r->cells) {
+			RingsDestroy(tp);
+			return EAGAIN;
+		}
+		for (i = 0; i < size; i++) {
+			r->cells[i].seq = i;
+			r->cells[i].jobId = INVALID_JOB_ID;
+		}
+		r->mask = size - 1;
+		r->lastTaken = now;
 	}
+
+	return 0;
 }
 
 int ThreadPoolInit(ThreadPool *tp, ThreadPoolAttr *attr)
@@ -743,15 +2576,45 @@ int ThreadPoolInit(ThreadPool *tp, ThreadPoolAttr *attr)
 	}
 	retCode += FreeListInit(
 		&tp->jobFreeList, sizeof(ThreadPoolJob), JOBFREELISTSIZE);
+	retCode += ithread_key_create(&tp->jobKey, NULL);
+	retCode +=
+		SlotMapInit(&tp->jobIds, INDEXED_JOB_ID, SLOT_MAP_SLOT_BITS);
+	memset(tp->waitHist, 0, sizeof(tp->waitHist));
+	memset(tp->runHist, 0, sizeof(tp->runHist));
+	memset(tp->typeWaitHist, 0, sizeof(tp->typeWaitHist));
+	memset(tp->typeRunHist, 0, sizeof(tp->typeRunHist));
 	StatsInit(&tp->stats);
 	retCode += ListInit(&tp->highJobQ, CmpThreadPoolJob, NULL);
 	retCode += ListInit(&tp->medJobQ, CmpThreadPoolJob, NULL);
 	retCode += ListInit(&tp->lowJobQ, CmpThreadPoolJob, NULL);
+	tp->queues = NULL;
+	tp->queueCount = 0;
+	tp->nextQueue = 0;
+	memset(tp->queuedJobs, 0, sizeof(tp->queuedJobs));
+	tp->pendingJobs = 0;
+	tp->idleWorkers = 0;
+	tp->rings = NULL;
+	tp->parkSeq = 0;
+	tp->deadlineQ = NULL;
+	tp->deadlineJobs = 0;
+	tp->deadlineQSize = 0;
+	tp->adaptThreads = tp->attr.minThreads;
+	tp->adaptRunning = 0;
+	tp->adaptDone = 0;
+	tp->adaptLate = 0;
+	tp->adaptLastDone = 0;
+	tp->adaptStep = 0;
+	tp->adaptChange = NowMillis();
+	if (!retCode && tp->attr.queueMode == WORK_STEALING)
+		retCode = QueuesInit(tp);
+	if (!retCode && tp->attr.queueMode == LOCK_FREE_QUEUES)
+		retCode = RingsInit(tp);
+	if (!retCode)
+		retCode = WorkerCpusInit(tp);
 	if (retCode) {
 		retCode = EAGAIN;
 	} else {
 		tp->persistentJob = NULL;
-		tp->lastJobId = 0;
 		tp->shutdown = 0;
 		tp->totalThreads = 0;
 		tp->busyThreads = 0;
@@ -763,6 +2626,8 @@ int ThreadPoolInit(ThreadPool *tp, ThreadPoolAttr *attr)
 				break;
 			}
 		}
+		if (!retCode)
+			retCode = StartAdapt(tp);
 	}
 
 	ithread_mutex_unlock(&tp->mutex);
@@ -772,55 +2637,311 @@ int ThreadPoolInit(ThreadPool *tp, ThreadPoolAttr *attr)
 		ThreadPoolShutdown(tp);
 	}
 
-	return retCode;
+	return retCode;
+}
+
+int ThreadPoolAddPersistent(ThreadPool *tp, ThreadPoolJob *job, int *jobId)
+{
+	int ret = 0;
+	int tempId = -1;
+	int id;
+	ThreadPoolJob *temp = NULL;
+
+	if (!tp || !job) {
+		return EINVAL;
+	}
+	if (!jobId) {
+		jobId = &tempId;
+	}
+	*jobId = INVALID_JOB_ID;
+
+	ithread_mutex_lock(&tp->mutex);
+
+	/* Create A worker if less than max threads running */
+	if (tp->totalThreads < tp->attr.maxThreads) {
+		CreateWorker(tp);
+	} else {
+		/* if there is more than one worker thread
+		 * available then schedule job, otherwise fail */
+		if (tp->totalThreads - tp->persistentThreads - 1 == 0) {
+			ret = EMAXTHREADS;
+			goto exit_function;
+		}
+	}
+	temp = CreateThreadPoolJob(job, INVALID_JOB_ID, tp);
+	if (!temp) {
+		ret = EOUTOFMEM;
+		goto exit_function;
+	}
+	if (SlotMapAdd(&tp->jobIds, temp, &temp->jobId) != 0) {
+		FreeThreadPoolJob(tp, temp);
+		ret = EOUTOFMEM;
+		goto exit_function;
+	}
+	id = temp->jobId;
+	(void)ithread_atomic_exchange_ptr(&tp->persistentJob, temp);
+
+	/* Notify a waiting thread */
+	ithread_cond_signal(&tp->condition);
+	if (tp->rings)
+		ParkWake(tp, 0, 1);
+
+	/* wait until long job has been picked up */
+	while (tp->persistentJob)
+		ithread_cond_wait(&tp->start_and_shutdown, &tp->mutex);
+	*jobId = id;
+
+exit_function:
+	ithread_mutex_unlock(&tp->mutex);
+
+	return ret;
+}
+
+/*!
+ * \brief Tells whether AddWorker() may start a worker, without locking the
+ * pool mutex.
+ *
+ * \internal
+ */
+static int NeedWorker(
+	/*! . */
+	ThreadPool *tp)
+{
+	int total = ithread_atomic_load(&tp->totalThreads);
+	int threads = total - ithread_atomic_load(&tp->persistentThreads);
+
+	if (tp->attr.maxThreads != INFINITE_THREADS &&
+		total >= tp->attr.maxThreads)
+		return 0;
+	if (tp->attr.adaptiveInterval > 0)
+		return threads <= 0 ||
+		       total < ithread_atomic_load(&tp->adaptThreads);
+
+	return threads <= 0 ||
+	       ithread_atomic_load(&tp->pendingJobs) / threads >=
+		       tp->attr.jobsPerThread ||
+	       total == ithread_atomic_load(&tp->busyThreads);
+}
+
+/*!
+ * \brief Counts a job pending unless there are maxJobsTotal of them.
+ *
+ * \internal
+ *
+ * \return 0 on success, EOUTOFMEM if there are too many jobs.
+ */
+static int AdmitJob(
+	/*! . */
+	ThreadPool *tp)
+{
+	int pending = ithread_atomic_add(&tp->pendingJobs, 1);
+
+	if (pending > tp->attr.maxJobsTotal) {
+		ithread_atomic_add(&tp->pendingJobs, -1);
+		fprintf(stderr,
+			"libupnp ThreadPoolAdd too many jobs: %d\n",
+			pending - 1);
+		return EOUTOFMEM;
+	}
+
+	return 0;
+}
+
+/*!
+ * \brief Returns the q index of the priority of a job.
+ *
+ * \internal
+ */
+static int JobPriority(
+	/*! . */
+	ThreadPoolJob *job)
+{
+	switch (job->priority) {
+	case HIGH_PRIORITY:
+	case MED_PRIORITY:
+		return job->priority;
+	default:
+		return LOW_PRIORITY;
+	}
+}
+
+/*!
+ * \brief Adds a job to the qs of a worker in WORK_STEALING mode, chosen in
+ * turn, and wakes up an idle worker or starts a new one if needed.
+ *
+ * \internal
+ *
+ * \return 0 on success, EOUTOFMEM if there are too many jobs or not enough
+ * memory.
+ */
+static int StealingAdd(
+	/*! . */
+	ThreadPool *tp,
+	/*! . */
+	ThreadPoolJob *job,
+	/*! id of job. */
+	int *jobId)
+{
+	ThreadPoolQueue *q;
+	ThreadPoolJob *temp;
+	int p;
+	int rc = EOUTOFMEM;
+
+	if (AdmitJob(tp) != 0)
+		return rc;
+	p = JobPriority(job);
+	q = &tp->queues[(unsigned int)ithread_atomic_add(&tp->nextQueue, 1) %
+			(unsigned int)tp->queueCount];
+	ithread_mutex_lock(&q->mutex);
+	temp = (ThreadPoolJob *)FreeListAlloc(&q->jobFreeList);
+	if (temp) {
+		*temp = *job;
+		gettimeofday(&temp->requestTime, NULL);
+		temp->node = NULL;
+		temp->place = p;
+		if (SlotMapAdd(&q->jobIds, temp, &temp->jobId) == 0) {
+			temp->node = ListAddTail(&q->jobQ[p], temp);
+			if (!temp->node)
+				SlotMapRemove(&q->jobIds, temp->jobId);
+		}
+		if (temp->node) {
+			/* counted once it can be taken */
+			ithread_atomic_add(&tp->queuedJobs[p], 1);
+			*jobId = temp->jobId;
+			rc = 0;
+		} else {
+			FreeListFree(&q->jobFreeList, temp);
+		}
+	}
+	ithread_mutex_unlock(&q->mutex);
+	if (rc != 0) {
+		ithread_atomic_add(&tp->pendingJobs, -1);
+		return rc;
+	}
+	/* Notify a waiting thread, and AddWorker if appropriate */
+	if (ithread_atomic_load(&tp->idleWorkers) > 0) {
+		ithread_mutex_lock(&tp->mutex);
+		ithread_cond_signal(&tp->condition);
+		ithread_mutex_unlock(&tp->mutex);
+	}
+	if (NeedWorker(tp)) {
+		ithread_mutex_lock(&tp->mutex);
+		AddWorker(tp);
+		ithread_mutex_unlock(&tp->mutex);
+	}
+
+	return 0;
 }
 
-int ThreadPoolAddPersistent(ThreadPool *tp, ThreadPoolJob *job, int *jobId)
+/*!
+ * \brief Adds a job to the ring of its priority in LOCK_FREE_QUEUES mode,
+ * and wakes up an idle worker or starts a new one if needed.
+ *
+ * \internal
+ *
+ * \return 0 on success, EOUTOFMEM if there are too many jobs.
+ */
+static int LockFreeAdd(
+	/*! . */
+	ThreadPool *tp,
+	/*! . */
+	ThreadPoolJob *job,
+	/*! id of job. */
+	int *jobId)
 {
-	int ret = 0;
-	int tempId = -1;
-	ThreadPoolJob *temp = NULL;
-
-	if (!tp || !job) {
-		return EINVAL;
+	ThreadPoolJob temp;
+	int p = JobPriority(job);
+
+	if (AdmitJob(tp) != 0)
+		return EOUTOFMEM;
+	temp = *job;
+	gettimeofday(&temp.requestTime, NULL);
+	if (!RingAdd(&tp->rings[p], &temp, p, NowMillis())) {
+		ithread_atomic_add(&tp->pendingJobs, -1);
+		return EOUTOFMEM;
 	}
-	if (!jobId) {
-		jobId = &tempId;
+	*jobId = temp.jobId;
+	/* Notify a parked thread, and AddWorker if appropriate */
+	if (ithread_atomic_load(&tp->idleWorkers) > 0)
+		ParkWake(tp, 0, 0);
+	if (NeedWorker(tp)) {
+		ithread_mutex_lock(&tp->mutex);
+		AddWorker(tp);
+		ithread_mutex_unlock(&tp->mutex);
 	}
-	*jobId = INVALID_JOB_ID;
 
-	ithread_mutex_lock(&tp->mutex);
+	return 0;
+}
 
-	/* Create A worker if less than max threads running */
-	if (tp->totalThreads < tp->attr.maxThreads) {
-		CreateWorker(tp);
-	} else {
-		/* if there is more than one worker thread
-		 * available then schedule job, otherwise fail */
-		if (tp->totalThreads - tp->persistentThreads - 1 == 0) {
-			ret = EMAXTHREADS;
+/*!
+ * \brief Adds a job with a deadline to the deadline heap, and wakes up an
+ * idle worker or starts a new one if needed.
+ *
+ * \internal
+ *
+ * \return 0 on success, EOUTOFMEM if there are too many jobs or not enough
+ * memory.
+ */
+static int DeadlineAdd(
+	/*! . */
+	ThreadPool *tp,
+	/*! . */
+	ThreadPoolJob *job,
+	/*! id of job. */
+	int *jobId)
+{
+	ThreadPoolJob **q;
+	ThreadPoolJob *temp;
+	long totalJobs;
+	int size;
+	int rc = EOUTOFMEM;
+
+	if ((tp->queues || tp->rings) && AdmitJob(tp) != 0)
+		return rc;
+	ithread_mutex_lock(&tp->mutex);
+	if (!tp->queues && !tp->rings) {
+		totalJobs = tp->highJobQ.size + tp->lowJobQ.size +
+			    tp->medJobQ.size + tp->deadlineJobs;
+		if (totalJobs >= tp->attr.maxJobsTotal) {
+			fprintf(stderr,
+				"libupnp ThreadPoolAdd too many jobs: %ld\n",
+				totalJobs);
 			goto exit_function;
 		}
 	}
-	temp = CreateThreadPoolJob(job, tp->lastJobId, tp);
-	if (!temp) {
-		ret = EOUTOFMEM;
+	if (tp->deadlineJobs == tp->deadlineQSize) {
+		size = tp->deadlineQSize ? 2 * tp->deadlineQSize
+					 : JOBFREELISTSIZE;
+		q = (ThreadPoolJob **)realloc(
+			tp->deadlineQ, (size_t)size * sizeof(ThreadPoolJob *));
+		if (!q)
+			goto exit_function;
+		tp->deadlineQ = q;
+		tp->deadlineQSize = size;
+	}
+	temp = CreateThreadPoolJob(job, INVALID_JOB_ID, tp);
+	if (!temp)
+		goto exit_function;
+	if (SlotMapAdd(&tp->jobIds, temp, &temp->jobId) != 0) {
+		FreeThreadPoolJob(tp, temp);
 		goto exit_function;
 	}
-	tp->persistentJob = temp;
-
-	/* Notify a waiting thread */
+	tp->deadlineQ[tp->deadlineJobs] = temp;
+	DeadlineSift(tp, ithread_atomic_add(&tp->deadlineJobs, 1) - 1);
+	*jobId = temp->jobId;
+	rc = 0;
+	/* AddWorker if appropriate, and notify a waiting thread */
+	AddWorker(tp);
 	ithread_cond_signal(&tp->condition);
-
-	/* wait until long job has been picked up */
-	while (tp->persistentJob)
-		ithread_cond_wait(&tp->start_and_shutdown, &tp->mutex);
-	*jobId = tp->lastJobId++;
+	if (tp->rings)
+		ParkWake(tp, 0, 1);
 
 exit_function:
+	if (rc != 0 && (tp->queues || tp->rings))
+		ithread_atomic_add(&tp->pendingJobs, -1);
 	ithread_mutex_unlock(&tp->mutex);
 
-	return ret;
+	return rc;
 }
 
 int ThreadPoolAdd(ThreadPool *tp, ThreadPoolJob *job, int *jobId)
@@ -832,10 +2953,21 @@ int ThreadPoolAdd(ThreadPool *tp, ThreadPoolJob *job, int *jobId)
 
 	if (!tp || !job)
 		return EINVAL;
+	if (job->deadline.tv_sec != 0 || tp->queues || tp->rings) {
+		if (!jobId)
+			jobId = &tempId;
+		*jobId = INVALID_JOB_ID;
+		if (job->deadline.tv_sec != 0)
+			return DeadlineAdd(tp, job, jobId);
+		if (tp->rings)
+			return LockFreeAdd(tp, job, jobId);
+		return StealingAdd(tp, job, jobId);
+	}
 
 	ithread_mutex_lock(&tp->mutex);
 
-	totalJobs = tp->highJobQ.size + tp->lowJobQ.size + tp->medJobQ.size;
+	totalJobs = tp->highJobQ.size + tp->lowJobQ.size + tp->medJobQ.size +
+		    tp->deadlineJobs;
 	if (totalJobs >= tp->attr.maxJobsTotal) {
 		fprintf(stderr,
 			"libupnp ThreadPoolAdd too many jobs: %ld\n",
@@ -845,30 +2977,38 @@ int ThreadPoolAdd(ThreadPool *tp, ThreadPoolJob *job, int *jobId)
 	if (!jobId)
 		jobId = &tempId;
 	*jobId = INVALID_JOB_ID;
-	temp = CreateThreadPoolJob(job, tp->lastJobId, tp);
+	temp = CreateThreadPoolJob(job, INVALID_JOB_ID, tp);
 	if (!temp)
 		goto exit_function;
+	if (SlotMapAdd(&tp->jobIds, temp, &temp->jobId) != 0) {
+		FreeThreadPoolJob(tp, temp);
+		goto exit_function;
+	}
 	switch (job->priority) {
 	case HIGH_PRIORITY:
-		if (ListAddTail(&tp->highJobQ, temp))
-			rc = 0;
+		temp->node = ListAddTail(&tp->highJobQ, temp);
+		temp->place = HIGH_PRIORITY;
 		break;
 	case MED_PRIORITY:
-		if (ListAddTail(&tp->medJobQ, temp))
-			rc = 0;
+		temp->node = ListAddTail(&tp->medJobQ, temp);
+		temp->place = MED_PRIORITY;
 		break;
 	default:
-		if (ListAddTail(&tp->lowJobQ, temp))
-			rc = 0;
+		temp->node = ListAddTail(&tp->lowJobQ, temp);
+		temp->place = LOW_PRIORITY;
+	}
+	if (!temp->node) {
+		SlotMapRemove(&tp->jobIds, temp->jobId);
+		FreeThreadPoolJob(tp, temp);
+		goto exit_function;
 	}
+	/* the job may run as soon as AddWorker() waits */
+	*jobId = temp->jobId;
+	rc = 0;
 	/* AddWorker if appropriate */
 	AddWorker(tp);
 	/* Notify a waiting thread */
-	if (rc == 0)
-		ithread_cond_signal(&tp->condition);
-	else
-		FreeThreadPoolJob(tp, temp);
-	*jobId = tp->lastJobId++;
+	ithread_cond_signal(&tp->condition);
 
 exit_function:
 	ithread_mutex_unlock(&tp->mutex);
@@ -876,55 +3016,92 @@ exit_function:
 	return rc;
 }
 
+/*!
+ * \brief Removes a job from the qs of the workers in WORK_STEALING mode.
+ *
+ * \internal
+ *
+ * \return 0 on success, INVALID_JOB_ID if job not found.
+ */
+static int StealingRemove(
+	/*! . */
+	ThreadPool *tp,
+	/*! id of job. */
+	int jobId,
+	/*! space for removed job. */
+	ThreadPoolJob *out)
+{
+	ThreadPoolQueue *q;
+	ThreadPoolJob *temp;
+	int i = jobId >> (tp->queues[0].jobIds.slotBits +
+			  SLOT_MAP_GENERATION_BITS);
+	int ret = INVALID_JOB_ID;
+
+	if (jobId < 0 || i >= tp->queueCount)
+		return INVALID_JOB_ID;
+	/* the id gives the qs of the job */
+	q = &tp->queues[i];
+	ithread_mutex_lock(&q->mutex);
+	temp = (ThreadPoolJob *)SlotMapRemove(&q->jobIds, jobId);
+	if (temp) {
+		*out = *temp;
+		ListDelNode(&q->jobQ[temp->place], temp->node, 0);
+		FreeListFree(&q->jobFreeList, temp);
+		ithread_atomic_add(&tp->queuedJobs[out->place], -1);
+		ithread_atomic_add(&tp->pendingJobs, -1);
+		ret = 0;
+	}
+	ithread_mutex_unlock(&q->mutex);
+
+	return ret;
+}
+
 int ThreadPoolRemove(ThreadPool *tp, int jobId, ThreadPoolJob *out)
 {
 	int ret = INVALID_JOB_ID;
 	ThreadPoolJob *temp = NULL;
-	ListNode *tempNode = NULL;
 	ThreadPoolJob dummy;
 
 	if (!tp)
 		return EINVAL;
 	if (!out)
 		out = &dummy;
-	dummy.jobId = jobId;
+	if (!(jobId & INDEXED_JOB_ID)) {
+		if (tp->queues)
+			return StealingRemove(tp, jobId, out);
+		if (tp->rings)
+			return RingsRemove(tp, jobId, out);
+		return INVALID_JOB_ID;
+	}
 
 	ithread_mutex_lock(&tp->mutex);
 
-	tempNode = ListFind(&tp->highJobQ, NULL, &dummy);
-	if (tempNode) {
-		temp = (ThreadPoolJob *)tempNode->item;
-		*out = *temp;
-		ListDelNode(&tp->highJobQ, tempNode, 0);
-		FreeThreadPoolJob(tp, temp);
-		ret = 0;
-		goto exit_function;
-	}
-
-	tempNode = ListFind(&tp->medJobQ, NULL, &dummy);
-	if (tempNode) {
-		temp = (ThreadPoolJob *)tempNode->item;
-		*out = *temp;
-		ListDelNode(&tp->medJobQ, tempNode, 0);
-		FreeThreadPoolJob(tp, temp);
+	if (tp->persistentJob && tp->persistentJob->jobId == jobId) {
+		*out = *tp->persistentJob;
+		SlotMapRemove(&tp->jobIds, jobId);
+		FreeThreadPoolJob(tp, tp->persistentJob);
+		(void)ithread_atomic_exchange_ptr(&tp->persistentJob, NULL);
 		ret = 0;
 		goto exit_function;
 	}
-	tempNode = ListFind(&tp->lowJobQ, NULL, &dummy);
-	if (tempNode) {
-		temp = (ThreadPoolJob *)tempNode->item;
+	/* the jobs of the qs and the deadline heap are looked up by id */
+	temp = (ThreadPoolJob *)SlotMapGet(&tp->jobIds, jobId);
+	if (temp) {
+		if (!temp->node) {
+			/* also frees the id */
+			temp = DeadlineDel(tp, temp->place);
+		} else {
+			if (temp->place == HIGH_PRIORITY)
+				ListDelNode(&tp->highJobQ, temp->node, 0);
+			else if (temp->place == MED_PRIORITY)
+				ListDelNode(&tp->medJobQ, temp->node, 0);
+			else
+				ListDelNode(&tp->lowJobQ, temp->node, 0);
+			SlotMapRemove(&tp->jobIds, jobId);
+		}
 		*out = *temp;
-		ListDelNode(&tp->lowJobQ, tempNode, 0);
 		FreeThreadPoolJob(tp, temp);
 		ret = 0;
-		goto exit_function;
-	}
-	if (tp->persistentJob && tp->persistentJob->jobId == jobId) {
-		*out = *tp->persistentJob;
-		FreeThreadPoolJob(tp, tp->persistentJob);
-		tp->persistentJob = NULL;
-		ret = 0;
-		goto exit_function;
 	}
 
 exit_function:
@@ -965,6 +3142,11 @@ int ThreadPoolSetAttr(ThreadPool *tp, ThreadPoolAttr *attr)
 		ithread_mutex_unlock(&tp->mutex);
 		return INVALID_POLICY;
 	}
+	/* the qs and the CPUs of the workers are not changed */
+	temp.queueMode = tp->attr.queueMode;
+	temp.cpuSet = tp->attr.cpuSet;
+	temp.persistentCpuSet = tp->attr.persistentCpuSet;
+	temp.numaLocal = tp->attr.numaLocal;
 	tp->attr = temp;
 	/* add threads */
 	if (tp->totalThreads < tp->attr.minThreads) {
@@ -975,6 +3157,8 @@ int ThreadPoolSetAttr(ThreadPool *tp, ThreadPoolAttr *attr)
 			}
 		}
 	}
+	if (retCode == 0)
+		retCode = StartAdapt(tp);
 	/* signal changes */
 	ithread_cond_signal(&tp->condition);
 
@@ -1037,20 +3221,41 @@ int ThreadPoolShutdown(ThreadPool *tp)
 		ListDelNode(&tp->lowJobQ, head, 0);
 	}
 	ListDestroy(&tp->lowJobQ, 0);
+	/* clean up jobs with a deadline */
+	while (tp->deadlineJobs > 0) {
+		temp = DeadlineDel(tp, tp->deadlineJobs - 1);
+		if (temp->free_func)
+			temp->free_func(temp->arg);
+		FreeThreadPoolJob(tp, temp);
+	}
+	free(tp->deadlineQ);
+	tp->deadlineQ = NULL;
+	tp->deadlineQSize = 0;
 	/* clean up long term job */
 	if (tp->persistentJob) {
 		temp = tp->persistentJob;
 		if (temp->free_func)
 			temp->free_func(temp->arg);
 		FreeThreadPoolJob(tp, temp);
-		tp->persistentJob = NULL;
+		(void)ithread_atomic_exchange_ptr(&tp->persistentJob, NULL);
 	}
 	/* signal shutdown */
-	tp->shutdown = 1;
+	ithread_atomic_add(&tp->shutdown, 1);
 	ithread_cond_broadcast(&tp->condition);
+	ithread_cond_broadcast(&tp->start_and_shutdown);
+	if (tp->rings)
+		ParkWake(tp, 1, 1);
 	/* wait for all threads to finish */
-	while (tp->totalThreads > 0)
+	while (tp->totalThreads > 0 || tp->adaptRunning)
 		ithread_cond_wait(&tp->start_and_shutdown, &tp->mutex);
+	/* clean up the jobs of the workers, which no longer take them */
+	QueuesDestroy(tp);
+	RingsDestroy(tp);
+	free(tp->workerCpus);
+	tp->workerCpus = NULL;
+	tp->workerCpuSets = 0;
+	ithread_key_delete(tp->jobKey);
+	SlotMapDestroy(&tp->jobIds);
 	/* destroy condition */
 	while (ithread_cond_destroy(&tp->condition) != 0) {
 	}
@@ -1079,6 +3284,12 @@ int TPAttrInit(ThreadPoolAttr *attr)
 	attr->schedPolicy = DEFAULT_POLICY;
 	attr->starvationTime = DEFAULT_STARVATION_TIME;
 	attr->maxJobsTotal = DEFAULT_MAX_JOBS_TOTAL;
+	attr->queueMode = DEFAULT_QUEUE_MODE;
+	memset(&attr->cpuSet, 0, sizeof(attr->cpuSet));
+	memset(&attr->persistentCpuSet, 0, sizeof(attr->persistentCpuSet));
+	attr->numaLocal = 0;
+	attr->adaptiveInterval = DEFAULT_ADAPTIVE_INTERVAL;
+	attr->adaptiveWait = DEFAULT_ADAPTIVE_WAIT;
 
 	return 0;
 }
@@ -1091,6 +3302,10 @@ int TPJobInit(ThreadPoolJob *job, start_routine func, void *arg)
 	job->arg = arg;
 	job->priority = DEFAULT_PRIORITY;
 	job->free_func = DEFAULT_FREE_ROUTINE;
+	job->deadline.tv_sec = 0;
+	job->deadline.tv_usec = 0;
+	job->expired_func = NULL;
+	job->type = 0;
 
 	return 0;
 }
@@ -1119,6 +3334,27 @@ int TPJobSetFreeFunction(ThreadPoolJob *job, free_routine func)
 	return 0;
 }
 
+int TPJobSetDeadline(ThreadPoolJob *job,
+	const struct timeval *deadline,
+	free_routine expired_func)
+{
+	if (!job || !deadline || deadline->tv_sec == 0)
+		return EINVAL;
+	job->deadline = *deadline;
+	job->expired_func = expired_func;
+
+	return 0;
+}
+
+int TPJobSetType(ThreadPoolJob *job, int type)
+{
+	if (!job || type < 0 || type >= TP_JOB_TYPES)
+		return EINVAL;
+	job->type = type;
+
+	return 0;
+}
+
 int TPAttrSetMaxThreads(ThreadPoolAttr *attr, int maxThreads)
 {
 	if (!attr)
@@ -1191,6 +3427,196 @@ int TPAttrSetMaxJobsTotal(ThreadPoolAttr *attr, int maxJobsTotal)
 	return 0;
 }
 
+int TPAttrSetQueueMode(ThreadPoolAttr *attr, QueueMode queueMode)
+{
+	if (!attr)
+		return EINVAL;
+	attr->queueMode = queueMode;
+
+	return 0;
+}
+
+int TPCpuSetParse(ThreadPoolCpuSet *set, const char *list)
+{
+	const char *p = list;
+	char *end;
+	long first;
+	long last;
+
+	if (!set || !list)
+		return EINVAL;
+	memset(set, 0, sizeof(*set));
+	while (*p) {
+		first = strtol(p, &end, 10);
+		if (end == p || first < 0 || first >= MAX_POOL_CPUS)
+			return EINVAL;
+		last = first;
+		p = end;
+		if (*p == '-') {
+			last = strtol(p + 1, &end, 10);
+			if (end == p + 1 || last < first ||
+				last >= MAX_POOL_CPUS)
+				return EINVAL;
+			p = end;
+		}
+		for (; first <= last; first++)
+			set->bits[first / CPU_SET_BITS] |=
+				1UL << (first % CPU_SET_BITS);
+		if (*p == ',')
+			p++;
+		else if (*p)
+			return EINVAL;
+	}
+
+	return 0;
+}
+
+int TPAttrSetCpuSet(ThreadPoolAttr *attr, const ThreadPoolCpuSet *cpuSet)
+{
+	if (!attr)
+		return EINVAL;
+	if (cpuSet)
+		attr->cpuSet = *cpuSet;
+	else
+		memset(&attr->cpuSet, 0, sizeof(attr->cpuSet));
+
+	return 0;
+}
+
+int TPAttrSetPersistentCpuSet(
+	ThreadPoolAttr *attr, const ThreadPoolCpuSet *cpuSet)
+{
+	if (!attr)
+		return EINVAL;
+	if (cpuSet)
+		attr->persistentCpuSet = *cpuSet;
+	else
+		memset(&attr->persistentCpuSet,
+			0,
+			sizeof(attr->persistentCpuSet));
+
+	return 0;
+}
+
+int TPAttrSetNumaLocal(ThreadPoolAttr *attr, int numaLocal)
+{
+	if (!attr)
+		return EINVAL;
+	attr->numaLocal = numaLocal;
+
+	return 0;
+}
+
+int TPAttrSetAdaptiveInterval(ThreadPoolAttr *attr, int adaptiveInterval)
+{
+	if (!attr)
+		return EINVAL;
+	attr->adaptiveInterval = adaptiveInterval;
+
+	return 0;
+}
+
+int TPAttrSetAdaptiveWait(ThreadPoolAttr *attr, int adaptiveWait)
+{
+	if (!attr)
+		return EINVAL;
+	attr->adaptiveWait = adaptiveWait;
+
+	return 0;
+}
+
+int ThreadPoolSetJobType(ThreadPool *tp, int type)
+{
+	ThreadPoolJob *job;
+
+	if (!tp || type < 0 || type >= TP_JOB_TYPES)
+		return EINVAL;
+	job = (ThreadPoolJob *)ithread_getspecific(tp->jobKey);
+	if (!job)
+		return EINVAL;
+	job->type = type;
+
+	return 0;
+}
+
+/*!
+ * \brief Copies a latency histogram while it is updated.
+ *
+ * \internal
+ */
+static void HistogramCopy(
+	/*! . */
+	ThreadPoolHistogram *out,
+	/*! . */
+	ThreadPoolHistogram *h)
+{
+	int i;
+
+	for (i = 0; i < TP_HIST_BUCKETS; i++)
+		out->counts[i] = ithread_atomic_load(&h->counts[i]);
+	out->max = ithread_atomic_load(&h->max);
+}
+
+int ThreadPoolGetLatency(ThreadPool *tp,
+	int priority,
+	int type,
+	ThreadPoolHistogram *wait,
+	ThreadPoolHistogram *run)
+{
+	if (!tp || !wait || !run)
+		return EINVAL;
+	if (priority >= LOW_PRIORITY && priority <= HIGH_PRIORITY) {
+		HistogramCopy(wait, &tp->waitHist[priority]);
+		HistogramCopy(run, &tp->runHist[priority]);
+	} else if (priority == -1 && type >= 0 && type < TP_JOB_TYPES) {
+		HistogramCopy(wait, &tp->typeWaitHist[type]);
+		HistogramCopy(run, &tp->typeRunHist[type]);
+	} else {
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+unsigned long TPHistogramCount(const ThreadPoolHistogram *h)
+{
+	unsigned long count = 0;
+	int i;
+
+	for (i = 0; i < TP_HIST_BUCKETS; i++)
+		count += h->counts[i];
+
+	return count;
+}
+
+long TPHistogramValueAt(const ThreadPoolHistogram *h, double fraction)
+{
+	unsigned long count = TPHistogramCount(h);
+	unsigned long rank;
+	unsigned long seen = 0;
+	long top;
+	int i;
+
+	if (count == 0)
+		return 0;
+	if (fraction < 0.0)
+		fraction = 0.0;
+	if (fraction > 1.0)
+		fraction = 1.0;
+	/* the rank of the value, from 1 to count */
+	rank = (unsigned long)(fraction * (double)count + 0.999999);
+	if (rank < 1)
+		rank = 1;
+	for (i = 0; i < TP_HIST_BUCKETS - 1; i++) {
+		seen += h->counts[i];
+		if (seen >= rank)
+			break;
+	}
+	top = HistogramBucketTop(i);
+
+	return top < h->max ? top : h->max;
+}
+
 #ifdef STATS
 void ThreadPoolPrintStats(ThreadPoolStats *stats)
 {
@@ -1204,6 +3630,7 @@ void ThreadPoolPrintStats(ThreadPoolStats *stats)
 	fprintf(stderr, "High Jobs pending: %d\n", stats->currentJobsHQ);
 	fprintf(stderr, "Med Jobs Pending: %d\n", stats->currentJobsMQ);
 	fprintf(stderr, "Low Jobs Pending: %d\n", stats->currentJobsLQ);
+	fprintf(stderr, "Deadline Jobs Pending: %d\n", stats->currentJobsDQ);
 	fprintf(stderr,
 		"Average Wait in High Priority Q in milliseconds: %f\n",
 		stats->avgWaitHQ);
@@ -1213,6 +3640,23 @@ void ThreadPoolPrintStats(ThreadPoolStats *stats)
 	fprintf(stderr,
 		"Averate Wait in Low Priority Q in milliseconds: %f\n",
 		stats->avgWaitLQ);
+	fprintf(stderr,
+		"Average Wait in Deadline Q in milliseconds: %f\n",
+		stats->avgWaitDQ);
+	fprintf(stderr,
+		"99th Percentile Wait in High/Med/Low Priority Q in "
+		"microseconds: %ld/%ld/%ld\n",
+		stats->p99WaitHQ,
+		stats->p99WaitMQ,
+		stats->p99WaitLQ);
+	fprintf(stderr,
+		"99th Percentile Run of High/Med/Low Priority Jobs in "
+		"microseconds: %ld/%ld/%ld\n",
+		stats->p99RunHQ,
+		stats->p99RunMQ,
+		stats->p99RunLQ);
+	fprintf(stderr, "Deadline Misses: %d\n", stats->deadlineMisses);
+	fprintf(stderr, "Deadline Drops: %d\n", stats->deadlineDrops);
 	fprintf(stderr, "Max Threads Active: %d\n", stats->maxThreads);
 	fprintf(stderr, "Current Worker Threads: %d\n", stats->workerThreads);
 	fprintf(stderr,
@@ -1220,6 +3664,7 @@ void ThreadPoolPrintStats(ThreadPoolStats *stats)
 		stats->persistentThreads);
 	fprintf(stderr, "Current Idle Threads: %d\n", stats->idleThreads);
 	fprintf(stderr, "Total Threads : %d\n", stats->totalThreads);
+	fprintf(stderr, "Adaptive Threads : %d\n", stats->adaptiveThreads);
 	fprintf(stderr,
 		"Total Time spent Working in seconds: %f\n",
 		stats->totalWorkTime);
@@ -1228,8 +3673,31 @@ void ThreadPoolPrintStats(ThreadPoolStats *stats)
 		stats->totalIdleTime);
 }
 
+/*!
+ * \brief Returns the 99th percentile of a latency histogram while it is
+ * updated.
+ *
+ * \internal
+ *
+ * \return The percentile, or 0 if there is no room for the copy.
+ */
+static long HistogramP99(
+	/*! . */
+	ThreadPoolHistogram *h,
+	/*! Room for a copy of the histogram, or NULL. */
+	ThreadPoolHistogram *copy)
+{
+	if (!copy)
+		return 0;
+	HistogramCopy(copy, h);
+
+	return TPHistogramValueAt(copy, 0.99);
+}
+
 int ThreadPoolGetStats(ThreadPool *tp, ThreadPoolStats *stats)
 {
+	ThreadPoolHistogram *copy;
+
 	if (tp == NULL || stats == NULL)
 		return EINVAL;
 	/* if not shutdown then acquire mutex */
@@ -1237,6 +3705,22 @@ int ThreadPoolGetStats(ThreadPool *tp, ThreadPoolStats *stats)
 		ithread_mutex_lock(&tp->mutex);
 
 	*stats = tp->stats;
+	if (tp->queues) {
+		ThreadPoolQueue *q;
+		int i;
+
+		for (i = 0; i < tp->queueCount; i++) {
+			q = &tp->queues[i];
+			ithread_mutex_lock(&q->mutex);
+			stats->totalJobsHQ += q->totalJobs[HIGH_PRIORITY];
+			stats->totalTimeHQ += q->totalTime[HIGH_PRIORITY];
+			stats->totalJobsMQ += q->totalJobs[MED_PRIORITY];
+			stats->totalTimeMQ += q->totalTime[MED_PRIORITY];
+			stats->totalJobsLQ += q->totalJobs[LOW_PRIORITY];
+			stats->totalTimeLQ += q->totalTime[LOW_PRIORITY];
+			ithread_mutex_unlock(&q->mutex);
+		}
+	}
 	if (stats->totalJobsHQ > 0)
 		stats->avgWaitHQ =
 			stats->totalTimeHQ / (double)stats->totalJobsHQ;
@@ -1252,11 +3736,47 @@ int ThreadPoolGetStats(ThreadPool *tp, ThreadPoolStats *stats)
 			stats->totalTimeLQ / (double)stats->totalJobsLQ;
 	else
 		stats->avgWaitLQ = 0.0;
+	if (stats->totalJobsDQ > 0)
+		stats->avgWaitDQ =
+			stats->totalTimeDQ / (double)stats->totalJobsDQ;
+	else
+		stats->avgWaitDQ = 0.0;
+	stats->currentJobsDQ = tp->deadlineJobs;
+	/* too large for the stack of the small threads */
+	copy = (ThreadPoolHistogram *)malloc(sizeof(*copy));
+	stats->p99WaitHQ = HistogramP99(&tp->waitHist[HIGH_PRIORITY], copy);
+	stats->p99WaitMQ = HistogramP99(&tp->waitHist[MED_PRIORITY], copy);
+	stats->p99WaitLQ = HistogramP99(&tp->waitHist[LOW_PRIORITY], copy);
+	stats->p99RunHQ = HistogramP99(&tp->runHist[HIGH_PRIORITY], copy);
+	stats->p99RunMQ = HistogramP99(&tp->runHist[MED_PRIORITY], copy);
+	stats->p99RunLQ = HistogramP99(&tp->runHist[LOW_PRIORITY], copy);
+	free(copy);
 	stats->totalThreads = tp->totalThreads;
 	stats->persistentThreads = tp->persistentThreads;
+	stats->adaptiveThreads =
+		tp->attr.adaptiveInterval > 0 ? tp->adaptThreads : 0;
 	stats->currentJobsHQ = (int)ListSize(&tp->highJobQ);
 	stats->currentJobsLQ = (int)ListSize(&tp->lowJobQ);
 	stats->currentJobsMQ = (int)ListSize(&tp->medJobQ);
+	if (tp->queues) {
+		stats->currentJobsHQ =
+			ithread_atomic_load(&tp->queuedJobs[HIGH_PRIORITY]);
+		stats->currentJobsLQ =
+			ithread_atomic_load(&tp->queuedJobs[LOW_PRIORITY]);
+		stats->currentJobsMQ =
+			ithread_atomic_load(&tp->queuedJobs[MED_PRIORITY]);
+	}
+	if (tp->rings) {
+		stats->currentJobsHQ = RingJobs(&tp->rings[HIGH_PRIORITY]);
+		stats->currentJobsLQ = RingJobs(&tp->rings[LOW_PRIORITY]);
+		stats->currentJobsMQ = RingJobs(&tp->rings[MED_PRIORITY]);
+	}
+	if (tp->queues || tp->rings) {
+		stats->idleThreads = ithread_atomic_load(&tp->idleWorkers);
+		stats->workerThreads =
+			ithread_atomic_load(&tp->busyThreads) -
+			tp->persistentThreads;
+	}
 
 	/* if not shutdown then release mutex */
 	if (!tp->shutdown)
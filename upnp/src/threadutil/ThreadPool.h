@@ -39,6 +39,8 @@
 
 #include "FreeList.h"
 #include "LinkedList.h"
+#include "SlotMap.h"
+#include "ThreadKey.h"
 #include "UpnpGlobal.h" /* for UPNP_INLINE, UPNP_EXPORT_SPEC */
 #include "UpnpInet.h"
 #include "ithread.h"
@@ -94,6 +96,49 @@ typedef enum priority
 	HIGH_PRIORITY
 } ThreadPriority;
 
+/*! Number of job priorities. */
+#define NUM_PRIORITIES 3
+
+/*! How the jobs of a thread pool are queued. */
+typedef enum queue_mode
+{
+	/*! One set of priority queues, protected by the pool mutex. */
+	SHARED_QUEUES,
+	/*! One set of priority queues per worker, each with its own mutex.
+	 * Jobs are spread over the queues as they are added; a worker takes
+	 * the jobs of its own queue and steals those of the others when it
+	 * has run out, always the highest priority job first. The pool mutex
+	 * is only taken to park and wake up idle workers. */
+	WORK_STEALING,
+	/*! One bounded lock-free ring per priority, holding copies of the
+	 * jobs. Adding a job takes no lock and allocates nothing, and idle
+	 * workers are parked on a futex where available. A priority that has
+	 * not been served for the starvation time is served first. */
+	LOCK_FREE_QUEUES
+} QueueMode;
+
+/*! Maximum number of queues of a pool in WORK_STEALING mode. */
+#define MAX_STEALING_QUEUES 64
+
+/*! Maximum number of jobs of a ring in LOCK_FREE_QUEUES mode. */
+#define MAX_RING_SIZE 65536
+
+/*! Number of CPUs a CPU set can hold. */
+#define MAX_POOL_CPUS 1024
+
+/*! Maximum number of NUMA nodes the workers of a pool are spread over. */
+#define MAX_NUMA_NODES 64
+
+/*!
+ * \brief Set of CPUs, see TPCpuSetParse(). An empty set places no
+ * constraint.
+ */
+typedef struct THREADPOOLCPUSET
+{
+	/*! CPU n is bit n % bits of a long of word n / bits of a long. */
+	unsigned long bits[MAX_POOL_CPUS / (8 * sizeof(unsigned long))];
+} ThreadPoolCpuSet;
+
 /*! default priority used by TPJobInit */
 #define DEFAULT_PRIORITY MED_PRIORITY
 
@@ -121,6 +166,17 @@ typedef enum priority
 /*! default max jobs used TPAttrInit */
 #define DEFAULT_MAX_JOBS_TOTAL 100
 
+/*! default queue mode used by TPAttrInit */
+#define DEFAULT_QUEUE_MODE SHARED_QUEUES
+
+/*! default milliseconds between the steps of the adaptive sizing, 0 for
+ * none. */
+#define DEFAULT_ADAPTIVE_INTERVAL 0
+
+/*! default milliseconds a job may wait in its queue before the adaptive
+ * sizing grows the pool. */
+#define DEFAULT_ADAPTIVE_WAIT 20
+
 /*!
  * \brief Statistics.
  *
@@ -139,6 +195,25 @@ typedef int PolicyType;
 /*! Function for freeing a thread argument. */
 typedef void (*free_routine)(void *arg);
 
+/*! Number of job types, see TPJobSetType(). */
+#define TP_JOB_TYPES 8
+
+/*! Buckets of a latency histogram per power of two of microseconds, the
+ * values being recorded within 1 / TP_HIST_SUB_BUCKETS. */
+#define TP_HIST_SUB_BUCKETS 16
+
+/*! Buckets of a latency histogram, the values up to 2^31 microseconds. */
+#define TP_HIST_BUCKETS (28 * TP_HIST_SUB_BUCKETS)
+
+/*! Latency histogram, updated with atomic operations. */
+typedef struct THREADPOOLHISTOGRAM
+{
+	/*! Number of values in each bucket. */
+	unsigned long counts[TP_HIST_BUCKETS];
+	/*! Largest value, in microseconds. */
+	int max;
+} ThreadPoolHistogram;
+
 /*! Attributes for thread pool. Used to set and change parameters of thread
  * pool. */
 typedef struct THREADPOOLATTR
@@ -161,6 +236,22 @@ typedef struct THREADPOOLATTR
 	int starvationTime;
 	/*! scheduling policy to use. */
 	PolicyType schedPolicy;
+	/*! how the jobs are queued, fixed when the pool is initialized. */
+	QueueMode queueMode;
+	/*! CPUs the workers run on, fixed when the pool is initialized. */
+	ThreadPoolCpuSet cpuSet;
+	/*! CPUs the persistent jobs run on, fixed when the pool is
+	 * initialized. */
+	ThreadPoolCpuSet persistentCpuSet;
+	/*! whether each worker runs on the CPUs of one NUMA node, so that the
+	 * memory it touches first is local to them. */
+	int numaLocal;
+	/*! milliseconds between the steps of the adaptive sizing, 0 to size
+	 * the pool by jobsPerThread and maxIdleTime. */
+	int adaptiveInterval;
+	/*! milliseconds a job may wait in its queue before the adaptive sizing
+	 * grows the pool. */
+	int adaptiveWait;
 } ThreadPoolAttr;
 
 /*! Internal ThreadPool Job. */
@@ -172,6 +263,17 @@ typedef struct THREADPOOLJOB
 	struct timeval requestTime;
 	ThreadPriority priority;
 	int jobId;
+	/*! Time the job must run by, tv_sec 0 if none. */
+	struct timeval deadline;
+	/*! Called instead of func once the deadline has passed, or NULL. */
+	free_routine expired_func;
+	/*! Type of the job the latency is recorded for, 0 if none. */
+	int type;
+	/*! Node of the job in the q it waits in, NULL in the deadline heap. */
+	ListNode *node;
+	/*! Priority of the q the job waits in, or its position in the
+	 * deadline heap. */
+	int place;
 } ThreadPoolJob;
 
 /*! Structure to hold statistics. */
@@ -196,8 +298,75 @@ typedef struct TPOOLSTATS
 	int currentJobsHQ;
 	int currentJobsLQ;
 	int currentJobsMQ;
+	/*! Jobs with a deadline. */
+	double totalTimeDQ;
+	int totalJobsDQ;
+	double avgWaitDQ;
+	int currentJobsDQ;
+	/*! Jobs with a deadline run after it. */
+	int deadlineMisses;
+	/*! Jobs with a deadline given to their expired_func. */
+	int deadlineDrops;
+	/*! 99th percentiles of the wait and run times of the jobs of each
+	 * priority, in microseconds, 0 if out of memory. */
+	long p99WaitHQ;
+	long p99WaitMQ;
+	long p99WaitLQ;
+	long p99RunHQ;
+	long p99RunMQ;
+	long p99RunLQ;
+	/*! threads the adaptive sizing keeps, 0 if it is off. */
+	int adaptiveThreads;
 } ThreadPoolStats;
 
+/*! Job queues of a worker in WORK_STEALING mode. */
+typedef struct THREADPOOLQUEUE
+{
+	/*! Mutex to protect the job qs, the free list and the ids. */
+	ithread_mutex_t mutex;
+	/*! job qs, indexed by priority. */
+	LinkedList jobQ[NUM_PRIORITIES];
+	/*! free list of jobs. */
+	FreeList jobFreeList;
+	/*! jobs of the qs, by id, see ThreadPoolRemove(). */
+	SlotMap jobIds;
+	/*! total wait time of the jobs taken, indexed by priority. */
+	double totalTime[NUM_PRIORITIES];
+	/*! number of jobs taken, indexed by priority. */
+	int totalJobs[NUM_PRIORITIES];
+} ThreadPoolQueue;
+
+/*! Cell of a job ring in LOCK_FREE_QUEUES mode. */
+typedef struct THREADPOOLCELL
+{
+	/*! Position the cell is next written at, plus one once written. */
+	int seq;
+	/*! Whether the job is there, being taken or was removed. */
+	int state;
+	/*! id of the job, read by ThreadPoolRemove(). */
+	int jobId;
+	/*! Copy of the job. */
+	ThreadPoolJob job;
+} ThreadPoolCell;
+
+/*! Job ring of a priority in LOCK_FREE_QUEUES mode. */
+typedef struct THREADPOOLRING
+{
+	/*! Cells, a power of two of them. */
+	ThreadPoolCell *cells;
+	/*! Number of cells minus one. */
+	int mask;
+	/*! Position of the next job added. */
+	int enqueuePos;
+	/*! Keeps the positions on cache lines of their own. */
+	char pad[64];
+	/*! Position of the next job taken. */
+	int dequeuePos;
+	/*! Time the ring was last served or became non-empty, in
+	 * milliseconds. */
+	int lastTaken;
+} ThreadPoolRing;
+
 /*!
  * \brief A thread pool similar to the thread pool in the UPnP SDK.
  *
@@ -221,8 +390,6 @@ typedef struct THREADPOOL
 	ithread_cond_t condition;
 	/*! Condition variable for start and stop. */
 	ithread_cond_t start_and_shutdown;
-	/*! ids for jobs */
-	int lastJobId;
 	/*! whether or not we are shutting down */
 	int shutdown;
 	/*! total number of threads */
@@ -243,6 +410,63 @@ typedef struct THREADPOOL
 	LinkedList highJobQ;
 	/*! persistent job */
 	ThreadPoolJob *persistentJob;
+	/*! job qs of the workers in WORK_STEALING mode. */
+	ThreadPoolQueue *queues;
+	/*! number of job qs in WORK_STEALING mode. */
+	int queueCount;
+	/*! next q to add a job to, or to give a new worker. */
+	int nextQueue;
+	/*! jobs in the qs in WORK_STEALING mode, indexed by priority. */
+	int queuedJobs[NUM_PRIORITIES];
+	/*! jobs added and not taken yet in WORK_STEALING and LOCK_FREE_QUEUES
+	 * modes. */
+	int pendingJobs;
+	/*! number of workers waiting for a job in WORK_STEALING and
+	 * LOCK_FREE_QUEUES modes. */
+	int idleWorkers;
+	/*! job rings in LOCK_FREE_QUEUES mode, indexed by priority. */
+	ThreadPoolRing *rings;
+	/*! changed to wake up the workers parked in LOCK_FREE_QUEUES mode. */
+	int parkSeq;
+	/*! jobs with a deadline, a heap ordered by deadline. */
+	ThreadPoolJob **deadlineQ;
+	/*! number of jobs in deadlineQ, read without the mutex. */
+	int deadlineJobs;
+	/*! room in deadlineQ. */
+	int deadlineQSize;
+	/*! CPU sets the workers are bound to in turn, NULL if not bound. */
+	ThreadPoolCpuSet *workerCpus;
+	/*! number of sets in workerCpus. */
+	int workerCpuSets;
+	/*! next set of workerCpus. */
+	int nextCpuSet;
+	/*! job run by the calling worker, see ThreadPoolSetJobType(). */
+	ithread_key_t jobKey;
+	/*! wait times of the jobs, indexed by priority. */
+	ThreadPoolHistogram waitHist[NUM_PRIORITIES];
+	/*! run times of the jobs, indexed by priority. */
+	ThreadPoolHistogram runHist[NUM_PRIORITIES];
+	/*! wait times of the jobs, indexed by type. */
+	ThreadPoolHistogram typeWaitHist[TP_JOB_TYPES];
+	/*! run times of the jobs, indexed by type. */
+	ThreadPoolHistogram typeRunHist[TP_JOB_TYPES];
+	/*! threads the adaptive sizing keeps. */
+	int adaptThreads;
+	/*! whether the thread of the adaptive sizing runs. */
+	int adaptRunning;
+	/*! jobs run since the last step of the adaptive sizing. */
+	int adaptDone;
+	/*! jobs of adaptDone that waited longer than adaptiveWait. */
+	int adaptLate;
+	/*! adaptDone of the last step. */
+	int adaptLastDone;
+	/*! change of adaptThreads at the last step. */
+	int adaptStep;
+	/*! time of the last change of adaptThreads, see NowMillis(). */
+	int adaptChange;
+	/*! jobs waiting under the pool mutex and the persistent job, by id,
+	 * see ThreadPoolRemove(). */
+	SlotMap jobIds;
 	/*! thread pool attributes */
 	ThreadPoolAttr attr;
 	/*! statistics */
@@ -400,6 +624,31 @@ int TPJobSetFreeFunction(
 	/*! value to set. */
 	free_routine func);
 
+/*!
+ * \brief Gives a job a deadline, making it a job of the deadline class.
+ *
+ * The jobs with a deadline are run before the jobs of any priority, the
+ * earliest deadline first. A job whose deadline has passed when a worker
+ * picks it is given to expired_func instead of being run, or run late if
+ * expired_func is NULL; both are counted in the statistics. Like the function
+ * of the job, expired_func owns the argument: free_func is only called for
+ * the jobs never given to either, as when the pool shuts down.
+ *
+ * The jobs with a deadline are kept under the pool mutex in every queue mode,
+ * so in LOCK_FREE_QUEUES mode adding them waits on the mutex, unlike adding
+ * other jobs.
+ *
+ * \return 0 on success, EINVAL if invalid parameters.
+ */
+int TPJobSetDeadline(
+	/*! must be valid job. */
+	ThreadPoolJob *job,
+	/*! absolute time, as given by gettimeofday(). */
+	const struct timeval *deadline,
+	/*! called with the argument of the job if it is dropped, and releases
+	 * it, or NULL. */
+	free_routine expired_func);
+
 /*!
  * \brief Initializes thread pool attributes. Sets values to defaults defined
  * in ThreadPool.h.
@@ -498,6 +747,155 @@ int TPAttrSetMaxJobsTotal(
 	/*! maximum number of jobs. */
 	int maxJobsTotal);
 
+/*!
+ * \brief Sets how the jobs of the thread pool are queued.
+ *
+ * \return Always returns 0.
+ */
+int TPAttrSetQueueMode(
+	/*! must be valid thread pool attributes. */
+	ThreadPoolAttr *attr,
+	/*! queue mode. */
+	QueueMode queueMode);
+
+/*!
+ * \brief Parses a list of CPUs such as "0-3,8" into a CPU set.
+ *
+ * \return 0 on success, EINVAL if the list is not valid.
+ */
+int TPCpuSetParse(
+	/*! set to fill. */
+	ThreadPoolCpuSet *set,
+	/*! CPU numbers and ranges separated by commas, empty for no CPU. */
+	const char *list);
+
+/*!
+ * \brief Sets the CPUs the workers of the thread pool run on.
+ *
+ * \return Always returns 0.
+ */
+int TPAttrSetCpuSet(
+	/*! must be valid thread pool attributes. */
+	ThreadPoolAttr *attr,
+	/*! CPUs, NULL or empty not to bind the workers. */
+	const ThreadPoolCpuSet *cpuSet);
+
+/*!
+ * \brief Sets the CPUs a worker runs on while it runs a persistent job.
+ *
+ * \return Always returns 0.
+ */
+int TPAttrSetPersistentCpuSet(
+	/*! must be valid thread pool attributes. */
+	ThreadPoolAttr *attr,
+	/*! CPUs, NULL or empty for those of the workers. */
+	const ThreadPoolCpuSet *cpuSet);
+
+/*!
+ * \brief Sets whether each worker runs on the CPUs of one NUMA node only,
+ * the workers being spread over the nodes of the CPU set.
+ *
+ * \return Always returns 0.
+ */
+int TPAttrSetNumaLocal(
+	/*! must be valid thread pool attributes. */
+	ThreadPoolAttr *attr,
+	/*! 1 to keep the workers on a node, 0 otherwise. */
+	int numaLocal);
+
+/*!
+ * \brief Sets the interval of the adaptive sizing of the pool.
+ *
+ * Every interval, a thread of the pool grows it while the jobs wait longer
+ * than adaptiveWait in their queue or the workers are all blocked, unless
+ * the threads added last did not raise the number of jobs run, and shrinks
+ * it by one thread per maxIdleTime while workers stay idle. The workers
+ * above the size it keeps exit after maxIdleTime; jobsPerThread is not
+ * used.
+ *
+ * \return Always returns 0.
+ */
+int TPAttrSetAdaptiveInterval(
+	/*! must be valid thread pool attributes. */
+	ThreadPoolAttr *attr,
+	/*! milliseconds, 0 to size the pool by jobsPerThread. */
+	int adaptiveInterval);
+
+/*!
+ * \brief Sets how long a job may wait in its queue before the adaptive
+ * sizing grows the pool.
+ *
+ * \return Always returns 0.
+ */
+int TPAttrSetAdaptiveWait(
+	/*! must be valid thread pool attributes. */
+	ThreadPoolAttr *attr,
+	/*! milliseconds. */
+	int adaptiveWait);
+
+/*!
+ * \brief Sets the type of a job, its wait and run times being recorded for
+ * the type as well as for its priority.
+ *
+ * \return 0 on success, EINVAL if the type is not below TP_JOB_TYPES.
+ */
+int TPJobSetType(
+	/*! must be valid thread pool job. */
+	ThreadPoolJob *job,
+	/*! type, 0 for none. */
+	int type);
+
+/*!
+ * \brief Sets the type of the job the calling worker runs, for the jobs
+ * whose type is only known once they run.
+ *
+ * \return 0 on success, EINVAL if the type is not valid or the caller is
+ * not running a job of the pool.
+ */
+int ThreadPoolSetJobType(
+	/*! valid thread pool pointer. */
+	ThreadPool *tp,
+	/*! type, 0 for none. */
+	int type);
+
+/*!
+ * \brief Copies the histograms of the wait and run times of the jobs of a
+ * priority, or of a type, while the pool runs.
+ *
+ * \return 0 on success, EINVAL if the priority or the type is not valid.
+ */
+int ThreadPoolGetLatency(
+	/*! valid thread pool pointer. */
+	ThreadPool *tp,
+	/*! priority, or -1 to get those of a type. */
+	int priority,
+	/*! type, ignored unless priority is -1. */
+	int type,
+	/*! out parameter, wait times. */
+	ThreadPoolHistogram *wait,
+	/*! out parameter, run times. */
+	ThreadPoolHistogram *run);
+
+/*!
+ * \brief Returns the number of values of a latency histogram.
+ */
+unsigned long TPHistogramCount(
+	/*! histogram. */
+	const ThreadPoolHistogram *h);
+
+/*!
+ * \brief Returns the value below which a fraction of the values of a
+ * latency histogram are, such as 0.999 for the 99.9th percentile.
+ *
+ * \return The value in microseconds, rounded up to the top of its bucket
+ * but at most the largest value, 0 if the histogram is empty.
+ */
+long TPHistogramValueAt(
+	/*! histogram. */
+	const ThreadPoolHistogram *h,
+	/*! fraction of the values, from 0 to 1. */
+	double fraction);
+
 /*!
  * \brief Returns various statistics about the thread pool.
  *
@@ -37,6 +37,102 @@
 #include "TimerThread.h"
 
 #include <assert.h>
+#include <stdlib.h>
+
+/*! Slots of a new table of event ids. */
+#define TIMER_MIN_SLOTS 64
+
+/*!
+ * \brief Returns the slot of the node of an event id.
+ */
+static ListNode **EventSlot(
+	/*! [in] Valid timer thread pointer. */
+	TimerThread *timer,
+	/*! [in] Id of the event. */
+	int id)
+{
+	return &timer->eventSlots[(unsigned int)id &
+				  (unsigned int)(timer->eventSlotCount - 1)];
+}
+
+/*!
+ * \brief Returns the node of the event of an id.
+ *
+ * \return The node, NULL if no event has the id.
+ */
+static ListNode *FindEvent(
+	/*! [in] Valid timer thread pointer. */
+	TimerThread *timer,
+	/*! [in] Id of the event. */
+	int id)
+{
+	ListNode *node;
+
+	if (timer->eventSlots == NULL)
+		return NULL;
+	node = *EventSlot(timer, id);
+	if (node == NULL || ((TimerEvent *)node->item)->id != id)
+		return NULL;
+
+	return node;
+}
+
+/*!
+ * \brief Doubles the table of event ids before it is more than half full,
+ * moving the nodes to the slots of their ids.
+ *
+ * \return 0 on success, EOUTOFMEM on failure.
+ */
+static int GrowEventSlots(
+	/*! [in] Valid timer thread pointer. */
+	TimerThread *timer)
+{
+	ListNode **slots;
+	ListNode *node;
+	unsigned int mask;
+	int count;
+
+	if (2 * (timer->eventQ.size + 1) <= (long)timer->eventSlotCount)
+		return 0;
+	count = timer->eventSlotCount ? 2 * timer->eventSlotCount
+				      : TIMER_MIN_SLOTS;
+	slots = (ListNode **)calloc((size_t)count, sizeof(*slots));
+	if (slots == NULL)
+		return EOUTOFMEM;
+	/* ids in different slots stay in different slots */
+	mask = (unsigned int)(count - 1);
+	for (node = ListHead(&timer->eventQ); node != NULL;
+		node = ListNext(&timer->eventQ, node))
+		slots[(unsigned int)((TimerEvent *)node->item)->id & mask] =
+			node;
+	free(timer->eventSlots);
+	timer->eventSlots = slots;
+	timer->eventSlotCount = count;
+
+	return 0;
+}
+
+/*!
+ * \brief Gives the id following the last one whose slot is free, skipping 0
+ * and INVALID_EVENT_ID. The table must have a free slot.
+ *
+ * \return The id.
+ */
+static int NextEventId(
+	/*! [in] Valid timer thread pointer. */
+	TimerThread *timer)
+{
+	int id = timer->lastEventId;
+
+	do {
+		/* positive ids, wrapping around */
+		id = (int)(((unsigned int)id + 1u) & 0x7fffffffu);
+	} while (id == 0 || id == INVALID_EVENT_ID ||
+		 *EventSlot(timer, id) != NULL);
+	timer->lastEventId = id;
+
+	return id;
+}
 
 /*!
  * \brief Deallocates a dynamically allocated TimerEvent.
@@ -119,6 +215,7 @@ static void TimerThreadWorker(
 				}
 			}
 			ListDelNode(&timer->eventQ, head, 0);
+			*EventSlot(timer, nextEvent->id) = NULL;
 			FreeTimerEvent(timer, nextEvent);
 			continue;
 		}
@@ -224,6 +321,8 @@ int TimerThreadInit(TimerThread *timer, ThreadPool *tp)
 	timer->shutdown = 0;
 	timer->tp = tp;
 	timer->lastEventId = 0;
+	timer->eventSlots = NULL;
+	timer->eventSlotCount = 0;
 	rc += ListInit(&timer->eventQ, NULL, NULL);
 
 	assert(rc == 0);
@@ -258,10 +357,11 @@ int TimerThreadSchedule(TimerThread *timer,
 	int *id)
 {
 	int rc = EOUTOFMEM;
-	int found = 0;
 	int tempId = 0;
+	int eventId;
 
 	ListNode *tempNode = NULL;
+	ListNode *newNode = NULL;
 	TimerEvent *temp = NULL;
 	TimerEvent *newEvent = NULL;
 
@@ -280,8 +380,13 @@ int TimerThreadSchedule(TimerThread *timer,
 
 	(*id) = INVALID_EVENT_ID;
 
-	newEvent = CreateTimerEvent(
-		timer, job, duration, timeout, timer->lastEventId);
+	if (GrowEventSlots(timer) != 0) {
+		ithread_mutex_unlock(&timer->mutex);
+		return rc;
+	}
+	eventId = NextEventId(timer);
+	newEvent =
+		CreateTimerEvent(timer, job, duration, timeout, eventId);
 
 	if (newEvent == NULL) {
 		ithread_mutex_unlock(&timer->mutex);
@@ -293,26 +398,24 @@ int TimerThreadSchedule(TimerThread *timer,
 	 * the next event. */
 	while (tempNode != NULL) {
 		temp = (TimerEvent *)tempNode->item;
-		if (temp->eventTime >= timeout) {
-			if (ListAddBefore(&timer->eventQ, newEvent, tempNode))
-				rc = 0;
-			found = 1;
+		if (temp->eventTime >= timeout)
 			break;
-		}
 		tempNode = ListNext(&timer->eventQ, tempNode);
 	}
-	/* add to the end of Q. */
-	if (!found) {
-		if (ListAddTail(&timer->eventQ, newEvent) != NULL)
-			rc = 0;
-	}
+	/* add to the end of Q if no event comes later. */
+	if (tempNode != NULL)
+		newNode = ListAddBefore(&timer->eventQ, newEvent, tempNode);
+	else
+		newNode = ListAddTail(&timer->eventQ, newEvent);
 	/* signal change in Q. */
-	if (rc == 0) {
+	if (newNode != NULL) {
+		*EventSlot(timer, eventId) = newNode;
 		ithread_cond_signal(&timer->condition);
+		(*id) = eventId;
+		rc = 0;
 	} else {
 		FreeTimerEvent(timer, newEvent);
 	}
-	(*id) = timer->lastEventId++;
 	ithread_mutex_unlock(&timer->mutex);
 
 	return rc;
@@ -332,20 +435,16 @@ int TimerThreadRemove(TimerThread *timer, int id, ThreadPoolJob *out)
 
 	ithread_mutex_lock(&timer->mutex);
 
-	tempNode = ListHead(&timer->eventQ);
-
-	while (tempNode != NULL) {
+	/* looked up by id rather than searched in the Q */
+	tempNode = FindEvent(timer, id);
+	if (tempNode != NULL) {
+		*EventSlot(timer, id) = NULL;
 		temp = (TimerEvent *)tempNode->item;
-		if (temp->id == id) {
-
-			ListDelNode(&timer->eventQ, tempNode, 0);
-			if (out != NULL)
-				(*out) = temp->job;
-			FreeTimerEvent(timer, temp);
-			rc = 0;
-			break;
-		}
-		tempNode = ListNext(&timer->eventQ, tempNode);
+		ListDelNode(&timer->eventQ, tempNode, 0);
+		if (out != NULL)
+			(*out) = temp->job;
+		FreeTimerEvent(timer, temp);
+		rc = 0;
 	}
 
 	ithread_mutex_unlock(&timer->mutex);
@@ -382,6 +481,9 @@ int TimerThreadShutdown(TimerThread *timer)
 	}
 
 	ListDestroy(&timer->eventQ, 0);
+	free(timer->eventSlots);
+	timer->eventSlots = NULL;
+	timer->eventSlotCount = 0;
 	FreeListDestroy(&timer->freeEvents);
 
 	ithread_cond_broadcast(&timer->condition);
@@ -69,7 +69,14 @@ typedef struct TIMERTHREAD
 {
 	ithread_mutex_t mutex;
 	ithread_cond_t condition;
+	/*! id of the last event scheduled. */
 	int lastEventId;
+	/*! nodes of the events in eventQ, each at the slot of its id modulo
+	 * eventSlotCount, so that an id is looked up in constant time. */
+	ListNode **eventSlots;
+	/*! number of slots, a power of two at least twice the number of
+	 * events. */
+	int eventSlotCount;
 	LinkedList eventQ;
 	int shutdown;
 	FreeList freeEvents;
@@ -123,7 +130,8 @@ int TimerThreadSchedule(
 	ThreadPoolJob *job,
 	/*! [in] . */
 	Duration duration,
-	/*! [in] Id of timer event. (out, can be null). */
+	/*! [in] Id of timer event, never 0 nor INVALID_EVENT_ID, and not
+	 * given again until the ids wrap around. (out, can be null). */
 	int *id);
 
 /*!
@@ -361,6 +361,7 @@ error_handler:
  *struct sockaddr* serverAddr : ip address and port of the miniserver IN const
  *char* alias : a name to be used for the temp; e.g.:"foo.xml" IN time_t
  *last_modified :	time OUT char docURL[LINE_SIZE] :	document URL
+ *		OUT char docAlias[LINE_SIZE] :	alias of the document
  *
  *	Description : Configure the full URL for the description document.
  *		Create the URL document and add alias, description information.
@@ -377,7 +378,8 @@ int configure_urlbase(IXML_Document *doc,
 	const struct sockaddr *serverAddr,
 	const char *alias,
 	time_t last_modified,
-	char docURL[LINE_SIZE])
+	char docURL[LINE_SIZE],
+	char docAlias[LINE_SIZE])
 {
 	char *root_path = NULL;
 	char *new_alias = NULL;
@@ -418,6 +420,11 @@ int configure_urlbase(IXML_Document *doc,
 	/* store in web server */
 	err_code = web_server_set_alias(
 		new_alias, xml_str, strlen(xml_str), last_modified);
+	if (err_code == UPNP_E_SUCCESS) {
+		/* shorter than docURL */
+		strncpy(docAlias, new_alias, LINE_SIZE - 1);
+		docAlias[LINE_SIZE - 1] = '\0';
+	}
 
 error_handler:
 	free(root_path);
@@ -0,0 +1,125 @@
+/* Force asserts enabled for the test */
+#ifdef NDEBUG
+	#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "httpparser.h"
+
+static const struct
+{
+	const char *name;
+	int id;
+} headers[] = {
+	{"ACCEPT", HDR_ACCEPT},
+	{"ACCEPT-CHARSET", HDR_ACCEPT_CHARSET},
+	{"ACCEPT-ENCODING", HDR_ACCEPT_ENCODING},
+	{"ACCEPT-LANGUAGE", HDR_ACCEPT_LANGUAGE},
+	{"ACCEPT-RANGES", HDR_ACCEPT_RANGE},
+	{"CACHE-CONTROL", HDR_CACHE_CONTROL},
+	{"CALLBACK", HDR_CALLBACK},
+	{"CONTENT-ENCODING", HDR_CONTENT_ENCODING},
+	{"CONTENT-LANGUAGE", HDR_CONTENT_LANGUAGE},
+	{"CONTENT-LENGTH", HDR_CONTENT_LENGTH},
+	{"CONTENT-LOCATION", HDR_CONTENT_LOCATION},
+	{"CONTENT-RANGE", HDR_CONTENT_RANGE},
+	{"CONTENT-TYPE", HDR_CONTENT_TYPE},
+	{"DATE", HDR_DATE},
+	{"EXT", HDR_EXT},
+	{"HOST", HDR_HOST},
+	{"IF-MODIFIED-SINCE", HDR_IF_MODIFIED_SINCE},
+	{"IF-NONE-MATCH", HDR_IF_NONE_MATCH},
+	{"IF-RANGE", HDR_IF_RANGE},
+	{"LOCATION", HDR_LOCATION},
+	{"MAN", HDR_MAN},
+	{"MX", HDR_MX},
+	{"NT", HDR_NT},
+	{"NTS", HDR_NTS},
+	{"RANGE", HDR_RANGE},
+	{"SEQ", HDR_SEQ},
+	{"SERVER", HDR_SERVER},
+	{"SID", HDR_SID},
+	{"SOAPACTION", HDR_SOAPACTION},
+	{"ST", HDR_ST},
+	{"TE", HDR_TE},
+	{"TIMEOUT", HDR_TIMEOUT},
+	{"TRANSFER-ENCODING", HDR_TRANSFER_ENCODING},
+	{"USER-AGENT", HDR_USER_AGENT},
+	{"USN", HDR_USN},
+};
+
+/* Parses a request line and returns the method, or -1 on failure. */
+static int parse_method(const char *line)
+{
+	http_parser_t parser;
+	int method = -1;
+
+	parser_request_init(&parser);
+	if (parser_append(&parser, line, strlen(line)) == PARSE_SUCCESS)
+		method = (int)parser.msg.method;
+	httpmsg_destroy(&parser.msg);
+
+	return method;
+}
+
+int main(void)
+{
+	char lower[32];
+	char line[64];
+	size_t i;
+	size_t j;
+	int id;
+	int method;
+
+	for (i = 0; i < sizeof(headers) / sizeof(headers[0]); i++) {
+		const char *name = headers[i].name;
+		size_t len = strlen(name);
+
+		assert(httpheader_name_to_id(name, len) == headers[i].id);
+		for (j = 0; j <= len; j++)
+			lower[j] = (char)(name[j] | (name[j] ? 0x20 : 0));
+		assert(httpheader_name_to_id(lower, len) == headers[i].id);
+		/* prefixes must not match */
+		assert(httpheader_name_to_id(name, len - 1) != headers[i].id);
+	}
+	/* every header id has its name above; 9 and 10 are not used */
+	for (id = 1; id <= HDR_IF_NONE_MATCH; id++) {
+		for (i = 0; i < sizeof(headers) / sizeof(headers[0]); i++) {
+			if (headers[i].id == id)
+				break;
+		}
+		assert((i < sizeof(headers) / sizeof(headers[0])) ==
+			(id != 9 && id != 10));
+	}
+	assert(httpheader_name_to_id("X-AV-CLIENT-INFO", 16) == HDR_UNKNOWN);
+	assert(httpheader_name_to_id("CONTENT-LENGTH", 0) == HDR_UNKNOWN);
+
+	/* every method name resolves to its method */
+	for (method = HTTPMETHOD_PUT; method <= SOAPMETHOD_POST; method++) {
+		if (method == HTTPMETHOD_UNKNOWN)
+			continue;
+		snprintf(line,
+			sizeof(line),
+			"%s / HTTP/1.1\r\nContent-Length: 0\r\n\r\n",
+			method_to_str((http_method_t)method));
+		if (method == HTTPMETHOD_PUT)
+			assert(parse_method(line) == -1);
+		else if (method == SOAPMETHOD_POST)
+			assert(parse_method(line) == HTTPMETHOD_POST);
+		else
+			assert(parse_method(line) == method);
+	}
+	assert(parse_method("GET / HTTP/1.1\r\n\r\n") == HTTPMETHOD_GET);
+	assert(parse_method("SUBSCRIBE / HTTP/1.1\r\n\r\n") ==
+		HTTPMETHOD_SUBSCRIBE);
+	assert(parse_method("M-SEARCH * HTTP/1.1\r\n\r\n") ==
+		HTTPMETHOD_MSEARCH);
+	assert(parse_method("get / HTTP/1.1\r\n\r\n") == -1);
+	assert(parse_method("PUT / HTTP/1.1\r\n\r\n") == -1);
+	assert(parse_method("BREW / HTTP/1.1\r\n\r\n") == -1);
+
+	return 0;
+}
@@ -0,0 +1,82 @@
+/* Force asserts enabled for the test */
+#ifdef NDEBUG
+	#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "httpscan.h"
+
+/* Lengths around the 16 and 32 byte blocks of the vector versions. */
+static const size_t lengths[] = {15, 16, 17, 31, 32, 33};
+
+/* Bytes that stop httpscan_identifier(). */
+static const char identifier_stops[] = {
+	' ', '"', '(', ',', '/', ':', '@', '[', ']', '{', '}', '\t', '\r',
+	'\0', '\x7f', '\x80', '\xff'};
+
+/* Bytes that stop httpscan_text(). */
+static const char text_stops[] = {'\r', '\n', '"', '\x80', '\xff'};
+
+/* Fills a buffer with every byte that does not stop a scan in turn. */
+static void fill(char *buf, size_t len, int identifier)
+{
+	unsigned int c = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		do {
+			c = (c + 1) & 0x7f;
+		} while (identifier ? !(http_char_class[c] &
+					       HTTP_CHAR_IDENTIFIER)
+				    : c == '\r' || c == '\n' || c == '"');
+		buf[i] = (char)c;
+	}
+}
+
+/* Checks a level with a stop byte at every position, and none. */
+static void check(int level)
+{
+	char buf[64];
+	size_t n;
+	size_t len;
+	size_t pos;
+	size_t i;
+
+	assert(httpscan_limit(level) <= level);
+	for (n = 0; n < sizeof(lengths) / sizeof(lengths[0]); n++) {
+		len = lengths[n];
+		fill(buf, len, 1);
+		assert(httpscan_identifier(buf, buf + len) == buf + len);
+		for (pos = 0; pos < len; pos++) {
+			for (i = 0; i < sizeof(identifier_stops); i++) {
+				fill(buf, len, 1);
+				buf[pos] = identifier_stops[i];
+				assert(httpscan_identifier(buf, buf + len) ==
+					buf + pos);
+			}
+		}
+		fill(buf, len, 0);
+		assert(httpscan_text(buf, buf + len) == buf + len);
+		for (pos = 0; pos < len; pos++) {
+			for (i = 0; i < sizeof(text_stops); i++) {
+				fill(buf, len, 0);
+				buf[pos] = text_stops[i];
+				assert(httpscan_text(buf, buf + len) ==
+					buf + pos);
+			}
+		}
+	}
+}
+
+int main(void)
+{
+	check(HTTPSCAN_LEVEL_SCALAR);
+	check(HTTPSCAN_LEVEL_SSE2);
+	check(HTTPSCAN_LEVEL_AVX2);
+	printf("vector level %d\n", httpscan_limit(HTTPSCAN_LEVEL_AVX2));
+
+	return 0;
+}
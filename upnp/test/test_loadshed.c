@@ -0,0 +1,233 @@
+/* Force asserts enabled for the test */
+#ifdef NDEBUG
+	#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "config.h"
+
+#include "httpparser.h"
+#include "loadshed.h"
+#include "ssdplib.h"
+#include "upnp.h"
+#include "upnpapi.h"
+
+/*! Exit code of a skipped test for CTest and automake. */
+#define SKIP 77
+
+static void test_budget(void)
+{
+	Upnp_LoadStats stats;
+	int i;
+
+	assert(load_set_budget(UPNP_LOAD_HTTP, -1) == UPNP_E_INVALID_PARAM);
+	assert(load_set_budget((Upnp_LoadClass)3, 1) == UPNP_E_INVALID_PARAM);
+	assert(load_get_stats(UPNP_LOAD_HTTP, NULL) == UPNP_E_INVALID_PARAM);
+
+	/* not limited */
+	assert(load_set_budget(UPNP_LOAD_HTTP, 0) == UPNP_E_SUCCESS);
+	for (i = 0; i < 100; i++)
+		assert(load_admit(UPNP_LOAD_HTTP));
+	assert(!load_pressure(UPNP_LOAD_HTTP));
+	for (i = 0; i < 100; i++)
+		load_done(UPNP_LOAD_HTTP);
+
+	/* the jobs over the budget are shed */
+	assert(load_set_budget(UPNP_LOAD_HTTP, 4) == UPNP_E_SUCCESS);
+	assert(load_admit(UPNP_LOAD_HTTP));
+	assert(!load_pressure(UPNP_LOAD_HTTP));
+	assert(load_admit(UPNP_LOAD_HTTP));
+	assert(load_pressure(UPNP_LOAD_HTTP));
+	assert(load_admit(UPNP_LOAD_HTTP));
+	assert(load_admit(UPNP_LOAD_HTTP));
+	assert(!load_admit(UPNP_LOAD_HTTP));
+	assert(load_get_stats(UPNP_LOAD_HTTP, &stats) == UPNP_E_SUCCESS);
+	assert(stats.jobs == 4);
+	assert(stats.budget == 4);
+	assert(stats.admitted == 104);
+	assert(stats.shedBudget == 1);
+
+	/* a job done, shed by its pool or as a duplicate makes room */
+	load_done(UPNP_LOAD_HTTP);
+	assert(load_admit(UPNP_LOAD_HTTP));
+	load_shed_pool(UPNP_LOAD_HTTP);
+	load_shed_duplicate(UPNP_LOAD_HTTP);
+	assert(load_admit(UPNP_LOAD_HTTP));
+	assert(load_admit(UPNP_LOAD_HTTP));
+	assert(!load_admit(UPNP_LOAD_HTTP));
+	assert(load_get_stats(UPNP_LOAD_HTTP, &stats) == UPNP_E_SUCCESS);
+	assert(stats.jobs == 4);
+	assert(stats.admitted == 105);
+	assert(stats.shedBudget == 2);
+	assert(stats.shedPool == 1);
+	assert(stats.shedDuplicate == 1);
+
+	/* a lower budget admits no job until enough are done */
+	assert(load_set_budget(UPNP_LOAD_HTTP, 2) == UPNP_E_SUCCESS);
+	load_done(UPNP_LOAD_HTTP);
+	assert(!load_admit(UPNP_LOAD_HTTP));
+	load_done(UPNP_LOAD_HTTP);
+	load_done(UPNP_LOAD_HTTP);
+	assert(load_admit(UPNP_LOAD_HTTP));
+	load_done(UPNP_LOAD_HTTP);
+	load_done(UPNP_LOAD_HTTP);
+	assert(load_get_stats(UPNP_LOAD_HTTP, &stats) == UPNP_E_SUCCESS);
+	assert(stats.jobs == 0);
+	assert(load_set_budget(UPNP_LOAD_HTTP, LOAD_BUDGET_HTTP) ==
+		UPNP_E_SUCCESS);
+}
+
+#if defined(INCLUDE_DEVICE_APIS) && EXCLUDE_SSDP == 0
+static int callback(Upnp_EventType type, const void *event, void *cookie)
+{
+	(void)type;
+	(void)event;
+	(void)cookie;
+
+	return 0;
+}
+
+static pthread_mutex_t gate_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gate_cond = PTHREAD_COND_INITIALIZER;
+static int gate_open;
+
+/* Holds a worker of the send thread pool until the gate opens. */
+static void gate_job(void *arg)
+{
+	(void)arg;
+	pthread_mutex_lock(&gate_mutex);
+	while (!gate_open)
+		pthread_cond_wait(&gate_cond, &gate_mutex);
+	pthread_mutex_unlock(&gate_mutex);
+}
+
+/* Handles an M-SEARCH as if received from a control point, without a
+ * socket. */
+static void handle_search(int mx)
+{
+	char search[256];
+	http_parser_t parser;
+	struct sockaddr_storage dest;
+	struct sockaddr_in *addr = (struct sockaddr_in *)&dest;
+	int len;
+
+	len = snprintf(search,
+		sizeof(search),
+		"M-SEARCH * HTTP/1.1\r\n"
+		"HOST: 239.255.255.250:1900\r\n"
+		"MAN: \"ssdp:discover\"\r\n"
+		"MX: %d\r\n"
+		"ST: upnp:rootdevice\r\n"
+		"\r\n",
+		mx);
+	memset(&dest, 0, sizeof(dest));
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons(9);
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	parser_request_init(&parser);
+	assert(parser_append(&parser, search, (size_t)len) == PARSE_SUCCESS);
+	ssdp_handle_device_request(&parser.msg, &dest);
+	httpmsg_destroy(&parser.msg);
+}
+
+/* A repeated M-SEARCH is not answered twice under pressure, and a reply
+ * that expires before a worker sends it releases its place once. */
+static void test_search_reply(void)
+{
+	static const char desc[] =
+		"<?xml version=\"1.0\"?>"
+		"<root xmlns=\"urn:schemas-upnp-org:device-1-0\">"
+		"<specVersion><major>1</major><minor>0</minor></specVersion>"
+		"<device>"
+		"<deviceType>urn:schemas-upnp-org:device:Test:1</deviceType>"
+		"<friendlyName>Test</friendlyName>"
+		"<UDN>uuid:test-loadshed</UDN>"
+		"</device></root>";
+	UpnpDevice_Handle hnd;
+	Upnp_LoadStats before;
+	Upnp_LoadStats stats;
+	ThreadPoolAttr attr;
+	ThreadPoolStats poolBefore;
+	ThreadPoolStats pool;
+	ThreadPoolJob job;
+	struct timeval now;
+	int i;
+
+	assert(UpnpRegisterRootDevice2(UPNPREG_BUF_DESC,
+		       desc,
+		       strlen(desc),
+		       1,
+		       callback,
+		       NULL,
+		       &hnd) == UPNP_E_SUCCESS);
+	/* pressure from the first reply waiting */
+	assert(UpnpSetLoadBudget(UPNP_LOAD_SEARCH_REPLY, 2) == UPNP_E_SUCCESS);
+	assert(UpnpGetLoadStats(UPNP_LOAD_SEARCH_REPLY, &before) ==
+		UPNP_E_SUCCESS);
+	assert(ThreadPoolGetStats(&gSendThreadPool, &poolBefore) == 0);
+
+	/* Every worker of the send thread pool is held: the gate jobs have
+	 * earlier deadlines than the replies, so they are picked first. */
+	assert(ThreadPoolGetAttr(&gSendThreadPool, &attr) == 0);
+	gettimeofday(&now, NULL);
+	for (i = 0; i < attr.maxThreads; i++) {
+		TPJobInit(&job, (start_routine)gate_job, NULL);
+		TPJobSetDeadline(&job, &now, NULL);
+		assert(ThreadPoolAdd(&gSendThreadPool, &job, NULL) == 0);
+	}
+
+	/* the same control point, with one second to reply */
+	handle_search(1);
+	handle_search(1);
+	assert(UpnpGetLoadStats(UPNP_LOAD_SEARCH_REPLY, &stats) ==
+		UPNP_E_SUCCESS);
+	assert(stats.admitted == before.admitted + 1);
+	assert(stats.shedDuplicate == before.shedDuplicate + 1);
+	assert(stats.jobs == before.jobs + 1);
+
+	/* the reply is dropped at its deadline */
+	sleep(2);
+	pthread_mutex_lock(&gate_mutex);
+	gate_open = 1;
+	pthread_cond_broadcast(&gate_cond);
+	pthread_mutex_unlock(&gate_mutex);
+	for (i = 0; i < 200; i++) {
+		assert(ThreadPoolGetStats(&gSendThreadPool, &pool) == 0);
+		if (pool.deadlineDrops > poolBefore.deadlineDrops)
+			break;
+		usleep(10000);
+	}
+	assert(pool.deadlineDrops == poolBefore.deadlineDrops + 1);
+	assert(UpnpGetLoadStats(UPNP_LOAD_SEARCH_REPLY, &stats) ==
+		UPNP_E_SUCCESS);
+	assert(stats.jobs == before.jobs);
+
+	assert(UpnpUnRegisterRootDevice(hnd) == UPNP_E_SUCCESS);
+	assert(UpnpSetLoadBudget(UPNP_LOAD_SEARCH_REPLY,
+		       LOAD_BUDGET_SEARCH_REPLY) == UPNP_E_SUCCESS);
+}
+#endif
+
+int main(void)
+{
+	test_budget();
+
+	if (UpnpInit2(NULL, 0) != UPNP_E_SUCCESS) {
+		printf("no network interface, skipped\n");
+		return SKIP;
+	}
+#if defined(INCLUDE_DEVICE_APIS) && EXCLUDE_SSDP == 0
+	test_search_reply();
+#endif
+	UpnpFinish();
+
+	return 0;
+}
@@ -0,0 +1,121 @@
+/* Force asserts enabled for the test */
+#ifdef NDEBUG
+	#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+
+#include "upnp.h"
+#include "upnpapi.h"
+
+/*! Services added after the first three so that the path table grows. */
+#define EXTRA_SERVICES 40
+
+/*! Exit code of a skipped test for CTest and automake. */
+#define SKIP 77
+
+static char desc[16384];
+
+static int callback(Upnp_EventType type, const void *event, void *cookie)
+{
+	(void)type;
+	(void)event;
+	(void)cookie;
+
+	return 0;
+}
+
+static void add_service(size_t *len, const char *id, const char *control,
+	const char *event)
+{
+	*len += (size_t)snprintf(desc + *len,
+		sizeof(desc) - *len,
+		"<service>"
+		"<serviceType>urn:schemas-upnp-org:service:Test:1</serviceType>"
+		"<serviceId>%s</serviceId>"
+		"<SCPDURL>/scpd.xml</SCPDURL>"
+		"<controlURL>%s</controlURL>"
+		"<eventSubURL>%s</eventSubURL>"
+		"</service>",
+		id,
+		control,
+		event);
+	assert(*len < sizeof(desc));
+}
+
+/* Returns the id of the service found for a path. */
+static const char *lookup(const char *path)
+{
+	UpnpDevice_Handle hnd;
+	struct Handle_Info *info;
+	service_info *service = NULL;
+	Upnp_Handle_Type type;
+
+	HandleReadLock();
+	type = GetDeviceHandleInfoForPath(path, AF_INET, &hnd, &info, &service);
+	HandleUnlock();
+
+	return type == HND_DEVICE ? service->serviceId : NULL;
+}
+
+int main(void)
+{
+	UpnpDevice_Handle hnd;
+	char id[32];
+	char url[32];
+	size_t len;
+	int i;
+
+	if (UpnpInit2(NULL, 0) != UPNP_E_SUCCESS) {
+		printf("no network interface, skipped\n");
+		return SKIP;
+	}
+	len = (size_t)snprintf(desc,
+		sizeof(desc),
+		"<?xml version=\"1.0\"?>"
+		"<root xmlns=\"urn:schemas-upnp-org:device-1-0\">"
+		"<specVersion><major>1</major><minor>0</minor></specVersion>"
+		"<device>"
+		"<deviceType>urn:schemas-upnp-org:device:Test:1</deviceType>"
+		"<friendlyName>Test</friendlyName>"
+		"<UDN>uuid:test-service-paths</UDN>"
+		"<serviceList>");
+	/* the first service of the list wins, a control URL before an
+	 * event URL */
+	add_service(&len, "first", "/c", "/e1");
+	add_service(&len, "second", "/c", "/x");
+	add_service(&len, "third", "/x", "/e3");
+	for (i = 0; i < EXTRA_SERVICES; i++) {
+		snprintf(id, sizeof(id), "extra%d", i);
+		snprintf(url, sizeof(url), "/extra%d", i);
+		add_service(&len, id, url, url);
+	}
+	len += (size_t)snprintf(desc + len,
+		sizeof(desc) - len,
+		"</serviceList></device></root>");
+	assert(len < sizeof(desc));
+	assert(UpnpRegisterRootDevice2(UPNPREG_BUF_DESC,
+		       desc,
+		       len,
+		       1,
+		       callback,
+		       NULL,
+		       &hnd) == UPNP_E_SUCCESS);
+
+	assert(strcmp(lookup("/c"), "first") == 0);
+	assert(strcmp(lookup("/x"), "third") == 0);
+	assert(strcmp(lookup("/e1"), "first") == 0);
+	assert(strcmp(lookup("/e3"), "third") == 0);
+	assert(strcmp(lookup("/extra7"), "extra7") == 0);
+	assert(lookup("/missing") == NULL);
+
+	assert(UpnpUnRegisterRootDevice(hnd) == UPNP_E_SUCCESS);
+	assert(lookup("/c") == NULL);
+	UpnpFinish();
+
+	return 0;
+}
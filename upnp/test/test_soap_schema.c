@@ -0,0 +1,163 @@
+/* Force asserts enabled for the test */
+#ifdef NDEBUG
+	#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "soap_schema.h"
+#include "upnp.h"
+
+static const char *scpd_text =
+	"<?xml version=\"1.0\"?>"
+	"<scpd xmlns=\"urn:schemas-upnp-org:service-1-0\">"
+	"<actionList>"
+	"<action><name>SetTarget</name><argumentList>"
+	"<argument><name>newTargetValue</name><direction>in</direction>"
+	"<relatedStateVariable>Target</relatedStateVariable></argument>"
+	"<argument><name>Level</name><direction>in</direction>"
+	"<relatedStateVariable>Level</relatedStateVariable></argument>"
+	"<argument><name>Label</name><direction>in</direction>"
+	"<relatedStateVariable>Label</relatedStateVariable></argument>"
+	"<argument><name>Result</name><direction>out</direction>"
+	"<relatedStateVariable>Label</relatedStateVariable></argument>"
+	"</argumentList></action>"
+	"<action><name>GetStatus</name></action>"
+	"</actionList>"
+	"<serviceStateTable>"
+	"<stateVariable><name>Target</name><dataType>boolean</dataType>"
+	"</stateVariable>"
+	"<stateVariable><name>Level</name><dataType>ui1</dataType>"
+	"</stateVariable>"
+	"<stateVariable><name>Label</name><dataType>string</dataType>"
+	"</stateVariable>"
+	"</serviceStateTable>"
+	"</scpd>";
+
+static const char *service_type = "urn:schemas-upnp-org:service:Test:1";
+
+static int parse(const action_schema *action, const char *args_xml)
+{
+	char body[1024];
+	UpnpActionArgs *args;
+	int ret;
+
+	snprintf(body,
+		sizeof(body),
+		"<?xml version=\"1.0\"?>\r\n"
+		"<s:Envelope "
+		"xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+		"s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
+		"<s:Body>\r\n"
+		"<u:SetTarget xmlns:u=\"%s\">%s</u:SetTarget>"
+		"</s:Body></s:Envelope>\r\n",
+		service_type,
+		args_xml);
+	args = UpnpActionArgs_new(action);
+	assert(args != NULL);
+	ret = soap_schema_parse_request(body, strlen(body), service_type, args);
+	UpnpActionArgs_delete(args);
+
+	return ret;
+}
+
+int main(void)
+{
+	IXML_Document *scpd = NULL;
+	service_schema *schema = NULL;
+	const action_schema *action;
+	UpnpActionArgs *args;
+	membuffer out;
+	char body[1024];
+	long long level;
+	int target;
+
+	assert(ixmlParseBufferEx(scpd_text, &scpd) == IXML_SUCCESS);
+	assert(soap_schema_compile(scpd, &schema) == UPNP_E_SUCCESS);
+	ixmlDocument_free(scpd);
+	assert(schema->num_actions == 2);
+	assert(soap_schema_find_action(schema, "Missing", 7) == NULL);
+	assert(soap_schema_find_action(schema, "GetStatusX", 9) != NULL);
+	action = soap_schema_find_action(schema, "SetTarget", 9);
+	assert(action != NULL);
+	assert(action->num_in == 3 && action->num_out == 1);
+
+	/* template parse */
+	snprintf(body,
+		sizeof(body),
+		"<s:Envelope "
+		"xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\">"
+		"<s:Body><u:SetTarget xmlns:u=\"%s\">"
+		"<newTargetValue>true</newTargetValue>"
+		"<Level>200</Level>"
+		"<Label>a &lt;b&gt; &amp; &#233;</Label>"
+		"</u:SetTarget></s:Body></s:Envelope>",
+		service_type);
+	args = UpnpActionArgs_new(action);
+	assert(args != NULL);
+	assert(soap_schema_parse_request(
+		       body, strlen(body), service_type, args) == 0);
+	assert(UpnpActionArgs_get_InBoolean(args, 0, &target) ==
+		UPNP_E_SUCCESS);
+	assert(target == 1);
+	assert(UpnpActionArgs_get_InInteger(args, 1, &level) ==
+		UPNP_E_SUCCESS);
+	assert(level == 200);
+	assert(strcmp(UpnpActionArgs_get_InValue(args, 2),
+		       "a <b> & \xc3\xa9") == 0);
+
+	/* response */
+	assert(UpnpActionArgs_find_Out(args, "Result") == 0);
+	membuffer_init(&out);
+	assert(soap_schema_make_response(args, service_type, &out) ==
+		UPNP_E_INVALID_ARGUMENT);
+	assert(UpnpActionArgs_set_OutValue(args, 0, "x<y") == UPNP_E_SUCCESS);
+	assert(soap_schema_make_response(args, service_type, &out) ==
+		UPNP_E_SUCCESS);
+	assert(strstr(out.buf, "<Result>x&lt;y</Result>") != NULL);
+	membuffer_destroy(&out);
+	UpnpActionArgs_delete(args);
+
+	/* argument errors */
+	assert(parse(action,
+		       "<newTargetValue>1</newTargetValue><Level>3</Level>"
+		       "<Label/>") == 0);
+	assert(parse(action, "<newTargetValue>1</newTargetValue>") == 402);
+	assert(parse(action,
+		       "<newTargetValue>1</newTargetValue><Level>3</Level>"
+		       "<Label/><Label/>") == 402);
+	assert(parse(action,
+		       "<newTargetValue>1</newTargetValue><Level>3</Level>"
+		       "<Label/><Other/>") == 402);
+	assert(parse(action,
+		       "<newTargetValue>maybe</newTargetValue><Level>3</Level>"
+		       "<Label/>") == 600);
+	assert(parse(action,
+		       "<newTargetValue>0</newTargetValue><Level>256</Level>"
+		       "<Label/>") == 600);
+	assert(parse(action,
+		       "<newTargetValue>1</newTargetValue><Level>3</Level>"
+		       "<Label>&#x41;&#66;</Label>") == 0);
+	/* left to the DOM parser */
+	assert(parse(action,
+		       "<newTargetValue>1</newTargetValue><Level>3</Level>"
+		       "<Label>&# 65;</Label>") == -1);
+	assert(parse(action,
+		       "<newTargetValue>1</newTargetValue><Level>3</Level>"
+		       "<Label>&#-65;</Label>") == -1);
+	assert(parse(action,
+		       "<newTargetValue>1</newTargetValue><Level>3</Level>"
+		       "<Label>&#x0x41;</Label>") == -1);
+	assert(parse(action,
+		       "<newTargetValue>1</newTargetValue><Level>3</Level>"
+		       "<Label><![CDATA[x]]></Label>") == -1);
+	assert(parse(action,
+		       "<!-- comment --><newTargetValue>1</newTargetValue>") ==
+		-1);
+
+	soap_schema_free(schema);
+
+	return 0;
+}
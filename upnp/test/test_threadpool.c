@@ -0,0 +1,547 @@
+/* Force asserts enabled for the test */
+#ifdef NDEBUG
+	#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Atomic.h"
+#include "ThreadPool.h"
+#include "TimerThread.h"
+
+#define ADDERS 4
+#define JOBS_PER_ADDER 2000
+
+static int gRun;
+static int gFreed;
+static int gBlocked;
+static ithread_mutex_t gGateMutex = PTHREAD_MUTEX_INITIALIZER;
+static ithread_cond_t gGateCond = PTHREAD_COND_INITIALIZER;
+static int gGateOpen;
+
+static void count_job(void *arg)
+{
+	(void)arg;
+	ithread_atomic_add(&gRun, 1);
+}
+
+static void free_job(void *arg)
+{
+	(void)arg;
+	ithread_atomic_add(&gFreed, 1);
+}
+
+/* Holds a worker until the gate opens. */
+static void gate_job(void *arg)
+{
+	(void)arg;
+	ithread_mutex_lock(&gGateMutex);
+	gBlocked++;
+	ithread_cond_broadcast(&gGateCond);
+	while (!gGateOpen)
+		ithread_cond_wait(&gGateCond, &gGateMutex);
+	ithread_mutex_unlock(&gGateMutex);
+}
+
+/* Records the order the jobs run in. */
+static int gOrder[8];
+static int gOrderLen;
+
+static void order_job(void *arg)
+{
+	/* one worker runs them */
+	gOrder[gOrderLen] = (int)(long)arg;
+	ithread_atomic_add(&gOrderLen, 1);
+}
+
+static void expired_job(void *arg)
+{
+	order_job((void *)(-(long)arg));
+}
+
+static void *adder(void *arg)
+{
+	ThreadPool *tp = (ThreadPool *)arg;
+	ThreadPoolJob job;
+	int i;
+
+	for (i = 0; i < JOBS_PER_ADDER; i++) {
+		TPJobInit(&job, (start_routine)count_job, NULL);
+		TPJobSetPriority(&job, (ThreadPriority)(i % 3));
+		while (ThreadPoolAdd(tp, &job, NULL) != 0)
+			imillisleep(1);
+	}
+
+	return NULL;
+}
+
+static void wait_run(int n)
+{
+	while (ithread_atomic_load(&gRun) < n)
+		imillisleep(1);
+}
+
+static void test_pool(QueueMode mode)
+{
+	ThreadPool tp;
+	ThreadPoolAttr attr;
+	ThreadPoolJob job;
+	ThreadPoolJob out;
+	ithread_t threads[ADDERS];
+	int ids[10];
+	int i;
+
+	gRun = 0;
+	gFreed = 0;
+	gBlocked = 0;
+	gGateOpen = 0;
+	TPAttrInit(&attr);
+	TPAttrSetMaxThreads(&attr, 4);
+	TPAttrSetMinThreads(&attr, 4);
+	TPAttrSetMaxJobsTotal(&attr, ADDERS * JOBS_PER_ADDER);
+	TPAttrSetQueueMode(&attr, mode);
+	assert(ThreadPoolInit(&tp, &attr) == 0);
+
+	/* concurrent adders, every job runs once */
+	for (i = 0; i < ADDERS; i++)
+		assert(ithread_create(&threads[i], NULL, adder, &tp) == 0);
+	for (i = 0; i < ADDERS; i++)
+		ithread_join(threads[i], NULL);
+	wait_run(ADDERS * JOBS_PER_ADDER);
+
+	/* hold every worker, then queue jobs that cannot run */
+	TPJobInit(&job, (start_routine)gate_job, NULL);
+	for (i = 0; i < 4; i++)
+		assert(ThreadPoolAdd(&tp, &job, NULL) == 0);
+	ithread_mutex_lock(&gGateMutex);
+	while (gBlocked < 4)
+		ithread_cond_wait(&gGateCond, &gGateMutex);
+	ithread_mutex_unlock(&gGateMutex);
+	TPJobInit(&job, (start_routine)count_job, NULL);
+	TPJobSetFreeFunction(&job, free_job);
+	for (i = 0; i < 10; i++) {
+		TPJobSetPriority(&job, (ThreadPriority)(i % 3));
+		assert(ThreadPoolAdd(&tp, &job, &ids[i]) == 0);
+		assert(ids[i] != INVALID_JOB_ID);
+	}
+	/* removed jobs are returned and never run */
+	for (i = 0; i < 10; i += 2) {
+		memset(&out, 0, sizeof(out));
+		assert(ThreadPoolRemove(&tp, ids[i], &out) == 0);
+		assert(out.jobId == ids[i]);
+		assert(out.priority == (ThreadPriority)(i % 3));
+		assert(ThreadPoolRemove(&tp, ids[i], &out) == INVALID_JOB_ID);
+	}
+	/* the total is limited */
+	TPAttrSetMaxJobsTotal(&attr, 100);
+	assert(ThreadPoolSetAttr(&tp, &attr) == 0);
+	for (i = 5; i < 100; i++)
+		assert(ThreadPoolAdd(&tp, &job, NULL) == 0);
+	assert(ThreadPoolAdd(&tp, &job, NULL) != 0);
+
+	ithread_mutex_lock(&gGateMutex);
+	gGateOpen = 1;
+	ithread_cond_broadcast(&gGateCond);
+	ithread_mutex_unlock(&gGateMutex);
+	wait_run(ADDERS * JOBS_PER_ADDER + 100);
+	assert(ThreadPoolShutdown(&tp) == 0);
+	assert(ithread_atomic_load(&gRun) == ADDERS * JOBS_PER_ADDER + 100);
+	assert(gFreed == 0);
+
+	/* jobs left are freed on shutdown */
+	gGateOpen = 0;
+	gBlocked = 0;
+	assert(ThreadPoolInit(&tp, &attr) == 0);
+	TPJobInit(&job, (start_routine)gate_job, NULL);
+	for (i = 0; i < 4; i++)
+		assert(ThreadPoolAdd(&tp, &job, NULL) == 0);
+	ithread_mutex_lock(&gGateMutex);
+	while (gBlocked < 4)
+		ithread_cond_wait(&gGateCond, &gGateMutex);
+	gGateOpen = 1;
+	ithread_mutex_unlock(&gGateMutex);
+	TPJobInit(&job, (start_routine)count_job, NULL);
+	TPJobSetFreeFunction(&job, free_job);
+	gRun = 0;
+	for (i = 0; i < 10; i++)
+		assert(ThreadPoolAdd(&tp, &job, NULL) == 0);
+	ithread_mutex_lock(&gGateMutex);
+	ithread_cond_broadcast(&gGateCond);
+	ithread_mutex_unlock(&gGateMutex);
+	assert(ThreadPoolShutdown(&tp) == 0);
+	assert(ithread_atomic_load(&gRun) + gFreed == 10);
+}
+
+/* The jobs removed from a pool whose workers are busy do not fill it. */
+static void test_remove_wrap(QueueMode mode)
+{
+	ThreadPool tp;
+	ThreadPoolAttr attr;
+	ThreadPoolJob job;
+	int first;
+	int id;
+	int i;
+
+	gRun = 0;
+	gFreed = 0;
+	gBlocked = 0;
+	gGateOpen = 0;
+	TPAttrInit(&attr);
+	TPAttrSetMaxThreads(&attr, 1);
+	TPAttrSetMinThreads(&attr, 1);
+	/* the smallest ring */
+	TPAttrSetMaxJobsTotal(&attr, 2);
+	TPAttrSetQueueMode(&attr, mode);
+	assert(ThreadPoolInit(&tp, &attr) == 0);
+	TPJobInit(&job, (start_routine)gate_job, NULL);
+	assert(ThreadPoolAdd(&tp, &job, NULL) == 0);
+	ithread_mutex_lock(&gGateMutex);
+	while (gBlocked < 1)
+		ithread_cond_wait(&gGateCond, &gGateMutex);
+	ithread_mutex_unlock(&gGateMutex);
+
+	/* around the ring many times */
+	TPJobInit(&job, (start_routine)count_job, NULL);
+	TPJobSetFreeFunction(&job, free_job);
+	assert(ThreadPoolAdd(&tp, &job, &first) == 0);
+	assert(ThreadPoolRemove(&tp, first, NULL) == 0);
+	for (i = 0; i < 64; i++) {
+		assert(ThreadPoolAdd(&tp, &job, &id) == 0);
+		assert(id != first);
+		assert(ThreadPoolRemove(&tp, id, NULL) == 0);
+	}
+	/* after a removed job, the ring still takes as many jobs */
+	assert(ThreadPoolAdd(&tp, &job, &id) == 0);
+	assert(ThreadPoolRemove(&tp, id, NULL) == 0);
+	assert(ThreadPoolAdd(&tp, &job, NULL) == 0);
+	assert(ThreadPoolAdd(&tp, &job, NULL) == 0);
+	assert(ThreadPoolAdd(&tp, &job, NULL) != 0);
+	/* a stale id does not remove the job that reuses its place */
+	assert(ThreadPoolRemove(&tp, first, NULL) == INVALID_JOB_ID);
+	assert(ThreadPoolRemove(&tp, id, NULL) == INVALID_JOB_ID);
+
+	ithread_mutex_lock(&gGateMutex);
+	gGateOpen = 1;
+	ithread_cond_broadcast(&gGateCond);
+	ithread_mutex_unlock(&gGateMutex);
+	wait_run(2);
+	assert(ThreadPoolShutdown(&tp) == 0);
+	assert(ithread_atomic_load(&gRun) == 2);
+	assert(gFreed == 0);
+}
+
+/* The jobs with a deadline run first, the earliest first. */
+static void test_deadline(QueueMode mode)
+{
+	ThreadPool tp;
+	ThreadPoolAttr attr;
+	ThreadPoolJob job;
+	ThreadPoolStats stats;
+	struct timeval now;
+	struct timeval deadline;
+	/* seconds from now, in the order the jobs are added */
+	static const int offsets[] = {3, 1, -1, 2, -2};
+	int id;
+	int i;
+
+	gFreed = 0;
+	gBlocked = 0;
+	gGateOpen = 0;
+	gOrderLen = 0;
+	TPAttrInit(&attr);
+	TPAttrSetMaxThreads(&attr, 1);
+	TPAttrSetMinThreads(&attr, 1);
+	TPAttrSetQueueMode(&attr, mode);
+	assert(ThreadPoolInit(&tp, &attr) == 0);
+	TPJobInit(&job, (start_routine)gate_job, NULL);
+	assert(ThreadPoolAdd(&tp, &job, NULL) == 0);
+	ithread_mutex_lock(&gGateMutex);
+	while (gBlocked < 1)
+		ithread_cond_wait(&gGateCond, &gGateMutex);
+	ithread_mutex_unlock(&gGateMutex);
+
+	TPJobInit(&job, (start_routine)order_job, (void *)6L);
+	TPJobSetPriority(&job, HIGH_PRIORITY);
+	assert(ThreadPoolAdd(&tp, &job, NULL) == 0);
+	gettimeofday(&now, NULL);
+	for (i = 0; i < 5; i++) {
+		TPJobInit(&job, (start_routine)order_job, (void *)(long)(i + 1));
+		deadline = now;
+		deadline.tv_sec += offsets[i];
+		/* the job 2 seconds late is dropped */
+		assert(TPJobSetDeadline(&job,
+			       &deadline,
+			       offsets[i] == -2 ? expired_job : NULL) == 0);
+		/* the dropped job is given to expired_job only */
+		TPJobSetFreeFunction(&job, free_job);
+		assert(ThreadPoolAdd(&tp, &job, NULL) == 0);
+	}
+	/* removed jobs are never run */
+	deadline.tv_sec = now.tv_sec + 1;
+	TPJobSetDeadline(&job, &deadline, NULL);
+	assert(ThreadPoolAdd(&tp, &job, &id) == 0);
+	assert(ThreadPoolRemove(&tp, id, NULL) == 0);
+	assert(ThreadPoolRemove(&tp, id, NULL) == INVALID_JOB_ID);
+
+	ithread_mutex_lock(&gGateMutex);
+	gGateOpen = 1;
+	ithread_cond_broadcast(&gGateCond);
+	ithread_mutex_unlock(&gGateMutex);
+	while (ithread_atomic_load(&gOrderLen) < 6)
+		imillisleep(1);
+	assert(gOrder[0] == -5);
+	assert(gOrder[1] == 3);
+	assert(gOrder[2] == 2);
+	assert(gOrder[3] == 4);
+	assert(gOrder[4] == 1);
+	assert(gOrder[5] == 6);
+	assert(ThreadPoolGetStats(&tp, &stats) == 0);
+	assert(stats.deadlineMisses == 1);
+	assert(stats.deadlineDrops == 1);
+	assert(stats.totalJobsDQ == 5);
+	assert(ThreadPoolShutdown(&tp) == 0);
+	assert(gFreed == 0);
+}
+
+/* Releases the argument of a job, the way the search replies of SSDP are
+ * both run and freed. */
+static void release_job(void *arg)
+{
+	free(arg);
+	ithread_atomic_add(&gFreed, 1);
+}
+
+/* The argument of a job dropped at its deadline is released once, even if
+ * it has the same expired_func and free_func. */
+static void test_expire_release(QueueMode mode)
+{
+	ThreadPool tp;
+	ThreadPoolAttr attr;
+	ThreadPoolJob job;
+	struct timeval deadline;
+	void *arg;
+
+	gFreed = 0;
+	TPAttrInit(&attr);
+	TPAttrSetMaxThreads(&attr, 1);
+	TPAttrSetMinThreads(&attr, 1);
+	TPAttrSetQueueMode(&attr, mode);
+	assert(ThreadPoolInit(&tp, &attr) == 0);
+	arg = malloc((size_t)1);
+	assert(arg != NULL);
+	TPJobInit(&job, (start_routine)count_job, arg);
+	TPJobSetFreeFunction(&job, release_job);
+	gettimeofday(&deadline, NULL);
+	deadline.tv_sec -= 1;
+	assert(TPJobSetDeadline(&job, &deadline, release_job) == 0);
+	assert(ThreadPoolAdd(&tp, &job, NULL) == 0);
+	while (ithread_atomic_load(&gFreed) < 1)
+		imillisleep(1);
+	assert(ThreadPoolShutdown(&tp) == 0);
+	assert(gFreed == 1);
+}
+
+/* The ids of the timer events are not given twice, nor 0. */
+static void test_timer_ids(void)
+{
+	ThreadPool tp;
+	TimerThread timer;
+	ThreadPoolJob job;
+	int ids[100];
+	int first;
+	int last;
+	int id;
+	int i;
+
+	assert(ThreadPoolInit(&tp, NULL) == 0);
+	assert(TimerThreadInit(&timer, &tp) == 0);
+	TPJobInit(&job, (start_routine)count_job, NULL);
+	assert(TimerThreadSchedule(
+		       &timer, 3600, REL_SEC, &job, SHORT_TERM, &first) == 0);
+	assert(first != 0 && first != INVALID_EVENT_ID);
+	/* 0 is no event, as is -1 */
+	assert(TimerThreadRemove(&timer, 0, NULL) == INVALID_EVENT_ID);
+	assert(TimerThreadRemove(&timer, -1, NULL) == INVALID_EVENT_ID);
+
+	/* more events than the first table has slots */
+	last = first;
+	for (i = 0; i < 100; i++) {
+		assert(TimerThreadSchedule(&timer,
+			       3600,
+			       REL_SEC,
+			       &job,
+			       SHORT_TERM,
+			       &ids[i]) == 0);
+		assert(ids[i] > last);
+		last = ids[i];
+	}
+	for (i = 0; i < 100; i++)
+		assert(TimerThreadRemove(&timer, ids[i], NULL) == 0);
+
+	/* a stale id does not remove the event that reuses its slot */
+	for (i = 0; i < 2000; i++) {
+		assert(TimerThreadSchedule(
+			       &timer, 3600, REL_SEC, &job, SHORT_TERM, &id) ==
+			0);
+		assert(id > last);
+		last = id;
+		assert(TimerThreadRemove(&timer, ids[i % 100], NULL) ==
+			INVALID_EVENT_ID);
+		assert(TimerThreadRemove(&timer, id, NULL) == 0);
+		assert(TimerThreadRemove(&timer, id, NULL) == INVALID_EVENT_ID);
+	}
+	assert(TimerThreadRemove(&timer, first, NULL) == 0);
+
+	assert(TimerThreadShutdown(&timer) == 0);
+	assert(ThreadPoolShutdown(&tp) == 0);
+}
+
+static void typed_job(void *arg)
+{
+	ThreadPool *tp = (ThreadPool *)arg;
+
+	/* the type is given once the job knows what it does */
+	assert(ThreadPoolSetJobType(tp, 3) == 0);
+	imillisleep(2);
+	ithread_atomic_add(&gRun, 1);
+}
+
+/* The wait and run times are recorded per priority and per type. */
+static void test_latency(void)
+{
+	ThreadPool tp;
+	ThreadPoolAttr attr;
+	ThreadPoolJob job;
+	ThreadPoolHistogram wait;
+	ThreadPoolHistogram run;
+	long p50;
+	long p99;
+	int i;
+
+	gRun = 0;
+	TPAttrInit(&attr);
+	TPAttrSetMaxThreads(&attr, 2);
+	TPAttrSetMinThreads(&attr, 2);
+	assert(ThreadPoolInit(&tp, &attr) == 0);
+	assert(ThreadPoolSetJobType(&tp, 1) != 0);
+	for (i = 0; i < 20; i++) {
+		TPJobInit(&job, (start_routine)count_job, NULL);
+		TPJobSetPriority(&job, HIGH_PRIORITY);
+		TPJobSetType(&job, 2);
+		assert(ThreadPoolAdd(&tp, &job, NULL) == 0);
+	}
+	for (i = 0; i < 10; i++) {
+		TPJobInit(&job, (start_routine)typed_job, &tp);
+		TPJobSetType(&job, 2);
+		assert(ThreadPoolAdd(&tp, &job, NULL) == 0);
+	}
+	wait_run(30);
+	/* counted once the job returns, read while the pool runs */
+	for (i = 0; i < 1000; i++) {
+		assert(ThreadPoolGetLatency(&tp, -1, 3, &wait, &run) == 0);
+		if (TPHistogramCount(&run) == 10)
+			break;
+		imillisleep(1);
+	}
+	assert(TPHistogramCount(&run) == 10);
+	for (i = 0; i < 1000; i++) {
+		assert(ThreadPoolGetLatency(
+			       &tp, HIGH_PRIORITY, 0, &wait, &run) == 0);
+		if (TPHistogramCount(&run) == 20)
+			break;
+		imillisleep(1);
+	}
+	assert(TPHistogramCount(&wait) == 20);
+	assert(TPHistogramCount(&run) == 20);
+	assert(ThreadPoolGetLatency(&tp, -1, 2, &wait, &run) == 0);
+	assert(TPHistogramCount(&run) == 20);
+	assert(ThreadPoolGetLatency(&tp, -1, 3, &wait, &run) == 0);
+	assert(TPHistogramCount(&run) == 10);
+	p50 = TPHistogramValueAt(&run, 0.5);
+	p99 = TPHistogramValueAt(&run, 0.99);
+	assert(p50 >= 2000 && p50 <= p99 && p99 <= run.max);
+	assert(ThreadPoolGetLatency(&tp, -1, TP_JOB_TYPES, &wait, &run) != 0);
+	assert(ThreadPoolShutdown(&tp) == 0);
+}
+
+/* The adaptive sizing grows a blocked pool, then shrinks it when idle. */
+static void test_adaptive(QueueMode mode)
+{
+	ThreadPool tp;
+	ThreadPoolAttr attr;
+	ThreadPoolJob job;
+	ThreadPoolStats stats;
+	int i;
+
+	gBlocked = 0;
+	gGateOpen = 0;
+	TPAttrInit(&attr);
+	TPAttrSetMaxThreads(&attr, 8);
+	TPAttrSetMinThreads(&attr, 1);
+	TPAttrSetIdleTime(&attr, 100);
+	TPAttrSetJobsPerThread(&attr, 100);
+	TPAttrSetQueueMode(&attr, mode);
+	TPAttrSetAdaptiveInterval(&attr, 20);
+	assert(ThreadPoolInit(&tp, &attr) == 0);
+	TPJobInit(&job, (start_routine)gate_job, NULL);
+	for (i = 0; i < 4; i++)
+		assert(ThreadPoolAdd(&tp, &job, NULL) == 0);
+	/* the ratio alone would leave them to one worker */
+	ithread_mutex_lock(&gGateMutex);
+	while (gBlocked < 4)
+		ithread_cond_wait(&gGateCond, &gGateMutex);
+	gGateOpen = 1;
+	ithread_cond_broadcast(&gGateCond);
+	ithread_mutex_unlock(&gGateMutex);
+	assert(ThreadPoolGetStats(&tp, &stats) == 0);
+	assert(stats.adaptiveThreads >= 4);
+	for (i = 0; i < 300; i++) {
+		assert(ThreadPoolGetStats(&tp, &stats) == 0);
+		if (stats.totalThreads == 1)
+			break;
+		imillisleep(10);
+	}
+	assert(stats.totalThreads == 1);
+	assert(stats.adaptiveThreads == 1);
+	assert(ThreadPoolShutdown(&tp) == 0);
+}
+
+/* CPU lists are parsed into sets. */
+static void test_cpu_set(void)
+{
+	ThreadPoolCpuSet set;
+
+	assert(TPCpuSetParse(&set, "0-2,5") == 0);
+	assert(set.bits[0] == 0x27);
+	assert(TPCpuSetParse(&set, "") == 0);
+	assert(set.bits[0] == 0);
+	assert(TPCpuSetParse(&set, "3-1") != 0);
+	assert(TPCpuSetParse(&set, "x") != 0);
+	assert(TPCpuSetParse(&set, "2000") != 0);
+}
+
+int main(void)
+{
+	test_pool(SHARED_QUEUES);
+	test_pool(WORK_STEALING);
+	test_pool(LOCK_FREE_QUEUES);
+	test_remove_wrap(SHARED_QUEUES);
+	test_remove_wrap(WORK_STEALING);
+	test_remove_wrap(LOCK_FREE_QUEUES);
+	test_deadline(SHARED_QUEUES);
+	test_deadline(WORK_STEALING);
+	test_deadline(LOCK_FREE_QUEUES);
+	test_expire_release(SHARED_QUEUES);
+	test_expire_release(WORK_STEALING);
+	test_expire_release(LOCK_FREE_QUEUES);
+	test_timer_ids();
+	test_cpu_set();
+	test_latency();
+	test_adaptive(SHARED_QUEUES);
+	test_adaptive(WORK_STEALING);
+	test_adaptive(LOCK_FREE_QUEUES);
+
+	return 0;
+}
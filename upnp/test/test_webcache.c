@@ -0,0 +1,137 @@
+/* Force asserts enabled for the test */
+#ifdef NDEBUG
+	#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#include "httpparser.h"
+#include "webcache.h"
+
+static char dir[] = "/tmp/test_webcache.XXXXXX";
+
+/* Writes a file of the temporary directory and returns its path. */
+static const char *write_file(const char *name, const char *content)
+{
+	static char path[4][64];
+	static int next;
+	char *p = path[next++ % 4];
+	FILE *fp;
+
+	snprintf(p, sizeof(path[0]), "%s/%s", dir, name);
+	fp = fopen(p, "wb");
+	assert(fp != NULL);
+	assert(fwrite(content, 1, strlen(content), fp) == strlen(content));
+	fclose(fp);
+
+	return p;
+}
+
+static time_t date(const char *value)
+{
+	memptr ptr;
+	time_t t;
+
+	ptr.buf = (char *)value;
+	ptr.length = strlen(value);
+	if (parse_http_date(&ptr, &t) != 0)
+		return (time_t)-1;
+
+	return t;
+}
+
+static void test_date(void)
+{
+	/* the three formats of RFC 7231 */
+	assert(date("Sun, 06 Nov 1994 08:49:37 GMT") == 784111777);
+	assert(date("Sunday, 06-Nov-94 08:49:37 GMT") == 784111777);
+	assert(date("Sun Nov  6 08:49:37 1994") == 784111777);
+	assert(date("Thu, 01 Jan 1970 00:00:00 GMT") == 0);
+	/* leap day */
+	assert(date("Tue, 29 Feb 2000 12:00:00 GMT") == 951825600);
+	assert(date("Sun, 06 Xyz 1994 08:49:37 GMT") == -1);
+	assert(date("Sun, 32 Nov 1994 08:49:37 GMT") == -1);
+	assert(date("Sun, 06 Nov 1994 24:49:37 GMT") == -1);
+	assert(date("Sun, 06 Nov 1969 08:49:37 GMT") == -1);
+	assert(date("yesterday") == -1);
+}
+
+static void test_cache(void)
+{
+	web_cache_entry *a;
+	web_cache_entry *b;
+	web_cache_entry *c;
+	const char *pa;
+	const char *pb;
+	char etag[WEB_CACHE_ETAG_SIZE];
+
+	assert(mkdtemp(dir) != NULL);
+	assert(web_cache_init() == 0);
+	web_cache_set_limits(150, 100);
+	pa = write_file("a.txt", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+				 "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa");
+	pb = write_file("b.txt", "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb"
+				 "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb");
+
+	/* a miss, then a hit */
+	assert(web_cache_lookup(pa) == NULL);
+	a = web_cache_load(pa, "text/plain");
+	assert(a != NULL && a->length == 80);
+	web_cache_make_file_etag(etag, 80, a->last_modified);
+	assert(strcmp(etag, a->etag) == 0);
+	web_cache_release(a);
+	a = web_cache_lookup(pa);
+	assert(a != NULL && strcmp(a->content_type, "text/plain") == 0);
+
+	/* b evicts a, which stays valid while it is referenced */
+	b = web_cache_load(pb, "text/plain");
+	assert(b != NULL);
+	assert(web_cache_lookup(pa) == NULL);
+	assert(a->content[79] == 'a');
+	web_cache_release(a);
+
+	/* a file larger than the bound is not cached */
+	write_file("a.txt", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+			    "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+			    "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa");
+	assert(web_cache_load(pa, "text/plain") == NULL);
+
+	/* a file changed on disk is dropped */
+	c = web_cache_lookup(pb);
+	assert(c == b);
+	web_cache_release(c);
+	write_file("b.txt", "changed");
+	assert(web_cache_lookup(pb) == NULL);
+	c = web_cache_load(pb, "text/plain");
+	assert(c != NULL && c != b && c->length == 7);
+	web_cache_release(b);
+
+	/* two references across web_cache_destroy(), each released once */
+	b = web_cache_lookup(pb);
+	assert(b == c);
+	web_cache_destroy();
+	assert(web_cache_lookup(pb) == NULL);
+	assert(web_cache_load(pb, "text/plain") == NULL);
+	assert(strcmp(c->content, "changed") == 0);
+	web_cache_release(c);
+	assert(strcmp(b->content, "changed") == 0);
+	web_cache_release(b);
+
+	remove(pa);
+	remove(pb);
+	rmdir(dir);
+}
+
+int main(void)
+{
+	test_date();
+	test_cache();
+
+	return 0;
+}
@@ -0,0 +1,111 @@
+/* Force asserts enabled for the test */
+#ifdef NDEBUG
+	#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#include "webrate.h"
+
+/* Returns the current time in milliseconds. */
+static long now_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (long)tv.tv_sec * 1000 + (long)(tv.tv_usec / 1000);
+}
+
+static void test_bucket(void)
+{
+	/* bytes per second */
+	const size_t rate = 100000;
+	const size_t burst = rate * WEB_SERVER_RATE_BURST / 1000;
+	web_rate r;
+	long start;
+	long elapsed;
+	int delay;
+
+	web_rate_set(rate, 0);
+	assert(web_rate_enabled());
+	web_rate_init(&r);
+
+	/* a send larger than the burst goes through, then is paid for */
+	assert(web_rate_poll(&r, &delay) && delay == 0);
+	web_rate_charge(&r, rate / 2);
+	assert(!web_rate_poll(&r, &delay));
+	assert(delay > 400 && delay <= 500);
+	start = now_ms();
+	web_rate_wait(&r, 0);
+	elapsed = now_ms() - start;
+	assert(elapsed >= 400 && elapsed < 1000);
+
+	/* a long idle time refills at most the burst */
+	usleep(1100 * 1000);
+	assert(web_rate_poll(&r, &delay));
+	web_rate_charge(&r, burst + rate / 10);
+	assert(!web_rate_poll(&r, &delay));
+	assert(delay > 50 && delay <= 100);
+
+	web_rate_set(0, 0);
+	assert(!web_rate_enabled());
+	assert(web_rate_poll(&r, &delay) && delay == 0);
+}
+
+static void test_turns(void)
+{
+	web_rate a;
+	web_rate b;
+	web_rate c;
+	int delay;
+
+	/* no debt is taken below, only the turns are tested */
+	web_rate_set(0, 1000000);
+	web_rate_init(&a);
+	web_rate_init(&b);
+	web_rate_init(&c);
+
+	/* the first connection has the turn, the others queue */
+	assert(web_rate_poll(&a, &delay));
+	assert(!web_rate_poll(&b, &delay) && delay == -1);
+	assert(!web_rate_poll(&c, &delay) && delay == -1);
+	assert(!web_rate_poll(&b, &delay) && delay == -1);
+
+	/* the turn passes in order, a sender queues again at the tail */
+	web_rate_charge(&a, 0);
+	assert(!web_rate_poll(&a, &delay) && delay == -1);
+	assert(!web_rate_poll(&c, &delay));
+	assert(web_rate_poll(&b, &delay));
+	web_rate_charge(&b, 0);
+	assert(!web_rate_poll(&a, &delay));
+	assert(web_rate_poll(&c, &delay));
+
+	/* a cancelled connection passes its turn on */
+	web_rate_cancel(&c);
+	assert(web_rate_poll(&a, &delay));
+	web_rate_cancel(&a);
+
+	/* new rates clear the queue */
+	assert(web_rate_poll(&b, &delay));
+	assert(!web_rate_poll(&c, &delay));
+	web_rate_set(0, 1000000);
+	assert(web_rate_poll(&c, &delay));
+	web_rate_cancel(&c);
+	web_rate_cancel(&b);
+
+	web_rate_set(0, 0);
+}
+
+int main(void)
+{
+	test_turns();
+	test_bucket();
+
+	return 0;
+}
@@ -0,0 +1,782 @@
+/* Force asserts enabled for the test */
+#ifdef NDEBUG
+	#undef NDEBUG
+#endif
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fcntl.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "config.h"
+
+#include "httpreadwrite.h" /* for WEB_STREAM_TIMEOUT */
+#include "upnp.h"
+#include "webstream.h"
+
+#ifdef UPNP_ENABLE_ZLIB
+	#include <zlib.h>
+#endif
+
+/*! Exit code of a skipped test for CTest and automake. */
+#define SKIP 77
+
+#define PAST "Sun, 06 Nov 1994 08:49:37 GMT"
+#define FUTURE "Fri, 01 Jan 2100 00:00:00 GMT"
+
+static char dir[] = "/tmp/test_webserver.XXXXXX";
+
+static char response[65536];
+
+static size_t response_len;
+
+/* Connects to the web server and sends a GET request for a path with extra
+ * header lines. Returns the socket. */
+static int vsend_request(const char *path, const char *fmt, va_list ap)
+{
+	char buf[2048];
+	struct sockaddr_in addr;
+	size_t len;
+	int sock;
+
+	len = (size_t)snprintf(buf,
+		sizeof(buf),
+		"GET %s HTTP/1.1\r\n"
+		"Host: %s:%d\r\n"
+		"Connection: close\r\n",
+		path,
+		UpnpGetServerIpAddress(),
+		UpnpGetServerPort());
+	len += (size_t)vsnprintf(buf + len, sizeof(buf) - len, fmt, ap);
+	assert(len + 2 < sizeof(buf));
+	strcat(buf, "\r\n");
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(UpnpGetServerPort());
+	assert(inet_pton(AF_INET, UpnpGetServerIpAddress(), &addr.sin_addr) ==
+		1);
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	assert(sock >= 0);
+	assert(connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+	assert(send(sock, buf, strlen(buf), 0) == (ssize_t)strlen(buf));
+
+	return sock;
+}
+
+/* Same as vsend_request(), with a variable number of arguments. */
+static int send_request(const char *path, const char *fmt, ...)
+{
+	va_list ap;
+	int sock;
+
+	va_start(ap, fmt);
+	sock = vsend_request(path, fmt, ap);
+	va_end(ap);
+
+	return sock;
+}
+
+/* Reads the whole response of a request and closes the socket. Returns the
+ * status code. */
+static int recv_response(int sock)
+{
+	size_t len = 0;
+	ssize_t n;
+	int status = 0;
+
+	while ((n = recv(sock, response + len, sizeof(response) - 1 - len, 0)) >
+		0)
+		len += (size_t)n;
+	close(sock);
+	response[len] = '\0';
+	response_len = len;
+	sscanf(response, "HTTP/1.%*d %d", &status);
+
+	return status;
+}
+
+/* Sends a GET request for a path with extra header lines to the web server
+ * and reads the whole response. Returns the status code. */
+static int request(const char *path, const char *fmt, ...)
+{
+	va_list ap;
+	int sock;
+
+	va_start(ap, fmt);
+	sock = vsend_request(path, fmt, ap);
+	va_end(ap);
+
+	return recv_response(sock);
+}
+
+/* Returns the value of a response header, copied to a static buffer. */
+static const char *header(const char *name)
+{
+	static char value[256];
+	const char *p = response;
+	size_t len = strlen(name);
+	size_t n;
+
+	while ((p = strstr(p, "\r\n")) != NULL && strncmp(p, "\r\n\r\n", 4)) {
+		p += 2;
+		if (strncasecmp(p, name, len) == 0 && p[len] == ':') {
+			p += len + 1;
+			p += strspn(p, " ");
+			n = strcspn(p, "\r\n");
+			assert(n < sizeof(value));
+			memcpy(value, p, n);
+			value[n] = '\0';
+			return value;
+		}
+	}
+
+	return NULL;
+}
+
+/* Returns the body of the response and its length. */
+static const char *body(size_t *len)
+{
+	const char *p = strstr(response, "\r\n\r\n");
+
+	assert(p != NULL);
+	p += 4;
+	*len = response_len - (size_t)(p - response);
+
+	return p;
+}
+
+/* Writes a document of the temporary directory. */
+static void write_doc(const char *name, const char *content, size_t len)
+{
+	char path[64];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fp = fopen(path, "wb");
+	assert(fp != NULL);
+	assert(fwrite(content, 1, len, fp) == len);
+	fclose(fp);
+}
+
+/* Removes a document of the temporary directory. */
+static void remove_doc(const char *name)
+{
+	char path[64];
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	assert(remove(path) == 0);
+}
+
+static void test_conditional(void)
+{
+	char etag[64];
+
+	write_doc("doc.txt", "hello, world\n", strlen("hello, world\n"));
+
+	assert(request("/doc.txt", "") == 200);
+	assert(header("ETag") != NULL);
+	snprintf(etag, sizeof(etag), "%s", header("ETag"));
+	assert(strstr(response, "\r\n\r\nhello, world\n") != NULL);
+
+	/* the entity tag matches */
+	assert(request("/doc.txt", "If-None-Match: \"other\", %s\r\n", etag) ==
+		304);
+	assert(strcmp(header("ETag"), etag) == 0);
+	assert(strstr(response, "hello") == NULL);
+	assert(request("/doc.txt", "If-None-Match: *\r\n") == 304);
+	assert(request("/doc.txt", "If-None-Match: \"other\"\r\n") == 200);
+	/* If-None-Match takes precedence over If-Modified-Since */
+	assert(request("/doc.txt",
+		       "If-None-Match: \"other\"\r\n"
+		       "If-Modified-Since: %s\r\n",
+		       FUTURE) == 200);
+
+	/* the document has not changed since */
+	assert(request("/doc.txt",
+		       "If-Modified-Since: %s\r\n",
+		       header("Last-Modified")) == 304);
+	assert(request("/doc.txt", "If-Modified-Since: %s\r\n", PAST) == 200);
+	/* a date in the future is ignored */
+	assert(request("/doc.txt", "If-Modified-Since: %s\r\n", FUTURE) ==
+		200);
+
+	remove_doc("doc.txt");
+}
+
+static void test_etag(void)
+{
+	char etag[64];
+
+	write_doc("doc.txt", "hello, world\n", strlen("hello, world\n"));
+
+	/* the same tag whether the file is cached or not, weak since the
+	 * file may change within a second */
+	assert(request("/doc.txt", "") == 200);
+	snprintf(etag, sizeof(etag), "%s", header("ETag"));
+	assert(strncmp(etag, "W/\"", 3) == 0);
+	assert(UpnpSetWebServerCache(0, 0) == UPNP_E_SUCCESS);
+	assert(request("/doc.txt", "") == 200);
+	assert(strcmp(header("ETag"), etag) == 0);
+	assert(request("/doc.txt", "If-None-Match: %s\r\n", etag) == 304);
+	assert(UpnpSetWebServerCache(WEB_SERVER_CACHE_SIZE,
+		       WEB_SERVER_CACHE_MAX_FILE_SIZE) == UPNP_E_SUCCESS);
+	assert(request("/doc.txt", "If-None-Match: %s\r\n", etag) == 304);
+
+	remove_doc("doc.txt");
+}
+
+/* Checks a part of a multipart/byteranges body and returns the next one. */
+static const char *check_part(const char *p,
+	const char *boundary,
+	const char *content,
+	int first,
+	int last,
+	size_t total)
+{
+	char line[128];
+
+	snprintf(line, sizeof(line), "\r\n--%s\r\n", boundary);
+	assert(strncmp(p, line, strlen(line)) == 0);
+	p = strstr(p, "CONTENT-RANGE: ");
+	assert(p != NULL);
+	snprintf(line,
+		sizeof(line),
+		"CONTENT-RANGE: bytes %d-%d/%d\r\n\r\n",
+		first,
+		last,
+		(int)total);
+	assert(strncmp(p, line, strlen(line)) == 0);
+	p += strlen(line);
+	assert(memcmp(p, content + first, (size_t)(last - first + 1)) == 0);
+
+	return p + last - first + 1;
+}
+
+/* Requests ranges of a document of the given length. */
+static void check_ranges(const char *path, const char *content, size_t total)
+{
+	char boundary[64];
+	/* the closing delimiter: the boundary between "\r\n--" and "--\r\n" */
+	char range[sizeof(boundary) + 8];
+	const char *p;
+	size_t len;
+
+	/* one range */
+	assert(request(path, "Range: bytes=10-19\r\n") == 206);
+	snprintf(range, sizeof(range), "bytes 10-19/%d", (int)total);
+	assert(strcmp(header("Content-Range"), range) == 0);
+	p = body(&len);
+	assert(len == 10 && memcmp(p, content + 10, len) == 0);
+	assert(request(path, "Range: bytes=-10\r\n") == 206);
+	p = body(&len);
+	assert(len == 10 && memcmp(p, content + total - 10, len) == 0);
+	assert(request(path, "Range: bytes=%d-\r\n", (int)total - 5) == 206);
+	p = body(&len);
+	assert(len == 5 && memcmp(p, content + total - 5, len) == 0);
+
+	/* the unsatisfiable ranges are dropped */
+	assert(request(path, "Range: bytes=%d-\r\n", (int)total) == 416);
+	assert(request(path,
+		       "Range: bytes=%d-%d, 10-19\r\n",
+		       (int)total,
+		       (int)total + 10) == 206);
+	assert(strcmp(header("Content-Range"), range) == 0);
+
+	/* ranges less than WEB_SERVER_RANGE_GAP bytes apart are merged */
+	assert(request(path, "Range: bytes=50-59, 10-19, 15-29\r\n") == 206);
+	snprintf(range, sizeof(range), "bytes 10-59/%d", (int)total);
+	assert(strcmp(header("Content-Range"), range) == 0);
+	p = body(&len);
+	assert(len == 50 && memcmp(p, content + 10, len) == 0);
+
+	/* the others are sent as parts, in order */
+	assert(request(path, "Range: bytes=500-509, 10-19, -5\r\n") == 206);
+	assert(header("Content-Range") == NULL);
+	assert(sscanf(header("Content-Type"),
+		       "multipart/byteranges; boundary=%63s",
+		       boundary) == 1);
+	p = body(&len);
+	assert(len == (size_t)atoi(header("Content-Length")));
+	p = check_part(p, boundary, content, 10, 19, total);
+	p = check_part(p, boundary, content, 500, 509, total);
+	p = check_part(p,
+		boundary,
+		content,
+		(int)total - 5,
+		(int)total - 1,
+		total);
+	snprintf(range, sizeof(range), "\r\n--%s--\r\n", boundary);
+	assert(strcmp(p, range) == 0);
+}
+
+static void test_ranges(void)
+{
+	/* larger than WEB_SERVER_STREAM_MIN_SIZE */
+	size_t total = 100000;
+	char *content;
+	size_t i;
+
+	content = malloc(total);
+	assert(content != NULL);
+	for (i = 0; i < total; i++)
+		content[i] = (char)('a' + i % 26);
+	write_doc("small.txt", content, 1000);
+	write_doc("large.txt", content, total);
+
+	/* from the cache, the file, and the stream thread pool */
+	check_ranges("/small.txt", content, 1000);
+	assert(UpnpSetWebServerCache(0, 0) == UPNP_E_SUCCESS);
+	check_ranges("/small.txt", content, 1000);
+	assert(UpnpSetWebServerCache(WEB_SERVER_CACHE_SIZE,
+		       WEB_SERVER_CACHE_MAX_FILE_SIZE) == UPNP_E_SUCCESS);
+	check_ranges("/large.txt", content, total);
+
+	remove_doc("small.txt");
+	remove_doc("large.txt");
+	free(content);
+}
+
+/*! Events of the last stream, a bit per Upnp_WebStreamEvent. */
+static int stream_events;
+static pthread_mutex_t stream_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stream_cond = PTHREAD_COND_INITIALIZER;
+/*! File streamed for /vd/file. */
+static int stream_fd = -1;
+
+static int vd_get_info(const char *filename,
+	UpnpFileInfo *info,
+	const void *cookie,
+	const void **request_cookie)
+{
+	(void)cookie;
+	(void)request_cookie;
+
+	if (strncmp(filename, "/vd/", strlen("/vd/")) != 0)
+		return -1;
+	/* the length of a slow file is not known */
+	UpnpFileInfo_set_FileLength(
+		info, strcmp(filename, "/vd/slow") == 0 ? -1 : 5);
+	UpnpFileInfo_set_LastModified(info, 784111777);
+	UpnpFileInfo_set_IsDirectory(info, 0);
+	UpnpFileInfo_set_IsReadable(info, 1);
+	UpnpFileInfo_set_ContentType(info, "text/plain");
+
+	return 0;
+}
+
+/* Streams "hello" for /vd/hello, the file of stream_fd for /vd/file,
+ * nothing for /vd/idle, and declines to stream /vd/slow. */
+static int vd_open_stream(const char *filename,
+	off_t offset,
+	off_t length,
+	UpnpWebStream *stream,
+	const void *cookie,
+	const void *request_cookie)
+{
+	(void)offset;
+	(void)cookie;
+	(void)request_cookie;
+
+	if (strcmp(filename, "/vd/slow") == 0)
+		return 1;
+	assert(length == 5);
+	pthread_mutex_lock(&stream_mutex);
+	stream_events = 0;
+	pthread_mutex_unlock(&stream_mutex);
+	if (strcmp(filename, "/vd/hello") == 0)
+		assert(UpnpWebStream_Write(stream, "hello", 5) ==
+			UPNP_E_SUCCESS);
+	if (strcmp(filename, "/vd/file") == 0)
+		assert(UpnpWebStream_WriteFile(stream, stream_fd, 0, 5) ==
+			UPNP_E_SUCCESS);
+
+	return 0;
+}
+
+static void vd_stream_event(UpnpWebStream *stream,
+	Upnp_WebStreamEvent event,
+	const void *cookie,
+	const void *request_cookie)
+{
+	(void)cookie;
+	(void)request_cookie;
+
+	if (event != UPNP_WEBSTREAM_WRITABLE)
+		assert(UpnpWebStream_Close(stream) == UPNP_E_SUCCESS);
+	pthread_mutex_lock(&stream_mutex);
+	stream_events |= 1 << event;
+	pthread_cond_signal(&stream_cond);
+	pthread_mutex_unlock(&stream_mutex);
+}
+
+/* Waits for the last event of the stream and returns the events. */
+static int stream_wait(void)
+{
+	int events;
+
+	pthread_mutex_lock(&stream_mutex);
+	while (!(stream_events & (1 << UPNP_WEBSTREAM_DONE |
+					 1 << UPNP_WEBSTREAM_ABORTED)))
+		pthread_cond_wait(&stream_cond, &stream_mutex);
+	events = stream_events;
+	pthread_mutex_unlock(&stream_mutex);
+
+	return events;
+}
+
+static void test_stream(void)
+{
+	char path[64];
+	const char *p;
+	size_t len;
+	time_t start;
+
+	assert(UpnpVirtualDir_set_GetInfoCallback(vd_get_info) ==
+		UPNP_E_SUCCESS);
+	assert(UpnpVirtualDir_set_OpenStreamCallback(vd_open_stream) ==
+		UPNP_E_SUCCESS);
+	assert(UpnpVirtualDir_set_StreamEventCallback(vd_stream_event) ==
+		UPNP_E_SUCCESS);
+	assert(UpnpAddVirtualDir("/vd", NULL, NULL) == UPNP_E_SUCCESS);
+
+	/* a body of known length is done once sent */
+	assert(request("/vd/hello", "") == 200);
+	p = body(&len);
+	assert(len == 5 && memcmp(p, "hello", len) == 0);
+	assert(stream_wait() == 1 << UPNP_WEBSTREAM_DONE);
+
+	/* a file range is read by the stream thread pool */
+	write_doc("file.txt", "world", 5);
+	snprintf(path, sizeof(path), "%s/file.txt", dir);
+	stream_fd = open(path, O_RDONLY);
+	assert(stream_fd >= 0);
+	assert(request("/vd/file", "") == 200);
+	p = body(&len);
+	assert(len == 5 && memcmp(p, "world", len) == 0);
+	assert(stream_wait() == 1 << UPNP_WEBSTREAM_DONE);
+	close(stream_fd);
+	stream_fd = -1;
+	remove_doc("file.txt");
+
+	/* a stream to which the application queues nothing times out */
+	web_stream_set_timeout(1);
+	start = time(NULL);
+	assert(request("/vd/idle", "") == 200);
+	body(&len);
+	assert(len == 0);
+	assert(time(NULL) - start >= 1);
+	assert(stream_wait() == 1 << UPNP_WEBSTREAM_ABORTED);
+	web_stream_set_timeout(WEB_STREAM_TIMEOUT);
+
+	assert(UpnpRemoveVirtualDir("/vd") == UPNP_E_SUCCESS);
+}
+
+/*! Whether the slow files may be read. */
+static int slow_open;
+static pthread_cond_t slow_cond = PTHREAD_COND_INITIALIZER;
+
+static UpnpWebFileHandle vd_open(const char *filename,
+	enum UpnpOpenFileMode mode,
+	const void *cookie,
+	const void *request_cookie)
+{
+	int *done = malloc(sizeof(*done));
+
+	(void)cookie;
+	(void)request_cookie;
+
+	assert(strcmp(filename, "/vd/slow") == 0 && mode == UPNP_READ);
+	assert(done != NULL);
+	*done = 0;
+
+	return done;
+}
+
+/* Reads "slow" once the slow files may be read, then the end of the file. */
+static int vd_read(UpnpWebFileHandle fileHnd,
+	char *buf,
+	size_t buflen,
+	const void *cookie,
+	const void *request_cookie)
+{
+	int *done = fileHnd;
+
+	(void)cookie;
+	(void)request_cookie;
+
+	if (*done)
+		return 0;
+	pthread_mutex_lock(&stream_mutex);
+	while (!slow_open)
+		pthread_cond_wait(&slow_cond, &stream_mutex);
+	pthread_mutex_unlock(&stream_mutex);
+	assert(buflen >= 4);
+	memcpy(buf, "slow", 4);
+	*done = 1;
+
+	return 4;
+}
+
+static int vd_close(UpnpWebFileHandle fileHnd,
+	const void *cookie,
+	const void *request_cookie)
+{
+	(void)cookie;
+	(void)request_cookie;
+
+	free(fileHnd);
+
+	return 0;
+}
+
+static void test_stream_pool(void)
+{
+	int sock[STREAM_MAX_THREADS + STREAM_MAX_JOBS_TOTAL + 8];
+	const char *p;
+	size_t len;
+	int ok = 0;
+	int busy = 0;
+	int status;
+	size_t i;
+
+	assert(UpnpVirtualDir_set_GetInfoCallback(vd_get_info) ==
+		UPNP_E_SUCCESS);
+	assert(UpnpVirtualDir_set_OpenStreamCallback(vd_open_stream) ==
+		UPNP_E_SUCCESS);
+	assert(UpnpVirtualDir_set_OpenCallback(vd_open) == UPNP_E_SUCCESS);
+	assert(UpnpVirtualDir_set_ReadCallback(vd_read) == UPNP_E_SUCCESS);
+	assert(UpnpVirtualDir_set_CloseCallback(vd_close) == UPNP_E_SUCCESS);
+	assert(UpnpAddVirtualDir("/vd", NULL, NULL) == UPNP_E_SUCCESS);
+	write_doc("doc.txt", "hello, world\n", strlen("hello, world\n"));
+
+	/* more transfers of unknown length than the stream pool takes */
+	for (i = 0; i < sizeof(sock) / sizeof(sock[0]); i++)
+		sock[i] = send_request("/vd/slow", "");
+	/* handed off, they do not hold the miniserver threads up */
+	assert(request("/doc.txt", "") == 200);
+	pthread_mutex_lock(&stream_mutex);
+	slow_open = 1;
+	pthread_cond_broadcast(&slow_cond);
+	pthread_mutex_unlock(&stream_mutex);
+	for (i = 0; i < sizeof(sock) / sizeof(sock[0]); i++) {
+		status = recv_response(sock[i]);
+		if (status == 200) {
+			/* of unknown length, the body ends with the
+			 * connection */
+			p = body(&len);
+			assert(len == 4 && memcmp(p, "slow", len) == 0);
+			ok++;
+		} else {
+			assert(status == 503);
+			busy++;
+		}
+	}
+	assert(ok >= STREAM_MAX_THREADS && busy > 0);
+
+	remove_doc("doc.txt");
+	assert(UpnpRemoveVirtualDir("/vd") == UPNP_E_SUCCESS);
+}
+
+#ifdef INCLUDE_DEVICE_APIS
+static int callback(Upnp_EventType type, const void *event, void *cookie)
+{
+	(void)type;
+	(void)event;
+	(void)cookie;
+
+	return 0;
+}
+
+/* Registers a device described in a buffer. */
+static UpnpDevice_Handle register_device(const char *udn)
+{
+	UpnpDevice_Handle hnd;
+	char desc[1024];
+	int len;
+
+	len = snprintf(desc,
+		sizeof(desc),
+		"<?xml version=\"1.0\"?>"
+		"<root xmlns=\"urn:schemas-upnp-org:device-1-0\">"
+		"<specVersion><major>1</major><minor>0</minor></specVersion>"
+		"<device>"
+		"<deviceType>urn:schemas-upnp-org:device:Test:1</deviceType>"
+		"<friendlyName>Test</friendlyName>"
+		"<UDN>%s</UDN>"
+		"</device></root>",
+		udn);
+	assert(len > 0 && (size_t)len < sizeof(desc));
+	assert(UpnpRegisterRootDevice2(UPNPREG_BUF_DESC,
+		       desc,
+		       (size_t)len,
+		       1,
+		       callback,
+		       NULL,
+		       &hnd) == UPNP_E_SUCCESS);
+
+	return hnd;
+}
+
+static void test_description(void)
+{
+	UpnpDevice_Handle first;
+	UpnpDevice_Handle second;
+	UpnpDevice_Handle third;
+	char path[64];
+
+	/* the first device keeps the usual alias */
+	first = register_device("uuid:test-first");
+	assert(request("/description.xml", "") == 200);
+	assert(strstr(response, "uuid:test-first") != NULL);
+	second = register_device("uuid:test-second");
+	snprintf(path, sizeof(path), "/description-%d.xml", second);
+	assert(request(path, "") == 200);
+	assert(strstr(response, "uuid:test-second") != NULL);
+	assert(request("/description.xml", "") == 200);
+	assert(strstr(response, "uuid:test-first") != NULL);
+
+	/* the usual alias is given again once free */
+	assert(UpnpUnRegisterRootDevice(first) == UPNP_E_SUCCESS);
+	assert(request("/description.xml", "") == 404);
+	third = register_device("uuid:test-third");
+	assert(request("/description.xml", "") == 200);
+	assert(strstr(response, "uuid:test-third") != NULL);
+	assert(request(path, "") == 200);
+
+	assert(UpnpUnRegisterRootDevice(second) == UPNP_E_SUCCESS);
+	assert(UpnpUnRegisterRootDevice(third) == UPNP_E_SUCCESS);
+}
+#endif /* INCLUDE_DEVICE_APIS */
+
+#ifdef UPNP_ENABLE_ZLIB
+/* Checks that the body of the response inflates to the content, wbits
+ * selecting the gzip or the zlib format. */
+static void check_inflate(const char *content, size_t len, int wbits)
+{
+	char out[8192];
+	z_stream zs;
+	size_t in_len;
+
+	memset(&zs, 0, sizeof(zs));
+	assert(inflateInit2(&zs, wbits) == Z_OK);
+	zs.next_in = (Bytef *)body(&in_len);
+	zs.avail_in = (uInt)in_len;
+	assert(atoi(header("Content-Length")) == (int)in_len);
+	assert(in_len < len);
+	zs.next_out = (Bytef *)out;
+	zs.avail_out = sizeof(out);
+	assert(inflate(&zs, Z_FINISH) == Z_STREAM_END);
+	assert(zs.avail_in == 0);
+	assert(zs.total_out == len && memcmp(out, content, len) == 0);
+	inflateEnd(&zs);
+}
+#endif /* UPNP_ENABLE_ZLIB */
+
+static void test_deflate(void)
+{
+	char content[4096];
+	char etag[64];
+	const char *p;
+	size_t len;
+	size_t i;
+
+	for (i = 0; i < sizeof(content); i++)
+		content[i] = "the quick brown fox\n"[i % 20];
+	write_doc("doc.txt", content, sizeof(content));
+	write_doc("small.txt", content, 100);
+
+	/* the identity coding of a compressible document */
+	assert(request("/doc.txt", "") == 200);
+	assert(header("Content-Encoding") == NULL);
+	snprintf(etag, sizeof(etag), "%s", header("ETag"));
+	p = body(&len);
+	assert(len == sizeof(content) && memcmp(p, content, len) == 0);
+#ifdef UPNP_ENABLE_ZLIB
+	assert(strcmp(header("Vary"), "Accept-Encoding") == 0);
+
+	/* negotiation */
+	assert(request("/doc.txt", "Accept-Encoding: gzip\r\n") == 200);
+	assert(strcmp(header("Content-Encoding"), "gzip") == 0);
+	assert(strcmp(header("Vary"), "Accept-Encoding") == 0);
+	assert(strcmp(header("ETag"), etag) != 0);
+	check_inflate(content, sizeof(content), 16 + MAX_WBITS);
+	assert(request("/doc.txt", "Accept-Encoding: deflate\r\n") == 200);
+	assert(strcmp(header("Content-Encoding"), "deflate") == 0);
+	check_inflate(content, sizeof(content), MAX_WBITS);
+	assert(request("/doc.txt",
+		       "Accept-Encoding: gzip;q=0.5, deflate;q=0.8\r\n") ==
+		200);
+	assert(strcmp(header("Content-Encoding"), "deflate") == 0);
+	assert(request("/doc.txt", "Accept-Encoding: *\r\n") == 200);
+	assert(strcmp(header("Content-Encoding"), "gzip") == 0);
+	assert(request("/doc.txt", "Accept-Encoding: gzip;q=0, br\r\n") ==
+		200);
+	assert(header("Content-Encoding") == NULL);
+	assert(strcmp(header("ETag"), etag) == 0);
+
+	/* the compressed variant has its own entity tag */
+	assert(request("/doc.txt", "Accept-Encoding: gzip\r\n") == 200);
+	snprintf(etag, sizeof(etag), "%s", header("ETag"));
+	assert(request("/doc.txt",
+		       "Accept-Encoding: gzip\r\n"
+		       "If-None-Match: %s\r\n",
+		       etag) == 304);
+	assert(request("/doc.txt", "If-None-Match: %s\r\n", etag) == 200);
+#endif /* UPNP_ENABLE_ZLIB */
+
+	/* a range is taken from the identity coding */
+	assert(request("/doc.txt",
+		       "Accept-Encoding: gzip\r\n"
+		       "Range: bytes=20-39\r\n") == 206);
+	assert(header("Content-Encoding") == NULL);
+	p = body(&len);
+	assert(len == 20 && memcmp(p, content + 20, len) == 0);
+
+	/* a small document is never compressed */
+	assert(request("/small.txt", "Accept-Encoding: gzip\r\n") == 200);
+	assert(header("Content-Encoding") == NULL);
+	assert(header("Vary") == NULL);
+	p = body(&len);
+	assert(len == 100 && memcmp(p, content, len) == 0);
+
+	remove_doc("doc.txt");
+	remove_doc("small.txt");
+}
+
+int main(void)
+{
+	int ret;
+
+	if (UpnpInit2(NULL, 0) != UPNP_E_SUCCESS) {
+		printf("no network interface, skipped\n");
+		return SKIP;
+	}
+	assert(mkdtemp(dir) != NULL);
+	assert(UpnpSetWebServerRootDir(dir) == UPNP_E_SUCCESS);
+
+	test_conditional();
+	test_etag();
+	test_ranges();
+	test_deflate();
+	test_stream();
+	test_stream_pool();
+#ifdef INCLUDE_DEVICE_APIS
+	test_description();
+#endif
+
+	UpnpFinish();
+	ret = rmdir(dir);
+	assert(ret == 0);
+
+	return 0;
+}